@@ -4,8 +4,10 @@
 
 #include "escher/escher.h"
 #include "escher/impl/escher_impl.h"
+#include "escher/impl/frame_gpu_allocator.h"
 #include "escher/impl/gpu_allocator.h"
 #include "escher/impl/image_cache.h"
+#include "escher/impl/memory_budget.h"
 #include "escher/impl/mesh_manager.h"
 #include "escher/impl/mesh_impl.h"
 #include "escher/renderer/paper_renderer.h"
@@ -26,12 +28,44 @@ MeshBuilderPtr Escher::NewMeshBuilder(const MeshSpec& spec,
                                                max_index_count);
 }
 
-ImagePtr Escher::NewRgbaImage(uint32_t width, uint32_t height, uint8_t* bytes) {
-  return impl_->image_cache()->NewRgbaImage(width, height, bytes);
+ImagePtr Escher::NewRgbaImage(uint32_t width,
+                              uint32_t height,
+                              uint8_t* bytes,
+                              bool generate_mipmaps) {
+  return impl_->image_cache()->NewRgbaImage(width, height, bytes,
+                                            generate_mipmaps);
 }
 
-ImagePtr Escher::NewCheckerboardImage(uint32_t width, uint32_t height) {
-  return impl_->image_cache()->NewCheckerboardImage(width, height);
+ImagePtr Escher::NewCompressedImage(vk::Format format,
+                                    uint32_t width,
+                                    uint32_t height,
+                                    uint32_t mip_levels,
+                                    const uint8_t* data,
+                                    size_t size) {
+  return impl_->image_cache()->NewCompressedImage(format, width, height,
+                                                  mip_levels, data, size);
+}
+
+bool Escher::SupportsCompressedFormat(vk::Format format) {
+  return impl_->image_cache()->SupportsFormatFeatures(
+      format, vk::FormatFeatureFlagBits::eSampledImage);
+}
+
+ImageUploadStreamPtr Escher::NewImageUploadStream(
+    vk::Format format,
+    uint32_t width,
+    uint32_t height,
+    uint64_t max_staging_bytes,
+    std::function<void(uint32_t rows_resident, uint32_t height)> callback) {
+  return impl_->image_cache()->NewImageUploadStream(
+      format, width, height, max_staging_bytes, std::move(callback));
+}
+
+ImagePtr Escher::NewCheckerboardImage(uint32_t width,
+                                      uint32_t height,
+                                      bool generate_mipmaps) {
+  return impl_->image_cache()->NewCheckerboardImage(width, height,
+                                                    generate_mipmaps);
 }
 
 ImagePtr Escher::NewNoiseImage(uint32_t width, uint32_t height) {
@@ -53,7 +87,36 @@ TexturePtr Escher::NewTexture(ImagePtr image,
 }
 
 uint64_t Escher::GetNumGpuBytesAllocated() {
-  return impl_->gpu_allocator()->GetNumBytesAllocated();
+  return impl_->gpu_allocator()->GetNumBytesAllocated() +
+         impl_->frame_gpu_allocator()->GetNumBytesAllocated();
+}
+
+void Escher::SetGpuMemoryLimit(uint64_t bytes_per_heap) {
+  impl_->memory_budget()->SetLimit(bytes_per_heap);
+}
+
+void Escher::TrimGpuMemory() {
+  impl_->memory_budget()->Trim();
+}
+
+impl::MemoryBudget::Stats Escher::GetGpuMemoryStats() {
+  return impl_->memory_budget()->GetStats();
+}
+
+void Escher::SetImageCacheLimit(uint64_t max_unused_bytes,
+                                uint64_t max_unused_frames) {
+  impl_->image_cache()->set_max_unused_bytes(max_unused_bytes);
+  impl_->image_cache()->set_max_unused_frames(max_unused_frames);
+}
+
+impl::ImageCache::Stats Escher::GetImageCacheStats() {
+  return impl_->image_cache()->stats();
+}
+
+void Escher::SetGpuAllocationTraceRecorder(
+    impl::GpuAllocationTraceRecorder* recorder) {
+  impl_->gpu_allocator()->set_trace_recorder(recorder);
+  impl_->frame_gpu_allocator()->set_trace_recorder(recorder);
 }
 
 }  // namespace escher
@@ -4,9 +4,12 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 
 #include "escher/forward_declarations.h"
+#include "escher/impl/image_cache.h"
+#include "escher/impl/memory_budget.h"
 #include "escher/shape/mesh_builder_factory.h"
 #include "escher/status.h"
 #include "escher/vk/vulkan_context.h"
@@ -32,12 +35,39 @@ class Escher : public MeshBuilderFactory {
                                 size_t max_vertex_count,
                                 size_t max_index_count) override;
 
-  // Return new Image containing the provided pixels.
-  ImagePtr NewRgbaImage(uint32_t width, uint32_t height, uint8_t* bytes);
+  // Return new Image containing the provided pixels.  If |generate_mipmaps| is
+  // true, the Image has a full mip chain, which is generated on the GPU at the
+  // beginning of the next frame.
+  ImagePtr NewRgbaImage(uint32_t width,
+                        uint32_t height,
+                        uint8_t* bytes,
+                        bool generate_mipmaps = false);
   // Returns RGBA image.
-  ImagePtr NewCheckerboardImage(uint32_t width, uint32_t height);
+  ImagePtr NewCheckerboardImage(uint32_t width,
+                                uint32_t height,
+                                bool generate_mipmaps = false);
+  // Return new Image containing precompressed (BC, ETC2/EAC or ASTC) data for
+  // |mip_levels| levels, largest first.  Return null if the device doesn't
+  // support the format; see SupportsCompressedFormat().
+  ImagePtr NewCompressedImage(vk::Format format,
+                              uint32_t width,
+                              uint32_t height,
+                              uint32_t mip_levels,
+                              const uint8_t* data,
+                              size_t size);
+  // Return true if the device can sample images of the compressed |format|.
+  bool SupportsCompressedFormat(vk::Format format);
   // Returns single-channel luminance image.
   ImagePtr NewNoiseImage(uint32_t width, uint32_t height);
+  // Return a stream that uploads the pixels of a new RGBA or single-channel
+  // image incrementally, using a bounded amount of staging memory.
+  ImageUploadStreamPtr NewImageUploadStream(
+      vk::Format format,
+      uint32_t width,
+      uint32_t height,
+      uint64_t max_staging_bytes,
+      std::function<void(uint32_t rows_resident, uint32_t height)> callback =
+          nullptr);
 
   PaperRendererPtr NewPaperRenderer();
 
@@ -52,6 +82,37 @@ class Escher : public MeshBuilderFactory {
 
   uint64_t GetNumGpuBytesAllocated();
 
+  // Limit the number of bytes that Escher allocates from each Vulkan memory
+  // heap.  When the limit is exceeded, Escher frees cached resources that are
+  // not in use.  The limit is not strict: Escher never fails to allocate memory
+  // that it needs.
+  void SetGpuMemoryLimit(uint64_t bytes_per_heap);
+
+  // Free all cached resources that are not in use.
+  void TrimGpuMemory();
+
+  // Return the GPU memory used by Escher, by category and by memory type,
+  // along with the budget and usage of each memory heap.
+  impl::MemoryBudget::Stats GetGpuMemoryStats();
+
+  // Limit the images that Escher keeps for reuse once they are no longer used.
+  // The least recently used ones are freed while they total more than
+  // |max_unused_bytes|, as are any that have been unused for more than
+  // |max_unused_frames| frames.
+  void SetImageCacheLimit(uint64_t max_unused_bytes,
+                          uint64_t max_unused_frames);
+
+  // Return the hit, miss and eviction counters of the cache of reusable
+  // images, which help to choose its limit.  They also count the misses where
+  // an unused image could not be reused without waiting for the GPU.
+  impl::ImageCache::Stats GetImageCacheStats();
+
+  // Record all GPU memory allocations and frees into |recorder|, or stop
+  // recording if it is null.  The recorder must outlive Escher, or be replaced
+  // by null.
+  void SetGpuAllocationTraceRecorder(
+      impl::GpuAllocationTraceRecorder* recorder);
+
  private:
   std::unique_ptr<impl::EscherImpl> impl_;
 
@@ -15,6 +15,7 @@ class Buffer;
 class Escher;
 class Framebuffer;
 class Image;
+class ImageUploadStream;
 class MeshBuilder;
 class MeshBuilderFactory;
 struct MeshSpec;
@@ -37,6 +38,7 @@ struct VulkanSwapchain;
 typedef ftl::RefPtr<Buffer> BufferPtr;
 typedef ftl::RefPtr<Framebuffer> FramebufferPtr;
 typedef ftl::RefPtr<Image> ImagePtr;
+typedef ftl::RefPtr<ImageUploadStream> ImageUploadStreamPtr;
 typedef ftl::RefPtr<Material> MaterialPtr;
 typedef ftl::RefPtr<Mesh> MeshPtr;
 typedef ftl::RefPtr<MeshBuilder> MeshBuilderPtr;
@@ -51,6 +53,7 @@ namespace impl {
 class CommandBuffer;
 class CommandBufferPool;
 class EscherImpl;
+class GpuAllocationTraceRecorder;
 class GpuAllocator;
 class GpuMem;
 class ImageCache;
@@ -0,0 +1,187 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/buddy_gpu_allocator.h"
+
+#include <algorithm>
+
+#include "ftl/logging.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+// Blocks smaller than this are not worth the bookkeeping.
+constexpr vk::DeviceSize kMinBlockSize = 256;
+
+vk::DeviceSize RoundUpToPowerOfTwo(vk::DeviceSize size) {
+  vk::DeviceSize result = 1;
+  while (result < size) {
+    result <<= 1;
+  }
+  return result;
+}
+
+// |size| must be a power of two.
+uint32_t Log2(vk::DeviceSize size) {
+  uint32_t result = 0;
+  while (size > 1) {
+    size >>= 1;
+    ++result;
+  }
+  return result;
+}
+
+}  // namespace
+
+BuddyGpuAllocator::BuddyGpuAllocator(const VulkanContext& context,
+                                     std::unique_ptr<Backend> backend,
+                                     vk::DeviceSize slab_size)
+    : GpuAllocator(context, std::move(backend)),
+      min_block_size_(RoundUpToPowerOfTwo(std::max(
+          kMinBlockSize,
+          this->backend()->GetBufferImageGranularity()))),
+      slab_size_(std::max(min_block_size_, RoundUpToPowerOfTwo(slab_size))),
+      max_order_(Log2(slab_size_ / min_block_size_)) {}
+
+BuddyGpuAllocator::~BuddyGpuAllocator() {
+  for (auto& pair : slabs_by_memory_type_) {
+    for (auto& info : pair.second) {
+      FTL_DCHECK(info->allocated_orders.empty());
+      FreeSlab(std::move(info->slab));
+    }
+  }
+}
+
+GpuMemPtr BuddyGpuAllocator::AllocateImpl(vk::MemoryRequirements reqs,
+                                          vk::MemoryPropertyFlags flags) {
+  uint32_t memory_type_index =
+      backend()->GetMemoryTypeIndex(reqs.memoryTypeBits, flags);
+
+  vk::DeviceSize block_size = RoundUpToPowerOfTwo(
+      std::max(min_block_size_, std::max(reqs.size, reqs.alignment)));
+  if (block_size > slab_size_) {
+    // Too big to share a slab.  As with NaiveGpuAllocator, we release our
+    // unique_ptr because the slab is guaranteed to be returned by FreeMem().
+    auto slab = AllocateSlab(reqs.size, memory_type_index);
+    return AllocateMem(slab.release(), 0, reqs.size);
+  }
+  uint32_t order = Log2(block_size / min_block_size_);
+
+  vk::DeviceSize offset;
+  for (auto& info : slabs_by_memory_type_[memory_type_index]) {
+    if (AllocateBlock(info.get(), order, &offset)) {
+      return AllocateMem(info->slab.get(), offset, reqs.size);
+    }
+  }
+
+  // None of the existing slabs had room.
+  SlabInfo* info = NewSlab(memory_type_index);
+  bool success = AllocateBlock(info, order, &offset);
+  FTL_CHECK(success);
+  return AllocateMem(info->slab.get(), offset, reqs.size);
+}
+
+void BuddyGpuAllocator::FreeMem(GpuMemSlab* slab,
+                                uint32_t slab_ref_count,
+                                vk::DeviceSize offset,
+                                vk::DeviceSize size) {
+  auto it = slab_infos_.find(slab);
+  if (it == slab_infos_.end()) {
+    // Oversized slab; see AllocateImpl().
+    FTL_DCHECK(slab_ref_count == 0);
+    FTL_DCHECK(offset == 0);
+    FreeSlab(std::unique_ptr<GpuMemSlab>(slab));
+    return;
+  }
+
+  SlabInfo* info = it->second;
+  FreeBlock(info, offset);
+  if (slab_ref_count > 0) {
+    return;
+  }
+
+  // The slab is now empty.  Keep it if it is the only one of its type.
+  auto& slabs = slabs_by_memory_type_[slab->memory_type_index()];
+  if (slabs.size() > 1) {
+    slab_infos_.erase(it);
+    auto slab_it =
+        std::find_if(slabs.begin(), slabs.end(),
+                     [info](const std::unique_ptr<SlabInfo>& candidate) {
+                       return candidate.get() == info;
+                     });
+    FTL_DCHECK(slab_it != slabs.end());
+    std::unique_ptr<SlabInfo> doomed = std::move(*slab_it);
+    slabs.erase(slab_it);
+    FreeSlab(std::move(doomed->slab));
+  }
+}
+
+BuddyGpuAllocator::SlabInfo* BuddyGpuAllocator::NewSlab(
+    uint32_t memory_type_index) {
+  auto info = std::make_unique<SlabInfo>();
+  info->slab = AllocateSlab(slab_size_, memory_type_index);
+  info->free_blocks.resize(max_order_ + 1);
+  info->free_blocks[max_order_].insert(0);
+
+  SlabInfo* result = info.get();
+  slab_infos_[result->slab.get()] = result;
+  slabs_by_memory_type_[memory_type_index].push_back(std::move(info));
+  return result;
+}
+
+bool BuddyGpuAllocator::AllocateBlock(SlabInfo* info,
+                                      uint32_t order,
+                                      vk::DeviceSize* offset_out) {
+  // Find the smallest free block that is large enough.
+  uint32_t available_order = order;
+  while (available_order <= max_order_ &&
+         info->free_blocks[available_order].empty()) {
+    ++available_order;
+  }
+  if (available_order > max_order_) {
+    return false;
+  }
+
+  // Prefer the lowest offset, to keep allocations packed together.
+  auto& free_list = info->free_blocks[available_order];
+  vk::DeviceSize offset = *free_list.begin();
+  free_list.erase(free_list.begin());
+
+  // Split the block until it is the requested size, freeing the upper half
+  // each time.
+  while (available_order > order) {
+    --available_order;
+    info->free_blocks[available_order].insert(
+        offset + (min_block_size_ << available_order));
+  }
+
+  info->allocated_orders[offset] = order;
+  *offset_out = offset;
+  return true;
+}
+
+void BuddyGpuAllocator::FreeBlock(SlabInfo* info, vk::DeviceSize offset) {
+  auto it = info->allocated_orders.find(offset);
+  FTL_DCHECK(it != info->allocated_orders.end());
+  uint32_t order = it->second;
+  info->allocated_orders.erase(it);
+
+  while (order < max_order_) {
+    vk::DeviceSize buddy = offset ^ (min_block_size_ << order);
+    auto& free_list = info->free_blocks[order];
+    auto buddy_it = free_list.find(buddy);
+    if (buddy_it == free_list.end()) {
+      break;
+    }
+    free_list.erase(buddy_it);
+    offset = std::min(offset, buddy);
+    ++order;
+  }
+  info->free_blocks[order].insert(offset);
+}
+
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,93 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/impl/gpu_allocator.h"
+#include "escher/impl/gpu_mem.h"
+#include "escher/vk/vulkan_context.h"
+
+namespace escher {
+namespace impl {
+
+// BuddyGpuAllocator sub-allocates GpuMem from large per-memory-type
+// GpuMemSlabs, using a binary buddy scheme.  Each GpuMem occupies a
+// power-of-two-sized block that is aligned to its own size within the slab;
+// this satisfies any vk::MemoryRequirements::alignment that is no larger than
+// the block.  The smallest block is never smaller than the device's
+// bufferImageGranularity, so buffers and images that share a slab can never
+// share a granularity-sized "page".
+//
+// Requests that are larger than a slab are given a slab of their own.  When a
+// slab becomes empty it is freed, except for the last one of each memory type,
+// which is kept to avoid repeatedly allocating/freeing Vulkan memory.
+//
+// Not thread-safe.
+class BuddyGpuAllocator : public GpuAllocator {
+ public:
+  static constexpr vk::DeviceSize kDefaultSlabSize = 32 * 1024 * 1024;
+
+  // |slab_size| is rounded up to the next power of two.
+  BuddyGpuAllocator(const VulkanContext& context,
+                    std::unique_ptr<Backend> backend = nullptr,
+                    vk::DeviceSize slab_size = kDefaultSlabSize);
+  ~BuddyGpuAllocator() override;
+
+ private:
+  GpuMemPtr AllocateImpl(vk::MemoryRequirements reqs,
+                         vk::MemoryPropertyFlags flags) override;
+
+  // Bookkeeping for a slab that is shared by multiple GpuMems.
+  struct SlabInfo {
+    std::unique_ptr<GpuMemSlab> slab;
+    // free_blocks[order] contains the offsets of all free blocks whose size is
+    // |min_block_size_ << order|.
+    std::vector<std::set<vk::DeviceSize>> free_blocks;
+    // Maps the offset of each allocated block to its order.
+    std::unordered_map<vk::DeviceSize, uint32_t> allocated_orders;
+  };
+
+  void FreeMem(GpuMemSlab* slab,
+               uint32_t slab_ref_count,
+               vk::DeviceSize offset,
+               vk::DeviceSize size) override;
+
+  // Allocate a new slab of the specified memory type, and register it so that
+  // subsequent allocations can find it.
+  SlabInfo* NewSlab(uint32_t memory_type_index);
+
+  // If |info| has a free block of the specified order (or can obtain one by
+  // splitting a larger block), mark it as allocated, set |offset_out| and
+  // return true.  Otherwise, return false.
+  bool AllocateBlock(SlabInfo* info,
+                     uint32_t order,
+                     vk::DeviceSize* offset_out);
+
+  // Return a block to |info|, merging it with its buddy (recursively) if
+  // possible.
+  void FreeBlock(SlabInfo* info, vk::DeviceSize offset);
+
+  const vk::DeviceSize min_block_size_;
+  const vk::DeviceSize slab_size_;
+  // Order of a block that spans an entire slab.
+  const uint32_t max_order_;
+
+  // Shared slabs of each memory type, in the order in which they were created.
+  std::unordered_map<uint32_t, std::vector<std::unique_ptr<SlabInfo>>>
+      slabs_by_memory_type_;
+
+  // Allows FreeMem() to find the bookkeeping for a shared slab.  Slabs for
+  // requests larger than |slab_size_| are not present.
+  std::unordered_map<GpuMemSlab*, SlabInfo*> slab_infos_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(BuddyGpuAllocator);
+};
+
+}  // namespace impl
+}  // namespace escher
@@ -4,6 +4,8 @@
 
 #include "escher/impl/command_buffer.h"
 
+#include <algorithm>
+
 #include "escher/impl/mesh_impl.h"
 #include "escher/impl/resource.h"
 #include "escher/renderer/framebuffer.h"
@@ -101,7 +103,7 @@ void CommandBuffer::AddUsedResource(ResourcePtr resource) {
   used_resources_.push_back(std::move(resource));
 }
 
-void CommandBuffer::DrawMesh(const MeshPtr& mesh) {
+void CommandBuffer::DrawMesh(const MeshPtr& mesh, uint32_t instance_count) {
   AddUsedResource(mesh);
 
   AddWaitSemaphore(mesh->TakeWaitSemaphore(),
@@ -115,7 +117,8 @@ void CommandBuffer::DrawMesh(const MeshPtr& mesh) {
   command_buffer_.bindIndexBuffer(mesh_impl->index_buffer(),
                                   mesh_impl->vertex_buffer_offset(),
                                   vk::IndexType::eUint32);
-  command_buffer_.drawIndexed(mesh_impl->num_indices, 1, 0, 0, 0);
+  command_buffer_.drawIndexed(mesh_impl->num_indices, instance_count, 0, 0,
+                              0);
 }
 
 void CommandBuffer::CopyImage(const ImagePtr& src_image,
@@ -131,7 +134,9 @@ void CommandBuffer::CopyImage(const ImagePtr& src_image,
 
 void CommandBuffer::TransitionImageLayout(const ImagePtr& image,
                                           vk::ImageLayout old_layout,
-                                          vk::ImageLayout new_layout) {
+                                          vk::ImageLayout new_layout,
+                                          uint32_t base_mip_level,
+                                          uint32_t level_count) {
   vk::PipelineStageFlags src_stage_mask;
   vk::PipelineStageFlags dst_stage_mask;
 
@@ -153,9 +158,8 @@ void CommandBuffer::TransitionImageLayout(const ImagePtr& image,
     barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
   }
 
-  // TODO: assert that image only has one level.
-  barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseMipLevel = base_mip_level;
+  barrier.subresourceRange.levelCount = level_count;
   barrier.subresourceRange.baseArrayLayer = 0;
   barrier.subresourceRange.layerCount = 1;
 
@@ -194,6 +198,10 @@ void CommandBuffer::TransitionImageLayout(const ImagePtr& image,
       barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
       src_stage_mask = vk::PipelineStageFlagBits::eTransfer;
       break;
+    case vk::ImageLayout::eTransferSrcOptimal:
+      barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
+      src_stage_mask = vk::PipelineStageFlagBits::eTransfer;
+      break;
     case vk::ImageLayout::eUndefined:
       // If layout was eUndefined, we don't need a srcAccessMask.
       src_stage_mask = vk::PipelineStageFlagBits::eTopOfPipe;
@@ -266,6 +274,52 @@ void CommandBuffer::TransitionImageLayout(const ImagePtr& image,
   image->KeepAlive(this);
 }
 
+void CommandBuffer::GenerateMipmaps(const ImagePtr& image) {
+  const uint32_t mip_levels = image->mip_levels();
+  if (mip_levels <= 1) {
+    return;
+  }
+
+  int32_t width = static_cast<int32_t>(image->width());
+  int32_t height = static_cast<int32_t>(image->height());
+  for (uint32_t level = 1; level < mip_levels; ++level) {
+    // The previous level becomes the source of the blit: level 0 was uploaded
+    // (or rendered) directly, and the others were the destination of the
+    // previous blit.  The current level's old contents are discarded.
+    TransitionImageLayout(image,
+                          level == 1 ? vk::ImageLayout::eShaderReadOnlyOptimal
+                                     : vk::ImageLayout::eTransferDstOptimal,
+                          vk::ImageLayout::eTransferSrcOptimal, level - 1, 1);
+    TransitionImageLayout(image, vk::ImageLayout::eUndefined,
+                          vk::ImageLayout::eTransferDstOptimal, level, 1);
+
+    vk::ImageBlit blit;
+    blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    blit.srcSubresource.mipLevel = level - 1;
+    blit.srcSubresource.baseArrayLayer = 0;
+    blit.srcSubresource.layerCount = 1;
+    blit.srcOffsets[1] = vk::Offset3D(width, height, 1);
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+    blit.dstSubresource = blit.srcSubresource;
+    blit.dstSubresource.mipLevel = level;
+    blit.dstOffsets[1] = vk::Offset3D(width, height, 1);
+    command_buffer_.blitImage(image->get(),
+                              vk::ImageLayout::eTransferSrcOptimal,
+                              image->get(),
+                              vk::ImageLayout::eTransferDstOptimal, 1, &blit,
+                              vk::Filter::eLinear);
+  }
+
+  // All levels but the last were blit sources; the last was only written.
+  TransitionImageLayout(image, vk::ImageLayout::eTransferSrcOptimal,
+                        vk::ImageLayout::eShaderReadOnlyOptimal, 0,
+                        mip_levels - 1);
+  TransitionImageLayout(image, vk::ImageLayout::eTransferDstOptimal,
+                        vk::ImageLayout::eShaderReadOnlyOptimal,
+                        mip_levels - 1, 1);
+}
+
 void CommandBuffer::BeginRenderPass(
     vk::RenderPass render_pass,
     const FramebufferPtr& framebuffer,
@@ -59,9 +59,10 @@ class CommandBuffer {
   // running on the GPU.
   void AddUsedResource(ResourcePtr resource);
 
-  // Bind index/vertex buffers and write draw command.
+  // Bind index/vertex buffers and write draw command, which draws
+  // |instance_count| instances of the mesh.
   // Retain mesh in used_resources.
-  void DrawMesh(const MeshPtr& mesh);
+  void DrawMesh(const MeshPtr& mesh, uint32_t instance_count = 1);
 
   // Copy pixels from one image to another.  No image barriers or other
   // synchronization is used.  Retain both images in used_resources.
@@ -72,10 +73,22 @@ class CommandBuffer {
                  vk::ImageCopy* region);
 
   // Transition the image between the two layouts; see section 11.4 of the
-  // Vulkan spec.  Retain image in used_resources.
+  // Vulkan spec.  By default all mip levels are transitioned; otherwise only
+  // |level_count| levels starting at |base_mip_level|.  Retain image in
+  // used_resources.
   void TransitionImageLayout(const ImagePtr& image,
                              vk::ImageLayout old_layout,
-                             vk::ImageLayout new_layout);
+                             vk::ImageLayout new_layout,
+                             uint32_t base_mip_level = 0,
+                             uint32_t level_count = VK_REMAINING_MIP_LEVELS);
+
+  // Fill in mip levels 1 and up of the image by repeatedly blitting each level
+  // into the next with linear filtering.  All levels must be in
+  // eShaderReadOnlyOptimal layout, and are left in that layout afterward.  The
+  // image must have been created with eTransferSrc and eTransferDst usage, and
+  // its format must support linear blits.  Only valid on a graphics queue.
+  // Retain image in used_resources.
+  void GenerateMipmaps(const ImagePtr& image);
 
   // Convenient way to begin a render-pass that renders to the whole framebuffer
   // (i.e. width/height of viewport and scissors are obtained from framebuffer).
@@ -87,6 +100,11 @@ class CommandBuffer {
                        const vk::ClearValue* clear_values,
                        size_t clear_value_count);
 
+  // Simple wrapper around nextSubpass().
+  void NextSubpass() {
+    command_buffer_.nextSubpass(vk::SubpassContents::eInline);
+  }
+
   // Simple wrapper around endRenderPass().
   void EndRenderPass() { command_buffer_.endRenderPass(); }
 
@@ -123,5 +123,17 @@ void CommandBufferPool::Cleanup() {
   }
 }
 
+void CommandBufferPool::WaitUntilFinished(uint64_t sequence_number) {
+  Cleanup();
+  while (!pending_buffers_.empty() &&
+         pending_buffers_.front()->sequence_number() <= sequence_number) {
+    // Buffers are retired in order, so once the first one is finished, this
+    // makes progress.
+    vk::Result result = pending_buffers_.front()->Wait(UINT64_MAX);
+    FTL_CHECK(result == vk::Result::eSuccess);
+    Cleanup();
+  }
+}
+
 }  // namespace impl
 }  // namespace escher
@@ -40,6 +40,11 @@ class CommandBufferPool {
   // Do periodic housekeeping.
   void Cleanup();
 
+  // Block until all CommandBuffers obtained from this pool whose sequence
+  // number is less than or equal to |sequence_number| have finished, and
+  // retire them.  These CommandBuffers must have been submitted.
+  void WaitUntilFinished(uint64_t sequence_number);
+
   vk::Device device() const { return device_; }
   vk::Queue queue() const { return queue_; }
 
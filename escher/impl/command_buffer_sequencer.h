@@ -50,6 +50,11 @@ class CommandBufferSequencer {
 
   void AddListener(CommandBufferSequencerListener* listener);
 
+  // All CommandBuffers with this sequence number or lower have finished.
+  uint64_t last_finished_sequence_number() const {
+    return last_finished_sequence_number_;
+  }
+
  private:
   uint64_t next_sequence_number_ = 1;
   uint64_t last_finished_sequence_number_ = 0;
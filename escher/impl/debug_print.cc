@@ -56,7 +56,11 @@ std::ostream& operator<<(std::ostream& str,
                          const impl::ModelPipelineSpec& spec) {
   str << "ModelPipelineSpec[" << spec.mesh_spec << ", " << spec.shape_modifiers
       << ", sample_count: " << spec.sample_count
-      << ", depth_prepass: " << spec.use_depth_prepass << "]";
+      << ", depth_prepass: " << spec.use_depth_prepass
+      << ", depth_and_lighting_pass: " << spec.use_depth_and_lighting_pass
+      << ", instanced: " << spec.is_instanced
+      << ", push_constants: " << spec.use_push_constants
+      << "]";
   return str;
 }
 
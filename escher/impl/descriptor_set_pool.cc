@@ -46,33 +46,48 @@ DescriptorSetPool::DescriptorSetPool(
 
 DescriptorSetPool::~DescriptorSetPool() {
   FTL_DCHECK(allocation_count_ == 0);
+  Trim();
+  device_.destroyDescriptorSetLayout(layout_);
+}
+
+void DescriptorSetPool::Trim() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (allocation_count_ > 0) {
+    return;
+  }
   for (auto pool : pools_) {
     device_.resetDescriptorPool(pool);
     device_.destroyDescriptorPool(pool);
   }
-  device_.destroyDescriptorSetLayout(layout_);
+  pools_.clear();
+  free_sets_.clear();
+  capacity_ = 0;
 }
 
 DescriptorSetAllocationPtr DescriptorSetPool::Allocate(
     uint32_t count,
     CommandBuffer* command_buffer) {
-  // Ensure that enough free sets are available.
-  if (free_sets_.size() < count) {
-    constexpr uint32_t kGrowthFactor = 2;
-    InternalAllocate(count * kGrowthFactor);
-  }
-
-  // Obtain the required number of free descriptor sets.
   std::vector<vk::DescriptorSet> allocated_sets;
-  allocated_sets.reserve(count);
-  for (size_t i = free_sets_.size() - count; i < free_sets_.size(); ++i) {
-    allocated_sets.push_back(free_sets_[i]);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Ensure that enough free sets are available.
+    if (free_sets_.size() < count) {
+      constexpr uint32_t kGrowthFactor = 2;
+      InternalAllocate(count * kGrowthFactor);
+    }
+
+    // Obtain the required number of free descriptor sets.
+    allocated_sets.reserve(count);
+    for (size_t i = free_sets_.size() - count; i < free_sets_.size(); ++i) {
+      allocated_sets.push_back(free_sets_[i]);
+    }
+    free_sets_.resize(free_sets_.size() - count);
+    ++allocation_count_;
   }
-  free_sets_.resize(free_sets_.size() - count);
 
   auto allocation = ftl::AdoptRef(
       new DescriptorSetAllocation(this, std::move(allocated_sets)));
-  ++allocation_count_;
 
   if (command_buffer) {
     command_buffer->AddUsedResource(allocation);
@@ -93,6 +108,7 @@ void DescriptorSetPool::InternalAllocate(uint32_t descriptor_set_count) {
   pool_info.maxSets = descriptor_set_count;
   auto pool = ESCHER_CHECKED_VK_RESULT(device_.createDescriptorPool(pool_info));
   pools_.push_back(pool);
+  capacity_ += descriptor_set_count;
 
   // Allocate the new descriptor sets.
   vk::DescriptorSetAllocateInfo allocate_info;
@@ -112,6 +128,7 @@ void DescriptorSetPool::InternalAllocate(uint32_t descriptor_set_count) {
 
 void DescriptorSetPool::ReturnDescriptorSets(
     std::vector<vk::DescriptorSet> unused_sets) {
+  std::lock_guard<std::mutex> lock(mutex_);
   auto count = --allocation_count_;
   FTL_DCHECK(count >= 0);
   free_sets_.insert(free_sets_.end(), unused_sets.begin(), unused_sets.end());
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <mutex>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 
@@ -43,7 +44,8 @@ typedef ftl::RefPtr<DescriptorSetAllocation> DescriptorSetAllocationPtr;
 // Interface that allows acquisition of DescriptorSets for a single use within
 // a particular CommandBuffer.  When that CommandBuffer is retired, all such
 // DescriptorSets are returned to the pool from which they originated, so that
-// they can be reused.
+// they can be reused.  Allocate() is thread-safe, as long as |command_buffer|
+// is null or is only used by the calling thread.
 class DescriptorSetPool {
  public:
   DescriptorSetPool(vk::Device device,
@@ -60,6 +62,14 @@ class DescriptorSetPool {
 
   vk::DescriptorSetLayout layout() const { return layout_; }
 
+  // If no DescriptorSetAllocations are outstanding, destroy all of the pool's
+  // vk::DescriptorPools.  New ones are created on demand.
+  void Trim();
+
+  // Number of descriptor sets allocated from the pool's vk::DescriptorPools,
+  // whether or not they are in use.
+  uint32_t capacity() const { return capacity_; }
+
  private:
   // Called by ~DescriptorSetAllocation() to return unused sets to free_sets_.
   friend class DescriptorSetAllocation;
@@ -71,6 +81,9 @@ class DescriptorSetPool {
 
   vk::Device device_;
 
+  // Guards the members below.
+  std::mutex mutex_;
+
   // These are used each time that more descriptor sets must be allocated.
   vk::DescriptorSetLayout layout_;
   std::vector<vk::DescriptorPoolSize> descriptor_counts_;
@@ -80,7 +93,10 @@ class DescriptorSetPool {
   std::vector<vk::DescriptorPool> pools_;
 
   // Number of outstanding DescriptorSetAllocations.
-  uint32_t allocation_count_;
+  uint32_t allocation_count_ = 0;
+
+  // Total number of sets allocated by |pools_|.
+  uint32_t capacity_ = 0;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(DescriptorSetPool);
 };
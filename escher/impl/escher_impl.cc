@@ -4,11 +4,15 @@
 
 #include "escher/impl/escher_impl.h"
 
+#include "escher/impl/buddy_gpu_allocator.h"
 #include "escher/impl/command_buffer_pool.h"
+#include "escher/impl/command_buffer_sequencer.h"
+#include "escher/impl/frame_gpu_allocator.h"
 #include "escher/impl/glsl_compiler.h"
 #include "escher/impl/gpu_allocator.h"
 #include "escher/impl/gpu_uploader.h"
 #include "escher/impl/image_cache.h"
+#include "escher/impl/memory_budget.h"
 #include "escher/impl/mesh_manager.h"
 #include "escher/impl/naive_gpu_allocator.h"
 #include "escher/impl/vk/pipeline_cache.h"
@@ -42,12 +46,28 @@ std::unique_ptr<CommandBufferPool> NewTransferCommandBufferPool(
         context.transfer_queue_family_index, sequencer, false);
 }
 
+// Constructor helper.  Define ESCHER_USE_NAIVE_GPU_ALLOCATOR to give every
+// GpuMem its own Vulkan allocation, e.g. to rule out sub-allocation bugs.
+std::unique_ptr<GpuAllocator> NewGpuAllocator(const VulkanContext& context) {
+#if defined(ESCHER_USE_NAIVE_GPU_ALLOCATOR)
+  return std::make_unique<NaiveGpuAllocator>(context);
+#else
+  return std::make_unique<BuddyGpuAllocator>(context);
+#endif
+}
+
 // Constructor helper.
 std::unique_ptr<GpuUploader> NewGpuUploader(CommandBufferPool* main_pool,
                                             CommandBufferPool* transfer_pool,
                                             GpuAllocator* allocator) {
+  // Large enough for a few frames' worth of streamed textures and meshes;
+  // larger uploads fall back to dedicated staging buffers.
+  constexpr vk::DeviceSize kStagingRingBufferSize = 8 * 1024 * 1024;
+  // Writes are flushed once per frame by Renderer::BeginFrame().
+  constexpr bool kBatchWrites = true;
   return std::make_unique<GpuUploader>(
-      transfer_pool ? transfer_pool : main_pool, allocator);
+      transfer_pool ? transfer_pool : main_pool, allocator,
+      kStagingRingBufferSize, kBatchWrites);
 }
 
 // Constructor helper.
@@ -69,22 +89,28 @@ EscherImpl::EscherImpl(const VulkanContext& context)
       transfer_command_buffer_pool_(
           NewTransferCommandBufferPool(context,
                                        command_buffer_sequencer_.get())),
-      gpu_allocator_(std::make_unique<NaiveGpuAllocator>(context)),
+      gpu_allocator_(NewGpuAllocator(context)),
+      frame_gpu_allocator_(std::make_unique<FrameGpuAllocator>(context)),
       gpu_uploader_(NewGpuUploader(command_buffer_pool(),
                                    transfer_command_buffer_pool(),
                                    gpu_allocator())),
       pipeline_cache_(std::make_unique<PipelineCache>()),
+      resource_life_preserver_(
+          std::make_unique<ResourceLifePreserver>(vulkan_context_)),
       image_cache_(std::make_unique<ImageCache>(vulkan_context_,
                                                 command_buffer_pool(),
                                                 gpu_allocator(),
-                                                gpu_uploader())),
+                                                gpu_uploader(),
+                                                frame_gpu_allocator(),
+                                                resource_life_preserver())),
       mesh_manager_(NewMeshManager(command_buffer_pool(),
                                    transfer_command_buffer_pool(),
                                    gpu_allocator(),
                                    gpu_uploader())),
       glsl_compiler_(std::make_unique<GlslToSpirvCompiler>()),
-      resource_life_preserver_(
-          std::make_unique<ResourceLifePreserver>(vulkan_context_)),
+      memory_budget_(
+          std::make_unique<MemoryBudget>(context,
+                                         command_buffer_sequencer_.get())),
       renderer_count_(0) {
   FTL_DCHECK(context.instance);
   FTL_DCHECK(context.physical_device);
@@ -94,6 +120,15 @@ EscherImpl::EscherImpl(const VulkanContext& context)
   // and compute.
 
   command_buffer_sequencer_->AddListener(resource_life_preserver_.get());
+  command_buffer_sequencer_->AddListener(frame_gpu_allocator_.get());
+  command_buffer_sequencer_->AddListener(image_cache_.get());
+
+  // Clients are trimmed in this order, cheapest to recreate first.
+  memory_budget_->AddAllocator(gpu_allocator_.get());
+  memory_budget_->AddAllocator(frame_gpu_allocator_.get());
+  memory_budget_->AddClient(gpu_uploader_.get());
+  memory_budget_->AddClient(frame_gpu_allocator_.get());
+  memory_budget_->AddClient(image_cache_.get());
 
   auto device_properties = context.physical_device.getProperties();
   timestamp_period_ = device_properties.limits.timestampPeriod;
@@ -106,6 +141,9 @@ EscherImpl::EscherImpl(const VulkanContext& context)
 EscherImpl::~EscherImpl() {
   FTL_DCHECK(renderer_count_ == 0);
 
+  // Submit any uploads that were never flushed by a renderer, so that their
+  // staging space is released.
+  gpu_uploader_->Flush();
   vulkan_context_.device.waitIdle();
 
   Cleanup();
@@ -115,6 +153,9 @@ void EscherImpl::Cleanup() {
   command_buffer_pool_->Cleanup();
   if (transfer_command_buffer_pool_)
     transfer_command_buffer_pool_->Cleanup();
+  image_cache_->Cleanup(
+      command_buffer_sequencer_->last_finished_sequence_number());
+  memory_budget_->TrimIfOverBudget();
 }
 
 const VulkanContext& EscherImpl::vulkan_context() {
@@ -145,10 +186,18 @@ ResourceLifePreserver* EscherImpl::resource_life_preserver() {
   return resource_life_preserver_.get();
 }
 
+MemoryBudget* EscherImpl::memory_budget() {
+  return memory_budget_.get();
+}
+
 GpuAllocator* EscherImpl::gpu_allocator() {
   return gpu_allocator_.get();
 }
 
+FrameGpuAllocator* EscherImpl::frame_gpu_allocator() {
+  return frame_gpu_allocator_.get();
+}
+
 GpuUploader* EscherImpl::gpu_uploader() {
   return gpu_uploader_.get();
 }
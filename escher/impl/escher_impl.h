@@ -13,10 +13,12 @@ namespace escher {
 namespace impl {
 class CommandBufferSequencer;
 class CommandBufferPool;
+class FrameGpuAllocator;
 class GlslToSpirvCompiler;
 class GpuAllocator;
 class GpuUploader;
 class ImageCache;
+class MemoryBudget;
 class MeshManager;
 class PipelineCache;
 class SsdoSampler;
@@ -31,12 +33,14 @@ class EscherImpl {
   CommandBufferPool* command_buffer_pool();
   CommandBufferPool* transfer_command_buffer_pool();
   GpuAllocator* gpu_allocator();
+  FrameGpuAllocator* frame_gpu_allocator();
   GpuUploader* gpu_uploader();
   PipelineCache* pipeline_cache();
   ImageCache* image_cache();
   MeshManager* mesh_manager();
   GlslToSpirvCompiler* glsl_compiler();
   ResourceLifePreserver* resource_life_preserver();
+  MemoryBudget* memory_budget();
 
   bool supports_timer_queries() const { return supports_timer_queries_; }
   float timestamp_period() const { return timestamp_period_; }
@@ -47,7 +51,9 @@ class EscherImpl {
   void IncrementResourceCount() { ++resource_count_; }
   void DecrementResourceCount() { --resource_count_; }
 
-  // Do periodic housekeeping.
+  // Do periodic housekeeping, including evicting least-recently-used images
+  // from the ImageCache, and trimming cached resources if GPU memory usage
+  // exceeds the budget.  Called once per frame.
   void Cleanup();
 
  private:
@@ -56,12 +62,17 @@ class EscherImpl {
   std::unique_ptr<CommandBufferPool> command_buffer_pool_;
   std::unique_ptr<CommandBufferPool> transfer_command_buffer_pool_;
   std::unique_ptr<GpuAllocator> gpu_allocator_;
+  std::unique_ptr<FrameGpuAllocator> frame_gpu_allocator_;
   std::unique_ptr<GpuUploader> gpu_uploader_;
   std::unique_ptr<PipelineCache> pipeline_cache_;
+  // Must outlive |image_cache_|, and be outlived by |frame_gpu_allocator_|,
+  // since it is responsible for destroying transient images.
+  std::unique_ptr<ResourceLifePreserver> resource_life_preserver_;
   std::unique_ptr<ImageCache> image_cache_;
   std::unique_ptr<MeshManager> mesh_manager_;
   std::unique_ptr<GlslToSpirvCompiler> glsl_compiler_;
-  std::unique_ptr<ResourceLifePreserver> resource_life_preserver_;
+  // Declared last, so that it is destroyed before its allocators and clients.
+  std::unique_ptr<MemoryBudget> memory_budget_;
 
   std::atomic<uint32_t> renderer_count_;
   std::atomic<uint32_t> resource_count_;
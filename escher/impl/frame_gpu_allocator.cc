@@ -0,0 +1,183 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/frame_gpu_allocator.h"
+
+#include <algorithm>
+
+#include "escher/impl/gpu_allocation_trace.h"
+#include "ftl/logging.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+vk::DeviceSize AlignUp(vk::DeviceSize offset, vk::DeviceSize alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+}  // namespace
+
+FrameGpuAllocator::FrameGpuAllocator(const VulkanContext& context,
+                                     std::unique_ptr<Backend> backend,
+                                     vk::DeviceSize block_size)
+    : GpuAllocator(context, std::move(backend)),
+      block_size_(block_size),
+      buffer_image_granularity_(
+          this->backend()->GetBufferImageGranularity()) {}
+
+FrameGpuAllocator::~FrameGpuAllocator() {
+  for (auto& pair : blocks_) {
+    FTL_DCHECK(pair.second->mem_count == 0);
+    FreeSlab(std::move(pair.second->slab));
+  }
+}
+
+GpuMemPtr FrameGpuAllocator::AllocateImpl(vk::MemoryRequirements reqs,
+                                          vk::MemoryPropertyFlags flags) {
+  uint32_t memory_type_index =
+      backend()->GetMemoryTypeIndex(reqs.memoryTypeBits, flags);
+
+  // Since consecutive allocations are packed together, each must start on a
+  // new bufferImageGranularity "page"; otherwise a linear resource might share
+  // a page with an optimally-tiled one.
+  vk::DeviceSize alignment =
+      std::max(reqs.alignment, buffer_image_granularity_);
+
+  auto& blocks = current_blocks_[memory_type_index];
+  Block* block = blocks.empty() ? nullptr : blocks.back();
+  vk::DeviceSize offset = block ? AlignUp(block->next_offset, alignment) : 0;
+  if (!block || offset + reqs.size > block->slab->size()) {
+    block = ObtainBlock(memory_type_index, reqs.size);
+    offset = 0;
+  }
+
+  block->next_offset = offset + reqs.size;
+  ++block->mem_count;
+  return AllocateMem(block->slab.get(), offset, reqs.size);
+}
+
+void FrameGpuAllocator::EndFrame(uint64_t sequence_number) {
+  FTL_DCHECK(sequence_number > 0);
+  if (trace_recorder()) {
+    trace_recorder()->RecordEndFrame(this, sequence_number);
+  }
+  for (auto& pair : current_blocks_) {
+    for (Block* block : pair.second) {
+      block->sequence_number = sequence_number;
+      if (IsReadyForReuse(block)) {
+        ResetBlock(block);
+      } else {
+        pending_blocks_.push_back(block);
+      }
+    }
+  }
+  current_blocks_.clear();
+}
+
+void FrameGpuAllocator::CommandBufferFinished(uint64_t sequence_number) {
+  FTL_DCHECK(sequence_number > last_finished_sequence_number_);
+  last_finished_sequence_number_ = sequence_number;
+
+  auto it = pending_blocks_.begin();
+  while (it != pending_blocks_.end()) {
+    if (IsReadyForReuse(*it)) {
+      ResetBlock(*it);
+      it = pending_blocks_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void FrameGpuAllocator::Trim(uint64_t last_finished_sequence_number) {
+  for (auto& pair : free_blocks_) {
+    for (Block* block : pair.second) {
+      GpuMemSlab* slab = block->slab.get();
+      std::unique_ptr<GpuMemSlab> doomed = std::move(block->slab);
+      blocks_.erase(slab);
+      FreeSlab(std::move(doomed));
+    }
+  }
+  free_blocks_.clear();
+}
+
+void FrameGpuAllocator::AddToStats(MemoryBudget::Stats* stats) const {
+  for (auto& pair : free_blocks_) {
+    for (const Block* block : pair.second) {
+      stats->cached_bytes += block->slab->size();
+    }
+  }
+}
+
+size_t FrameGpuAllocator::GetFreeBlockCount() const {
+  size_t count = 0;
+  for (auto& pair : free_blocks_) {
+    count += pair.second.size();
+  }
+  return count;
+}
+
+void FrameGpuAllocator::FreeMem(GpuMemSlab* slab,
+                                uint32_t slab_ref_count,
+                                vk::DeviceSize offset,
+                                vk::DeviceSize size) {
+  auto it = blocks_.find(slab);
+  FTL_DCHECK(it != blocks_.end());
+  Block* block = it->second.get();
+  FTL_DCHECK(block->mem_count == slab_ref_count + 1);
+  --block->mem_count;
+
+  // The memory itself is not reused until the whole block is reset.  If this
+  // was the last outstanding GpuMem of a finished frame, do so now.
+  if (IsReadyForReuse(block)) {
+    auto pending_it =
+        std::find(pending_blocks_.begin(), pending_blocks_.end(), block);
+    FTL_DCHECK(pending_it != pending_blocks_.end());
+    pending_blocks_.erase(pending_it);
+    ResetBlock(block);
+  }
+}
+
+FrameGpuAllocator::Block* FrameGpuAllocator::ObtainBlock(
+    uint32_t memory_type_index,
+    vk::DeviceSize size) {
+  Block* block = nullptr;
+  auto& free_list = free_blocks_[memory_type_index];
+  if (size <= block_size_ && !free_list.empty()) {
+    block = free_list.back();
+    free_list.pop_back();
+  } else {
+    auto new_block = std::make_unique<Block>();
+    new_block->slab =
+        AllocateSlab(std::max(size, block_size_), memory_type_index);
+    block = new_block.get();
+    blocks_[block->slab.get()] = std::move(new_block);
+  }
+  current_blocks_[memory_type_index].push_back(block);
+  return block;
+}
+
+bool FrameGpuAllocator::IsReadyForReuse(const Block* block) const {
+  return block->sequence_number != 0 &&
+         block->sequence_number <= last_finished_sequence_number_ &&
+         block->mem_count == 0;
+}
+
+void FrameGpuAllocator::ResetBlock(Block* block) {
+  GpuMemSlab* slab = block->slab.get();
+  if (slab->size() > block_size_) {
+    std::unique_ptr<GpuMemSlab> doomed = std::move(block->slab);
+    blocks_.erase(slab);
+    FreeSlab(std::move(doomed));
+    return;
+  }
+  block->next_offset = 0;
+  block->sequence_number = 0;
+  free_blocks_[slab->memory_type_index()].push_back(block);
+}
+
+}  // namespace impl
+}  // namespace escher
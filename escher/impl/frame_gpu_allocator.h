@@ -0,0 +1,125 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/impl/command_buffer_sequencer.h"
+#include "escher/impl/gpu_allocator.h"
+#include "escher/impl/gpu_mem.h"
+#include "escher/impl/memory_budget.h"
+#include "escher/vk/vulkan_context.h"
+
+namespace escher {
+namespace impl {
+
+// FrameGpuAllocator is a linear ("bump") allocator for memory that is only
+// needed for the duration of a single frame, such as the intermediate render
+// targets used by PaperRenderer.  Allocation is O(1) and freeing a GpuMem is
+// free; instead, each block of memory is reset all at once.
+//
+// All memory allocated between consecutive calls to EndFrame() belongs to the
+// same frame.  EndFrame() is passed the sequence number of the frame's last
+// CommandBuffer; once the CommandBufferSequencer reports that this sequence
+// number has finished, and all GpuMems that belong to the frame have been
+// released, the frame's blocks are reset and reused by subsequent frames.
+//
+// Blocks are never returned to the Vulkan device until the allocator is
+// destroyed, except for "oversized" blocks that were allocated to satisfy a
+// request larger than |block_size|, or when trimmed by the MemoryBudget.
+//
+// Not thread-safe.
+class FrameGpuAllocator : public GpuAllocator,
+                          public CommandBufferSequencerListener,
+                          public MemoryBudget::Client {
+ public:
+  static constexpr vk::DeviceSize kDefaultBlockSize = 32 * 1024 * 1024;
+
+  FrameGpuAllocator(const VulkanContext& context,
+                    std::unique_ptr<Backend> backend = nullptr,
+                    vk::DeviceSize block_size = kDefaultBlockSize);
+  ~FrameGpuAllocator() override;
+
+  // Close the current frame.  Its memory will be reused once the CommandBuffer
+  // with the specified sequence number has finished.
+  void EndFrame(uint64_t sequence_number);
+
+  // Implement CommandBufferSequencerListener::CommandBufferFinished().  Resets
+  // the blocks of all frames that have finished.
+  void CommandBufferFinished(uint64_t sequence_number) override;
+
+  // Implement MemoryBudget::Client::Trim().  Frees all blocks that are ready
+  // for reuse.
+  void Trim(uint64_t last_finished_sequence_number) override;
+
+  // Implement MemoryBudget::Client::AddToStats().  Blocks that are ready for
+  // reuse are counted as cached.
+  void AddToStats(MemoryBudget::Stats* stats) const override;
+
+  // Return the number of blocks that are ready for reuse.
+  size_t GetFreeBlockCount() const;
+
+ private:
+  GpuMemPtr AllocateImpl(vk::MemoryRequirements reqs,
+                         vk::MemoryPropertyFlags flags) override;
+
+  // Dedicated allocations would be made and freed every frame, defeating the
+  // purpose of this allocator.
+  bool AllowsDedicatedAllocation() const override { return false; }
+
+  struct Block {
+    std::unique_ptr<GpuMemSlab> slab;
+    // Offset of the first byte that has not been handed out.
+    vk::DeviceSize next_offset = 0;
+    // Number of GpuMems that have been allocated from the block and not yet
+    // freed.
+    uint32_t mem_count = 0;
+    // Sequence number passed to EndFrame(), or 0 if the block belongs to the
+    // current frame.
+    uint64_t sequence_number = 0;
+  };
+
+  void FreeMem(GpuMemSlab* slab,
+               uint32_t slab_ref_count,
+               vk::DeviceSize offset,
+               vk::DeviceSize size) override;
+
+  // Return a block of the specified memory type that can hold at least |size|
+  // bytes, either by reusing a free block or allocating a new one.  The block
+  // is added to |current_blocks_|.
+  Block* ObtainBlock(uint32_t memory_type_index, vk::DeviceSize size);
+
+  // Return true if |block| belongs to a finished frame, and none of its memory
+  // is still in use.
+  bool IsReadyForReuse(const Block* block) const;
+
+  // Free |block| if it is oversized, otherwise add it to |free_blocks_|.  The
+  // caller is responsible for removing it from |pending_blocks_|.
+  void ResetBlock(Block* block);
+
+  const vk::DeviceSize block_size_;
+  const vk::DeviceSize buffer_image_granularity_;
+  uint64_t last_finished_sequence_number_ = 0;
+
+  // Owns all blocks, and allows FreeMem() to find the block for a slab.
+  std::unordered_map<GpuMemSlab*, std::unique_ptr<Block>> blocks_;
+
+  // Blocks that belong to the current frame, per memory type.  Allocation is
+  // attempted from the last block of the appropriate type.
+  std::unordered_map<uint32_t, std::vector<Block*>> current_blocks_;
+
+  // Blocks that belong to frames that have ended.
+  std::vector<Block*> pending_blocks_;
+
+  // Blocks that are ready for reuse, per memory type.
+  std::unordered_map<uint32_t, std::vector<Block*>> free_blocks_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(FrameGpuAllocator);
+};
+
+}  // namespace impl
+}  // namespace escher
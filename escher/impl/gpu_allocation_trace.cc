@@ -0,0 +1,110 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/gpu_allocation_trace.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include "ftl/logging.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+// GpuMems are identified by their address, which is unique among live GpuMems.
+uint64_t GetId(const GpuMem* mem) {
+  return reinterpret_cast<uintptr_t>(mem);
+}
+
+}  // namespace
+
+GpuAllocationTraceRecorder::GpuAllocationTraceRecorder()
+    : start_time_(std::chrono::steady_clock::now()) {}
+
+void GpuAllocationTraceRecorder::RecordAllocate(
+    const GpuAllocator* allocator,
+    const GpuMem* mem,
+    const vk::MemoryRequirements& reqs,
+    vk::MemoryPropertyFlags flags) {
+  auto record =
+      AddRecord(GpuAllocationTraceRecord::kAllocate, allocator, GetId(mem));
+  record->category = static_cast<uint8_t>(mem->category());
+  record->memory_type_index = static_cast<uint8_t>(mem->memory_type_index());
+  record->is_dedicated = mem->is_dedicated() ? 1 : 0;
+  record->memory_property_flags = static_cast<VkMemoryPropertyFlags>(flags);
+  record->memory_type_bits = reqs.memoryTypeBits;
+  record->size = mem->size();
+  record->alignment = reqs.alignment;
+}
+
+void GpuAllocationTraceRecorder::RecordFree(const GpuAllocator* allocator,
+                                            const GpuMem* mem) {
+  auto record =
+      AddRecord(GpuAllocationTraceRecord::kFree, allocator, GetId(mem));
+  record->category = static_cast<uint8_t>(mem->category());
+  record->memory_type_index = static_cast<uint8_t>(mem->memory_type_index());
+  record->size = mem->size();
+}
+
+void GpuAllocationTraceRecorder::RecordEndFrame(const GpuAllocator* allocator,
+                                                uint64_t sequence_number) {
+  AddRecord(GpuAllocationTraceRecord::kEndFrame, allocator, sequence_number);
+}
+
+GpuAllocationTraceRecord* GpuAllocationTraceRecorder::AddRecord(
+    GpuAllocationTraceRecord::Type type,
+    const GpuAllocator* allocator,
+    uint64_t id) {
+  auto elapsed = std::chrono::steady_clock::now() - start_time_;
+  GpuAllocationTraceRecord record = {};
+  record.type = type;
+  auto it = std::find(allocators_.begin(), allocators_.end(), allocator);
+  record.allocator = static_cast<uint32_t>(it - allocators_.begin());
+  if (it == allocators_.end()) {
+    allocators_.push_back(allocator);
+  }
+  record.timestamp_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  record.id = id;
+  records_.push_back(record);
+  return &records_.back();
+}
+
+bool GpuAllocationTraceRecorder::WriteToFile(const std::string& path) const {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    FTL_LOG(ERROR) << "Could not open GPU allocation trace: " << path;
+    return false;
+  }
+  const uint32_t header[] = {kMagic, kVersion};
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(records_.data()),
+             records_.size() * sizeof(GpuAllocationTraceRecord));
+  return static_cast<bool>(file);
+}
+
+bool GpuAllocationTraceRecorder::ReadFromFile(
+    const std::string& path,
+    std::vector<GpuAllocationTraceRecord>* records) {
+  std::ifstream file(path, std::ios::binary);
+  uint32_t header[2];
+  if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+      header[0] != kMagic || header[1] != kVersion) {
+    FTL_LOG(ERROR) << "Not a version " << kVersion
+                   << " GPU allocation trace: " << path;
+    return false;
+  }
+  records->clear();
+  GpuAllocationTraceRecord record;
+  while (file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+    records->push_back(record);
+  }
+  // Anything left over is a truncated record.
+  return file.gcount() == 0;
+}
+
+}  // namespace impl
+}  // namespace escher
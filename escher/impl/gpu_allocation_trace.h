@@ -0,0 +1,108 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/impl/gpu_mem.h"
+#include "ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+class GpuAllocator;
+
+// A single event in a GpuAllocationTrace.  Records are written to disk
+// verbatim, so the layout must not change without bumping
+// GpuAllocationTraceRecorder::kVersion.
+struct GpuAllocationTraceRecord {
+  enum Type : uint8_t {
+    // A GpuMem was allocated.  All fields are valid.
+    kAllocate = 0,
+    // A GpuMem was freed.  |id|, |size| and |memory_type_index| are valid.
+    kFree = 1,
+    // FrameGpuAllocator::EndFrame() was called.  |id| is the sequence number.
+    kEndFrame = 2,
+  };
+
+  uint8_t type;
+  // GpuMemCategory of the allocation.
+  uint8_t category;
+  // Memory type that the allocator chose.
+  uint8_t memory_type_index;
+  // Non-zero if the allocation was given a dedicated vk::DeviceMemory.
+  uint8_t is_dedicated;
+  // vk::MemoryPropertyFlags that were requested.
+  uint32_t memory_property_flags;
+  // vk::MemoryRequirements::memoryTypeBits.
+  uint32_t memory_type_bits;
+  // Identifies the GpuAllocator, numbered in the order that the recorder first
+  // saw them.  Escher uses one allocator for long-lived memory and another for
+  // per-frame memory, and a single recorder may be attached to both.
+  uint32_t allocator;
+  // Nanoseconds since the recorder was created.
+  uint64_t timestamp_ns;
+  // Matches each kFree to the corresponding kAllocate.
+  uint64_t id;
+  uint64_t size;
+  uint64_t alignment;
+};
+static_assert(sizeof(GpuAllocationTraceRecord) == 48,
+              "GpuAllocationTraceRecord must be tightly packed");
+
+// Records every allocation and free made by the GpuAllocators that it is
+// attached to (see GpuAllocator::set_trace_recorder()), so that allocation
+// strategies can be compared offline by replaying the trace against a fake
+// memory backend (see //lib/escher/tools/gpu_allocator_replay).
+//
+// Records are buffered in memory until WriteToFile() is called.
+//
+// Not thread-safe.
+class GpuAllocationTraceRecorder {
+ public:
+  // Written at the start of each trace file, followed by the records.
+  static constexpr uint32_t kMagic = 0x54414745;  // "EGAT"
+  static constexpr uint32_t kVersion = 1;
+
+  GpuAllocationTraceRecorder();
+
+  void RecordAllocate(const GpuAllocator* allocator,
+                      const GpuMem* mem,
+                      const vk::MemoryRequirements& reqs,
+                      vk::MemoryPropertyFlags flags);
+  void RecordFree(const GpuAllocator* allocator, const GpuMem* mem);
+  void RecordEndFrame(const GpuAllocator* allocator, uint64_t sequence_number);
+
+  const std::vector<GpuAllocationTraceRecord>& records() const {
+    return records_;
+  }
+  void Clear() { records_.clear(); }
+
+  // Return false if the file could not be written.
+  bool WriteToFile(const std::string& path) const;
+
+  // Return false if the file could not be read, or is not a trace of the
+  // current version.
+  static bool ReadFromFile(const std::string& path,
+                           std::vector<GpuAllocationTraceRecord>* records);
+
+ private:
+  GpuAllocationTraceRecord* AddRecord(GpuAllocationTraceRecord::Type type,
+                                      const GpuAllocator* allocator,
+                                      uint64_t id);
+
+  const std::chrono::steady_clock::time_point start_time_;
+  std::vector<GpuAllocationTraceRecord> records_;
+  // Index in this vector is the record's |allocator| field.
+  std::vector<const GpuAllocator*> allocators_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(GpuAllocationTraceRecorder);
+};
+
+}  // namespace impl
+}  // namespace escher
@@ -4,40 +4,285 @@
 
 #include "escher/impl/gpu_allocator.h"
 
+#include "escher/impl/gpu_allocation_trace.h"
 #include "escher/impl/vulkan_utils.h"
 
+// Dedicated allocations are only used if the Vulkan headers are recent enough
+// to define the necessary extensions.
+#if defined(VK_KHR_dedicated_allocation) && \
+    defined(VK_KHR_get_memory_requirements2)
+#define ESCHER_HAS_DEDICATED_ALLOCATION_EXT 1
+#else
+#define ESCHER_HAS_DEDICATED_ALLOCATION_EXT 0
+#endif
+
 namespace escher {
 namespace impl {
 
-GpuAllocator::GpuAllocator(const VulkanContext& context)
+namespace {
+
+// Default GpuAllocator::Backend, which obtains memory from the Vulkan device.
+// Dedicated allocations are used if the application enabled
+// VK_KHR_dedicated_allocation and VK_KHR_get_memory_requirements2.
+class VulkanBackend : public GpuAllocator::Backend {
+ public:
+  explicit VulkanBackend(const VulkanContext& context)
+      : physical_device_(context.physical_device),
+        device_(context.device),
+        memory_properties_(physical_device_.getMemoryProperties()) {
+#if ESCHER_HAS_DEDICATED_ALLOCATION_EXT
+    // These are null unless the extensions were enabled on the device.
+    get_image_memory_requirements2_ =
+        reinterpret_cast<PFN_vkGetImageMemoryRequirements2KHR>(
+            device_.getProcAddr("vkGetImageMemoryRequirements2KHR"));
+    get_buffer_memory_requirements2_ =
+        reinterpret_cast<PFN_vkGetBufferMemoryRequirements2KHR>(
+            device_.getProcAddr("vkGetBufferMemoryRequirements2KHR"));
+#endif
+  }
+
+  vk::DeviceMemory AllocateMemory(vk::DeviceSize size,
+                                  uint32_t memory_type_index,
+                                  const DedicatedResource& dedicated) override {
+    vk::MemoryAllocateInfo info;
+    info.allocationSize = size;
+    info.memoryTypeIndex = memory_type_index;
+#if ESCHER_HAS_DEDICATED_ALLOCATION_EXT
+    VkMemoryDedicatedAllocateInfoKHR dedicated_info = {};
+    if (dedicated.image || dedicated.buffer) {
+      FTL_DCHECK(SupportsDedicatedAllocation());
+      dedicated_info.sType =
+          VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR;
+      dedicated_info.image = static_cast<VkImage>(dedicated.image);
+      dedicated_info.buffer = static_cast<VkBuffer>(dedicated.buffer);
+      info.pNext = &dedicated_info;
+    }
+#else
+    FTL_DCHECK(!dedicated.image && !dedicated.buffer);
+#endif
+    return ESCHER_CHECKED_VK_RESULT(device_.allocateMemory(info));
+  }
+
+  void FreeMemory(vk::DeviceMemory mem) override { device_.freeMemory(mem); }
+
+  bool SupportsDedicatedAllocation() override {
+#if ESCHER_HAS_DEDICATED_ALLOCATION_EXT
+    return get_image_memory_requirements2_ && get_buffer_memory_requirements2_;
+#else
+    return false;
+#endif
+  }
+
+  uint8_t* MapMemory(vk::DeviceMemory mem, vk::DeviceSize size) override {
+    void* ptr = ESCHER_CHECKED_VK_RESULT(device_.mapMemory(mem, 0, size));
+    return reinterpret_cast<uint8_t*>(ptr);
+  }
+
+  vk::MemoryPropertyFlags GetMemoryPropertyFlags(
+      uint32_t memory_type_index) override {
+    FTL_DCHECK(memory_type_index < memory_properties_.memoryTypeCount);
+    return memory_properties_.memoryTypes[memory_type_index].propertyFlags;
+  }
+
+  vk::MemoryRequirements GetImageMemoryRequirements(
+      vk::Image image,
+      bool* wants_dedicated) override {
+    *wants_dedicated = false;
+#if ESCHER_HAS_DEDICATED_ALLOCATION_EXT
+    if (get_image_memory_requirements2_) {
+      VkMemoryDedicatedRequirementsKHR dedicated_reqs = {};
+      dedicated_reqs.sType =
+          VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR;
+      VkMemoryRequirements2KHR reqs = {};
+      reqs.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR;
+      reqs.pNext = &dedicated_reqs;
+      VkImageMemoryRequirementsInfo2KHR info = {};
+      info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2_KHR;
+      info.image = static_cast<VkImage>(image);
+      get_image_memory_requirements2_(static_cast<VkDevice>(device_), &info,
+                                      &reqs);
+      *wants_dedicated = dedicated_reqs.prefersDedicatedAllocation ||
+                         dedicated_reqs.requiresDedicatedAllocation;
+      return vk::MemoryRequirements(reqs.memoryRequirements);
+    }
+#endif
+    return device_.getImageMemoryRequirements(image);
+  }
+
+  vk::MemoryRequirements GetBufferMemoryRequirements(
+      vk::Buffer buffer,
+      bool* wants_dedicated) override {
+    *wants_dedicated = false;
+#if ESCHER_HAS_DEDICATED_ALLOCATION_EXT
+    if (get_buffer_memory_requirements2_) {
+      VkMemoryDedicatedRequirementsKHR dedicated_reqs = {};
+      dedicated_reqs.sType =
+          VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR;
+      VkMemoryRequirements2KHR reqs = {};
+      reqs.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR;
+      reqs.pNext = &dedicated_reqs;
+      VkBufferMemoryRequirementsInfo2KHR info = {};
+      info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2_KHR;
+      info.buffer = static_cast<VkBuffer>(buffer);
+      get_buffer_memory_requirements2_(static_cast<VkDevice>(device_), &info,
+                                       &reqs);
+      *wants_dedicated = dedicated_reqs.prefersDedicatedAllocation ||
+                         dedicated_reqs.requiresDedicatedAllocation;
+      return vk::MemoryRequirements(reqs.memoryRequirements);
+    }
+#endif
+    return device_.getBufferMemoryRequirements(buffer);
+  }
+
+  uint32_t GetMemoryTypeIndex(uint32_t type_bits,
+                              vk::MemoryPropertyFlags flags) override {
+    return impl::GetMemoryTypeIndex(physical_device_, type_bits, flags);
+  }
+
+  vk::DeviceSize GetBufferImageGranularity() override {
+    return physical_device_.getProperties().limits.bufferImageGranularity;
+  }
+
+ private:
+  vk::PhysicalDevice physical_device_;
+  vk::Device device_;
+  vk::PhysicalDeviceMemoryProperties memory_properties_;
+#if ESCHER_HAS_DEDICATED_ALLOCATION_EXT
+  PFN_vkGetImageMemoryRequirements2KHR get_image_memory_requirements2_ =
+      nullptr;
+  PFN_vkGetBufferMemoryRequirements2KHR get_buffer_memory_requirements2_ =
+      nullptr;
+#endif
+};
+
+}  // namespace
+
+GpuMemStats& GpuMemStats::operator+=(const GpuMemStats& other) {
+  for (size_t i = 0; i < VK_MAX_MEMORY_TYPES; ++i) {
+    allocated_bytes_by_memory_type[i] +=
+        other.allocated_bytes_by_memory_type[i];
+    used_bytes_by_memory_type[i] += other.used_bytes_by_memory_type[i];
+  }
+  for (size_t i = 0; i < kCategoryCount; ++i) {
+    used_bytes_by_category[i] += other.used_bytes_by_category[i];
+  }
+  used_bytes += other.used_bytes;
+  return *this;
+}
+
+GpuAllocator::GpuAllocator(const VulkanContext& context,
+                           std::unique_ptr<Backend> backend)
     : physical_device_(context.physical_device),
       device_(context.device),
+      backend_(backend ? std::move(backend)
+                       : std::make_unique<VulkanBackend>(context)),
       num_bytes_allocated_(0),
       slab_count_(0) {}
 
 GpuAllocator::~GpuAllocator() {
   FTL_CHECK(num_bytes_allocated_ == 0);
   FTL_CHECK(slab_count_ == 0);
+  FTL_DCHECK(stats_.used_bytes == 0);
+}
+
+GpuMemPtr GpuAllocator::Allocate(vk::MemoryRequirements reqs,
+                                 vk::MemoryPropertyFlags flags,
+                                 GpuMemCategory category) {
+  GpuMemPtr mem = AllocateImpl(reqs, flags);
+  RecordAllocation(mem.get(), reqs, flags, category);
+  return mem;
+}
+
+GpuMemPtr GpuAllocator::AllocateForImage(vk::Image image,
+                                         vk::MemoryPropertyFlags flags,
+                                         GpuMemCategory category) {
+  bool wants_dedicated = false;
+  vk::MemoryRequirements reqs =
+      backend_->GetImageMemoryRequirements(image, &wants_dedicated);
+  if (flags & vk::MemoryPropertyFlagBits::eLazilyAllocated) {
+    wants_dedicated = true;
+  }
+  if (!wants_dedicated || !AllowsDedicatedAllocation()) {
+    return Allocate(reqs, flags, category);
+  }
+  Backend::DedicatedResource dedicated;
+  dedicated.image = image;
+  GpuMemPtr mem = AllocateDedicated(reqs, flags, dedicated);
+  RecordAllocation(mem.get(), reqs, flags, category);
+  return mem;
+}
+
+GpuMemPtr GpuAllocator::AllocateForBuffer(vk::Buffer buffer,
+                                          vk::MemoryPropertyFlags flags,
+                                          GpuMemCategory category) {
+  bool wants_dedicated = false;
+  vk::MemoryRequirements reqs =
+      backend_->GetBufferMemoryRequirements(buffer, &wants_dedicated);
+  if (!wants_dedicated || !AllowsDedicatedAllocation()) {
+    return Allocate(reqs, flags, category);
+  }
+  Backend::DedicatedResource dedicated;
+  dedicated.buffer = buffer;
+  GpuMemPtr mem = AllocateDedicated(reqs, flags, dedicated);
+  RecordAllocation(mem.get(), reqs, flags, category);
+  return mem;
+}
+
+GpuMemPtr GpuAllocator::AllocateDedicated(
+    vk::MemoryRequirements reqs,
+    vk::MemoryPropertyFlags flags,
+    const Backend::DedicatedResource& dedicated) {
+  uint32_t memory_type_index =
+      backend_->GetMemoryTypeIndex(reqs.memoryTypeBits, flags);
+  // Without VK_KHR_dedicated_allocation, the resource still gets a slab of its
+  // own (e.g. for lazily-allocated images), but the driver isn't told so.
+  auto slab = AllocateSlab(reqs.size, memory_type_index,
+                           backend_->SupportsDedicatedAllocation()
+                               ? dedicated
+                               : Backend::DedicatedResource());
+  slab->is_dedicated_ = true;
+  // Freed by ReleaseMem(), when the GpuMem is destroyed.
+  return AllocateMem(slab.release(), 0, reqs.size);
+}
+
+void GpuAllocator::RecordAllocation(GpuMem* mem,
+                                    const vk::MemoryRequirements& reqs,
+                                    vk::MemoryPropertyFlags flags,
+                                    GpuMemCategory category) {
+  mem->category_ = category;
+  stats_.used_bytes_by_memory_type[mem->memory_type_index()] += mem->size();
+  stats_.used_bytes_by_category[static_cast<size_t>(category)] += mem->size();
+  stats_.used_bytes += mem->size();
+  if (trace_recorder_) {
+    trace_recorder_->RecordAllocate(this, mem, reqs, flags);
+  }
 }
 
 std::unique_ptr<GpuMemSlab> GpuAllocator::AllocateSlab(
     vk::DeviceSize size,
-    uint32_t memory_type_index) {
-  vk::MemoryAllocateInfo info;
-  info.allocationSize = size;
-  info.memoryTypeIndex = memory_type_index;
-  vk::DeviceMemory mem = ESCHER_CHECKED_VK_RESULT(device_.allocateMemory(info));
+    uint32_t memory_type_index,
+    const Backend::DedicatedResource& dedicated) {
+  vk::DeviceMemory mem =
+      backend_->AllocateMemory(size, memory_type_index, dedicated);
+  uint8_t* mapped_ptr = nullptr;
+  if (backend_->GetMemoryPropertyFlags(memory_type_index) &
+      vk::MemoryPropertyFlagBits::eHostVisible) {
+    mapped_ptr = backend_->MapMemory(mem, size);
+  }
   num_bytes_allocated_ += size;
+  stats_.allocated_bytes_by_memory_type[memory_type_index] += size;
   ++slab_count_;
   return std::unique_ptr<GpuMemSlab>(
-      new GpuMemSlab(mem, size, memory_type_index, this));
+      new GpuMemSlab(mem, size, memory_type_index, mapped_ptr, this));
 }
 
 void GpuAllocator::FreeSlab(std::unique_ptr<GpuMemSlab> slab) {
   FTL_DCHECK(slab->ref_count_ == 0);
   FTL_DCHECK(slab->allocator_ == this);
   num_bytes_allocated_ -= slab->size();
-  device_.freeMemory(slab->base());
+  stats_.allocated_bytes_by_memory_type[slab->memory_type_index()] -=
+      slab->size();
+  backend_->FreeMemory(slab->base());
   --slab_count_;
 }
 
@@ -49,5 +294,23 @@ GpuMemPtr GpuAllocator::AllocateMem(GpuMemSlab* slab,
   return ftl::AdoptRef(new GpuMem(slab, offset, size));
 }
 
+void GpuAllocator::ReleaseMem(GpuMemSlab* slab,
+                              uint32_t slab_ref_count,
+                              const GpuMem* mem) {
+  if (trace_recorder_) {
+    trace_recorder_->RecordFree(this, mem);
+  }
+  stats_.used_bytes_by_memory_type[slab->memory_type_index()] -= mem->size();
+  stats_.used_bytes_by_category[static_cast<size_t>(mem->category())] -=
+      mem->size();
+  stats_.used_bytes -= mem->size();
+  if (slab->is_dedicated()) {
+    FTL_DCHECK(slab_ref_count == 0);
+    FreeSlab(std::unique_ptr<GpuMemSlab>(slab));
+    return;
+  }
+  FreeMem(slab, slab_ref_count, mem->offset(), mem->size());
+}
+
 }  // namespace impl
 }  // namespace escher
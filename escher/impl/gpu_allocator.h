@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <array>
+#include <memory>
 #include <vulkan/vulkan.hpp>
 
 #include "escher/impl/gpu_mem.h"
@@ -12,6 +14,25 @@
 namespace escher {
 namespace impl {
 
+class GpuAllocationTraceRecorder;
+
+// Statistics about the memory managed by a GpuAllocator.  "Allocated" bytes
+// were obtained from Vulkan (i.e. the total size of all GpuMemSlabs), and
+// "used" bytes are occupied by live GpuMems.
+struct GpuMemStats {
+  static constexpr size_t kCategoryCount =
+      static_cast<size_t>(GpuMemCategory::kEnumCount);
+
+  std::array<vk::DeviceSize, VK_MAX_MEMORY_TYPES>
+      allocated_bytes_by_memory_type{};
+  std::array<vk::DeviceSize, VK_MAX_MEMORY_TYPES> used_bytes_by_memory_type{};
+  std::array<vk::DeviceSize, kCategoryCount> used_bytes_by_category{};
+  vk::DeviceSize used_bytes = 0;
+
+  // Add the values from |other| to this.
+  GpuMemStats& operator+=(const GpuMemStats& other);
+};
+
 // Vulkan does not support large numbers of memory allocations.  Instead,
 // applications are expected to allocate larger chunks of memory, and do their
 // own memory management within these chunks.  This is the responsibility of
@@ -19,22 +40,110 @@ namespace impl {
 // TODO: move out of impl namespace.
 class GpuAllocator {
  public:
-  GpuAllocator(const VulkanContext& context);
+  // Source of the vk::DeviceMemory that is carved up by a GpuAllocator, along
+  // with the device properties that are needed to do so.  By default, memory
+  // is obtained from the Vulkan device; tests substitute a fake Backend so
+  // that allocators can be exercised without a GPU.
+  class Backend {
+   public:
+    virtual ~Backend() {}
+
+    // Identifies the resource that a dedicated allocation is made for.  At
+    // most one of |image| and |buffer| is set; if neither is, the allocation is
+    // not dedicated.
+    struct DedicatedResource {
+      vk::Image image;
+      vk::Buffer buffer;
+    };
+
+    // |dedicated| must be empty unless SupportsDedicatedAllocation() returns
+    // true.
+    virtual vk::DeviceMemory AllocateMemory(
+        vk::DeviceSize size,
+        uint32_t memory_type_index,
+        const DedicatedResource& dedicated) = 0;
+    virtual void FreeMemory(vk::DeviceMemory mem) = 0;
+
+    // Map all |size| bytes of |mem|, which must be host-visible.  The memory
+    // is implicitly unmapped when it is freed.
+    virtual uint8_t* MapMemory(vk::DeviceMemory mem, vk::DeviceSize size) = 0;
+
+    virtual vk::MemoryPropertyFlags GetMemoryPropertyFlags(
+        uint32_t memory_type_index) = 0;
+
+    // Return the memory requirements of |image|/|buffer|.  |wants_dedicated|
+    // is set to true if the driver prefers or requires that the resource have
+    // an allocation of its own (see VK_KHR_dedicated_allocation).
+    virtual vk::MemoryRequirements GetImageMemoryRequirements(
+        vk::Image image,
+        bool* wants_dedicated) = 0;
+    virtual vk::MemoryRequirements GetBufferMemoryRequirements(
+        vk::Buffer buffer,
+        bool* wants_dedicated) = 0;
+
+    // Return true if the device enabled VK_KHR_dedicated_allocation, so that
+    // AllocateMemory() may be given a DedicatedResource.
+    virtual bool SupportsDedicatedAllocation() = 0;
+
+    // Return the index of the first memory type that is allowed by
+    // |type_bits| and has all of the required |flags|.
+    virtual uint32_t GetMemoryTypeIndex(uint32_t type_bits,
+                                        vk::MemoryPropertyFlags flags) = 0;
+
+    // Return the granularity at which linear and optimally-tiled resources
+    // may be placed next to each other in the same vk::DeviceMemory without
+    // aliasing.  See "Buffer-Image Granularity" in the Vulkan spec.
+    virtual vk::DeviceSize GetBufferImageGranularity() = 0;
+  };
+
+  // If |backend| is null, memory is allocated from |context.device|.
+  GpuAllocator(const VulkanContext& context,
+               std::unique_ptr<Backend> backend = nullptr);
   virtual ~GpuAllocator();
 
-  virtual GpuMemPtr Allocate(vk::MemoryRequirements reqs,
-                             vk::MemoryPropertyFlags flags) = 0;
+  // Allocate memory that satisfies |reqs| and has all of the specified
+  // |flags|.  |category| is used only for accounting.
+  GpuMemPtr Allocate(vk::MemoryRequirements reqs,
+                     vk::MemoryPropertyFlags flags,
+                     GpuMemCategory category = GpuMemCategory::kOther);
+
+  // Allocate memory that is suitable for binding to |image|/|buffer|.  If the
+  // driver prefers that the resource have a dedicated vk::DeviceMemory, and
+  // AllowsDedicatedAllocation() returns true, it gets one; otherwise the
+  // memory is obtained from Allocate().  Lazily-allocated images also get a
+  // vk::DeviceMemory of their own if allowed, since the driver commits lazily-
+  // allocated memory per vk::DeviceMemory, not per image; it is only marked as
+  // dedicated to the image if the backend SupportsDedicatedAllocation().
+  GpuMemPtr AllocateForImage(vk::Image image,
+                             vk::MemoryPropertyFlags flags,
+                             GpuMemCategory category = GpuMemCategory::kOther);
+  GpuMemPtr AllocateForBuffer(vk::Buffer buffer,
+                              vk::MemoryPropertyFlags flags,
+                              GpuMemCategory category = GpuMemCategory::kOther);
 
   uint64_t GetNumBytesAllocated() { return num_bytes_allocated_; }
 
+  const GpuMemStats& stats() const { return stats_; }
+
+  // If non-null, |recorder| is notified of every subsequent allocation and
+  // free.  It must outlive the allocator, or be replaced by null.
+  void set_trace_recorder(GpuAllocationTraceRecorder* recorder) {
+    trace_recorder_ = recorder;
+  }
+  GpuAllocationTraceRecorder* trace_recorder() const { return trace_recorder_; }
+
   vk::PhysicalDevice physical_device() { return physical_device_; }
   vk::Device device() { return device_; }
 
  protected:
   // Concrete subclasses use this to allocate GpuMemSlabs that are then used
-  // to suballocate GpuMem instances from.
-  std::unique_ptr<GpuMemSlab> AllocateSlab(vk::DeviceSize size,
-                                           uint32_t memory_type_index);
+  // to suballocate GpuMem instances from.  Host-visible slabs are persistently
+  // mapped, so that GpuMems which share a slab can all be written by the CPU.
+  std::unique_ptr<GpuMemSlab> AllocateSlab(
+      vk::DeviceSize size,
+      uint32_t memory_type_index,
+      const Backend::DedicatedResource& dedicated =
+          Backend::DedicatedResource());
   void FreeSlab(std::unique_ptr<GpuMemSlab> slab);
 
   // Concrete subclasses use this to sub-allocate GpuMem from GpuMemSlabs.
@@ -42,9 +151,37 @@ class GpuAllocator {
                         vk::DeviceSize offset,
                         vk::DeviceSize size);
 
+  Backend* backend() { return backend_.get(); }
+
+  // Subclasses may return false to never make dedicated allocations.  Drivers
+  // only require them for memory that is shared with other APIs or processes,
+  // which Escher does not do.
+  virtual bool AllowsDedicatedAllocation() const { return true; }
+
  private:
-  // Called by GpuMemSlab::FreeMem().
+  // Implemented by concrete subclasses; called by Allocate().
+  virtual GpuMemPtr AllocateImpl(vk::MemoryRequirements reqs,
+                                 vk::MemoryPropertyFlags flags) = 0;
+
+  // Give the resource a vk::DeviceMemory of its own.
+  GpuMemPtr AllocateDedicated(vk::MemoryRequirements reqs,
+                              vk::MemoryPropertyFlags flags,
+                              const Backend::DedicatedResource& dedicated);
+
+  // Update |stats_| and |trace_recorder_| to account for a newly-allocated
+  // GpuMem.
+  void RecordAllocation(GpuMem* mem,
+                        const vk::MemoryRequirements& reqs,
+                        vk::MemoryPropertyFlags flags,
+                        GpuMemCategory category);
+
+  // Called by GpuMemSlab::FreeMem().  Updates |stats_|, then frees dedicated
+  // slabs directly, and passes everything else to FreeMem().
   friend class GpuMemSlab;
+  void ReleaseMem(GpuMemSlab* slab,
+                  uint32_t slab_ref_count,
+                  const GpuMem* mem);
+
   virtual void FreeMem(GpuMemSlab* slab,
                        uint32_t slab_ref_count,
                        vk::DeviceSize offset,
@@ -52,7 +189,10 @@ class GpuAllocator {
 
   vk::PhysicalDevice physical_device_;
   vk::Device device_;
+  std::unique_ptr<Backend> backend_;
   vk::DeviceSize num_bytes_allocated_;
+  GpuMemStats stats_;
+  GpuAllocationTraceRecorder* trace_recorder_ = nullptr;
 
   mutable std::atomic_uint_fast32_t slab_count_;
 
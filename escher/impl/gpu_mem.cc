@@ -15,7 +15,7 @@ GpuMem::GpuMem(GpuMemSlab* slab, vk::DeviceSize offset, vk::DeviceSize size)
 }
 
 GpuMem::~GpuMem() {
-  slab_->FreeMem(offset_, size_);
+  slab_->FreeMem(this);
 }
 
 }  // namespace impl
@@ -13,6 +13,17 @@
 namespace escher {
 namespace impl {
 
+// Identifies the subsystem that a GpuMem was allocated for.  Used only for
+// accounting; see GpuAllocator::stats().
+enum class GpuMemCategory {
+  kOther = 0,
+  kImage,
+  kMesh,
+  kStaging,
+  kUniform,
+  kEnumCount
+};
+
 // Memory allocated by a GpuAllocator.  It is a region of a GpuMemSlab (this is
 // an implementation detail, not relevant to clients of GpuAllocator/GpuMem).
 // TODO: move out of impl namespace.
@@ -28,6 +39,18 @@ class GpuMem : public ftl::RefCountedThreadSafe<GpuMem> {
   // Return the memory type of the underlying slab.
   uint32_t memory_type_index() const { return slab_->memory_type_index(); }
 
+  // If the memory is host-visible, return a pointer to its first byte, which
+  // remains valid for the lifetime of the GpuMem.  Otherwise, return nullptr.
+  // Clients must not map the memory themselves.
+  uint8_t* mapped_ptr() const {
+    return slab_->mapped_ptr() ? slab_->mapped_ptr() + offset_ : nullptr;
+  }
+
+  // True if the underlying slab was allocated for this GpuMem alone.
+  bool is_dedicated() const { return slab_->is_dedicated(); }
+
+  GpuMemCategory category() const { return category_; }
+
  private:
   // Called by GpuAllocator::Allocate().
   friend class GpuAllocator;
@@ -39,6 +62,7 @@ class GpuMem : public ftl::RefCountedThreadSafe<GpuMem> {
   GpuMemSlab* slab_;
   vk::DeviceSize offset_;
   vk::DeviceSize size_;
+  GpuMemCategory category_ = GpuMemCategory::kOther;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(GpuMem);
 };
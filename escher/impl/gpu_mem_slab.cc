@@ -13,10 +13,12 @@ namespace impl {
 GpuMemSlab::GpuMemSlab(vk::DeviceMemory base,
                        vk::DeviceSize size,
                        uint32_t memory_type_index,
+                       uint8_t* mapped_ptr,
                        GpuAllocator* allocator)
     : base_(base),
       size_(size),
       memory_type_index_(memory_type_index),
+      mapped_ptr_(mapped_ptr),
       allocator_(allocator),
       ref_count_(0) {}
 
@@ -28,9 +30,9 @@ void GpuMemSlab::AddRef() {
   ++ref_count_;
 }
 
-void GpuMemSlab::FreeMem(vk::DeviceSize offset, vk::DeviceSize size) {
+void GpuMemSlab::FreeMem(const GpuMem* mem) {
   FTL_DCHECK(ref_count_ >= 1);
-  allocator_->FreeMem(this, --ref_count_, offset, size);
+  allocator_->ReleaseMem(this, --ref_count_, mem);
 }
 
 }  // namespace impl
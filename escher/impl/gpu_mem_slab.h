@@ -22,6 +22,16 @@ class GpuMemSlab {
   vk::DeviceSize size() const { return size_; }
   uint32_t memory_type_index() const { return memory_type_index_; }
 
+  // Host-visible slabs are mapped for their entire lifetime, since Vulkan does
+  // not allow a vk::DeviceMemory to be mapped more than once at a time.  Null
+  // for other slabs.
+  uint8_t* mapped_ptr() const { return mapped_ptr_; }
+
+  // True if the slab is a dedicated allocation for a single image or buffer
+  // (see GpuAllocator::AllocateForImage()).  Such slabs are freed by the
+  // GpuAllocator itself, rather than by its concrete subclass.
+  bool is_dedicated() const { return is_dedicated_; }
+
   ~GpuMemSlab();
 
  private:
@@ -29,17 +39,20 @@ class GpuMemSlab {
   GpuMemSlab(vk::DeviceMemory base,
              vk::DeviceSize size,
              uint32_t memory_type_index,
+             uint8_t* mapped_ptr,
              GpuAllocator* allocator);
 
   // Slab's ref-count is adjusted by GpuMem's constructor and destructor.
   friend class GpuMem;
   void AddRef();
-  void FreeMem(vk::DeviceSize offset, vk::DeviceSize size);
+  void FreeMem(const GpuMem* mem);
 
   vk::DeviceMemory base_;
   vk::DeviceSize size_;
   uint32_t memory_type_index_;
+  uint8_t* mapped_ptr_;
   GpuAllocator* allocator_;
+  bool is_dedicated_ = false;
   mutable std::atomic_uint_fast32_t ref_count_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(GpuMemSlab);
@@ -8,108 +8,136 @@
 #include "escher/impl/gpu_allocator.h"
 #include "escher/impl/vulkan_utils.h"
 #include "escher/renderer/image.h"
+#include "escher/renderer/semaphore_wait.h"
 
 #include <algorithm>
 
 namespace escher {
 namespace impl {
 
+namespace {
+
+// Not all clients will require this alignment, but let's be safe for now.
+constexpr vk::DeviceSize kWriterAlignment = 16;
+
+}  // namespace
+
 GpuUploader::Writer::Writer(BufferPtr buffer,
-                            CommandBuffer* command_buffer,
-                            vk::Queue queue,
                             vk::DeviceSize size,
-                            vk::DeviceSize offset)
+                            vk::DeviceSize offset,
+                            GpuUploader* uploader,
+                            bool uses_ring)
     : buffer_(std::move(buffer)),
-      command_buffer_(command_buffer),
-      queue_(queue),
       size_(size),
       offset_(offset),
       ptr_(buffer_->ptr() + offset_),
-      has_writes_(false) {
-  FTL_DCHECK(buffer_ && command_buffer_ && queue_ && ptr_);
+      uploader_(uploader),
+      uses_ring_(uses_ring) {
+  FTL_DCHECK(buffer_ && ptr_ && uploader_);
 }
 
+GpuUploader::Writer::Writer()
+    : size_(0),
+      offset_(0),
+      ptr_(nullptr),
+      uploader_(nullptr),
+      uses_ring_(false) {}
+
 GpuUploader::Writer::Writer(Writer&& other)
     : buffer_(std::move(other.buffer_)),
-      command_buffer_(other.command_buffer_),
-      queue_(other.queue_),
       size_(other.size_),
       offset_(other.offset_),
       ptr_(other.ptr_),
-      has_writes_(other.has_writes_) {
+      uploader_(other.uploader_),
+      uses_ring_(other.uses_ring_),
+      commands_(std::move(other.commands_)),
+      finished_callbacks_(std::move(other.finished_callbacks_)) {
   other.size_ = 0;
   other.offset_ = 0;
-  other.command_buffer_ = nullptr;
-  other.queue_ = nullptr;
   other.ptr_ = nullptr;
-  other.has_writes_ = false;
+  other.uploader_ = nullptr;
+  other.uses_ring_ = false;
+  other.commands_.clear();
+  other.finished_callbacks_.clear();
 }
 
 void GpuUploader::Writer::Submit() {
-  FTL_CHECK(command_buffer_);
-  if (has_writes_) {
-    if (has_writes_) {
-      command_buffer_->AddUsedResource(std::move(buffer_));
-      command_buffer_->Submit(queue_, nullptr);
-    } else {
-      // We need to submit the buffer anyway, otherwise we'll stall the
-      // CommandPool.
-      FTL_DLOG(WARNING) << "Submitting command-buffer without any writes.";
-      command_buffer_->Submit(queue_, nullptr);
-    }
-  }
+  FTL_CHECK(uploader_);
+  uploader_->SubmitWriter({std::move(buffer_), offset_, uses_ring_,
+                           std::move(commands_),
+                           std::move(finished_callbacks_)});
+  commands_.clear();
+  finished_callbacks_.clear();
   buffer_ = nullptr;
-  command_buffer_ = nullptr;
-  queue_ = nullptr;
   size_ = 0;
   offset_ = 0;
   ptr_ = 0;
-  has_writes_ = false;
+  uploader_ = nullptr;
+  uses_ring_ = false;
 }
 
 GpuUploader::Writer::~Writer() {
-  FTL_CHECK(!command_buffer_);
+  FTL_CHECK(!uploader_);
 }
 
 void GpuUploader::Writer::WriteBuffer(const BufferPtr& target,
                                       vk::BufferCopy region,
                                       SemaphorePtr semaphore) {
-  has_writes_ = true;
+  FTL_DCHECK(uploader_);
   region.srcOffset += offset_;
-  RememberTarget(target, std::move(semaphore));
-
-  command_buffer_->get().copyBuffer(buffer_->get(), target->get(), 1, &region);
+  if (semaphore) {
+    target->SetWaitSemaphore(semaphore);
+  }
+  vk::Buffer source = buffer_->get();
+  commands_.push_back(
+      [source, target, region, semaphore](CommandBuffer* command_buffer) {
+        command_buffer->get().copyBuffer(source, target->get(), 1, &region);
+        command_buffer->AddSignalSemaphore(semaphore);
+        command_buffer->AddUsedResource(target);
+      });
 }
 
 void GpuUploader::Writer::WriteImage(const ImagePtr& target,
                                      vk::BufferImageCopy region,
-                                     SemaphorePtr semaphore) {
-  has_writes_ = true;
-  region.bufferOffset += offset_;
-
-  command_buffer_->TransitionImageLayout(target, vk::ImageLayout::eUndefined,
-                                         vk::ImageLayout::eTransferDstOptimal);
-  command_buffer_->get().copyBufferToImage(buffer_->get(), target->get(),
-                                           vk::ImageLayout::eTransferDstOptimal,
-                                           1, &region);
-  command_buffer_->TransitionImageLayout(
-      target, vk::ImageLayout::eTransferDstOptimal,
-      vk::ImageLayout::eShaderReadOnlyOptimal);
+                                     SemaphorePtr semaphore,
+                                     vk::ImageLayout initial_layout) {
+  WriteImage(target, &region, 1, std::move(semaphore), initial_layout);
+}
 
+void GpuUploader::Writer::WriteImage(const ImagePtr& target,
+                                     const vk::BufferImageCopy* regions,
+                                     uint32_t region_count,
+                                     SemaphorePtr semaphore,
+                                     vk::ImageLayout initial_layout) {
+  FTL_DCHECK(uploader_);
+  std::vector<vk::BufferImageCopy> offset_regions(regions,
+                                                  regions + region_count);
+  for (auto& region : offset_regions) {
+    region.bufferOffset += offset_;
+  }
   if (semaphore) {
     target->SetWaitSemaphore(semaphore);
-    command_buffer_->AddSignalSemaphore(std::move(semaphore));
   }
-  target->KeepAlive(command_buffer_);
+  vk::Buffer source = buffer_->get();
+  commands_.push_back([source, target, offset_regions, semaphore,
+                       initial_layout](CommandBuffer* command_buffer) {
+    command_buffer->TransitionImageLayout(
+        target, initial_layout, vk::ImageLayout::eTransferDstOptimal);
+    command_buffer->get().copyBufferToImage(
+        source, target->get(), vk::ImageLayout::eTransferDstOptimal,
+        static_cast<uint32_t>(offset_regions.size()), offset_regions.data());
+    command_buffer->TransitionImageLayout(
+        target, vk::ImageLayout::eTransferDstOptimal,
+        vk::ImageLayout::eShaderReadOnlyOptimal);
+    command_buffer->AddSignalSemaphore(semaphore);
+    target->KeepAlive(command_buffer);
+  });
 }
 
-void GpuUploader::Writer::RememberTarget(ResourcePtr target,
-                                         SemaphorePtr semaphore) {
-  if (semaphore) {
-    target->SetWaitSemaphore(semaphore);
-    command_buffer_->AddSignalSemaphore(std::move(semaphore));
-  }
-  command_buffer_->AddUsedResource(std::move(target));
+void GpuUploader::Writer::AddFinishedCallback(
+    CommandBufferFinishedCallback callback) {
+  FTL_DCHECK(uploader_);
+  finished_callbacks_.push_back(std::move(callback));
 }
 
 GpuUploader::TransferBufferInfo::TransferBufferInfo(vk::Buffer buf,
@@ -143,16 +171,28 @@ void GpuUploader::TransferBufferInfo::DestroyBuffer(vk::Device device) {
 }
 
 GpuUploader::GpuUploader(CommandBufferPool* command_buffer_pool,
-                         GpuAllocator* allocator)
+                         GpuAllocator* allocator,
+                         vk::DeviceSize ring_buffer_size,
+                         bool batch_writes)
     : command_buffer_pool_(command_buffer_pool),
       device_(command_buffer_pool_->device()),
       queue_(command_buffer_pool_->queue()),
       allocator_(allocator),
       current_offset_(0),
-      allocation_count_(0) {}
+      allocation_count_(0),
+      batch_writes_(batch_writes) {
+  if (ring_buffer_size) {
+    ring_allocator_ =
+        std::make_unique<RingAllocator>(ring_buffer_size, kWriterAlignment);
+  }
+}
 
 GpuUploader::~GpuUploader() {
+  // The batch must have been flushed, and its CommandBuffer retired.
+  FTL_DCHECK(batched_writers_.empty());
+  FTL_DCHECK(!ring_allocator_ || ring_allocator_->empty());
   current_buffer_ = nullptr;
+  ring_buffer_ = nullptr;
 
   // Destroy all free buffers (which should include the formerly-current
   // buffer that was just released).
@@ -168,21 +208,176 @@ GpuUploader::~GpuUploader() {
 GpuUploader::Writer GpuUploader::GetWriter(size_t s) {
   vk::DeviceSize size = s;
   FTL_DCHECK(size == s);
+  if (ring_allocator_ && size <= ring_allocator_->size()) {
+    Writer writer = GetRingWriter(size, true);
+    if (writer.is_valid()) {
+      return writer;
+    }
+  }
+  return GetFreeListWriter(size);
+}
+
+GpuUploader::Writer GpuUploader::TryGetWriter(size_t s) {
+  vk::DeviceSize size = s;
+  FTL_DCHECK(size == s);
+  if (ring_allocator_ && size <= ring_allocator_->size()) {
+    return GetRingWriter(size, false);
+  }
+  return GetFreeListWriter(size);
+}
+
+SemaphorePtr GpuUploader::Flush() {
+  if (batched_writers_.empty()) {
+    return SemaphorePtr();
+  }
+  // The CommandBuffer is only obtained now, and submitted immediately, so that
+  // it never holds back the retirement of other CommandBuffers from the pool.
+  CommandBuffer* command_buffer = command_buffer_pool_->GetCommandBuffer();
+  bool uses_ring = false;
+  std::vector<CommandBufferFinishedCallback> finished_callbacks;
+  for (auto& writer : batched_writers_) {
+    RecordWriter(&writer, command_buffer);
+    uses_ring = uses_ring || writer.uses_ring;
+    for (auto& callback : writer.finished_callbacks) {
+      finished_callbacks.push_back(std::move(callback));
+    }
+  }
+  batched_writers_.clear();
+
+  auto semaphore = Semaphore::New(device_);
+  command_buffer->AddSignalSemaphore(semaphore);
+  command_buffer->Submit(
+      queue_, MakeFinishedCallback(command_buffer, uses_ring,
+                                   std::move(finished_callbacks)));
+  return semaphore;
+}
+
+void GpuUploader::SubmitWriter(SubmittedWriter writer) {
+  if (batch_writes_) {
+    // Recorded and submitted by Flush().
+    batched_writers_.push_back(std::move(writer));
+    return;
+  }
+  if (writer.commands.empty()) {
+    // We need to submit a buffer anyway, otherwise in ring mode we'll never
+    // reclaim this Writer's space.
+    FTL_DLOG(WARNING) << "Submitting command-buffer without any writes.";
+  }
+  CommandBuffer* command_buffer = command_buffer_pool_->GetCommandBuffer();
+  RecordWriter(&writer, command_buffer);
+  command_buffer->Submit(
+      queue_, MakeFinishedCallback(command_buffer, writer.uses_ring,
+                                   std::move(writer.finished_callbacks)));
+}
+
+void GpuUploader::RecordWriter(SubmittedWriter* writer,
+                               CommandBuffer* command_buffer) {
+  for (auto& command : writer->commands) {
+    command(command_buffer);
+  }
+  if (!writer->commands.empty()) {
+    command_buffer->AddUsedResource(std::move(writer->buffer));
+  }
+  if (writer->uses_ring) {
+    ring_allocator_->Reassign(writer->offset,
+                              command_buffer->sequence_number());
+  }
+}
+
+GpuUploader::Writer GpuUploader::GetFreeListWriter(vk::DeviceSize size) {
   PrepareForWriterOfSize(size);
-  Writer writer(current_buffer_, command_buffer_pool_->GetCommandBuffer(),
-                queue_, size, current_offset_);
+  Writer writer(current_buffer_, size, current_offset_, this, false);
   current_offset_ += size;
 
-  // Not all clients will require this alignment, but let's be safe for now.
-  constexpr vk::DeviceSize kAlignment = 16;
-  vk::DeviceSize adjustment = kAlignment - (current_offset_ % kAlignment);
-  if (adjustment != kAlignment) {
+  vk::DeviceSize adjustment =
+      kWriterAlignment - (current_offset_ % kWriterAlignment);
+  if (adjustment != kWriterAlignment) {
     current_offset_ += adjustment;
   }
 
   return writer;
 }
 
+GpuUploader::Writer GpuUploader::GetRingWriter(vk::DeviceSize size,
+                                               bool block) {
+  while (!ring_allocator_->CanAllocate(size)) {
+    if (!block || !WaitForOldestRingWriter()) {
+      return Writer();
+    }
+  }
+  if (!ring_buffer_) {
+    ring_buffer_ = NewBuffer(NewTransferBufferInfo(ring_allocator_->size()));
+  }
+  // The space is tagged with the sequence number of the CommandBuffer that the
+  // Writer's copies are recorded into, once it is submitted.
+  vk::DeviceSize offset =
+      ring_allocator_->Allocate(size, RingAllocator::kUnassignedSequenceNumber);
+  return Writer(ring_buffer_, size, offset, this, true);
+}
+
+bool GpuUploader::WaitForOldestRingWriter() {
+  auto it = pending_ring_command_buffers_.find(
+      ring_allocator_->oldest_sequence_number());
+  if (it == pending_ring_command_buffers_.end()) {
+    // The oldest Writer has not been submitted (or flushed), so waiting would
+    // deadlock.
+    return false;
+  }
+  vk::DeviceSize bytes_in_use = ring_allocator_->bytes_in_use();
+  auto result = it->second->Wait(UINT64_MAX);
+  FTL_DCHECK(result == vk::Result::eSuccess);
+  // Retiring the CommandBuffer invokes the callback that reclaims its space.
+  // This may not happen if an older CommandBuffer from the same pool has not
+  // been submitted yet.
+  command_buffer_pool_->Cleanup();
+  return ring_allocator_->bytes_in_use() < bytes_in_use;
+}
+
+CommandBufferFinishedCallback GpuUploader::MakeFinishedCallback(
+    CommandBuffer* command_buffer,
+    bool uses_ring,
+    std::vector<CommandBufferFinishedCallback> callbacks) {
+  if (!uses_ring && callbacks.empty()) {
+    return nullptr;
+  }
+  uint64_t sequence_number = command_buffer->sequence_number();
+  if (uses_ring) {
+    pending_ring_command_buffers_[sequence_number] = command_buffer;
+  }
+  return [ this, sequence_number, uses_ring,
+           callbacks = std::move(callbacks) ]() {
+    if (uses_ring) {
+      pending_ring_command_buffers_.erase(sequence_number);
+      ring_allocator_->Release(sequence_number);
+    }
+    for (auto& callback : callbacks) {
+      callback();
+    }
+  };
+}
+
+void GpuUploader::Trim(uint64_t last_finished_sequence_number) {
+  if (ring_allocator_ && ring_allocator_->empty()) {
+    // Recycled into free_buffers_, unless still referenced by a CommandBuffer
+    // that is being retired; it is recreated when next needed.
+    ring_buffer_ = nullptr;
+  }
+  for (auto& info : free_buffers_) {
+    static_cast<TransferBufferInfo*>(info.get())->DestroyBuffer(device_);
+    --allocation_count_;
+  }
+  free_buffers_.clear();
+}
+
+void GpuUploader::AddToStats(MemoryBudget::Stats* stats) const {
+  for (auto& info : free_buffers_) {
+    stats->cached_bytes += info->GetSize();
+  }
+  if (ring_buffer_ && ring_allocator_->empty()) {
+    stats->cached_bytes += ring_buffer_->size();
+  }
+}
+
 void GpuUploader::RecycleBuffer(std::unique_ptr<BufferInfo> info) {
   free_buffers_.push_back(std::move(info));
 }
@@ -213,6 +408,11 @@ void GpuUploader::PrepareForWriterOfSize(vk::DeviceSize size) {
   constexpr vk::DeviceSize kMinBufferSize = 1024 * 1024;
   constexpr vk::DeviceSize kOverAllocationFactor = 2;
   size = std::max(kMinBufferSize, size * kOverAllocationFactor);
+  current_buffer_ = NewBuffer(NewTransferBufferInfo(size));
+}
+
+std::unique_ptr<GpuUploader::TransferBufferInfo>
+GpuUploader::NewTransferBufferInfo(vk::DeviceSize size) {
   vk::Buffer buffer;
   {
     vk::BufferCreateInfo buffer_create_info;
@@ -224,15 +424,14 @@ void GpuUploader::PrepareForWriterOfSize(vk::DeviceSize size) {
   // Allocate memory and bind it to the buffer.
   auto memory_properties = vk::MemoryPropertyFlagBits::eHostVisible |
                            vk::MemoryPropertyFlagBits::eHostCoherent;
-  GpuMemPtr mem = allocator_->Allocate(
-      device_.getBufferMemoryRequirements(buffer), memory_properties);
+  GpuMemPtr mem = allocator_->AllocateForBuffer(buffer, memory_properties,
+                                                GpuMemCategory::kStaging);
   device_.bindBufferMemory(buffer, mem->base(), mem->offset());
-  void* ptr = ESCHER_CHECKED_VK_RESULT(
-      device_.mapMemory(mem->base(), mem->offset(), mem->size()));
-  // Wrap everything in a TransferBufferInfo, and wrap that in a Buffer.
-  current_buffer_ = NewBuffer(std::make_unique<TransferBufferInfo>(
-      buffer, size, reinterpret_cast<uint8_t*>(ptr), std::move(mem)));
+  uint8_t* ptr = mem->mapped_ptr();
+  FTL_DCHECK(ptr);
   ++allocation_count_;
+  return std::make_unique<TransferBufferInfo>(buffer, size, ptr,
+                                              std::move(mem));
 }
 
 }  // namespace impl
@@ -4,14 +4,35 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "escher/impl/command_buffer.h"
+#include "escher/impl/memory_budget.h"
+#include "escher/impl/ring_allocator.h"
 #include "escher/vk/buffer.h"
 
 namespace escher {
 namespace impl {
 
-class GpuUploader : BufferOwner {
+// GpuUploader has two staging modes.  By default, each Writer is carved from a
+// buffer that is recycled via a free list once its CommandBuffers are retired.
+// If |ring_buffer_size| is non-zero, Writers are instead carved from a single
+// persistently-mapped ring buffer of that size, whose space is reclaimed as
+// the Writers' CommandBuffers finish; this avoids creating buffers while
+// streaming.  Writers that are larger than the ring always use the free list.
+//
+// A Writer's copies are recorded when it is submitted, so open Writers never
+// hold on to a CommandBuffer.  By default, Writer::Submit() records them into a
+// new CommandBuffer and submits it.  If |batch_writes| is true, the copies of
+// all submitted Writers are recorded into a single CommandBuffer by Flush().
+class GpuUploader : BufferOwner, public MemoryBudget::Client {
  public:
-  GpuUploader(CommandBufferPool* command_buffer_pool, GpuAllocator* allocator);
+  GpuUploader(CommandBufferPool* command_buffer_pool,
+              GpuAllocator* allocator,
+              vk::DeviceSize ring_buffer_size = 0,
+              bool batch_writes = false);
   ~GpuUploader();
 
   // Provides a pointer in host-accessible GPU memory, and methods to copy this
@@ -23,54 +44,116 @@ class GpuUploader : BufferOwner {
     ~Writer();
 
     // Schedule a buffer-to-buffer copy that will be submitted when Submit()
-    // is called.  Retains a reference to the target until the submission's
-    // CommandBuffer is retired.
+    // is called (or, if writes are batched, by the next Flush()).  Retains a
+    // reference to the target until the submission's CommandBuffer is retired.
+    // The copy reads the scratch space when it is submitted, so the data must
+    // be written before then.
     void WriteBuffer(const BufferPtr& target,
                      vk::BufferCopy region,
                      SemaphorePtr semaphore);
 
     // Schedule a buffer-to-image copy that will be submitted when Submit()
-    // is called.  Retains a reference to the target until the submission's
-    // CommandBuffer is retired.
-    void WriteImage(const ImagePtr& target,
-                    vk::BufferImageCopy region,
-                    SemaphorePtr semaphore);
+    // is called (or, if writes are batched, by the next Flush()).  Retains a
+    // reference to the target until the submission's CommandBuffer is retired.
+    // The target is transitioned from |initial_layout| to
+    // eShaderReadOnlyOptimal; the default discards the image's contents, so
+    // pass eShaderReadOnlyOptimal to preserve data written by previous copies.
+    void WriteImage(
+        const ImagePtr& target,
+        vk::BufferImageCopy region,
+        SemaphorePtr semaphore,
+        vk::ImageLayout initial_layout = vk::ImageLayout::eUndefined);
+
+    // Like WriteImage(), but copies |region_count| regions (e.g. one per mip
+    // level) with a single pair of layout transitions.
+    void WriteImage(
+        const ImagePtr& target,
+        const vk::BufferImageCopy* regions,
+        uint32_t region_count,
+        SemaphorePtr semaphore,
+        vk::ImageLayout initial_layout = vk::ImageLayout::eUndefined);
+
+    // |callback| is invoked once this Writer's writes have finished executing
+    // on the GPU (or more precisely, when the CommandBuffer that they were
+    // submitted in is retired).
+    void AddFinishedCallback(CommandBufferFinishedCallback callback);
 
     // Submit all image/buffer writes that been made on this Writer.  It is an
-    // error to call this more than once.
+    // error to call this more than once.  If writes are batched, the writes
+    // are submitted by the next Flush().
     void Submit();
 
     uint8_t* ptr() const { return ptr_; }
     vk::DeviceSize size() const { return size_; }
 
+    // False if the Writer was returned by TryGetWriter() because the ring
+    // buffer was full.  Invalid Writers must not be used or submitted.
+    bool is_valid() const { return uploader_ != nullptr; }
+
    private:
-    // Constructor called by GpuUploader.
+    // Constructors called by GpuUploader.  If |uses_ring| is true, the
+    // Writer's scratch space is in the uploader's ring buffer.
     friend class GpuUploader;
     Writer(BufferPtr buffer,
-           CommandBuffer* command_buffer,
-           vk::Queue queue,
            vk::DeviceSize size,
-           vk::DeviceSize offset);
-
-    // Add the resource to command_buffer_.  If semaphore is not null, set it as
-    // target's wait-sempahore, and signal it when the command-buffer is
-    // retired.
-    void RememberTarget(ResourcePtr target, SemaphorePtr semaphore);
+           vk::DeviceSize offset,
+           GpuUploader* uploader,
+           bool uses_ring);
+    // Creates an invalid Writer.
+    Writer();
 
     BufferPtr buffer_;
-    CommandBuffer* command_buffer_;
-    vk::Queue queue_;
     vk::DeviceSize size_;
     vk::DeviceSize offset_;
     uint8_t* ptr_;
-    bool has_writes_;
+    GpuUploader* uploader_;
+    bool uses_ring_;
+    // Record the Writer's copies into a CommandBuffer, once it is submitted.
+    std::vector<std::function<void(CommandBuffer*)>> commands_;
+    std::vector<CommandBufferFinishedCallback> finished_callbacks_;
 
     FTL_DISALLOW_COPY_AND_ASSIGN(Writer);
   };
 
-  // Get a Writer that has the specified amount of scratch space.
+  // Get a Writer that has the specified amount of scratch space.  If the ring
+  // buffer is full, block until enough of the GPU work that uses it has
+  // finished.  If that is impossible because the oldest Writer in the ring has
+  // not been submitted (or flushed) yet, fall back to the free list.
   Writer GetWriter(size_t size);
 
+  // Like GetWriter(), but never blocks: if the ring buffer is full, return an
+  // invalid Writer, and the caller should try again later (e.g. next frame).
+  Writer TryGetWriter(size_t size);
+
+  // Submit the batched writes of all Writers that have been submitted since
+  // the previous flush, and return a semaphore that is signaled when they are
+  // finished.  Work that uses the written resources must wait on it; the
+  // resources are not given individual wait-semaphores.  Writers that are
+  // still open are unaffected; their writes are submitted by the first flush
+  // after they are submitted.  Return null if writes are not batched, or if
+  // there is nothing to flush.
+  SemaphorePtr Flush();
+
+  bool batches_writes() const { return batch_writes_; }
+
+  // Zero if ring-buffer staging is disabled.
+  vk::DeviceSize ring_buffer_size() const {
+    return ring_allocator_ ? ring_allocator_->size() : 0;
+  }
+  // Bytes of the ring buffer that are used by pending Writers.
+  vk::DeviceSize ring_buffer_bytes_in_use() const {
+    return ring_allocator_ ? ring_allocator_->bytes_in_use() : 0;
+  }
+
+  // Implement MemoryBudget::Client::Trim().  Destroys all free buffers; they
+  // are not recycled until the CommandBuffers that use them have finished.
+  // The ring buffer is also released if no Writers are using it.
+  void Trim(uint64_t last_finished_sequence_number) override;
+
+  // Implement MemoryBudget::Client::AddToStats().  Free buffers, and the ring
+  // buffer if no Writers are using it, are counted as cached.
+  void AddToStats(MemoryBudget::Stats* stats) const override;
+
  private:
   // Implement BufferOwner::RecycleBuffer().
   void RecycleBuffer(std::unique_ptr<BufferInfo> info) override;
@@ -97,6 +180,49 @@ class GpuUploader : BufferOwner {
     GpuMemPtr mem;
   };
 
+  // Create a host-visible transfer-source buffer of the specified size.
+  std::unique_ptr<TransferBufferInfo> NewTransferBufferInfo(
+      vk::DeviceSize size);
+
+  // Get a Writer whose scratch space is in current_buffer_.
+  Writer GetFreeListWriter(vk::DeviceSize size);
+
+  // Get a Writer whose scratch space is in ring_buffer_.  If the ring is full
+  // and |block| is true, wait for space to be reclaimed.  Return an invalid
+  // Writer if the ring is (still) full.
+  Writer GetRingWriter(vk::DeviceSize size, bool block);
+
+  // Block until the CommandBuffer of the oldest Writer in the ring has
+  // finished, and reclaim its space.  Return false if no space was reclaimed,
+  // e.g. because that Writer has not been submitted yet.
+  bool WaitForOldestRingWriter();
+
+  // The contents of a Writer that has been submitted, but whose copies have not
+  // been recorded yet.
+  struct SubmittedWriter {
+    BufferPtr buffer;
+    vk::DeviceSize offset;
+    bool uses_ring;
+    std::vector<std::function<void(CommandBuffer*)>> commands;
+    std::vector<CommandBufferFinishedCallback> finished_callbacks;
+  };
+
+  // Called by Writer::Submit().  Unless writes are batched, records the
+  // Writer's copies into a new CommandBuffer and submits it.
+  void SubmitWriter(SubmittedWriter writer);
+
+  // Record the copies of |writer| into |command_buffer|, and tag its ring
+  // space (if any) with the CommandBuffer's sequence number.
+  void RecordWriter(SubmittedWriter* writer, CommandBuffer* command_buffer);
+
+  // Called when submitting |command_buffer|.  Returns a callback that reclaims
+  // the ring space of its Writers (if |uses_ring| is true) and then invokes
+  // |callbacks|, or null if there is nothing to do.
+  CommandBufferFinishedCallback MakeFinishedCallback(
+      CommandBuffer* command_buffer,
+      bool uses_ring,
+      std::vector<CommandBufferFinishedCallback> callbacks);
+
   // If current_buffer_ doesn't have enough room, release it and prepare a
   // suitable buffer.
   void PrepareForWriterOfSize(vk::DeviceSize size);
@@ -125,6 +251,20 @@ class GpuUploader : BufferOwner {
   // by this uploader.
   uint32_t allocation_count_;
 
+  // Null if ring-buffer staging is disabled.  Tracks which parts of
+  // ring_buffer_ are used by pending Writers.
+  std::unique_ptr<RingAllocator> ring_allocator_;
+  // Allocated when first needed.
+  BufferPtr ring_buffer_;
+  // CommandBuffers of submitted ring Writers that have not finished yet, keyed
+  // by sequence number.  The ring space of a Writer is tagged with
+  // RingAllocator::kUnassignedSequenceNumber until its copies are recorded.
+  std::map<uint64_t, CommandBuffer*> pending_ring_command_buffers_;
+
+  const bool batch_writes_;
+  // Writers that have been submitted since the last Flush(), in order.
+  std::vector<SubmittedWriter> batched_writers_;
+
   FTL_DISALLOW_COPY_AND_ASSIGN(GpuUploader);
 };
 
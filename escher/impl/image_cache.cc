@@ -4,37 +4,95 @@
 
 #include "escher/impl/image_cache.h"
 
+#include <algorithm>
+#include <iterator>
+
+#include "escher/impl/command_buffer.h"
 #include "escher/impl/command_buffer_pool.h"
+#include "escher/impl/frame_gpu_allocator.h"
 #include "escher/impl/gpu_allocator.h"
 #include "escher/impl/gpu_uploader.h"
 #include "escher/impl/vulkan_utils.h"
+#include "escher/resources/resource_life_preserver.h"
+#include "escher/util/image_formats.h"
 #include "escher/util/image_loader.h"
 
 namespace escher {
 namespace impl {
 
+constexpr vk::DeviceSize ImageCache::kDefaultMaxUnusedBytes;
+constexpr uint64_t ImageCache::kDefaultMaxUnusedFrames;
+
 ImageCache::ImageCache(const VulkanContext& context,
                        CommandBufferPool* pool,
                        GpuAllocator* allocator,
-                       GpuUploader* uploader)
+                       GpuUploader* uploader,
+                       FrameGpuAllocator* frame_allocator,
+                       ResourceLifePreserver* life_preserver)
     : ImageOwner(context),
       queue_(pool->queue()),
+      physical_device_(context.physical_device),
       allocator_(allocator),
-      uploader_(uploader) {}
+      uploader_(uploader),
+      frame_allocator_(frame_allocator),
+      life_preserver_(life_preserver) {
+  FTL_DCHECK(!frame_allocator_ == !life_preserver_);
+
+  auto memory_properties = physical_device_.getMemoryProperties();
+  for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i) {
+    if (memory_properties.memoryTypes[i].propertyFlags &
+        vk::MemoryPropertyFlagBits::eLazilyAllocated) {
+      supports_lazily_allocated_memory_ = true;
+      break;
+    }
+  }
+}
 
 ImageCache::~ImageCache() {}
 
 ImagePtr ImageCache::NewImage(const ImageInfo& info) {
   if (ImagePtr result = FindImage(info)) {
+    ++stats_.hit_count;
     return result;
   }
+  ++stats_.miss_count;
 
   // Create a new vk::Image, since we couldn't find a suitable one.
+  return CreateImage(NewImageCore(info, allocator_, this));
+}
+
+ImagePtr ImageCache::NewTransientImage(const ImageInfo& info) {
+  if (!frame_allocator_) {
+    return NewImage(info);
+  }
+  // The ResourceLifePreserver destroys the core (thereby releasing its memory
+  // back to the FrameGpuAllocator) once the GPU is finished with it.
+  return CreateImage(NewImageCore(info, frame_allocator_, life_preserver_));
+}
+
+ImagePtr ImageCache::NewTransientAttachmentImage(ImageInfo info) {
+  const vk::ImageUsageFlags kAttachmentUsage =
+      vk::ImageUsageFlagBits::eColorAttachment |
+      vk::ImageUsageFlagBits::eDepthStencilAttachment |
+      vk::ImageUsageFlagBits::eInputAttachment;
+  FTL_DCHECK(info.usage && !(info.usage & ~kAttachmentUsage));
+  info.usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+  if (!supports_lazily_allocated_memory_) {
+    return NewTransientImage(info);
+  }
+  // Lazily-allocated memory costs (almost) nothing, so these images are cached
+  // like any other, instead of using the FrameGpuAllocator.
+  info.memory_flags = vk::MemoryPropertyFlagBits::eDeviceLocal |
+                      vk::MemoryPropertyFlagBits::eLazilyAllocated;
+  return NewImage(info);
+}
+
+vk::Image ImageCache::NewUnboundImage(const ImageInfo& info) {
   vk::ImageCreateInfo create_info;
   create_info.imageType = vk::ImageType::e2D;
   create_info.format = info.format;
   create_info.extent = vk::Extent3D{info.width, info.height, 1};
-  create_info.mipLevels = 1;
+  create_info.mipLevels = info.mip_levels;
   create_info.arrayLayers = 1;
   switch (info.sample_count) {
     case 1:
@@ -56,17 +114,35 @@ ImagePtr ImageCache::NewImage(const ImageInfo& info) {
   create_info.usage = info.usage;
   create_info.sharingMode = vk::SharingMode::eExclusive;
   create_info.initialLayout = vk::ImageLayout::eUndefined;
-  vk::Image image = ESCHER_CHECKED_VK_RESULT(device().createImage(create_info));
+  return ESCHER_CHECKED_VK_RESULT(device().createImage(create_info));
+}
 
-  // Allocate memory and bind it to the image.
-  vk::MemoryRequirements reqs = device().getImageMemoryRequirements(image);
-  GpuMemPtr memory = allocator_->Allocate(reqs, info.memory_flags);
+ImagePtr ImageCache::NewAliasedImage(const ImageInfo& info,
+                                     vk::Image image,
+                                     GpuMemPtr memory) {
+  FTL_DCHECK(life_preserver_);
   vk::Result result =
       device().bindImageMemory(image, memory->base(), memory->offset());
   FTL_CHECK(result == vk::Result::eSuccess);
+  return CreateImage(std::make_unique<ImageCore>(life_preserver_, info, image,
+                                                 std::move(memory)));
+}
+
+std::unique_ptr<ImageCore> ImageCache::NewImageCore(
+    const ImageInfo& info,
+    GpuAllocator* allocator,
+    ResourceCoreManager* manager) {
+  vk::Image image = NewUnboundImage(info);
 
-  return CreateImage(
-      std::make_unique<ImageCore>(this, info, image, std::move(memory)));
+  // Allocate memory and bind it to the image.  Large render targets may be
+  // given a dedicated allocation, if the driver prefers it.
+  GpuMemPtr memory = allocator->AllocateForImage(image, info.memory_flags,
+                                                 GpuMemCategory::kImage);
+  vk::Result result =
+      device().bindImageMemory(image, memory->base(), memory->offset());
+  FTL_CHECK(result == vk::Result::eSuccess);
+
+  return std::make_unique<ImageCore>(manager, info, image, std::move(memory));
 }
 
 ImagePtr ImageCache::NewDepthImage(vk::Format format,
@@ -102,21 +178,13 @@ ImagePtr ImageCache::NewImageFromPixels(vk::Format format,
                                         uint32_t width,
                                         uint32_t height,
                                         uint8_t* pixels,
-                                        vk::ImageUsageFlags additional_flags) {
-  size_t bytes_per_pixel = 0;
-  switch (format) {
-    case vk::Format::eR8G8B8A8Unorm:
-      bytes_per_pixel = 4;
-      break;
-    case vk::Format::eR8Unorm:
-      bytes_per_pixel = 1;
-      break;
-    default:
-      FTL_CHECK(false);
-  }
+                                        vk::ImageUsageFlags additional_flags,
+                                        bool generate_mipmaps) {
+  FTL_DCHECK(!GetImageFormatInfo(format).is_compressed());
+  vk::DeviceSize size = GetImageLevelSize(format, width, height);
 
-  auto writer = uploader_->GetWriter(width * height * bytes_per_pixel);
-  memcpy(writer.ptr(), pixels, width * height * bytes_per_pixel);
+  auto writer = uploader_->GetWriter(size);
+  memcpy(writer.ptr(), pixels, size);
 
   ImageInfo info;
   info.format = format;
@@ -126,6 +194,20 @@ ImagePtr ImageCache::NewImageFromPixels(vk::Format format,
   info.usage = additional_flags | vk::ImageUsageFlagBits::eTransferDst |
                vk::ImageUsageFlagBits::eSampled;
 
+  // The mip chain is blitted from the first level, which requires the format
+  // to support linear filtering of blits.  Otherwise, fall back to a single
+  // level.
+  generate_mipmaps =
+      generate_mipmaps && GetMaxMipLevels(width, height) > 1 &&
+      SupportsFormatFeatures(
+          format, vk::FormatFeatureFlagBits::eBlitSrc |
+                      vk::FormatFeatureFlagBits::eBlitDst |
+                      vk::FormatFeatureFlagBits::eSampledImageFilterLinear);
+  if (generate_mipmaps) {
+    info.mip_levels = GetMaxMipLevels(width, height);
+    info.usage |= vk::ImageUsageFlagBits::eTransferSrc;
+  }
+
   // Create the new image.
   auto image = NewImage(info);
 
@@ -139,22 +221,127 @@ ImagePtr ImageCache::NewImageFromPixels(vk::Format format,
   region.imageExtent.depth = 1;
   region.bufferOffset = 0;
 
-  writer.WriteImage(image, region, Semaphore::New(device()));
+  // If writes are batched, rendering waits on the semaphore returned by
+  // GpuUploader::Flush() instead.
+  writer.WriteImage(image, region,
+                    uploader_->batches_writes() ? SemaphorePtr()
+                                                : Semaphore::New(device()));
   writer.Submit();
 
+  if (generate_mipmaps) {
+    images_needing_mipmaps_.push_back(image);
+  }
   return image;
 }
 
+ImagePtr ImageCache::NewCompressedImage(vk::Format format,
+                                        uint32_t width,
+                                        uint32_t height,
+                                        uint32_t mip_levels,
+                                        const uint8_t* data,
+                                        size_t size) {
+  FTL_DCHECK(GetImageFormatInfo(format).is_compressed());
+  FTL_DCHECK(mip_levels >= 1 && mip_levels <= GetMaxMipLevels(width, height));
+  if (!SupportsFormatFeatures(format,
+                              vk::FormatFeatureFlagBits::eSampledImage)) {
+    return ImagePtr();
+  }
+
+  ImageInfo info;
+  info.format = format;
+  info.width = width;
+  info.height = height;
+  info.sample_count = 1;
+  info.mip_levels = mip_levels;
+  info.usage =
+      vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+
+  auto writer = uploader_->GetWriter(size);
+  memcpy(writer.ptr(), data, size);
+
+  // One copy region per mip level; the blocks of each level directly follow
+  // those of the previous level.
+  std::vector<vk::BufferImageCopy> regions(mip_levels);
+  vk::DeviceSize offset = 0;
+  for (uint32_t level = 0; level < mip_levels; ++level) {
+    uint32_t level_width = std::max(width >> level, 1U);
+    uint32_t level_height = std::max(height >> level, 1U);
+    auto& region = regions[level];
+    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    region.imageSubresource.mipLevel = level;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = level_width;
+    region.imageExtent.height = level_height;
+    region.imageExtent.depth = 1;
+    region.bufferOffset = offset;
+    offset += GetImageLevelSize(format, level_width, level_height);
+  }
+  FTL_CHECK(offset == size);
+
+  auto image = NewImage(info);
+  writer.WriteImage(image, regions.data(), mip_levels,
+                    uploader_->batches_writes() ? SemaphorePtr()
+                                                : Semaphore::New(device()));
+  writer.Submit();
+  return image;
+}
+
+bool ImageCache::SupportsFormatFeatures(
+    vk::Format format,
+    vk::FormatFeatureFlags features) const {
+  vk::FormatProperties properties =
+      physical_device_.getFormatProperties(format);
+  return (properties.optimalTilingFeatures & features) == features;
+}
+
+void ImageCache::GenerateMipmaps(CommandBuffer* command_buffer) {
+  for (auto& image : images_needing_mipmaps_) {
+    // Only set if uploads are not batched.
+    command_buffer->TakeWaitSemaphore(image,
+                                      vk::PipelineStageFlagBits::eTransfer);
+    command_buffer->GenerateMipmaps(image);
+  }
+  images_needing_mipmaps_.clear();
+}
+
+ImageUploadStreamPtr ImageCache::NewImageUploadStream(
+    vk::Format format,
+    uint32_t width,
+    uint32_t height,
+    vk::DeviceSize max_staging_bytes,
+    ImageUploadStream::ProgressCallback callback,
+    vk::ImageUsageFlags additional_flags) {
+  ImageInfo info;
+  info.format = format;
+  info.width = width;
+  info.height = height;
+  info.sample_count = 1;
+  info.usage = additional_flags | vk::ImageUsageFlagBits::eTransferDst |
+               vk::ImageUsageFlagBits::eSampled;
+
+  FTL_DCHECK(!GetImageFormatInfo(format).is_compressed());
+  return AdoptRef(new ImageUploadStream(uploader_, NewImage(info),
+                                        GetImageLevelSize(format, 1, 1),
+                                        max_staging_bytes,
+                                        std::move(callback)));
+}
+
 ImagePtr ImageCache::NewRgbaImage(uint32_t width,
                                   uint32_t height,
-                                  uint8_t* pixels) {
-  return NewImageFromPixels(vk::Format::eR8G8B8A8Unorm, width, height, pixels);
+                                  uint8_t* pixels,
+                                  bool generate_mipmaps) {
+  return NewImageFromPixels(vk::Format::eR8G8B8A8Unorm, width, height, pixels,
+                            vk::ImageUsageFlags(), generate_mipmaps);
 }
 
-ImagePtr ImageCache::NewCheckerboardImage(uint32_t width, uint32_t height) {
+ImagePtr ImageCache::NewCheckerboardImage(uint32_t width,
+                                          uint32_t height,
+                                          bool generate_mipmaps) {
   auto pixels = NewCheckerboardPixels(width, height);
   return NewImageFromPixels(vk::Format::eR8G8B8A8Unorm, width, height,
-                            pixels.get());
+                            pixels.get(), vk::ImageUsageFlags(),
+                            generate_mipmaps);
 }
 
 ImagePtr ImageCache::NewNoiseImage(uint32_t width,
@@ -166,21 +353,99 @@ ImagePtr ImageCache::NewNoiseImage(uint32_t width,
 }
 
 ImagePtr ImageCache::FindImage(const ImageInfo& info) {
-  auto& queue = unused_images_[info];
-  if (queue.empty()) {
+  auto it = unused_images_.find(info);
+  if (it == unused_images_.end()) {
     return ImagePtr();
-  } else {
-    ImagePtr result = CreateImage(std::move(queue.front()));
-    queue.pop();
-    return result;
+  }
+  // The images that became unused first are the most likely to be finished.
+  for (auto& image : it->second) {
+    if (image->core->sequence_number() <= last_finished_sequence_number_) {
+      return CreateImage(RemoveUnusedImage(image));
+    }
+  }
+  ++stats_.reuse_would_stall_count;
+  return ImagePtr();
+}
+
+std::unique_ptr<ImageCore> ImageCache::RemoveUnusedImage(
+    UnusedImageIterator it) {
+  std::unique_ptr<ImageCore> core = std::move(it->core);
+  lru_images_.erase(it);
+  if (core->mem()) {
+    unused_image_bytes_ -= core->mem()->size();
+  }
+
+  // Images with the same info are usually removed in FIFO order, so this is
+  // almost always the first one.
+  auto map_it = unused_images_.find(core->info());
+  FTL_DCHECK(map_it != unused_images_.end());
+  auto& same_info_images = map_it->second;
+  same_info_images.erase(std::find(same_info_images.begin(),
+                                   same_info_images.end(), it));
+  if (same_info_images.empty()) {
+    unused_images_.erase(map_it);
+  }
+  return core;
+}
+
+ImageCache::UnusedImageIterator ImageCache::EvictUnusedImage(
+    UnusedImageIterator it) {
+  auto next = std::next(it);
+  std::unique_ptr<ImageCore> core = RemoveUnusedImage(it);
+  ++stats_.eviction_count;
+  if (core->mem()) {
+    stats_.evicted_bytes += core->mem()->size();
+  }
+  return next;
+}
+
+void ImageCache::Cleanup(uint64_t last_finished_sequence_number) {
+  ++frame_number_;
+  auto it = lru_images_.begin();
+  while (it != lru_images_.end()) {
+    // Images become unused in order, so once an image is recent enough and the
+    // cache is within its limit, so are all subsequent images.
+    if (unused_image_bytes_ <= max_unused_bytes_ &&
+        frame_number_ - it->last_used_frame <= max_unused_frames_) {
+      break;
+    }
+    if (it->core->sequence_number() > last_finished_sequence_number) {
+      ++it;
+    } else {
+      it = EvictUnusedImage(it);
+    }
+  }
+}
+
+void ImageCache::Trim(uint64_t last_finished_sequence_number) {
+  auto it = lru_images_.begin();
+  while (it != lru_images_.end()) {
+    if (it->core->sequence_number() > last_finished_sequence_number) {
+      ++it;
+    } else {
+      it = EvictUnusedImage(it);
+    }
   }
 }
 
+void ImageCache::AddToStats(MemoryBudget::Stats* stats) const {
+  stats->cached_bytes += unused_image_bytes_;
+}
+
+void ImageCache::CommandBufferFinished(uint64_t sequence_number) {
+  FTL_DCHECK(sequence_number > last_finished_sequence_number_);
+  last_finished_sequence_number_ = sequence_number;
+}
+
 void ImageCache::ReceiveResourceCore(std::unique_ptr<ResourceCore> core) {
   std::unique_ptr<ImageCore> image_core(
       static_cast<ImageCore*>(core.release()));
-  auto& queue = unused_images_[image_core->info()];
-  queue.push(std::move(image_core));
+  if (image_core->mem()) {
+    unused_image_bytes_ += image_core->mem()->size();
+  }
+  const ImageInfo& info = image_core->info();
+  lru_images_.push_back({std::move(image_core), frame_number_});
+  unused_images_[info].push_back(std::prev(lru_images_.end()));
 }
 
 }  // namespace impl
@@ -4,14 +4,19 @@
 
 #pragma once
 
-#include <queue>
+#include <deque>
+#include <list>
 #include <unordered_map>
+#include <vector>
 #include <vulkan/vulkan.hpp>
 
 #include "escher/forward_declarations.h"
+#include "escher/impl/command_buffer_sequencer.h"
 #include "escher/impl/gpu_mem.h"
+#include "escher/impl/memory_budget.h"
 #include "escher/renderer/image.h"
 #include "escher/renderer/image_owner.h"
+#include "escher/renderer/image_upload_stream.h"
 #include "escher/util/hash.h"
 #include "ftl/macros.h"
 #include "ftl/memory/ref_counted.h"
@@ -19,25 +24,96 @@
 namespace escher {
 namespace impl {
 
+class CommandBuffer;
 class CommandBufferPool;
+class FrameGpuAllocator;
 class GpuUploader;
 
 // Allow client to obtain new or recycled Images.  All Images obtained from an
 // ImageCache must be destroyed before the ImageCache is destroyed.
-class ImageCache : public ImageOwner {
+//
+// Unused images are kept for reuse in least-recently-used order.  Cleanup()
+// evicts the least recently used ones when they exceed a byte limit, or when
+// they haven't been used for a number of frames (e.g. images that were sized
+// for a window before it was resized).
+//
+// An unused image may still be referenced by a pending CommandBuffer (i.e. the
+// one whose sequence number was last recorded in its ImageCore).  Reusing such
+// an image would make the new work wait for the pending work, so ImageCache
+// only reuses images whose CommandBuffers have finished, and otherwise creates
+// a new one.
+class ImageCache : public ImageOwner,
+                   public MemoryBudget::Client,
+                   public CommandBufferSequencerListener {
  public:
+  // Counters that help to tune the cache limits.
+  struct Stats {
+    // Calls to NewImage() that reused an unused image.
+    uint64_t hit_count = 0;
+    // Calls to NewImage() that created a new image.
+    uint64_t miss_count = 0;
+    // Misses where an unused image with the required properties existed, but
+    // was still referenced by a pending CommandBuffer.
+    uint64_t reuse_would_stall_count = 0;
+    // Unused images that were destroyed, either by Cleanup() or by Trim().
+    uint64_t eviction_count = 0;
+    vk::DeviceSize evicted_bytes = 0;
+  };
+
+  static constexpr vk::DeviceSize kDefaultMaxUnusedBytes = 64 * 1024 * 1024;
+  static constexpr uint64_t kDefaultMaxUnusedFrames = 120;
+
   // The allocator is used to allocate memory for newly-created images.  The
   // queue and CommandBufferPool are used to schedule image layout transitions.
+  // If |frame_allocator| and |life_preserver| are provided, they are used by
+  // NewTransientImage().
   ImageCache(const VulkanContext& context,
              CommandBufferPool* pool,
              GpuAllocator* allocator,
-             GpuUploader* uploader);
+             GpuUploader* uploader,
+             FrameGpuAllocator* frame_allocator = nullptr,
+             ResourceLifePreserver* life_preserver = nullptr);
   ~ImageCache();
 
   // Obtain an unused Image with the required properties.  A new Image might be
   // created, or an existing one reused.
   ImagePtr NewImage(const ImageInfo& info);
 
+  // Return a new Image that is only used during the current frame.  Its memory
+  // is obtained from the FrameGpuAllocator, and instead of being recycled by
+  // the cache, it is destroyed once it is no longer referenced by a pending
+  // CommandBuffer.  Falls back to NewImage() if there is no FrameGpuAllocator.
+  ImagePtr NewTransientImage(const ImageInfo& info);
+
+  // Return a new Image that is only used as an attachment within a render
+  // pass: its contents are never loaded before the pass, nor read after it
+  // (e.g. a multisampled depth buffer).  |info.usage| may only contain
+  // attachment usages.  The Image is created with eTransientAttachment usage
+  // and, if the device supports it, eLazilyAllocated memory, so that a tiled
+  // GPU can keep it entirely in tile memory.  Otherwise, this is equivalent to
+  // NewTransientImage().
+  ImagePtr NewTransientAttachmentImage(ImageInfo info);
+
+  // Return a new vk::Image that is not yet bound to memory, so that the caller
+  // can query its memory requirements (e.g. to alias its memory with other
+  // images).  It must be passed to NewAliasedImage().
+  vk::Image NewUnboundImage(const ImageInfo& info);
+
+  // Bind |image| (obtained from NewUnboundImage()) to the start of |memory|,
+  // and wrap it in an Image.  Several images may share the same memory, as
+  // long as they are never used at the same time.  Like NewTransientImage(),
+  // the Image is not recycled; it is destroyed once it is no longer referenced
+  // by a pending CommandBuffer, and the memory is released once all of the
+  // images that share it are destroyed.  Requires a ResourceLifePreserver.
+  ImagePtr NewAliasedImage(const ImageInfo& info,
+                           vk::Image image,
+                           GpuMemPtr memory);
+
+  // True if the device has a lazily-allocated memory type.
+  bool supports_lazily_allocated_memory() const {
+    return supports_lazily_allocated_memory_;
+  }
+
   // Return a new Image that is suitable for use as a depth attachment.  A new
   // Image might be created, or an existing one reused.
   ImagePtr NewDepthImage(vk::Format format,
@@ -54,21 +130,67 @@ class ImageCache : public ImageOwner {
   // Return new Image containing the provided pixels.  A new Image might be
   // created, or an existing one reused.  Uses transfer queue to efficiently
   // transfer image data to GPU.
+  //
+  // If |generate_mipmaps| is true and the format supports linear blits, the
+  // Image has a full mip chain, which is generated on the GPU by the next call
+  // to GenerateMipmaps().  Until then, only the first level is defined.
   ImagePtr NewImageFromPixels(
       vk::Format format,
       uint32_t width,
       uint32_t height,
       uint8_t* pixels,
-      vk::ImageUsageFlags additional_flags = vk::ImageUsageFlags());
+      vk::ImageUsageFlags additional_flags = vk::ImageUsageFlags(),
+      bool generate_mipmaps = false);
 
   // Return new Image containing the provided pixels.  A new Image might be
   // created, or an existing one reused.  Uses transfer queue to efficiently
   // transfer image data to GPU.  If bytes is null, don't bother transferring.
-  ImagePtr NewRgbaImage(uint32_t width, uint32_t height, uint8_t* bytes);
+  ImagePtr NewRgbaImage(uint32_t width,
+                        uint32_t height,
+                        uint8_t* bytes,
+                        bool generate_mipmaps = false);
+
+  // Return a new Image of a block-compressed format (BC, ETC2/EAC or ASTC),
+  // containing |mip_levels| levels of precompressed data.  |data| holds the
+  // levels one after another, largest first, each tightly packed; |size| must
+  // be exactly the size of all levels.  Return null if the device can't sample
+  // images of this format, in which case the caller should fall back to an
+  // uncompressed format.
+  ImagePtr NewCompressedImage(vk::Format format,
+                              uint32_t width,
+                              uint32_t height,
+                              uint32_t mip_levels,
+                              const uint8_t* data,
+                              size_t size);
+
+  // Return true if optimally-tiled images of |format| support all of
+  // |features| on this device.
+  bool SupportsFormatFeatures(vk::Format format,
+                              vk::FormatFeatureFlags features) const;
+
+  // Record the blits that generate the mip chains of all Images that were
+  // created by NewImageFromPixels() with |generate_mipmaps| set since the
+  // previous call.  |command_buffer| must be on a graphics queue, and must
+  // execute after the images' uploads (e.g. it waits for the semaphore that is
+  // returned by GpuUploader::Flush()).
+  void GenerateMipmaps(CommandBuffer* command_buffer);
+
+  // Return a stream that uploads pixels into a new Image incrementally, using
+  // at most |max_staging_bytes| of staging memory at a time (unless a single
+  // row is larger).  |callback| is invoked as rows become resident on the GPU.
+  ImageUploadStreamPtr NewImageUploadStream(
+      vk::Format format,
+      uint32_t width,
+      uint32_t height,
+      vk::DeviceSize max_staging_bytes,
+      ImageUploadStream::ProgressCallback callback = nullptr,
+      vk::ImageUsageFlags additional_flags = vk::ImageUsageFlags());
 
   // Returns RGBA image.  A new Image might be created, or an existing one
   // reused.
-  ImagePtr NewCheckerboardImage(uint32_t width, uint32_t height);
+  ImagePtr NewCheckerboardImage(uint32_t width,
+                                uint32_t height,
+                                bool generate_mipmaps = false);
 
   // Returns single-channel luminance image containing white noise.  A new Image
   // might be created, or an existing one reused.
@@ -77,32 +199,91 @@ class ImageCache : public ImageOwner {
       uint32_t height,
       vk::ImageUsageFlags additional_flags = vk::ImageUsageFlags());
 
+  // Called once per frame (see EscherImpl::Cleanup()).  Evict unused images,
+  // least recently used first, while they total more than max_unused_bytes(),
+  // and also evict any that have been unused for more than max_unused_frames()
+  // calls.  Images that are referenced by a pending CommandBuffer are skipped.
+  void Cleanup(uint64_t last_finished_sequence_number);
+
+  // Implement MemoryBudget::Client::Trim().  Destroys all unused images that
+  // are no longer referenced by a pending CommandBuffer.
+  void Trim(uint64_t last_finished_sequence_number) override;
+
+  // Implement MemoryBudget::Client::AddToStats().  Unused images are counted as
+  // cached.
+  void AddToStats(MemoryBudget::Stats* stats) const override;
+
+  // Implement CommandBufferSequencerListener::CommandBufferFinished().  Unused
+  // images that were last used by the finished CommandBuffers become reusable.
+  void CommandBufferFinished(uint64_t sequence_number) override;
+
+  void set_max_unused_bytes(vk::DeviceSize bytes) { max_unused_bytes_ = bytes; }
+  vk::DeviceSize max_unused_bytes() const { return max_unused_bytes_; }
+  void set_max_unused_frames(uint64_t frames) { max_unused_frames_ = frames; }
+  uint64_t max_unused_frames() const { return max_unused_frames_; }
+
+  vk::DeviceSize unused_image_bytes() const { return unused_image_bytes_; }
+  const Stats& stats() const { return stats_; }
+
  private:
+  struct UnusedImage {
+    std::unique_ptr<ImageCore> core;
+    // Value of |frame_number_| when the image became unused.
+    uint64_t last_used_frame;
+  };
+  typedef std::list<UnusedImage>::iterator UnusedImageIterator;
+
   // Implement ResourceCoreManager::ReceiveResourceCore().  Adds the image to
   // unused_images_.
   void ReceiveResourceCore(std::unique_ptr<ResourceCore> core) override;
 
-  // Try to find an unused image that meets the required specs.  If successful,
-  // remove and return it.  Otherwise, return nullptr.
+  // Try to find an unused image that meets the required specs, and that is not
+  // referenced by a pending CommandBuffer.  If successful, remove and return
+  // it.  Otherwise, return nullptr.
   ImagePtr FindImage(const ImageInfo& info);
 
+  // Remove the image from |lru_images_| and |unused_images_|, and return it.
+  std::unique_ptr<ImageCore> RemoveUnusedImage(UnusedImageIterator it);
+
+  // Remove the image and destroy it.  Return the iterator that follows it.
+  UnusedImageIterator EvictUnusedImage(UnusedImageIterator it);
+
+  // Create a vk::Image with memory from |allocator|, and wrap it in a core that
+  // will be returned to |manager|.
+  std::unique_ptr<ImageCore> NewImageCore(const ImageInfo& info,
+                                          GpuAllocator* allocator,
+                                          ResourceCoreManager* manager);
+
   vk::Queue queue_;
+  vk::PhysicalDevice physical_device_;
+  bool supports_lazily_allocated_memory_ = false;
   GpuAllocator* allocator_;
   GpuUploader* uploader_;
+  FrameGpuAllocator* frame_allocator_;
+  ResourceLifePreserver* life_preserver_;
 
-  // Keep track of all images that are available for reuse.
-  // TODO: need some method of trimming the cache, to free images that haven't
-  // been used.  Note: using a FIFO queue below (instead of a stack) will make
-  // this more difficult, but there is a reason to do so: some of these images
-  // may still be referenced by a pending command buffer, and reusing them in
-  // FIFO order makes it less likely that a pipeline barrier will result in a
-  // GPU stall.  The right approach is probably to trim the cache in the most
-  // straightforward way, and profile to determine whether GPU stalls are a real
-  // concern.
+  // All images that are available for reuse, least recently used first.
+  std::list<UnusedImage> lru_images_;
+  // The images in |lru_images_|, grouped by ImageInfo, in the order that they
+  // became unused.  Images whose command buffers have not finished are never
+  // reused or destroyed.
   std::unordered_map<ImageInfo,
-                     std::queue<std::unique_ptr<ImageCore>>,
+                     std::deque<UnusedImageIterator>,
                      Hash<ImageInfo>>
       unused_images_;
+  // Total size of the memory bound to the images in |lru_images_|.
+  vk::DeviceSize unused_image_bytes_ = 0;
+
+  vk::DeviceSize max_unused_bytes_ = kDefaultMaxUnusedBytes;
+  uint64_t max_unused_frames_ = kDefaultMaxUnusedFrames;
+  // Incremented by each call to Cleanup().
+  uint64_t frame_number_ = 0;
+  // All CommandBuffers with this sequence number or lower have finished.
+  uint64_t last_finished_sequence_number_ = 0;
+  Stats stats_;
+
+  // Images whose mip chains will be generated by the next GenerateMipmaps().
+  std::vector<ImagePtr> images_needing_mipmaps_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(ImageCache);
 };
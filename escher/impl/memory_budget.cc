@@ -0,0 +1,179 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/memory_budget.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "escher/impl/command_buffer_sequencer.h"
+#include "escher/impl/vulkan_utils.h"
+#include "ftl/logging.h"
+
+// VK_EXT_memory_budget is only used if the Vulkan headers are recent enough to
+// define it.
+#if defined(VK_EXT_memory_budget) && \
+    defined(VK_KHR_get_physical_device_properties2)
+#define ESCHER_HAS_MEMORY_BUDGET_EXT 1
+#else
+#define ESCHER_HAS_MEMORY_BUDGET_EXT 0
+#endif
+
+namespace escher {
+namespace impl {
+
+MemoryBudget::MemoryBudget(const VulkanContext& context,
+                           CommandBufferSequencer* sequencer)
+    : physical_device_(context.physical_device), sequencer_(sequencer) {
+  FTL_DCHECK(sequencer_);
+  auto props = physical_device_.getMemoryProperties();
+  for (uint32_t i = 0; i < props.memoryTypeCount; ++i) {
+    memory_type_heaps_.push_back(props.memoryTypes[i].heapIndex);
+  }
+  for (uint32_t i = 0; i < props.memoryHeapCount; ++i) {
+    heap_budgets_.push_back(props.memoryHeaps[i].size);
+  }
+  heap_limits_.resize(props.memoryHeapCount,
+                      std::numeric_limits<vk::DeviceSize>::max());
+
+#if ESCHER_HAS_MEMORY_BUDGET_EXT
+  // The extension is used only if both the device supports it, and the
+  // instance exposes vkGetPhysicalDeviceMemoryProperties2KHR().
+  auto extensions = ESCHER_CHECKED_VK_RESULT(
+      physical_device_.enumerateDeviceExtensionProperties());
+  for (auto& extension : extensions) {
+    if (!strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+      get_memory_properties2_ = context.instance.getProcAddr(
+          "vkGetPhysicalDeviceMemoryProperties2KHR");
+      break;
+    }
+  }
+#endif
+  UpdateDeviceBudget();
+}
+
+void MemoryBudget::AddAllocator(GpuAllocator* allocator) {
+  FTL_DCHECK(std::find(allocators_.begin(), allocators_.end(), allocator) ==
+             allocators_.end());
+  allocators_.push_back(allocator);
+}
+
+void MemoryBudget::AddClient(Client* client) {
+  FTL_DCHECK(std::find(clients_.begin(), clients_.end(), client) ==
+             clients_.end());
+  clients_.push_back(client);
+}
+
+void MemoryBudget::RemoveClient(Client* client) {
+  auto it = std::find(clients_.begin(), clients_.end(), client);
+  FTL_DCHECK(it != clients_.end());
+  clients_.erase(it);
+}
+
+void MemoryBudget::SetHeapLimit(uint32_t heap_index, vk::DeviceSize limit) {
+  FTL_DCHECK(heap_index < heap_count());
+  heap_limits_[heap_index] = limit;
+}
+
+void MemoryBudget::SetLimit(vk::DeviceSize limit) {
+  std::fill(heap_limits_.begin(), heap_limits_.end(), limit);
+}
+
+vk::DeviceSize MemoryBudget::GetHeapBudget(uint32_t heap_index) const {
+  FTL_DCHECK(heap_index < heap_count());
+  return std::min(heap_limits_[heap_index], heap_budgets_[heap_index]);
+}
+
+vk::DeviceSize MemoryBudget::GetHeapUsage(uint32_t heap_index) const {
+  FTL_DCHECK(heap_index < heap_count());
+  if (!device_heap_usages_.empty()) {
+    return device_heap_usages_[heap_index];
+  }
+  vk::DeviceSize usage = 0;
+  for (auto allocator : allocators_) {
+    auto& allocated = allocator->stats().allocated_bytes_by_memory_type;
+    for (size_t i = 0; i < memory_type_heaps_.size(); ++i) {
+      if (memory_type_heaps_[i] == heap_index) {
+        usage += allocated[i];
+      }
+    }
+  }
+  return usage;
+}
+
+bool MemoryBudget::IsOverBudget() const {
+  for (uint32_t i = 0; i < heap_count(); ++i) {
+    if (GetHeapUsage(i) > GetHeapBudget(i)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool MemoryBudget::TrimIfOverBudget() {
+  UpdateDeviceBudget();
+  bool trimmed = false;
+  uint64_t last_finished = sequencer_->last_finished_sequence_number();
+  for (auto client : clients_) {
+    if (!IsOverBudget()) {
+      break;
+    }
+    client->Trim(last_finished);
+    UpdateDeviceBudget();
+    trimmed = true;
+  }
+  return trimmed;
+}
+
+void MemoryBudget::Trim() {
+  uint64_t last_finished = sequencer_->last_finished_sequence_number();
+  for (auto client : clients_) {
+    client->Trim(last_finished);
+  }
+  UpdateDeviceBudget();
+}
+
+MemoryBudget::Stats MemoryBudget::GetStats() const {
+  Stats stats;
+  for (auto allocator : allocators_) {
+    stats.gpu_mem += allocator->stats();
+  }
+  for (auto client : clients_) {
+    client->AddToStats(&stats);
+  }
+  for (uint32_t i = 0; i < heap_count(); ++i) {
+    stats.heap_budgets.push_back(GetHeapBudget(i));
+    stats.heap_usages.push_back(GetHeapUsage(i));
+  }
+  return stats;
+}
+
+void MemoryBudget::UpdateDeviceBudget() {
+#if ESCHER_HAS_MEMORY_BUDGET_EXT
+  if (!get_memory_properties2_) {
+    return;
+  }
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_props = {};
+  budget_props.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+  VkPhysicalDeviceMemoryProperties2KHR props = {};
+  props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+  props.pNext = &budget_props;
+  auto get_memory_properties2 =
+      reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+          get_memory_properties2_);
+  get_memory_properties2(static_cast<VkPhysicalDevice>(physical_device_),
+                         &props);
+
+  device_heap_usages_.resize(heap_count());
+  for (uint32_t i = 0; i < heap_count(); ++i) {
+    heap_budgets_[i] = budget_props.heapBudget[i];
+    device_heap_usages_[i] = budget_props.heapUsage[i];
+  }
+#endif
+}
+
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,129 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/impl/gpu_allocator.h"
+#include "escher/vk/vulkan_context.h"
+#include "ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+class CommandBufferSequencer;
+
+// MemoryBudget tracks the GPU memory used by Escher, per memory heap, and
+// compares it against a budget.  When the budget is exceeded, registered
+// Clients (i.e. subsystems that cache GPU resources for reuse) are asked to
+// free their cached resources.
+//
+// Each heap's budget is the smaller of the limit specified by the application
+// (unlimited by default), and the budget reported by the device.  If the device
+// supports VK_EXT_memory_budget, the latter takes into account memory used by
+// other processes; otherwise, it is simply the size of the heap.
+//
+// Not thread-safe.
+class MemoryBudget {
+ public:
+  // Memory usage aggregated over all allocators and clients.
+  struct Stats {
+    GpuMemStats gpu_mem;
+    // Bytes held by clients' caches of unused resources.
+    vk::DeviceSize cached_bytes = 0;
+    // Descriptor sets allocated by clients' descriptor pools, whether or not
+    // they are in use.  Descriptor pool memory is owned by the Vulkan driver,
+    // so this is reported as a count rather than in bytes.
+    uint32_t descriptor_set_count = 0;
+    // GetHeapBudget() and GetHeapUsage() of each memory heap.
+    std::vector<vk::DeviceSize> heap_budgets;
+    std::vector<vk::DeviceSize> heap_usages;
+  };
+
+  // Implemented by subsystems that cache GPU resources for reuse.  Clients
+  // must remove themselves before they are destroyed, unless they outlive the
+  // MemoryBudget.
+  class Client {
+   public:
+    virtual ~Client() {}
+
+    // Free cached resources that are not currently in use.  Resources that
+    // were last used by a CommandBuffer whose sequence number is greater than
+    // |last_finished_sequence_number| may still be in use by the GPU, and must
+    // not be destroyed.
+    virtual void Trim(uint64_t last_finished_sequence_number) = 0;
+
+    // Add the resources held by this client to |cached_bytes| and
+    // |descriptor_set_count|.
+    virtual void AddToStats(Stats* stats) const = 0;
+  };
+
+  MemoryBudget(const VulkanContext& context, CommandBufferSequencer* sequencer);
+
+  // Allocators must outlive the MemoryBudget.
+  void AddAllocator(GpuAllocator* allocator);
+
+  // Clients are trimmed in the order that they were added, so those whose
+  // cached resources are cheapest to recreate should be added first.
+  void AddClient(Client* client);
+  void RemoveClient(Client* client);
+
+  // Limit the number of bytes that Escher may allocate from the specified heap.
+  void SetHeapLimit(uint32_t heap_index, vk::DeviceSize limit);
+
+  // Convenience: apply the same limit to every heap.
+  void SetLimit(vk::DeviceSize limit);
+
+  uint32_t heap_count() const {
+    return static_cast<uint32_t>(heap_budgets_.size());
+  }
+
+  vk::DeviceSize GetHeapBudget(uint32_t heap_index) const;
+  vk::DeviceSize GetHeapUsage(uint32_t heap_index) const;
+
+  bool IsOverBudget() const;
+
+  // Re-query the device's budget (it changes as other processes allocate and
+  // free memory).  If over budget, trim clients one at a time until usage is
+  // back within budget, or there is nothing left to trim.  Return true if any
+  // clients were trimmed.
+  bool TrimIfOverBudget();
+
+  // Unconditionally trim all clients.
+  void Trim();
+
+  // Return the current usage of every allocator, client and heap.
+  Stats GetStats() const;
+
+ private:
+  // Update |heap_budgets_|, and also |device_heap_usages_| if the device
+  // supports VK_EXT_memory_budget.
+  void UpdateDeviceBudget();
+
+  const vk::PhysicalDevice physical_device_;
+  CommandBufferSequencer* const sequencer_;
+  std::vector<GpuAllocator*> allocators_;
+  std::vector<Client*> clients_;
+
+  // Index of the heap that each memory type is allocated from.
+  std::vector<uint32_t> memory_type_heaps_;
+
+  std::vector<vk::DeviceSize> heap_limits_;
+  std::vector<vk::DeviceSize> heap_budgets_;
+
+  // Usage reported by VK_EXT_memory_budget, which includes memory that was
+  // not allocated via |allocators_|.  Empty if the extension is unavailable.
+  std::vector<vk::DeviceSize> device_heap_usages_;
+
+  // vkGetPhysicalDeviceMemoryProperties2KHR(), or null if VK_EXT_memory_budget
+  // is unavailable.
+  PFN_vkVoidFunction get_memory_properties2_ = nullptr;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(MemoryBudget);
+};
+
+}  // namespace impl
+}  // namespace escher
@@ -16,6 +16,78 @@
 namespace escher {
 namespace impl {
 
+namespace {
+
+const vk::MemoryPropertyFlags kDirectMeshMemoryProperties =
+    vk::MemoryPropertyFlagBits::eDeviceLocal |
+    vk::MemoryPropertyFlagBits::eHostVisible |
+    vk::MemoryPropertyFlagBits::eHostCoherent;
+
+// Return true if the device is an integrated GPU or a CPU-based Vulkan
+// implementation, with host-visible memory in its main device-local heap.  This
+// excludes discrete GPUs, even those that expose all of their video memory to
+// the host (e.g. with resizable BAR), since writing meshes into it would go
+// over PCIe.
+bool HasUnifiedMemory(vk::PhysicalDevice physical_device) {
+  if (!physical_device) {
+    return false;
+  }
+  auto device_type = physical_device.getProperties().deviceType;
+  if (device_type != vk::PhysicalDeviceType::eIntegratedGpu &&
+      device_type != vk::PhysicalDeviceType::eCpu) {
+    return false;
+  }
+  auto props = physical_device.getMemoryProperties();
+  uint32_t largest_heap = VK_MAX_MEMORY_HEAPS;
+  for (uint32_t i = 0; i < props.memoryHeapCount; ++i) {
+    auto& heap = props.memoryHeaps[i];
+    if ((heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) &&
+        (largest_heap == VK_MAX_MEMORY_HEAPS ||
+         heap.size > props.memoryHeaps[largest_heap].size)) {
+      largest_heap = i;
+    }
+  }
+  for (uint32_t i = 0; i < props.memoryTypeCount; ++i) {
+    auto& type = props.memoryTypes[i];
+    if (type.heapIndex == largest_heap &&
+        (type.propertyFlags & kDirectMeshMemoryProperties) ==
+            kDirectMeshMemoryProperties) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t GetAttributeOffset(const MeshSpecImpl& spec_impl, MeshAttribute flag) {
+  // Find the attribute location corresponding to the flag.
+  uint32_t location = static_cast<uint32_t>(-1);
+  switch (flag) {
+    case MeshAttribute::kPosition:
+      location = MeshImpl::kPositionAttributeLocation;
+      break;
+    case MeshAttribute::kPositionOffset:
+      location = MeshImpl::kPositionOffsetAttributeLocation;
+      break;
+    case MeshAttribute::kUV:
+      location = MeshImpl::kUVAttributeLocation;
+      break;
+    case MeshAttribute::kPerimeterPos:
+      location = MeshImpl::kPerimeterPosAttributeLocation;
+      break;
+  }
+
+  // Return offset of the attribute whose location matches.
+  for (auto& attr : spec_impl.attributes) {
+    if (attr.location == location) {
+      return attr.offset;
+    }
+  }
+  FTL_CHECK(0);
+  return 0;
+}
+
+}  // namespace
+
 MeshManager::MeshManager(CommandBufferPool* command_buffer_pool,
                          GpuAllocator* allocator,
                          GpuUploader* uploader)
@@ -24,6 +96,7 @@ MeshManager::MeshManager(CommandBufferPool* command_buffer_pool,
       uploader_(uploader),
       device_(command_buffer_pool->device()),
       queue_(command_buffer_pool->queue()),
+      use_direct_mesh_writes_(HasUnifiedMemory(allocator->physical_device())),
       builder_count_(0),
       mesh_count_(0) {}
 
@@ -36,6 +109,21 @@ MeshBuilderPtr MeshManager::NewMeshBuilder(const MeshSpec& spec,
                                            size_t max_vertex_count,
                                            size_t max_index_count) {
   auto& spec_impl = GetMeshSpecImpl(spec);
+  if (use_direct_mesh_writes_) {
+    // The buffers are sized for the maximum counts, since the actual counts
+    // are not known until Build().
+    auto vertex_buffer = ftl::MakeRefCounted<Buffer>(
+        device_, allocator_, max_vertex_count * spec_impl.binding.stride,
+        vk::BufferUsageFlagBits::eVertexBuffer, kDirectMeshMemoryProperties,
+        GpuMemCategory::kMesh);
+    auto index_buffer = ftl::MakeRefCounted<Buffer>(
+        device_, allocator_, max_index_count * sizeof(uint32_t),
+        vk::BufferUsageFlagBits::eIndexBuffer, kDirectMeshMemoryProperties,
+        GpuMemCategory::kMesh);
+    return AdoptRef(new MeshManager::DirectMeshBuilder(
+        this, spec, max_vertex_count, max_index_count,
+        std::move(vertex_buffer), std::move(index_buffer), spec_impl));
+  }
   return AdoptRef(new MeshManager::MeshBuilder(
       this, spec, max_vertex_count, max_index_count,
       uploader_->GetWriter(max_vertex_count * spec_impl.binding.stride),
@@ -78,15 +166,20 @@ MeshPtr MeshManager::MeshBuilder::Build() {
       device, allocator, vertex_count_ * vertex_stride_,
       vk::BufferUsageFlagBits::eVertexBuffer |
           vk::BufferUsageFlagBits::eTransferDst,
-      vk::MemoryPropertyFlagBits::eDeviceLocal);
+      vk::MemoryPropertyFlagBits::eDeviceLocal, GpuMemCategory::kMesh);
   auto index_buffer = ftl::MakeRefCounted<Buffer>(
       device, allocator, index_count_ * sizeof(uint32_t),
       vk::BufferUsageFlagBits::eIndexBuffer |
           vk::BufferUsageFlagBits::eTransferDst,
-      vk::MemoryPropertyFlagBits::eDeviceLocal);
+      vk::MemoryPropertyFlagBits::eDeviceLocal, GpuMemCategory::kMesh);
 
+  // If writes are batched, the vertex and index copies are submitted along
+  // with all other uploads, and rendering waits on the semaphore returned by
+  // GpuUploader::Flush() instead of one per mesh.
   vertex_writer_.WriteBuffer(vertex_buffer, {0, 0, vertex_buffer->size()},
-                             Semaphore::New(device));
+                             manager_->uploader_->batches_writes()
+                                 ? SemaphorePtr()
+                                 : Semaphore::New(device));
   vertex_writer_.Submit();
 
   index_writer_.WriteBuffer(index_buffer, {0, 0, index_buffer->size()},
@@ -102,31 +195,50 @@ MeshPtr MeshManager::MeshBuilder::Build() {
 }
 
 size_t MeshManager::MeshBuilder::GetAttributeOffset(MeshAttribute flag) {
-  // Find the attribute location corresponding to the flag.
-  uint32_t location = static_cast<uint32_t>(-1);
-  switch (flag) {
-    case MeshAttribute::kPosition:
-      location = MeshImpl::kPositionAttributeLocation;
-      break;
-    case MeshAttribute::kPositionOffset:
-      location = MeshImpl::kPositionOffsetAttributeLocation;
-      break;
-    case MeshAttribute::kUV:
-      location = MeshImpl::kUVAttributeLocation;
-      break;
-    case MeshAttribute::kPerimeterPos:
-      location = MeshImpl::kPerimeterPosAttributeLocation;
-      break;
-  }
+  return impl::GetAttributeOffset(spec_impl_, flag);
+}
 
-  // Return offset of the attribute whose location matches.
-  for (auto& attr : spec_impl_.attributes) {
-    if (attr.location == location) {
-      return attr.offset;
-    }
+MeshManager::DirectMeshBuilder::DirectMeshBuilder(
+    MeshManager* manager,
+    const MeshSpec& spec,
+    size_t max_vertex_count,
+    size_t max_index_count,
+    BufferPtr vertex_buffer,
+    BufferPtr index_buffer,
+    const MeshSpecImpl& spec_impl)
+    : escher::MeshBuilder(max_vertex_count,
+                          max_index_count,
+                          spec_impl.binding.stride,
+                          vertex_buffer->ptr(),
+                          reinterpret_cast<uint32_t*>(index_buffer->ptr())),
+      manager_(manager),
+      spec_(spec),
+      is_built_(false),
+      vertex_buffer_(std::move(vertex_buffer)),
+      index_buffer_(std::move(index_buffer)),
+      spec_impl_(spec_impl) {
+  FTL_DCHECK(vertex_staging_buffer_ && index_staging_buffer_);
+}
+
+MeshManager::DirectMeshBuilder::~DirectMeshBuilder() {}
+
+MeshPtr MeshManager::DirectMeshBuilder::Build() {
+  FTL_DCHECK(!is_built_);
+  if (is_built_) {
+    return MeshPtr();
   }
-  FTL_CHECK(0);
-  return 0;
+  is_built_ = true;
+
+  // The memory is host-coherent, so the vertices and indices are visible to
+  // the GPU as soon as the Mesh is used by a submitted CommandBuffer.
+  return ftl::MakeRefCounted<MeshImpl>(
+      spec_, vertex_count_, index_count_, manager_, std::move(vertex_buffer_),
+      std::move(index_buffer_), spec_impl_);
+}
+
+size_t MeshManager::DirectMeshBuilder::GetAttributeOffset(
+    MeshAttribute flag) {
+  return impl::GetAttributeOffset(spec_impl_, flag);
 }
 
 const MeshSpecImpl& MeshManager::GetMeshSpecImpl(MeshSpec spec) {
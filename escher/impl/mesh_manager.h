@@ -26,6 +26,12 @@ class GpuUploader;
 // Responsible for generating Meshes, tracking their memory use, managing
 // synchronization, etc.
 //
+// On unified-memory devices (i.e. integrated GPUs and CPU-based Vulkan
+// implementations with memory that is both device-local and host-visible),
+// MeshBuilders write directly into the Mesh's vertex and index buffers.
+// Otherwise, they write into staging buffers that are copied to device-local
+// buffers by Build().
+//
 // Not thread-safe.
 class MeshManager : public MeshBuilderFactory {
  public:
@@ -41,6 +47,9 @@ class MeshManager : public MeshBuilderFactory {
 
   const MeshSpecImpl& GetMeshSpecImpl(MeshSpec spec);
 
+  // True if MeshBuilders write directly into the Mesh's buffers.
+  bool uses_direct_mesh_writes() const { return use_direct_mesh_writes_; }
+
  private:
   void UpdateBusyResources();
 
@@ -69,6 +78,33 @@ class MeshManager : public MeshBuilderFactory {
     const MeshSpecImpl& spec_impl_;
   };
 
+  // Writes directly into host-visible device-local vertex and index buffers,
+  // which become the Mesh's buffers; no staging copy is needed.
+  class DirectMeshBuilder : public escher::MeshBuilder {
+   public:
+    DirectMeshBuilder(MeshManager* manager,
+                      const MeshSpec& spec,
+                      size_t max_vertex_count,
+                      size_t max_index_count,
+                      BufferPtr vertex_buffer,
+                      BufferPtr index_buffer,
+                      const MeshSpecImpl& spec_impl);
+    ~DirectMeshBuilder() override;
+
+    MeshPtr Build() override;
+
+    // Return the byte-offset of the attribute within each vertex.
+    size_t GetAttributeOffset(MeshAttribute flag) override;
+
+   private:
+    MeshManager* manager_;
+    MeshSpec spec_;
+    bool is_built_;
+    BufferPtr vertex_buffer_;
+    BufferPtr index_buffer_;
+    const MeshSpecImpl& spec_impl_;
+  };
+
   friend class MeshImpl;
   void IncrementMeshCount() { ++mesh_count_; }
   void DecrementMeshCount() { --mesh_count_; }
@@ -78,6 +114,7 @@ class MeshManager : public MeshBuilderFactory {
   GpuUploader* uploader_;
   vk::Device device_;
   vk::Queue queue_;
+  const bool use_direct_mesh_writes_;
 
   std::unordered_map<MeshSpec, std::unique_ptr<MeshSpecImpl>, MeshSpec::Hash>
       spec_cache_;
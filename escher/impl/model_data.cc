@@ -14,20 +14,50 @@ namespace impl {
 // DescriptorSetPools allocate new sets as necessary, so these are no big deal.
 constexpr uint32_t kInitialPerModelDescriptorSetCount = 50;
 constexpr uint32_t kInitialPerObjectDescriptorSetCount = 200;
+constexpr uint32_t kInitialPerInstanceDescriptorSetCount = 50;
 
 ModelData::ModelData(vk::Device device, GpuAllocator* allocator)
     : device_(device),
-      uniform_buffer_pool_(device, allocator),
+      uniform_buffer_pool_(device,
+                           allocator,
+                           vk::MemoryPropertyFlags(),
+                           vk::BufferUsageFlagBits::eUniformBuffer,
+                           &allocator_mutex_),
+      instance_buffer_pool_(device,
+                            allocator,
+                            vk::MemoryPropertyFlags(),
+                            vk::BufferUsageFlagBits::eStorageBuffer,
+                            &allocator_mutex_),
       per_model_descriptor_set_pool_(device,
                                      GetPerModelDescriptorSetLayoutCreateInfo(),
                                      kInitialPerModelDescriptorSetCount),
       per_object_descriptor_set_pool_(
           device,
           GetPerObjectDescriptorSetLayoutCreateInfo(),
-          kInitialPerObjectDescriptorSetCount) {}
+          kInitialPerObjectDescriptorSetCount),
+      per_instance_descriptor_set_pool_(
+          device,
+          GetPerInstanceDescriptorSetLayoutCreateInfo(),
+          kInitialPerInstanceDescriptorSetCount) {}
 
 ModelData::~ModelData() {}
 
+void ModelData::Trim(uint64_t last_finished_sequence_number) {
+  uniform_buffer_pool_.Trim();
+  instance_buffer_pool_.Trim();
+  per_model_descriptor_set_pool_.Trim();
+  per_object_descriptor_set_pool_.Trim();
+  per_instance_descriptor_set_pool_.Trim();
+}
+
+void ModelData::AddToStats(MemoryBudget::Stats* stats) const {
+  stats->cached_bytes += uniform_buffer_pool_.GetFreeBufferBytes() +
+                         instance_buffer_pool_.GetFreeBufferBytes();
+  stats->descriptor_set_count += per_model_descriptor_set_pool_.capacity() +
+                                 per_object_descriptor_set_pool_.capacity() +
+                                 per_instance_descriptor_set_pool_.capacity();
+}
+
 const vk::DescriptorSetLayoutCreateInfo&
 ModelData::GetPerModelDescriptorSetLayoutCreateInfo() {
   constexpr uint32_t kNumBindings = 2;
@@ -63,7 +93,8 @@ ModelData::GetPerObjectDescriptorSetLayoutCreateInfo() {
     auto& uniform_binding = bindings[0];
     auto& texture_binding = bindings[1];
     uniform_binding.binding = 0;
-    uniform_binding.descriptorType = vk::DescriptorType::eUniformBuffer;
+    // Dynamic, so that a descriptor set can be shared by multiple objects.
+    uniform_binding.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
     uniform_binding.descriptorCount = 1;
     uniform_binding.stageFlags =
         vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
@@ -78,5 +109,29 @@ ModelData::GetPerObjectDescriptorSetLayoutCreateInfo() {
   return *ptr;
 }
 
+const vk::DescriptorSetLayoutCreateInfo&
+ModelData::GetPerInstanceDescriptorSetLayoutCreateInfo() {
+  constexpr uint32_t kNumBindings = 2;
+  static vk::DescriptorSetLayoutBinding bindings[kNumBindings];
+  static vk::DescriptorSetLayoutCreateInfo info;
+  static vk::DescriptorSetLayoutCreateInfo* ptr = nullptr;
+  if (!ptr) {
+    auto& storage_binding = bindings[0];
+    auto& texture_binding = bindings[1];
+    storage_binding.binding = PerInstance::kDescriptorSetStorageBinding;
+    storage_binding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    storage_binding.descriptorCount = 1;
+    storage_binding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+    texture_binding.binding = PerInstance::kDescriptorSetSamplerBinding;
+    texture_binding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    texture_binding.descriptorCount = 1;
+    texture_binding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+    info.bindingCount = kNumBindings;
+    info.pBindings = bindings;
+    ptr = &info;
+  }
+  return *ptr;
+}
+
 }  // namespace impl
 }  // namespace escher
@@ -6,10 +6,12 @@
 
 #include <cstdint>
 #include <map>
+#include <mutex>
 #include <vulkan/vulkan.hpp>
 
 #include "escher/geometry/types.h"
 #include "escher/impl/descriptor_set_pool.h"
+#include "escher/impl/memory_budget.h"
 #include "escher/impl/uniform_buffer_pool.h"
 #include "escher/shape/modifier_wobble.h"
 #include "ftl/macros.h"
@@ -21,7 +23,7 @@ class CommandBuffer;
 class ModelUniformWriter;
 class GpuAllocator;
 
-class ModelData {
+class ModelData : public MemoryBudget::Client {
  public:
   // Describes per-model data accessible by shaders.
   struct PerModel {
@@ -48,6 +50,8 @@ class ModelData {
     // layout(set = 1, ...)
     static constexpr uint32_t kDescriptorSetIndex = 1;
     // layout(set = 1, binding = 0) uniform PerObject { ... }
+    // This is a dynamic uniform buffer: the offset of the object's data is
+    // specified when the descriptor set is bound.
     static constexpr uint32_t kDescriptorSetUniformBinding = 0;
     // layout(set = 1, binding = 1) sampler2D PerObjectSampler;
     static constexpr uint32_t kDescriptorSetSamplerBinding = 1;
@@ -59,13 +63,56 @@ class ModelData {
     ModifierWobble wobble;
   };
 
+  // Compact per-object data of untextured objects without shape modifiers,
+  // which is passed as push constants instead of in a uniform buffer.  The
+  // vertex shader reconstructs the transform from it.
+  struct PerObjectPushConstants {
+    vec2 scale;
+    vec2 translation;
+    // The object is rotated around this point, in object coordinates.
+    vec2 rotation_point;
+    // Cosine and sine of the rotation angle.
+    vec2 rotation;
+    float z;
+    // RGBA, 8 bits per channel; see glm::packUnorm4x8().
+    uint32_t color;
+  };
+
+  // Describes the per-object data of objects that are drawn together, as
+  // instances of the same mesh.  The data of all instances is stored in an
+  // array in a storage buffer, which is indexed by gl_InstanceIndex.  Such
+  // objects share a single texture, and may not have shape modifiers.
+  struct PerInstance {
+    // One storage-buffer descriptor, and one texture descriptor.
+    static constexpr uint32_t kDescriptorCount = 2;
+    // layout(set = 1, ...)
+    static constexpr uint32_t kDescriptorSetIndex = 1;
+    // layout(set = 1, binding = 0) readonly buffer PerInstances { ... }
+    static constexpr uint32_t kDescriptorSetStorageBinding = 0;
+    // layout(set = 1, binding = 1) sampler2D PerObjectSampler;
+    static constexpr uint32_t kDescriptorSetSamplerBinding = 1;
+
+    mat4 transform;
+    vec4 color;
+  };
+
   ModelData(vk::Device device, GpuAllocator* allocator);
-  ~ModelData();
+  ~ModelData() override;
 
   vk::Device device() { return device_; }
 
+  // Implement MemoryBudget::Client::Trim().  Uniform buffers and descriptor
+  // sets are only freed if none of them are in use.
+  void Trim(uint64_t last_finished_sequence_number) override;
+
+  // Implement MemoryBudget::Client::AddToStats().
+  void AddToStats(MemoryBudget::Stats* stats) const override;
+
   UniformBufferPool* uniform_buffer_pool() { return &uniform_buffer_pool_; }
 
+  // Vends storage buffers that hold arrays of PerInstance data.
+  UniformBufferPool* instance_buffer_pool() { return &instance_buffer_pool_; }
+
   DescriptorSetPool* per_model_descriptor_set_pool() {
     return &per_model_descriptor_set_pool_;
   }
@@ -74,6 +121,10 @@ class ModelData {
     return &per_object_descriptor_set_pool_;
   }
 
+  DescriptorSetPool* per_instance_descriptor_set_pool() {
+    return &per_instance_descriptor_set_pool_;
+  }
+
   vk::DescriptorSetLayout per_model_layout() const {
     return per_model_descriptor_set_pool_.layout();
   }
@@ -82,6 +133,10 @@ class ModelData {
     return per_object_descriptor_set_pool_.layout();
   }
 
+  vk::DescriptorSetLayout per_instance_layout() const {
+    return per_instance_descriptor_set_pool_.layout();
+  }
+
  private:
   // Provide access to statically-allocated layout info for per-model and
   // per-object descriptor-sets.
@@ -89,11 +144,19 @@ class ModelData {
   GetPerModelDescriptorSetLayoutCreateInfo();
   static const vk::DescriptorSetLayoutCreateInfo&
   GetPerObjectDescriptorSetLayoutCreateInfo();
+  static const vk::DescriptorSetLayoutCreateInfo&
+  GetPerInstanceDescriptorSetLayoutCreateInfo();
 
   vk::Device device_;
+  // Both buffer pools may grow while display lists are built by multiple
+  // threads, so their use of the shared GpuAllocator must be serialized.
+  // Declared before the pools, which use it until they are destroyed.
+  std::mutex allocator_mutex_;
   UniformBufferPool uniform_buffer_pool_;
+  UniformBufferPool instance_buffer_pool_;
   DescriptorSetPool per_model_descriptor_set_pool_;
   DescriptorSetPool per_object_descriptor_set_pool_;
+  DescriptorSetPool per_instance_descriptor_set_pool_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(ModelData);
 };
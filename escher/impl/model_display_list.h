@@ -6,6 +6,7 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include "escher/impl/descriptor_set_pool.h"
 #include "escher/impl/model_data.h"
 #include "escher/impl/resource.h"
 
@@ -19,30 +20,74 @@ class ModelDisplayList : public Resource {
     ModelPipeline* pipeline;
     MeshPtr mesh;
     uint32_t stencil_reference;
+    // If greater than 1, the pipeline is instanced, and |descriptor_sets[0]|
+    // is a ModelData::PerInstance set.
+    uint32_t instance_count = 1;
+    // Dynamic offset of the PerObject data, unless the item is instanced.
+    uint32_t dynamic_offset = 0;
+    // If true, the pipeline reads |push_constants| instead of a PerObject
+    // descriptor set.
+    bool use_push_constants = false;
+    ModelData::PerObjectPushConstants push_constants;
+  };
+
+  // The PerObject data of an object, and the descriptor set that makes it
+  // available to shaders.  Descriptor sets and uniform buffers are never
+  // written once they have been used by a display list, so a subsequent
+  // display list can reuse them for an identical object (see
+  // ModelDisplayListBuilder).
+  struct ObjectBinding {
+    ModelData::PerObject data;
+    vk::ImageView image_view;
+    vk::Sampler sampler;
+    // Null unless the object's material texture is used.
+    TexturePtr texture;
+    vk::DescriptorSet descriptor_set;
+    // Dynamic offset of |data| within the uniform buffer that |descriptor_set|
+    // refers to.
+    uint32_t dynamic_offset = 0;
+    // Retain the memory that |descriptor_set| and |data| live in.
+    DescriptorSetAllocationPtr descriptor_set_allocation;
+    BufferPtr uniform_buffer;
   };
 
   ModelDisplayList(vk::DescriptorSet stage_data,
                    std::vector<Item> items,
+                   std::vector<ObjectBinding> object_bindings,
                    std::vector<TexturePtr> textures,
-                   std::vector<ResourcePtr> resources)
+                   std::vector<ResourcePtr> resources,
+                   size_t per_object_bytes_written)
       : Resource(nullptr),
         stage_data_(stage_data),
         items_(std::move(items)),
+        object_bindings_(std::move(object_bindings)),
         textures_(std::move(textures)),
-        resources_(std::move(resources)) {}
+        resources_(std::move(resources)),
+        per_object_bytes_written_(per_object_bytes_written) {}
 
   const std::vector<Item>& items() { return items_; }
   const std::vector<TexturePtr>& textures() { return textures_; }
 
+  // One per object, in the order that the objects were added.
+  const std::vector<ObjectBinding>& object_bindings() const {
+    return object_bindings_;
+  }
+
   // TODO: consider rename
   vk::DescriptorSet stage_data() const { return stage_data_; }
 
+  // Number of bytes of per-object data (uniforms, instance data and push
+  // constants) that were written to build this display list.
+  size_t per_object_bytes_written() const { return per_object_bytes_written_; }
+
  private:
   vk::DescriptorSet stage_data_;
 
   std::vector<Item> items_;
+  std::vector<ObjectBinding> object_bindings_;
   std::vector<TexturePtr> textures_;
   std::vector<ResourcePtr> resources_;
+  size_t per_object_bytes_written_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(ModelDisplayList);
 };
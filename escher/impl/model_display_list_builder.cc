@@ -4,6 +4,9 @@
 
 #include "escher/impl/model_display_list_builder.h"
 
+#include <algorithm>
+#include <future>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtx/transform.hpp>
 
 #include "escher/impl/command_buffer.h"
@@ -16,11 +19,30 @@ namespace impl {
 namespace {
 // TODO: should be queried from device.
 constexpr vk::DeviceSize kMinUniformBufferOffsetAlignment = 256;
+constexpr vk::DeviceSize kMinStorageBufferOffsetAlignment = 256;
+
+// Limits the size of an item's PerInstance data, so that it fits in a single
+// buffer from ModelData::instance_buffer_pool().
+constexpr size_t kMaxInstancesPerItem = 512;
 
 // Add a small fudge-factor so that we don't clip objects resting on the stage
 // floor.  It can't be much smaller than this (0.00075 is too small for 16-bit
 // depth formats).
 constexpr float kStageFloorFudgeFactor = 0.0008f;
+
+// Below this, the cost of starting a thread outweighs that of adding the
+// objects.
+constexpr size_t kMinObjectsPerWorker = 256;
+
+// Return the number of objects that AddObject() adds for |object|, i.e. the
+// object and all of its clipped descendants.
+size_t CountObjects(const Object& object) {
+  size_t count = 1;
+  for (auto& child : object.clipped_children()) {
+    count += CountObjects(child);
+  }
+  return count;
+}
 }  // namespace
 
 ModelDisplayListBuilder::ModelDisplayListBuilder(
@@ -35,7 +57,12 @@ ModelDisplayListBuilder::ModelDisplayListBuilder(
     ModelRenderer* renderer,
     ModelPipelineCache* pipeline_cache,
     uint32_t sample_count,
-    bool use_depth_prepass)
+    bool use_depth_prepass,
+    bool use_depth_and_lighting_pass,
+    bool use_instancing,
+    bool use_descriptor_set_per_object,
+    bool use_push_constants,
+    const ModelDisplayListPtr& previous_display_list)
     : device_(device),
       volume_(stage.viewing_volume()),
       stage_scale_(
@@ -43,21 +70,30 @@ ModelDisplayListBuilder::ModelDisplayListBuilder(
                scale.y * 2.f / volume_.height(),
                1.f / (volume_.depth_range() + kStageFloorFudgeFactor))),
       use_material_textures_(use_material_textures),
+      use_instancing_(use_instancing),
+      use_descriptor_set_per_object_(use_descriptor_set_per_object),
+      use_push_constants_(use_push_constants),
       white_texture_(white_texture),
       illumination_texture_(illumination_texture ? illumination_texture
                                                  : white_texture),
+      first_object_index_(0),
       renderer_(renderer),
       uniform_buffer_pool_(model_data->uniform_buffer_pool()),
+      instance_buffer_pool_(model_data->instance_buffer_pool()),
       per_model_descriptor_set_pool_(
           model_data->per_model_descriptor_set_pool()),
       per_object_descriptor_set_pool_(
           model_data->per_object_descriptor_set_pool()),
-      pipeline_cache_(pipeline_cache) {
+      per_instance_descriptor_set_pool_(
+          model_data->per_instance_descriptor_set_pool()),
+      pipeline_cache_(pipeline_cache),
+      previous_display_list_(previous_display_list) {
   FTL_DCHECK(white_texture_);
 
   // These fields of the pipeline spec are the same for the entire display list.
   pipeline_spec_.sample_count = sample_count;
   pipeline_spec_.use_depth_prepass = use_depth_prepass;
+  pipeline_spec_.use_depth_and_lighting_pass = use_depth_and_lighting_pass;
 
   // Obtain a uniform buffer and write the PerModel data to it.
   PrepareUniformBufferForWriteOfSize(sizeof(ModelData::PerModel), 0);
@@ -109,6 +145,33 @@ ModelDisplayListBuilder::ModelDisplayListBuilder(
   device_.updateDescriptorSets(2, writes, 0, nullptr);
 }
 
+ModelDisplayListBuilder::ModelDisplayListBuilder(
+    const ModelDisplayListBuilder& parent,
+    size_t first_object_index)
+    : device_(parent.device_),
+      volume_(parent.volume_),
+      stage_scale_(parent.stage_scale_),
+      use_material_textures_(parent.use_material_textures_),
+      use_instancing_(parent.use_instancing_),
+      use_descriptor_set_per_object_(parent.use_descriptor_set_per_object_),
+      use_push_constants_(parent.use_push_constants_),
+      white_texture_(parent.white_texture_),
+      illumination_texture_(parent.illumination_texture_),
+      per_model_descriptor_set_(parent.per_model_descriptor_set_),
+      first_object_index_(first_object_index),
+      renderer_(parent.renderer_),
+      uniform_buffer_pool_(parent.uniform_buffer_pool_),
+      instance_buffer_pool_(parent.instance_buffer_pool_),
+      per_model_descriptor_set_pool_(parent.per_model_descriptor_set_pool_),
+      per_object_descriptor_set_pool_(parent.per_object_descriptor_set_pool_),
+      per_instance_descriptor_set_pool_(
+          parent.per_instance_descriptor_set_pool_),
+      pipeline_cache_(parent.pipeline_cache_),
+      previous_display_list_(parent.previous_display_list_),
+      pipeline_spec_(parent.pipeline_spec_) {
+  FTL_DCHECK(parent.clip_depth_ == 0 && parent.pending_instances_.empty());
+}
+
 // If |position| is already aligned to |alignment|, return it.  Otherwise,
 // return the next-larger value that is so aligned.  If |alignment| is zero,
 // |position| is always considered to be aligned.
@@ -123,18 +186,13 @@ static size_t AlignedToNext(size_t position, size_t alignment) {
 }
 
 void ModelDisplayListBuilder::AddObject(const Object& object) {
-  PrepareUniformBufferForWriteOfSize(sizeof(ModelData::PerObject),
-                                     kMinUniformBufferOffsetAlignment);
-  vk::DescriptorSet descriptor_set = ObtainPerObjectDescriptorSet();
-  UpdateDescriptorSetForObject(object, descriptor_set);
+  ModelDisplayList::ObjectBinding binding;
+  ComputeObjectBinding(object, &binding);
 
   const bool is_clipper = !object.clipped_children().empty();
   const bool is_clippee = clip_depth_ > 0;
 
-  // We can immediately create the display list item, even before we have
-  // updated the descriptor set.
   ModelDisplayList::Item item;
-  item.descriptor_sets[0] = descriptor_set;
   item.mesh = renderer_->GetMeshForShape(object.shape());
   pipeline_spec_.mesh_spec = item.mesh->spec;
   pipeline_spec_.shape_modifiers = object.shape().modifiers();
@@ -142,9 +200,30 @@ void ModelDisplayListBuilder::AddObject(const Object& object) {
   pipeline_spec_.clipper_state =
       is_clipper ? ModelPipelineSpec::ClipperState::kBeginClipChildren
                  : ModelPipelineSpec::ClipperState::kNoClipChildren;
-  item.pipeline = pipeline_cache_->GetPipeline(pipeline_spec_);
   item.stencil_reference = clip_depth_;
 
+  // Untextured objects without shape modifiers pass their data as push
+  // constants.  This doesn't depend on |use_material_textures_|, so that the
+  // depth pre-pass and the lighting pass draw each object with the same vertex
+  // shader (see the invariant gl_Position in ModelPipelineCache).
+  const Texture* material_texture = object.material()->texture().get();
+  item.use_push_constants =
+      use_push_constants_ && !material_texture && !object.shape().modifiers();
+  pipeline_spec_.use_push_constants = item.use_push_constants;
+  if (item.use_push_constants) {
+    ComputePushConstants(object, &item.push_constants);
+  }
+
+  // Clippers must be drawn twice, so they are never instanced.
+  if (use_instancing_ && !is_clipper && !object.shape().modifiers()) {
+    AddInstance(std::move(item), std::move(binding), material_texture);
+    return;
+  }
+  FlushInstances();
+
+  ObtainObjectDescriptorSet(std::move(binding), &item);
+  item.pipeline = pipeline_cache_->GetPipeline(pipeline_spec_);
+
   if (is_clipper) {
     // Drawing the item will increment the value in the stencil buffer.  Update
     // |clip_depth_| so that children can test against the correct value.
@@ -155,6 +234,7 @@ void ModelDisplayListBuilder::AddObject(const Object& object) {
     for (auto& o : object.clipped_children()) {
       AddObject(o);
     }
+    FlushInstances();
 
     // Revert the stencil buffer to the previous state.
     // TODO: if we knew that no subsequent children were to be clipped, we
@@ -174,11 +254,227 @@ void ModelDisplayListBuilder::AddObject(const Object& object) {
   }
 }
 
-void ModelDisplayListBuilder::UpdateDescriptorSetForObject(
+void ModelDisplayListBuilder::AddInstance(
+    ModelDisplayList::Item item,
+    ModelDisplayList::ObjectBinding binding,
+    const Texture* material_texture) {
+  // Consecutive objects can be drawn as instances of the same item if they
+  // have the same mesh, pipeline, stencil reference and texture.  Since they
+  // are consecutive, draw order is preserved.  The material's texture is
+  // compared even if it isn't used, so that objects are grouped the same way
+  // in every pass.
+  if (!pending_instances_.empty() &&
+      (pending_instances_.size() == kMaxInstancesPerItem ||
+       pending_item_.mesh != item.mesh ||
+       pending_item_.stencil_reference != item.stencil_reference ||
+       pending_pipeline_spec_ != pipeline_spec_ ||
+       pending_material_texture_ != material_texture)) {
+    FlushInstances();
+  }
+  if (pending_instances_.empty()) {
+    pending_item_ = std::move(item);
+    pending_pipeline_spec_ = pipeline_spec_;
+    pending_material_texture_ = material_texture;
+  }
+  pending_instances_.push_back(std::move(binding));
+}
+
+void ModelDisplayListBuilder::FlushInstances() {
+  if (pending_instances_.empty()) {
+    return;
+  }
+
+  ModelDisplayList::Item item = std::move(pending_item_);
+  if (pending_instances_.size() == 1) {
+    // Draw a lone object as usual, so that its descriptor set can be reused by
+    // subsequent display lists.
+    ObtainObjectDescriptorSet(std::move(pending_instances_[0]), &item);
+    item.pipeline = pipeline_cache_->GetPipeline(pending_pipeline_spec_);
+  } else {
+    item.descriptor_sets[0] = WriteInstances();
+    item.use_push_constants = false;
+    pending_pipeline_spec_.is_instanced = true;
+    pending_pipeline_spec_.use_push_constants = false;
+    item.pipeline = pipeline_cache_->GetPipeline(pending_pipeline_spec_);
+    item.instance_count = static_cast<uint32_t>(pending_instances_.size());
+
+    // All instances share the same texture.
+    if (pending_instances_[0].texture) {
+      textures_.push_back(pending_instances_[0].texture);
+    }
+    // The instances have no descriptor set of their own, so they can't be
+    // reused by subsequent display lists, but they must still be recorded so
+    // that the bindings of subsequent objects keep their positions.
+    for (auto& binding : pending_instances_) {
+      object_bindings_.push_back(std::move(binding));
+    }
+  }
+  items_.push_back(std::move(item));
+  pending_instances_.clear();
+}
+
+vk::DescriptorSet ModelDisplayListBuilder::WriteInstances() {
+  const size_t size =
+      pending_instances_.size() * sizeof(ModelData::PerInstance);
+  instance_buffer_write_index_ = AlignedToNext(
+      instance_buffer_write_index_, kMinStorageBufferOffsetAlignment);
+  if (!instance_buffer_ ||
+      instance_buffer_write_index_ + size > instance_buffer_->size()) {
+    instance_buffer_ = instance_buffer_pool_->Allocate();
+    instance_buffer_write_index_ = 0;
+    uniform_buffers_.push_back(instance_buffer_);
+  }
+  FTL_DCHECK(size <= instance_buffer_->size());
+
+  auto instances = reinterpret_cast<ModelData::PerInstance*>(
+      &(instance_buffer_->ptr()[instance_buffer_write_index_]));
+  for (size_t i = 0; i < pending_instances_.size(); ++i) {
+    instances[i].transform = pending_instances_[i].data.transform;
+    instances[i].color = pending_instances_[i].data.color;
+  }
+  per_object_bytes_written_ += size;
+
+  DescriptorSetAllocationPtr allocation =
+      per_instance_descriptor_set_pool_->Allocate(1, nullptr);
+  vk::DescriptorSet descriptor_set = allocation->get(0);
+  resources_.push_back(std::move(allocation));
+
+  // Update each descriptor in the PerInstance descriptor set.
+  vk::WriteDescriptorSet writes[ModelData::PerInstance::kDescriptorCount];
+
+  auto& buffer_write = writes[0];
+  buffer_write.dstSet = descriptor_set;
+  buffer_write.dstBinding =
+      ModelData::PerInstance::kDescriptorSetStorageBinding;
+  buffer_write.dstArrayElement = 0;
+  buffer_write.descriptorCount = 1;
+  buffer_write.descriptorType = vk::DescriptorType::eStorageBuffer;
+  vk::DescriptorBufferInfo buffer_info;
+  buffer_info.buffer = instance_buffer_->get();
+  buffer_info.range = size;
+  buffer_info.offset = instance_buffer_write_index_;
+  buffer_write.pBufferInfo = &buffer_info;
+
+  auto& image_write = writes[1];
+  image_write.dstSet = descriptor_set;
+  image_write.dstBinding = ModelData::PerInstance::kDescriptorSetSamplerBinding;
+  image_write.dstArrayElement = 0;
+  image_write.descriptorCount = 1;
+  image_write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  vk::DescriptorImageInfo image_info;
+  image_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  image_info.imageView = pending_instances_[0].image_view;
+  image_info.sampler = pending_instances_[0].sampler;
+  image_write.pImageInfo = &image_info;
+
+  device_.updateDescriptorSets(2, writes, 0, nullptr);
+
+  instance_buffer_write_index_ += size;
+  return descriptor_set;
+}
+
+void ModelDisplayListBuilder::AddObjects(
+    const std::vector<const Object*>& objects,
+    uint32_t worker_count) {
+  worker_count = std::min(
+      worker_count,
+      static_cast<uint32_t>(objects.size() / kMinObjectsPerWorker));
+  if (worker_count <= 1) {
+    for (const Object* object : objects) {
+      AddObject(*object);
+    }
+    return;
+  }
+  FlushInstances();
+
+  // Each worker needs to know the position of its first object, so that it
+  // can find the corresponding object in |previous_display_list_|.
+  const size_t chunk_size = (objects.size() + worker_count - 1) / worker_count;
+  size_t object_index = first_object_index_ + object_bindings_.size();
+  std::vector<std::unique_ptr<ModelDisplayListBuilder>> workers;
+  std::vector<std::future<void>> futures;
+  for (size_t begin = 0; begin < objects.size(); begin += chunk_size) {
+    const size_t end = std::min(begin + chunk_size, objects.size());
+    workers.emplace_back(new ModelDisplayListBuilder(*this, object_index));
+    ModelDisplayListBuilder* worker = workers.back().get();
+    futures.push_back(
+        std::async(std::launch::async, [worker, &objects, begin, end]() {
+          for (size_t i = begin; i < end; ++i) {
+            worker->AddObject(*objects[i]);
+          }
+          worker->FlushInstances();
+        }));
+    for (size_t i = begin; i < end; ++i) {
+      object_index += CountObjects(*objects[i]);
+    }
+  }
+
+  for (size_t i = 0; i < workers.size(); ++i) {
+    futures[i].wait();
+    Append(workers[i].get());
+  }
+}
+
+void ModelDisplayListBuilder::Append(ModelDisplayListBuilder* worker) {
+  FTL_DCHECK(worker->first_object_index_ ==
+             first_object_index_ + object_bindings_.size());
+  auto append = [](auto* dst, auto* src) {
+    dst->insert(dst->end(), std::make_move_iterator(src->begin()),
+                std::make_move_iterator(src->end()));
+    src->clear();
+  };
+  append(&items_, &worker->items_);
+  append(&object_bindings_, &worker->object_bindings_);
+  append(&textures_, &worker->textures_);
+  append(&uniform_buffers_, &worker->uniform_buffers_);
+  append(&resources_, &worker->resources_);
+  per_object_bytes_written_ += worker->per_object_bytes_written_;
+}
+
+void ModelDisplayListBuilder::ObtainObjectDescriptorSet(
+    ModelDisplayList::ObjectBinding binding,
+    ModelDisplayList::Item* item) {
+  if (item->use_push_constants) {
+    // The object's data is in |item|; only the binding's position matters.
+    object_bindings_.push_back(std::move(binding));
+    return;
+  }
+
+  // If the object at the same position in the previous display list was
+  // identical, then reuse its descriptor set and uniform data.  Otherwise, the
+  // object is new or has changed, so write them anew; those of the previous
+  // display list can't be overwritten, since it may still be in use by the
+  // GPU.
+  const size_t index = first_object_index_ + object_bindings_.size();
+  if (previous_display_list_ &&
+      index < previous_display_list_->object_bindings().size()) {
+    auto& previous = previous_display_list_->object_bindings()[index];
+    if (previous.descriptor_set &&
+        previous.image_view == binding.image_view &&
+        previous.sampler == binding.sampler &&
+        !memcmp(&previous.data, &binding.data, sizeof(binding.data))) {
+      binding.descriptor_set = previous.descriptor_set;
+      binding.descriptor_set_allocation = previous.descriptor_set_allocation;
+      binding.uniform_buffer = previous.uniform_buffer;
+      binding.dynamic_offset = previous.dynamic_offset;
+    }
+  }
+  if (!binding.descriptor_set) {
+    WriteObjectBinding(&binding);
+  }
+
+  if (binding.texture) {
+    textures_.push_back(binding.texture);
+  }
+  item->descriptor_sets[0] = binding.descriptor_set;
+  item->dynamic_offset = binding.dynamic_offset;
+  object_bindings_.push_back(std::move(binding));
+}
+
+void ModelDisplayListBuilder::ComputeObjectBinding(
     const Object& object,
-    vk::DescriptorSet descriptor_set) {
-  auto per_object = reinterpret_cast<ModelData::PerObject*>(
-      &(uniform_buffer_->ptr()[uniform_buffer_write_index_]));
+    ModelDisplayList::ObjectBinding* binding) {
+  ModelData::PerObject* per_object = &binding->data;
   *per_object = ModelData::PerObject();  // initialize with default values
   auto& transform = per_object->transform;
   auto& scale_x = transform[0][0];
@@ -220,71 +516,145 @@ void ModelDisplayListBuilder::UpdateDescriptorSetForObject(
 
   // Find the texture to use, either the object's material's texture, or
   // the default texture if the material doesn't have one.
-  vk::ImageView image_view;
-  vk::Sampler sampler;
   if (auto& texture = object.material()->texture()) {
     if (!use_material_textures_) {
       // The object's material has a texture, but we choose not to use it.
-      image_view = white_texture_->image_view();
-      sampler = white_texture_->sampler();
+      binding->image_view = white_texture_->image_view();
+      binding->sampler = white_texture_->sampler();
     } else {
-      image_view = object.material()->image_view();
-      sampler = object.material()->sampler();
-      textures_.push_back(texture);
+      binding->image_view = object.material()->image_view();
+      binding->sampler = object.material()->sampler();
+      binding->texture = texture;
     }
   } else {
     // No texture available.  Use white texture, so that object's color shows.
-    image_view = white_texture_->image_view();
-    sampler = white_texture_->sampler();
+    binding->image_view = white_texture_->image_view();
+    binding->sampler = white_texture_->sampler();
   }
 
   if (object.shape().modifiers() | ShapeModifier::kWobble) {
     auto wobble = object.shape_modifier_data<ModifierWobble>();
     per_object->wobble = wobble ? *wobble : ModifierWobble();
   }
+}
 
-  // Update each descriptor in the PerObject descriptor set.
-  {
-    // A pair of writes; order doesn't matter.
-    vk::WriteDescriptorSet writes[ModelData::PerObject::kDescriptorCount];
-
-    auto& buffer_write = writes[0];
-    buffer_write.dstSet = descriptor_set;
-    buffer_write.dstBinding =
-        ModelData::PerObject::kDescriptorSetUniformBinding;
-    buffer_write.dstArrayElement = 0;
-    buffer_write.descriptorCount = 1;
-    buffer_write.descriptorType = vk::DescriptorType::eUniformBuffer;
-    vk::DescriptorBufferInfo buffer_info;
-    buffer_info.buffer = uniform_buffer_->get();
-    buffer_info.range = sizeof(ModelData::PerObject);
-    buffer_info.offset = uniform_buffer_write_index_;
-    buffer_write.pBufferInfo = &buffer_info;
-
-    auto& image_write = writes[1];
-    image_write.dstSet = descriptor_set;
-    image_write.dstBinding = ModelData::PerObject::kDescriptorSetSamplerBinding;
-    image_write.dstArrayElement = 0;
-    image_write.descriptorCount = 1;
-    image_write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
-    vk::DescriptorImageInfo image_info;
-    image_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    image_info.imageView = image_view;
-    image_info.sampler = sampler;
-    image_write.pImageInfo = &image_info;
-
-    device_.updateDescriptorSets(2, writes, 0, nullptr);
+void ModelDisplayListBuilder::ComputePushConstants(
+    const Object& object,
+    ModelData::PerObjectPushConstants* push_constants) {
+  // Equivalent to the transform computed by ComputeObjectBinding().
+  push_constants->scale = vec2(object.width() * stage_scale_.x,
+                               object.height() * stage_scale_.y);
+  push_constants->translation =
+      vec2(object.position().x * stage_scale_.x - 1.f,
+           object.position().y * stage_scale_.y - 1.f);
+  push_constants->z =
+      1.f - (object.position().z + kStageFloorFudgeFactor) * stage_scale_.z;
+  if (object.rotation() != 0.f) {
+    push_constants->rotation_point = object.rotation_point();
+    push_constants->rotation =
+        vec2(cos(object.rotation()), sin(object.rotation()));
+  } else {
+    push_constants->rotation_point = vec2(0.f, 0.f);
+    push_constants->rotation = vec2(1.f, 0.f);
+  }
+  push_constants->color =
+      glm::packUnorm4x8(vec4(object.material()->color(), 1.f));
+}
+
+void ModelDisplayListBuilder::WriteObjectBinding(
+    ModelDisplayList::ObjectBinding* binding) {
+  PrepareUniformBufferForWriteOfSize(sizeof(ModelData::PerObject),
+                                     kMinUniformBufferOffsetAlignment);
+  binding->uniform_buffer = uniform_buffer_;
+
+  memcpy(&(uniform_buffer_->ptr()[uniform_buffer_write_index_]),
+         &binding->data, sizeof(ModelData::PerObject));
+  per_object_bytes_written_ += sizeof(ModelData::PerObject);
+
+  if (use_descriptor_set_per_object_) {
+    binding->descriptor_set = ObtainPerObjectDescriptorSet();
+    binding->descriptor_set_allocation = per_object_descriptor_set_allocation_;
+    binding->dynamic_offset = 0;
+    WritePerObjectDescriptorSet(binding->descriptor_set,
+                                uniform_buffer_write_index_,
+                                binding->image_view, binding->sampler);
+  } else {
+    // Objects whose data is in the same uniform buffer, and that have the same
+    // texture, share a descriptor set; the dynamic offset selects the data.
+    auto it = std::find_if(
+        shared_descriptor_sets_.begin(), shared_descriptor_sets_.end(),
+        [binding](const SharedDescriptorSet& shared) {
+          return shared.image_view == binding->image_view &&
+                 shared.sampler == binding->sampler;
+        });
+    if (it == shared_descriptor_sets_.end()) {
+      SharedDescriptorSet shared;
+      shared.image_view = binding->image_view;
+      shared.sampler = binding->sampler;
+      shared.descriptor_set = ObtainPerObjectDescriptorSet();
+      shared.allocation = per_object_descriptor_set_allocation_;
+      WritePerObjectDescriptorSet(shared.descriptor_set, 0, shared.image_view,
+                                  shared.sampler);
+      it = shared_descriptor_sets_.insert(it, std::move(shared));
+    }
+    binding->descriptor_set = it->descriptor_set;
+    binding->descriptor_set_allocation = it->allocation;
+    binding->dynamic_offset = uniform_buffer_write_index_;
   }
 
   uniform_buffer_write_index_ += sizeof(ModelData::PerObject);
 }
 
+void ModelDisplayListBuilder::WritePerObjectDescriptorSet(
+    vk::DescriptorSet descriptor_set,
+    vk::DeviceSize offset,
+    vk::ImageView image_view,
+    vk::Sampler sampler) {
+  // A pair of writes; order doesn't matter.
+  vk::WriteDescriptorSet writes[ModelData::PerObject::kDescriptorCount];
+
+  auto& buffer_write = writes[0];
+  buffer_write.dstSet = descriptor_set;
+  buffer_write.dstBinding = ModelData::PerObject::kDescriptorSetUniformBinding;
+  buffer_write.dstArrayElement = 0;
+  buffer_write.descriptorCount = 1;
+  buffer_write.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+  vk::DescriptorBufferInfo buffer_info;
+  buffer_info.buffer = uniform_buffer_->get();
+  buffer_info.range = sizeof(ModelData::PerObject);
+  buffer_info.offset = offset;
+  buffer_write.pBufferInfo = &buffer_info;
+
+  auto& image_write = writes[1];
+  image_write.dstSet = descriptor_set;
+  image_write.dstBinding = ModelData::PerObject::kDescriptorSetSamplerBinding;
+  image_write.dstArrayElement = 0;
+  image_write.descriptorCount = 1;
+  image_write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  vk::DescriptorImageInfo image_info;
+  image_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  image_info.imageView = image_view;
+  image_info.sampler = sampler;
+  image_write.pImageInfo = &image_info;
+
+  device_.updateDescriptorSets(2, writes, 0, nullptr);
+}
+
 ModelDisplayListPtr ModelDisplayListBuilder::Build(
     CommandBuffer* command_buffer) {
+  FlushInstances();
+
+  for (auto& item : items_) {
+    if (item.use_push_constants) {
+      per_object_bytes_written_ += sizeof(ModelData::PerObjectPushConstants);
+    }
+  }
+
   for (auto& uniform_buffer : uniform_buffers_) {
     vk::BufferMemoryBarrier barrier;
     barrier.srcAccessMask = vk::AccessFlagBits::eHostWrite;
-    barrier.dstAccessMask = vk::AccessFlagBits::eUniformRead;
+    barrier.dstAccessMask =
+        vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead;
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.buffer = uniform_buffer->get();
@@ -304,8 +674,9 @@ ModelDisplayListPtr ModelDisplayListBuilder::Build(
   uniform_buffers_.clear();
 
   return ftl::MakeRefCounted<ModelDisplayList>(
-      per_model_descriptor_set_, std::move(items_), std::move(textures_),
-      std::move(resources_));
+      per_model_descriptor_set_, std::move(items_),
+      std::move(object_bindings_), std::move(textures_),
+      std::move(resources_), per_object_bytes_written_);
 }
 
 vk::DescriptorSet ModelDisplayListBuilder::ObtainPerObjectDescriptorSet() {
@@ -339,6 +710,8 @@ void ModelDisplayListBuilder::PrepareUniformBufferForWriteOfSize(
     uniform_buffer_ = uniform_buffer_pool_->Allocate();
     uniform_buffer_write_index_ = 0;
     uniform_buffers_.push_back(uniform_buffer_);
+    // These refer to the previous buffer.
+    shared_descriptor_sets_.clear();
   }
 }
 
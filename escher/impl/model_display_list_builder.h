@@ -21,6 +21,14 @@ class ModelDisplayListBuilder {
   // OK to pass null |illumination_texture|; in that case, |white_texture| will
   // be used instead.
   // Must not outlive |stage|.   TODO: is this true?
+  // If |previous_display_list| is not null, objects that are identical to the
+  // object at the same position in it reuse its descriptor sets and uniforms,
+  // instead of writing new ones.  If |use_instancing| is true, consecutive
+  // objects that share a mesh, pipeline and texture are drawn by a single
+  // instanced item.  Unless |use_descriptor_set_per_object| is true, objects
+  // with the same texture share a descriptor set, and their data is selected
+  // by a dynamic uniform offset.  If |use_push_constants| is true, the data of
+  // untextured objects without shape modifiers is passed as push constants.
   ModelDisplayListBuilder(vk::Device device,
                           const Stage& stage,
                           const Model& model,
@@ -34,17 +42,68 @@ class ModelDisplayListBuilder {
                           uint32_t sample_count,
                           // TODO: this is redundant with use_material_textures
                           // (see callers).
-                          bool use_depth_prepass);
+                          bool use_depth_prepass,
+                          bool use_depth_and_lighting_pass,
+                          bool use_instancing,
+                          bool use_descriptor_set_per_object,
+                          bool use_push_constants,
+                          const ModelDisplayListPtr& previous_display_list);
 
   void AddObject(const Object& object);
 
+  // Equivalent to calling AddObject() for each of |objects|, in order.  The
+  // objects are split into contiguous chunks, which are built by up to
+  // |worker_count| threads, each with its own uniform buffers and descriptor
+  // sets; the chunks are then appended in order.
+  void AddObjects(const std::vector<const Object*>& objects,
+                  uint32_t worker_count);
+
   ModelDisplayListPtr Build(CommandBuffer* command_buffer);
 
  private:
+  // Create a builder that adds objects on behalf of |parent|, on another
+  // thread.  |first_object_index| is the position in the display list of the
+  // first object that it adds, counting clipped children.
+  ModelDisplayListBuilder(const ModelDisplayListBuilder& parent,
+                          size_t first_object_index);
+
+  // Append the items and resources of a builder created by the constructor
+  // above, once it has finished adding objects.
+  void Append(ModelDisplayListBuilder* worker);
+
   void PrepareUniformBufferForWriteOfSize(size_t size, size_t alignment);
   vk::DescriptorSet ObtainPerObjectDescriptorSet();
-  void UpdateDescriptorSetForObject(const Object& object,
-                                    vk::DescriptorSet descriptor_set);
+  // Set the descriptor set and dynamic offset of |item| to those of the
+  // object's PerObject data, either reused from |previous_display_list_| or
+  // newly written.  Not needed if |item| uses push constants.
+  void ObtainObjectDescriptorSet(ModelDisplayList::ObjectBinding binding,
+                                 ModelDisplayList::Item* item);
+  // Compute the PerObject data and the texture of |object|.
+  void ComputeObjectBinding(const Object& object,
+                            ModelDisplayList::ObjectBinding* binding);
+  // Write the data of |binding| into a new uniform buffer slot and descriptor
+  // set.
+  void WriteObjectBinding(ModelDisplayList::ObjectBinding* binding);
+  // Compute the compact equivalent of the PerObject data of |object|.
+  void ComputePushConstants(const Object& object,
+                            ModelData::PerObjectPushConstants* push_constants);
+  // Make |descriptor_set| refer to the PerObject data at |offset| in
+  // |uniform_buffer_|, and to the specified texture.
+  void WritePerObjectDescriptorSet(vk::DescriptorSet descriptor_set,
+                                   vk::DeviceSize offset,
+                                   vk::ImageView image_view,
+                                   vk::Sampler sampler);
+
+  // Add an object that can be drawn as an instance of the pending instanced
+  // item, if it is compatible; otherwise, flush the pending item first.
+  void AddInstance(ModelDisplayList::Item item,
+                   ModelDisplayList::ObjectBinding binding,
+                   const Texture* material_texture);
+  // Push the pending instanced item (if any) to |items_|.
+  void FlushInstances();
+  // Write the PerInstance data of the pending instances into an instance
+  // buffer, and return a descriptor set that refers to it.
+  vk::DescriptorSet WriteInstances();
 
   const vk::Device device_;
 
@@ -57,19 +116,37 @@ class ModelDisplayListBuilder {
   // existing texture (e.g. to save bandwidth during depth-only passes).
   const bool use_material_textures_;
 
+  const bool use_instancing_;
+
+  const bool use_descriptor_set_per_object_;
+
+  const bool use_push_constants_;
+
   const TexturePtr white_texture_;
   const TexturePtr illumination_texture_;
 
   const vk::DescriptorSet per_model_descriptor_set_;
 
+  // Position in the display list of the first object added by this builder.
+  const size_t first_object_index_;
+
   std::vector<ModelDisplayList::Item> items_;
+  std::vector<ModelDisplayList::ObjectBinding> object_bindings_;
+
+  // Objects that will be drawn by |pending_item_|, once it is known that no
+  // more can be added to it.
+  std::vector<ModelDisplayList::ObjectBinding> pending_instances_;
+  ModelDisplayList::Item pending_item_;
+  ModelPipelineSpec pending_pipeline_spec_;
+  const Texture* pending_material_texture_ = nullptr;
 
   // Textures are handled differently from other resources, because they may
   // have a semaphore that must be waited upon.
   std::vector<TexturePtr> textures_;
 
-  // Uniform buffers are handled differently from other resources, because they
-  // must be flushed before they can be used by a display list.
+  // Uniform (and instance) buffers are handled differently from other
+  // resources, because they must be flushed before they can be used by a
+  // display list.
   std::vector<BufferPtr> uniform_buffers_;
 
   // A list of resources that must be retained until the display list is no
@@ -78,9 +155,12 @@ class ModelDisplayListBuilder {
 
   ModelRenderer* const renderer_;
   UniformBufferPool* const uniform_buffer_pool_;
+  UniformBufferPool* const instance_buffer_pool_;
   DescriptorSetPool* const per_model_descriptor_set_pool_;
   DescriptorSetPool* const per_object_descriptor_set_pool_;
+  DescriptorSetPool* const per_instance_descriptor_set_pool_;
   ModelPipelineCache* const pipeline_cache_;
+  const ModelDisplayListPtr previous_display_list_;
 
   DescriptorSetAllocationPtr per_object_descriptor_set_allocation_;
 
@@ -88,9 +168,25 @@ class ModelDisplayListBuilder {
   uint32_t uniform_buffer_write_index_ = 0;
   uint32_t per_object_descriptor_set_index_ = 0;
 
+  // Descriptor sets that refer to |uniform_buffer_|, one per texture, which
+  // are shared by objects unless |use_descriptor_set_per_object_| is true.
+  struct SharedDescriptorSet {
+    vk::ImageView image_view;
+    vk::Sampler sampler;
+    vk::DescriptorSet descriptor_set;
+    DescriptorSetAllocationPtr allocation;
+  };
+  std::vector<SharedDescriptorSet> shared_descriptor_sets_;
+
+  BufferPtr instance_buffer_;
+  size_t instance_buffer_write_index_ = 0;
+
   ModelPipelineSpec pipeline_spec_;
   uint32_t clip_depth_ = 0;
 
+  // Reported by ModelDisplayList::per_object_bytes_written().
+  size_t per_object_bytes_written_ = 0;
+
   FTL_DISALLOW_COPY_AND_ASSIGN(ModelDisplayListBuilder);
 };
 
@@ -32,8 +32,9 @@ constexpr char g_vertex_src[] = R"GLSL(
     vec4 color;
   };
 
+  // Invariant, so that the depth prepass and lighting pass agree on depth.
   out gl_PerVertex {
-    vec4 gl_Position;
+    invariant vec4 gl_Position;
   };
 
   void main() {
@@ -43,6 +44,76 @@ constexpr char g_vertex_src[] = R"GLSL(
   }
   )GLSL";
 
+constexpr char g_vertex_instanced_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  // Attribute locations must match constants in mesh_impl.h
+  layout(location = 0) in vec2 inPosition;
+  layout(location = 2) in vec2 inUV;
+
+  layout(location = 0) out vec2 fragUV;
+  layout(location = 1) flat out vec4 fragColor;
+
+  // Must match ModelData::PerInstance.
+  struct PerInstance {
+    mat4 transform;
+    vec4 color;
+  };
+
+  layout(set = 1, binding = 0) readonly buffer PerInstances {
+    PerInstance instances[];
+  };
+
+  // Invariant, so that the depth prepass and lighting pass agree on depth.
+  out gl_PerVertex {
+    invariant vec4 gl_Position;
+  };
+
+  void main() {
+    mat4 transform = instances[gl_InstanceIndex].transform;
+    gl_Position = transform * vec4(inPosition, 0, 1);
+    fragUV = inUV;
+    fragColor = instances[gl_InstanceIndex].color;
+  }
+  )GLSL";
+
+constexpr char g_vertex_push_constants_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  // Attribute locations must match constants in mesh_impl.h
+  layout(location = 0) in vec2 inPosition;
+  layout(location = 2) in vec2 inUV;
+
+  layout(location = 0) out vec2 fragUV;
+  layout(location = 1) flat out vec4 fragColor;
+
+  // Must match ModelData::PerObjectPushConstants.
+  layout(push_constant) uniform PerObject {
+    vec2 scale;
+    vec2 translation;
+    vec2 rotation_point;
+    vec2 rotation;
+    float z;
+    uint color;
+  };
+
+  // Invariant, so that the depth prepass and lighting pass agree on depth.
+  out gl_PerVertex {
+    invariant vec4 gl_Position;
+  };
+
+  void main() {
+    vec2 pos = inPosition - rotation_point;
+    pos = vec2(rotation.x * pos.x - rotation.y * pos.y,
+               rotation.y * pos.x + rotation.x * pos.y) + rotation_point;
+    gl_Position = vec4(scale * pos + translation, z, 1);
+    fragUV = inUV;
+    fragColor = unpackUnorm4x8(color);
+  }
+  )GLSL";
+
 constexpr char g_vertex_wobble_src[] = R"GLSL(
     #version 450
     #extension GL_ARB_separate_shader_objects : enable
@@ -60,8 +131,9 @@ constexpr char g_vertex_wobble_src[] = R"GLSL(
       float time;
     };
 
+    // Invariant, so that the depth prepass and lighting pass agree on depth.
     out gl_PerVertex {
-      vec4 gl_Position;
+      invariant vec4 gl_Position;
     };
 
     // TODO: unused.  See discussion in PerObject struct, below.
@@ -156,21 +228,73 @@ constexpr char g_fragment_src[] = R"GLSL(
   }
   )GLSL";
 
+constexpr char g_fragment_push_constants_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  layout(location = 1) flat in vec4 inColor;
+
+  layout(set = 0, binding = 0) uniform PerModel {
+    vec2 frag_coord_to_uv_multiplier;
+    float time;
+  };
+
+  layout(set = 0, binding = 1) uniform sampler2D light_tex;
+
+  layout(location = 0) out vec4 outColor;
+
+  void main() {
+    vec4 light = texture(light_tex, gl_FragCoord.xy * frag_coord_to_uv_multiplier);
+    outColor = light.r * inColor;
+  }
+  )GLSL";
+
+constexpr char g_fragment_instanced_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  layout(location = 0) in vec2 inUV;
+  layout(location = 1) flat in vec4 inColor;
+
+  layout(set = 0, binding = 0) uniform PerModel {
+    vec2 frag_coord_to_uv_multiplier;
+    float time;
+  };
+
+  layout(set = 0, binding = 1) uniform sampler2D light_tex;
+
+  layout(set = 1, binding = 1) uniform sampler2D material_tex;
+
+  layout(location = 0) out vec4 outColor;
+
+  void main() {
+    vec4 light = texture(light_tex, gl_FragCoord.xy * frag_coord_to_uv_multiplier);
+    outColor = light.r * inColor * texture(material_tex, inUV);
+  }
+  )GLSL";
+
 }  // namespace
 
 ModelPipelineCache::ModelPipelineCache(vk::Device device,
                                        vk::RenderPass depth_prepass,
-                                       vk::RenderPass lighting_pass)
+                                       vk::RenderPass lighting_pass,
+                                       vk::RenderPass depth_and_lighting_pass)
     : device_(device),
       depth_prepass_(depth_prepass),
-      lighting_pass_(lighting_pass) {}
-
-ModelPipelineCacheOLD::ModelPipelineCacheOLD(vk::Device device,
-                                             vk::RenderPass depth_prepass,
-                                             vk::RenderPass lighting_pass,
-                                             ModelData* model_data,
-                                             MeshManager* mesh_manager)
-    : ModelPipelineCache(device, depth_prepass, lighting_pass),
+      lighting_pass_(lighting_pass),
+      depth_and_lighting_pass_(depth_and_lighting_pass) {}
+
+ModelPipelineCacheOLD::ModelPipelineCacheOLD(
+    vk::Device device,
+    vk::RenderPass depth_prepass,
+    vk::RenderPass lighting_pass,
+    vk::RenderPass depth_and_lighting_pass,
+    ModelData* model_data,
+    MeshManager* mesh_manager)
+    : ModelPipelineCache(device,
+                         depth_prepass,
+                         lighting_pass,
+                         depth_and_lighting_pass),
       model_data_(model_data),
       mesh_manager_(mesh_manager) {}
 
@@ -181,6 +305,7 @@ ModelPipelineCacheOLD::~ModelPipelineCacheOLD() {
 
 ModelPipeline* ModelPipelineCacheOLD::GetPipeline(
     const ModelPipelineSpec& spec) {
+  std::lock_guard<std::mutex> lock(mutex_);
   auto it = pipelines_.find(spec);
   if (it != pipelines_.end()) {
     return it->second.get();
@@ -202,7 +327,9 @@ std::pair<vk::Pipeline, vk::PipelineLayout> NewPipelineHelper(
     bool enable_depth_write,
     vk::CompareOp depth_compare_op,
     vk::RenderPass render_pass,
+    uint32_t subpass,
     std::vector<vk::DescriptorSetLayout> descriptor_set_layouts,
+    uint32_t push_constants_size,
     const ModelPipelineSpec& spec,
     const MeshSpecImpl& mesh_spec_impl,
     vk::SampleCountFlagBits sample_count) {
@@ -365,7 +492,12 @@ std::pair<vk::Pipeline, vk::PipelineLayout> NewPipelineHelper(
   pipeline_layout_info.setLayoutCount =
       static_cast<uint32_t>(descriptor_set_layouts.size());
   pipeline_layout_info.pSetLayouts = descriptor_set_layouts.data();
-  pipeline_layout_info.pushConstantRangeCount = 0;
+  vk::PushConstantRange push_constant_range;
+  push_constant_range.stageFlags = vk::ShaderStageFlagBits::eVertex;
+  push_constant_range.offset = 0;
+  push_constant_range.size = push_constants_size;
+  pipeline_layout_info.pushConstantRangeCount = push_constants_size ? 1 : 0;
+  pipeline_layout_info.pPushConstantRanges = &push_constant_range;
 
   vk::PipelineLayout pipeline_layout = ESCHER_CHECKED_VK_RESULT(
       device.createPipelineLayout(pipeline_layout_info, nullptr));
@@ -388,7 +520,7 @@ std::pair<vk::Pipeline, vk::PipelineLayout> NewPipelineHelper(
   pipeline_info.pDynamicState = &dynamic_state_info;
   pipeline_info.layout = pipeline_layout;
   pipeline_info.renderPass = render_pass;
-  pipeline_info.subpass = 0;
+  pipeline_info.subpass = subpass;
   pipeline_info.basePipelineHandle = vk::Pipeline();
 
   vk::Pipeline pipeline = ESCHER_CHECKED_VK_RESULT(
@@ -406,8 +538,19 @@ std::unique_ptr<ModelPipeline> ModelPipelineCacheOLD::NewPipeline(
   std::future<SpirvData> vertex_spirv_future;
   std::future<SpirvData> fragment_spirv_future;
 
-  // The wobble modifier causes a different vertex shader to be used.
-  if (spec.shape_modifiers & ShapeModifier::kWobble) {
+  // The wobble modifier causes a different vertex shader to be used.  So does
+  // instancing, which doesn't support shape modifiers.
+  if (spec.is_instanced) {
+    FTL_DCHECK(!spec.shape_modifiers);
+    vertex_spirv_future =
+        compiler_.Compile(vk::ShaderStageFlagBits::eVertex,
+                          {{g_vertex_instanced_src}}, std::string(), "main");
+  } else if (spec.use_push_constants) {
+    FTL_DCHECK(!spec.shape_modifiers);
+    vertex_spirv_future = compiler_.Compile(vk::ShaderStageFlagBits::eVertex,
+                                            {{g_vertex_push_constants_src}},
+                                            std::string(), "main");
+  } else if (spec.shape_modifiers & ShapeModifier::kWobble) {
     vertex_spirv_future =
         compiler_.Compile(vk::ShaderStageFlagBits::eVertex,
                           {{g_vertex_wobble_src}}, std::string(), "main");
@@ -420,15 +563,33 @@ std::unique_ptr<ModelPipeline> ModelPipelineCacheOLD::NewPipeline(
   // The depth-only pre-pass uses a different renderpass and a cheap fragment
   // shader.
   vk::RenderPass render_pass = depth_prepass_;
+  uint32_t subpass = 0;
   bool enable_depth_write = true;
   vk::CompareOp depth_compare_op = vk::CompareOp::eLess;
   if (spec.use_depth_prepass) {
     // Omit fragment shader.
   } else {
     render_pass = lighting_pass_;
+    const char* fragment_src = g_fragment_src;
+    if (spec.is_instanced) {
+      fragment_src = g_fragment_instanced_src;
+    } else if (spec.use_push_constants) {
+      fragment_src = g_fragment_push_constants_src;
+    }
     fragment_spirv_future =
-        compiler_.Compile(vk::ShaderStageFlagBits::eFragment,
-                          {{g_fragment_src}}, std::string(), "main");
+        compiler_.Compile(vk::ShaderStageFlagBits::eFragment, {{fragment_src}},
+                          std::string(), "main");
+  }
+  if (spec.use_depth_and_lighting_pass) {
+    render_pass = depth_and_lighting_pass_;
+    if (!spec.use_depth_prepass) {
+      // The depth of the visible fragments was written by the first subpass,
+      // so each pixel is shaded once.  This relies on the vertex shaders'
+      // invariant gl_Position.
+      subpass = 1;
+      enable_depth_write = false;
+      depth_compare_op = vk::CompareOp::eLessOrEqual;
+    }
   }
 
   // Wait for completion of asynchronous shader compilation.
@@ -453,11 +614,23 @@ std::unique_ptr<ModelPipeline> ModelPipelineCacheOLD::NewPipeline(
         ESCHER_CHECKED_VK_RESULT(device_.createShaderModule(module_info));
   }
 
+  // Push-constant pipelines don't use a PerObject descriptor set.
+  std::vector<vk::DescriptorSetLayout> descriptor_set_layouts{
+      model_data_->per_model_layout()};
+  uint32_t push_constants_size = 0;
+  if (spec.is_instanced) {
+    descriptor_set_layouts.push_back(model_data_->per_instance_layout());
+  } else if (spec.use_push_constants) {
+    push_constants_size = sizeof(ModelData::PerObjectPushConstants);
+  } else {
+    descriptor_set_layouts.push_back(model_data_->per_object_layout());
+  }
+
   auto pipeline_and_layout = NewPipelineHelper(
       device_, vertex_module, fragment_module, enable_depth_write,
-      depth_compare_op, render_pass,
-      {model_data_->per_model_layout(), model_data_->per_object_layout()}, spec,
-      mesh_spec_impl, SampleCountFlagBitsFromInt(spec.sample_count));
+      depth_compare_op, render_pass, subpass, std::move(descriptor_set_layouts),
+      push_constants_size, spec, mesh_spec_impl,
+      SampleCountFlagBitsFromInt(spec.sample_count));
 
   device_.destroyShaderModule(vertex_module);
   if (fragment_module) {
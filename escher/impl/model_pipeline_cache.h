@@ -5,6 +5,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 
 #include "escher/forward_declarations.h"
@@ -24,16 +25,18 @@ class ModelPipelineCache {
  public:
   ModelPipelineCache(vk::Device device,
                      vk::RenderPass depth_prepass,
-                     vk::RenderPass lighting_pass);
+                     vk::RenderPass lighting_pass,
+                     vk::RenderPass depth_and_lighting_pass);
   virtual ~ModelPipelineCache() {}
 
-  // Get cached pipeline, or return a newly-created one.
+  // Get cached pipeline, or return a newly-created one.  Thread-safe.
   virtual ModelPipeline* GetPipeline(const ModelPipelineSpec& spec) = 0;
 
  protected:
   vk::Device device_;
   vk::RenderPass depth_prepass_;
   vk::RenderPass lighting_pass_;
+  vk::RenderPass depth_and_lighting_pass_;
 
  private:
   FTL_DISALLOW_COPY_AND_ASSIGN(ModelPipelineCache);
@@ -49,6 +52,7 @@ class ModelPipelineCacheOLD : public ModelPipelineCache {
   ModelPipelineCacheOLD(vk::Device device,
                         vk::RenderPass depth_prepass,
                         vk::RenderPass lighting_pass,
+                        vk::RenderPass depth_and_lighting_pass,
                         ModelData* model_data,
                         MeshManager* mesh_manager);
   ~ModelPipelineCacheOLD();
@@ -68,6 +72,8 @@ class ModelPipelineCacheOLD : public ModelPipelineCache {
   ModelData* const model_data_;
   MeshManager* const mesh_manager_;
 
+  // Guards |pipelines_|, since display lists may be built by multiple threads.
+  std::mutex mutex_;
   std::unordered_map<ModelPipelineSpec,
                      std::unique_ptr<ModelPipeline>,
                      Hash<ModelPipelineSpec>>
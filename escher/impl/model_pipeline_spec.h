@@ -32,6 +32,17 @@ struct ModelPipelineSpec {
   bool is_clippee = false;
   // TODO: this is a hack.
   bool use_depth_prepass = true;
+  // If true, the pipeline is used in ModelRenderer::depth_and_lighting_pass():
+  // in its depth-only subpass if |use_depth_prepass|, and otherwise in its
+  // lighting subpass, which tests against the depth written by the former.
+  bool use_depth_and_lighting_pass = false;
+  // If true, the pipeline draws multiple instances of the mesh, whose
+  // ModelData::PerInstance data is read from a storage buffer.
+  bool is_instanced = false;
+  // If true, the pipeline reads ModelData::PerObjectPushConstants instead of a
+  // PerObject descriptor set.  Only for untextured objects without shape
+  // modifiers.
+  bool use_push_constants = false;
 };
 #pragma pack(pop)
 
@@ -44,7 +55,11 @@ inline bool operator==(const ModelPipelineSpec& spec1,
          spec1.sample_count == spec2.sample_count &&
          spec1.clipper_state == spec2.clipper_state &&
          spec1.is_clippee == spec2.is_clippee &&
-         spec1.use_depth_prepass == spec2.use_depth_prepass;
+         spec1.use_depth_prepass == spec2.use_depth_prepass &&
+         spec1.use_depth_and_lighting_pass ==
+             spec2.use_depth_and_lighting_pass &&
+         spec1.is_instanced == spec2.is_instanced &&
+         spec1.use_push_constants == spec2.use_push_constants;
 }
 
 inline bool operator!=(const ModelPipelineSpec& spec1,
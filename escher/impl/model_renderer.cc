@@ -4,6 +4,7 @@
 
 #include "escher/impl/model_renderer.h"
 
+#include <algorithm>
 #include <glm/gtx/transform.hpp>
 #include "escher/geometry/tessellation.h"
 #include "escher/impl/command_buffer.h"
@@ -22,6 +23,7 @@
 #include "escher/scene/shape.h"
 #include "escher/scene/stage.h"
 #include "escher/util/image_loader.h"
+#include "escher/util/radix_sort.h"
 
 namespace escher {
 namespace impl {
@@ -33,6 +35,7 @@ ModelRenderer::ModelRenderer(EscherImpl* escher,
                              uint32_t lighting_pass_sample_count,
                              vk::Format depth_format)
     : device_(escher->vulkan_context().device),
+      lighting_pass_sample_count_(lighting_pass_sample_count),
       life_preserver(escher->resource_life_preserver()),
       mesh_manager_(escher->mesh_manager()),
       model_data_(model_data) {
@@ -43,12 +46,62 @@ ModelRenderer::ModelRenderer(EscherImpl* escher,
   CreateRenderPasses(pre_pass_color_format, lighting_pass_color_format,
                      lighting_pass_sample_count, depth_format);
   pipeline_cache_ = std::make_unique<impl::ModelPipelineCacheOLD>(
-      device_, depth_prepass_, lighting_pass_, model_data_, mesh_manager_);
+      device_, depth_prepass_, lighting_pass_, depth_and_lighting_pass_,
+      model_data_, mesh_manager_);
 }
 
 ModelRenderer::~ModelRenderer() {
+  // Waits until the GPU is idle, so that the render passes are no longer used
+  // by pending frames.
+  pipeline_cache_.reset();
   device_.destroyRenderPass(depth_prepass_);
   device_.destroyRenderPass(lighting_pass_);
+  device_.destroyRenderPass(depth_and_lighting_pass_);
+}
+
+uint64_t ModelRenderer::ComputeSortKey(const Object& object,
+                                      float depth_range) {
+  // Keep in sync with the pipeline that ModelDisplayListBuilder chooses for
+  // the object, so that objects that share a pipeline are adjacent.
+  const Mesh* mesh = GetMeshForShape(object.shape()).get();
+  const Texture* texture = object.material()->texture().get();
+  ModelPipelineSpec spec;
+  spec.mesh_spec = mesh->spec;
+  spec.shape_modifiers = object.shape().modifiers();
+  spec.use_push_constants =
+      use_push_constants_ && !texture && !spec.shape_modifiers;
+  auto it = pipeline_sort_ids_.find(spec);
+  if (it == pipeline_sort_ids_.end()) {
+    // Pipeline ids are assigned in order of first use, and never reused.
+    uint64_t id = std::min<uint64_t>(pipeline_sort_ids_.size(),
+                                     (uint64_t(1) << kSortKeyPipelineBits) - 1);
+    it = pipeline_sort_ids_.insert({spec, id}).first;
+  }
+
+  // Objects with a greater z are closer to the viewer, and are drawn first.
+  float depth = 1.f - object.position().z / depth_range;
+  depth = std::max(0.f, std::min(1.f, depth));
+  const uint64_t max_depth = (uint64_t(1) << kSortKeyDepthBits) - 1;
+  const uint64_t quantized_depth = static_cast<uint64_t>(depth * max_depth);
+
+  // Meshes and textures are identified by a hash of their address.  Two of
+  // them may collide, in which case they are merely less likely to be drawn
+  // consecutively.
+  auto pointer_id = [](const void* ptr, uint32_t bits) -> uint64_t {
+    uint64_t n = reinterpret_cast<uintptr_t>(ptr);
+    n ^= n >> 29;
+    n *= 0xbf58476d1ce4e5b9ULL;
+    n ^= n >> 32;
+    return n & ((uint64_t(1) << bits) - 1);
+  };
+
+  const bool is_clipper = !object.clipped_children().empty();
+  uint64_t key = is_clipper ? 1 : 0;
+  key = (key << kSortKeyPipelineBits) | it->second;
+  key = (key << kSortKeyDepthBits) | quantized_depth;
+  key = (key << kSortKeyMeshBits) | pointer_id(mesh, kSortKeyMeshBits);
+  key = (key << kSortKeyTextureBits) | pointer_id(texture, kSortKeyTextureBits);
+  return key;
 }
 
 ModelDisplayListPtr ModelRenderer::CreateDisplayList(
@@ -57,60 +110,55 @@ ModelDisplayListPtr ModelRenderer::CreateDisplayList(
     vec2 scale,
     bool sort_by_pipeline,
     bool use_depth_prepass,
+    bool use_depth_and_lighting_pass,
     bool use_descriptor_set_per_object,
     uint32_t sample_count,
     const TexturePtr& illumination_texture,
+    const ModelDisplayListPtr& previous_display_list,
     CommandBuffer* command_buffer) {
   const std::vector<Object>& objects = model.objects();
 
-  // The alternative isn't implemented.
-  FTL_DCHECK(use_descriptor_set_per_object);
-
-  // Used to accumulate indices of objects in render-order.
-  std::vector<uint32_t> opaque_objects;
-  opaque_objects.reserve(objects.size());
   // TODO: Translucency.  When rendering translucent objects, we will need a
   // separate bin for all translucent objects, and need to sort the objects in
   // that bin from back-to-front.  Conceivably, we could relax this ordering
   // requirement in cases where we can prove that the translucent objects don't
   // overlap.
-
-  // TODO: We should sort according to more different metrics, and look for
-  // performance differences between them.  At the same time, we should
-  // experiment with strategies for updating/binding descriptor-sets.
+  std::vector<const Object*> ordered_objects;
+  ordered_objects.reserve(objects.size());
   if (!sort_by_pipeline) {
     // Simply render objects in the order that they appear in the model.
-    for (uint32_t i = 0; i < objects.size(); ++i) {
-      opaque_objects.push_back(i);
+    for (auto& object : objects) {
+      ordered_objects.push_back(&object);
     }
   } else {
-    // Sort all objects into bins.  Then, iterate over each bin in arbitrary
-    // order, without additional sorting within the bin.
-    std::unordered_map<ModelPipelineSpec, std::vector<size_t>,
-                       Hash<ModelPipelineSpec>>
-        pipeline_bins;
-    for (size_t i = 0; i < objects.size(); ++i) {
-      ModelPipelineSpec spec;
-      auto& obj = objects[i];
-      spec.mesh_spec = GetMeshForShape(obj.shape())->spec;
-      spec.shape_modifiers = obj.shape().modifiers();
-      pipeline_bins[spec].push_back(i);
+    // Sort the objects by ComputeSortKey().  Only top-level objects are
+    // sorted: the builder draws each clipper immediately followed by its
+    // clipped children, so clip hierarchies keep their internal order.
+    const uint32_t count = static_cast<uint32_t>(objects.size());
+    sort_keys_.resize(count);
+    sort_values_.resize(count);
+    sort_scratch_keys_.resize(count);
+    sort_scratch_values_.resize(count);
+    const float depth_range = stage.viewing_volume().depth_range();
+    for (uint32_t i = 0; i < count; ++i) {
+      sort_keys_[i] = ComputeSortKey(objects[i], depth_range);
+      sort_values_[i] = i;
     }
-    for (auto& pair : pipeline_bins) {
-      for (uint32_t object_index : pair.second) {
-        opaque_objects.push_back(object_index);
-      }
+    RadixSort(sort_keys_.data(), sort_values_.data(), count,
+              sort_scratch_keys_.data(), sort_scratch_values_.data());
+    for (uint32_t i = 0; i < count; ++i) {
+      ordered_objects.push_back(&objects[sort_values_[i]]);
     }
   }
-  FTL_DCHECK(opaque_objects.size() == objects.size());
+  FTL_DCHECK(ordered_objects.size() == objects.size());
 
   ModelDisplayListBuilder builder(
       device_, stage, model, scale, !use_depth_prepass, white_texture_,
       illumination_texture, model_data_, this, pipeline_cache_.get(),
-      sample_count, use_depth_prepass);
-  for (uint32_t object_index : opaque_objects) {
-    builder.AddObject(objects[object_index]);
-  }
+      sample_count, use_depth_prepass, use_depth_and_lighting_pass,
+      use_instancing_, use_descriptor_set_per_object, use_push_constants_,
+      previous_display_list);
+  builder.AddObjects(ordered_objects, display_list_worker_count_);
   return builder.Build(command_buffer);
 }
 
@@ -184,12 +232,21 @@ void ModelRenderer::Draw(const Stage& stage,
                                             current_stencil_reference);
     }
 
-    vk::DescriptorSet ds = item.descriptor_sets[0];
-    vk_command_buffer.bindDescriptorSets(
-        vk::PipelineBindPoint::eGraphics, current_pipeline_layout,
-        ModelData::PerObject::kDescriptorSetIndex, 1, &ds, 0, nullptr);
+    if (item.use_push_constants) {
+      vk_command_buffer.pushConstants(
+          current_pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0,
+          sizeof(item.push_constants), &item.push_constants);
+    } else {
+      // The PerInstance set of instanced items has no dynamic offset.
+      vk::DescriptorSet ds = item.descriptor_sets[0];
+      const uint32_t dynamic_offset_count = item.instance_count > 1 ? 0 : 1;
+      vk_command_buffer.bindDescriptorSets(
+          vk::PipelineBindPoint::eGraphics, current_pipeline_layout,
+          ModelData::PerObject::kDescriptorSetIndex, 1, &ds,
+          dynamic_offset_count, &item.dynamic_offset);
+    }
 
-    command_buffer->DrawMesh(item.mesh);
+    command_buffer->DrawMesh(item.mesh, item.instance_count);
   }
 }
 
@@ -229,12 +286,16 @@ void ModelRenderer::CreateRenderPasses(vk::Format pre_pass_color_format,
                                        vk::Format lighting_pass_color_format,
                                        uint32_t lighting_pass_sample_count,
                                        vk::Format depth_format) {
-  constexpr uint32_t kAttachmentCount = 2;
+  // The resolve attachment is only used by the illumination passes, and only
+  // if they are multisampled.
+  constexpr uint32_t kAttachmentCount = 3;
   const uint32_t kColorAttachment = 0;
   const uint32_t kDepthAttachment = 1;
+  const uint32_t kResolveAttachment = 2;
   vk::AttachmentDescription attachments[kAttachmentCount];
   auto& color_attachment = attachments[kColorAttachment];
   auto& depth_attachment = attachments[kDepthAttachment];
+  auto& resolve_attachment = attachments[kResolveAttachment];
 
   // Load/store ops and image layouts differ between passes; see below.
   depth_attachment.format = depth_format;
@@ -249,6 +310,10 @@ void ModelRenderer::CreateRenderPasses(vk::Format pre_pass_color_format,
   depth_reference.attachment = kDepthAttachment;
   depth_reference.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
 
+  vk::AttachmentReference resolve_reference;
+  resolve_reference.attachment = kResolveAttachment;
+  resolve_reference.layout = vk::ImageLayout::eColorAttachmentOptimal;
+
   // Every vk::RenderPass needs at least one subpass.
   vk::SubpassDescription subpass;
   subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
@@ -291,7 +356,7 @@ void ModelRenderer::CreateRenderPasses(vk::Format pre_pass_color_format,
   // We're almost ready to create the render-passes... we just need to fill in
   // some final values that differ between the passes.
   vk::RenderPassCreateInfo info;
-  info.attachmentCount = kAttachmentCount;
+  info.attachmentCount = kResolveAttachment;  // no resolve attachment
   info.pAttachments = attachments;
   info.subpassCount = 1;
   info.pSubpasses = &subpass;
@@ -313,15 +378,31 @@ void ModelRenderer::CreateRenderPasses(vk::Format pre_pass_color_format,
       vk::ImageLayout::eDepthStencilAttachmentOptimal;
   depth_prepass_ = ESCHER_CHECKED_VK_RESULT(device_.createRenderPass(info));
 
-  // Create the illumination RenderPass.
+  // Create the illumination RenderPass.  If it is multisampled, the color
+  // attachment is resolved into the resolve attachment at the end of the
+  // subpass; only the latter is stored, so that a tile-based GPU never writes
+  // the multisampled color (nor depth) to memory.
+  const bool resolve = lighting_pass_sample_count > 1;
   color_attachment.format = lighting_pass_color_format;
   color_attachment.samples =
       SampleCountFlagBitsFromInt(lighting_pass_sample_count);
   color_attachment.loadOp = vk::AttachmentLoadOp::eClear;
-  // TODO: necessary to store if we resolve as part of the render-pass?
-  color_attachment.storeOp = vk::AttachmentStoreOp::eStore;
+  color_attachment.storeOp = resolve ? vk::AttachmentStoreOp::eDontCare
+                                     : vk::AttachmentStoreOp::eStore;
   color_attachment.initialLayout = vk::ImageLayout::eUndefined;
   color_attachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+  resolve_attachment.format = lighting_pass_color_format;
+  resolve_attachment.samples = vk::SampleCountFlagBits::e1;
+  resolve_attachment.loadOp = vk::AttachmentLoadOp::eDontCare;
+  resolve_attachment.storeOp = vk::AttachmentStoreOp::eStore;
+  resolve_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+  resolve_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+  resolve_attachment.initialLayout = vk::ImageLayout::eUndefined;
+  resolve_attachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+  if (resolve) {
+    info.attachmentCount = kAttachmentCount;
+    subpass.pResolveAttachments = &resolve_reference;
+  }
   depth_attachment.samples =
       SampleCountFlagBitsFromInt(lighting_pass_sample_count);
   depth_attachment.loadOp = vk::AttachmentLoadOp::eClear;
@@ -330,6 +411,49 @@ void ModelRenderer::CreateRenderPasses(vk::Format pre_pass_color_format,
   depth_attachment.finalLayout =
       vk::ImageLayout::eDepthStencilAttachmentOptimal;
   lighting_pass_ = ESCHER_CHECKED_VK_RESULT(device_.createRenderPass(info));
+
+  // Create the combined depth-prepass/illumination RenderPass.  Its attachments
+  // are those of the illumination pass.  Both subpasses use the color and
+  // depth attachments, so that pipelines can be created the same way for
+  // either; the first subpass doesn't write color.  Only the second resolves.
+  constexpr uint32_t kSubpassCount = 2;
+  vk::SubpassDescription subpasses[kSubpassCount] = {subpass, subpass};
+  subpasses[0].pResolveAttachments = nullptr;
+
+  // Insert a dependency between the subpasses, so that the second subpass
+  // tests against the depth (and stencil) written by the first.  It is
+  // by-region, so a tile-based GPU can keep the depth buffer on-chip.
+  constexpr uint32_t kCombinedDependencyCount = 3;
+  vk::SubpassDependency combined_dependencies[kCombinedDependencyCount] = {
+      input_dependency, vk::SubpassDependency(), output_dependency};
+  auto& depth_dependency = combined_dependencies[1];
+  depth_dependency.srcSubpass = 0;
+  depth_dependency.dstSubpass = 1;
+  depth_dependency.srcStageMask =
+      vk::PipelineStageFlagBits::eEarlyFragmentTests |
+      vk::PipelineStageFlagBits::eLateFragmentTests |
+      vk::PipelineStageFlagBits::eColorAttachmentOutput;
+  depth_dependency.dstStageMask =
+      vk::PipelineStageFlagBits::eEarlyFragmentTests |
+      vk::PipelineStageFlagBits::eLateFragmentTests |
+      vk::PipelineStageFlagBits::eColorAttachmentOutput;
+  depth_dependency.srcAccessMask =
+      vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+      vk::AccessFlagBits::eColorAttachmentWrite;
+  depth_dependency.dstAccessMask =
+      vk::AccessFlagBits::eDepthStencilAttachmentRead |
+      vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+      vk::AccessFlagBits::eColorAttachmentRead |
+      vk::AccessFlagBits::eColorAttachmentWrite;
+  depth_dependency.dependencyFlags = vk::DependencyFlagBits::eByRegion;
+  combined_dependencies[2].srcSubpass = 1;
+
+  info.subpassCount = kSubpassCount;
+  info.pSubpasses = subpasses;
+  info.dependencyCount = kCombinedDependencyCount;
+  info.pDependencies = combined_dependencies;
+  depth_and_lighting_pass_ =
+      ESCHER_CHECKED_VK_RESULT(device_.createRenderPass(info));
 }
 
 }  // namespace impl
@@ -4,10 +4,15 @@
 
 #pragma once
 
+#include <unordered_map>
+#include <vector>
+
 #include "escher/forward_declarations.h"
 #include "escher/impl/model_data.h"
+#include "escher/impl/model_pipeline_spec.h"
 #include "escher/renderer/texture.h"
 #include "escher/shape/mesh.h"
+#include "escher/util/hash.h"
 
 namespace escher {
 namespace impl {
@@ -32,7 +37,22 @@ class ModelRenderer {
   bool hack_use_depth_prepass = false;
 
   vk::RenderPass depth_prepass() const { return depth_prepass_; }
+  // If lighting_pass_sample_count() is greater than 1, the framebuffer has a
+  // third, single-sampled attachment, into which the multisampled color is
+  // resolved at the end of the pass.
   vk::RenderPass lighting_pass() const { return lighting_pass_; }
+  uint32_t lighting_pass_sample_count() const {
+    return lighting_pass_sample_count_;
+  }
+  // Single render pass that performs both of the above, as two subpasses that
+  // share the depth attachment.  The first subpass only writes depth, and the
+  // second shades the visible fragments.  Since the depth is never stored, a
+  // tile-based GPU can keep it on-chip.  Cannot be used when the depth is
+  // needed between the two, e.g. for SSDO.  Its attachments are the same as
+  // those of the lighting pass.
+  vk::RenderPass depth_and_lighting_pass() const {
+    return depth_and_lighting_pass_;
+  }
 
   // Returns a single-pixel white texture.  Do with it what you will.
   const TexturePtr& white_texture() const { return white_texture_; }
@@ -41,18 +61,46 @@ class ModelRenderer {
     return pipeline_cache_.get();
   }
 
+  // If |sort_by_pipeline| is true, top-level objects are drawn in the order of
+  // ComputeSortKey(); otherwise, they are drawn in the order of the model.
+  // If |previous_display_list| is not null (typically, the display list that
+  // was created for the same pass during the previous frame), the descriptor
+  // sets of unchanged objects are reused from it.
   ModelDisplayListPtr CreateDisplayList(const Stage& stage,
                                         const Model& model,
                                         vec2 scale,
                                         bool sort_by_pipeline,
                                         bool use_depth_prepass,
+                                        bool use_depth_and_lighting_pass,
                                         bool use_descriptor_set_per_object,
                                         uint32_t sample_count,
                                         const TexturePtr& illumination_texture,
+                                        const ModelDisplayListPtr&
+                                            previous_display_list,
                                         CommandBuffer* command_buffer);
 
   const MeshPtr& GetMeshForShape(const Shape& shape) const;
 
+  // Maximum number of threads used by CreateDisplayList() to add the objects
+  // of a large model.  The default of 1 adds them on the calling thread.
+  void set_display_list_worker_count(uint32_t count) {
+    FTL_DCHECK(count > 0);
+    display_list_worker_count_ = count;
+  }
+  uint32_t display_list_worker_count() const {
+    return display_list_worker_count_;
+  }
+
+  // Whether CreateDisplayList() draws consecutive objects that share a mesh,
+  // pipeline and texture with a single instanced draw call.
+  void set_use_instancing(bool b) { use_instancing_ = b; }
+  bool use_instancing() const { return use_instancing_; }
+
+  // Whether CreateDisplayList() passes the data of untextured objects without
+  // shape modifiers as push constants, instead of in a uniform buffer.
+  void set_use_push_constants(bool b) { use_push_constants_ = b; }
+  bool use_push_constants() const { return use_push_constants_; }
+
  private:
   void CreateRenderPasses(vk::Format pre_pass_color_format,
                           vk::Format lighting_pass_color_format,
@@ -60,8 +108,10 @@ class ModelRenderer {
                           vk::Format depth_format);
 
   vk::Device device_;
+  const uint32_t lighting_pass_sample_count_;
   vk::RenderPass depth_prepass_;
   vk::RenderPass lighting_pass_;
+  vk::RenderPass depth_and_lighting_pass_;
 
   ResourceLifePreserver* life_preserver;
   MeshManager* mesh_manager_;
@@ -74,10 +124,44 @@ class ModelRenderer {
 
   static TexturePtr CreateWhiteTexture(EscherImpl* escher);
 
+  // Return the key by which CreateDisplayList() sorts a top-level object.
+  // From the most significant bits down:
+  //   - whether the object is a clipper, so that clip hierarchies (which are
+  //     drawn as a unit, and update the stencil buffer) come last,
+  //   - the id of the object's pipeline,
+  //   - the object's depth, quantized, so that opaque objects are drawn
+  //     front-to-back within each pipeline, maximizing early depth rejection,
+  //   - ids of the object's mesh and texture, so that objects at the same depth
+  //     that share them are adjacent, and can be instanced.
+  uint64_t ComputeSortKey(const Object& object, float depth_range);
+
+  static constexpr uint32_t kSortKeyPipelineBits = 11;
+  static constexpr uint32_t kSortKeyDepthBits = 16;
+  static constexpr uint32_t kSortKeyMeshBits = 18;
+  static constexpr uint32_t kSortKeyTextureBits = 18;
+  static_assert(1 + kSortKeyPipelineBits + kSortKeyDepthBits +
+                        kSortKeyMeshBits + kSortKeyTextureBits ==
+                    64,
+                "sort key fields must fill 64 bits");
+
   MeshPtr rectangle_;
   MeshPtr circle_;
 
   TexturePtr white_texture_;
+
+  uint32_t display_list_worker_count_ = 1;
+  bool use_instancing_ = true;
+  bool use_push_constants_ = true;
+
+  // Ids of the pipelines that have been used by ComputeSortKey().
+  std::unordered_map<ModelPipelineSpec, uint64_t, Hash<ModelPipelineSpec>>
+      pipeline_sort_ids_;
+  // Reused by CreateDisplayList() from frame to frame, so that sorting doesn't
+  // allocate once they are large enough.
+  std::vector<uint64_t> sort_keys_;
+  std::vector<uint32_t> sort_values_;
+  std::vector<uint64_t> sort_scratch_keys_;
+  std::vector<uint32_t> sort_scratch_values_;
 };
 
 }  // namespace impl
@@ -9,15 +9,16 @@
 namespace escher {
 namespace impl {
 
-NaiveGpuAllocator::NaiveGpuAllocator(const VulkanContext& context)
-    : GpuAllocator(context) {}
+NaiveGpuAllocator::NaiveGpuAllocator(const VulkanContext& context,
+                                     std::unique_ptr<Backend> backend)
+    : GpuAllocator(context, std::move(backend)) {}
 
-GpuMemPtr NaiveGpuAllocator::Allocate(vk::MemoryRequirements reqs,
-                                      vk::MemoryPropertyFlags flags) {
+GpuMemPtr NaiveGpuAllocator::AllocateImpl(vk::MemoryRequirements reqs,
+                                          vk::MemoryPropertyFlags flags) {
   // TODO: cache flags for efficiency? Or perhaps change signature of this
   // method to directly take the memory-type index.
   auto memory_type_index =
-      GetMemoryTypeIndex(physical_device(), reqs.memoryTypeBits, flags);
+      backend()->GetMemoryTypeIndex(reqs.memoryTypeBits, flags);
 
   // TODO: need to manually overallocate and adjust offset to ensure alignment,
   // based on the content of reqs.alignment?  Probably not, but should verify.
@@ -14,16 +14,18 @@ namespace escher {
 namespace impl {
 
 // NaiveGpuAllocator uses a separate GpuMemSlab for each GpuMem that it
-// allocates.  This ignores Vulkan best practices, and is a placeholder until a
-// more sophisticated allocator is written.
+// allocates.  This ignores Vulkan best practices; BuddyGpuAllocator is used by
+// default, but this remains useful for debugging (e.g. to rule out allocator
+// bugs, or to let validation layers track each resource's memory separately).
 class NaiveGpuAllocator : public GpuAllocator {
  public:
-  NaiveGpuAllocator(const VulkanContext& context);
-
-  GpuMemPtr Allocate(vk::MemoryRequirements reqs,
-                     vk::MemoryPropertyFlags flags) override;
+  NaiveGpuAllocator(const VulkanContext& context,
+                    std::unique_ptr<Backend> backend = nullptr);
 
  private:
+  GpuMemPtr AllocateImpl(vk::MemoryRequirements reqs,
+                         vk::MemoryPropertyFlags flags) override;
+
   void FreeMem(GpuMemSlab* slab,
                uint32_t slab_ref_count,
                vk::DeviceSize offset,
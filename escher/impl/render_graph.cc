@@ -0,0 +1,513 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/render_graph.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "escher/impl/command_buffer.h"
+#include "escher/impl/gpu_allocator.h"
+#include "escher/impl/image_cache.h"
+#include "ftl/logging.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+// The layout, stages and accesses that correspond to a RenderGraph::Usage.
+struct UsageInfo {
+  vk::ImageLayout layout;
+  vk::PipelineStageFlags stages;
+  vk::AccessFlags read_access;
+  vk::AccessFlags write_access;
+};
+
+UsageInfo GetUsageInfo(RenderGraph::Usage usage) {
+  typedef RenderGraph::Usage Usage;
+  switch (usage) {
+    case Usage::kColorAttachment:
+      return {vk::ImageLayout::eColorAttachmentOptimal,
+              vk::PipelineStageFlagBits::eColorAttachmentOutput,
+              vk::AccessFlagBits::eColorAttachmentRead,
+              vk::AccessFlagBits::eColorAttachmentWrite};
+    case Usage::kDepthAttachment:
+      return {vk::ImageLayout::eDepthStencilAttachmentOptimal,
+              vk::PipelineStageFlagBits::eEarlyFragmentTests |
+                  vk::PipelineStageFlagBits::eLateFragmentTests,
+              vk::AccessFlagBits::eDepthStencilAttachmentRead,
+              vk::AccessFlagBits::eDepthStencilAttachmentWrite};
+    case Usage::kFragmentShaderRead:
+      return {vk::ImageLayout::eShaderReadOnlyOptimal,
+              vk::PipelineStageFlagBits::eFragmentShader,
+              vk::AccessFlagBits::eShaderRead, vk::AccessFlags()};
+    case Usage::kComputeShaderRead:
+      return {vk::ImageLayout::eShaderReadOnlyOptimal,
+              vk::PipelineStageFlagBits::eComputeShader,
+              vk::AccessFlagBits::eShaderRead, vk::AccessFlags()};
+    case Usage::kShaderStorage:
+      return {vk::ImageLayout::eGeneral,
+              vk::PipelineStageFlagBits::eFragmentShader |
+                  vk::PipelineStageFlagBits::eComputeShader,
+              vk::AccessFlagBits::eShaderRead,
+              vk::AccessFlagBits::eShaderWrite};
+    case Usage::kTransferSrc:
+      return {vk::ImageLayout::eTransferSrcOptimal,
+              vk::PipelineStageFlagBits::eTransfer,
+              vk::AccessFlagBits::eTransferRead, vk::AccessFlags()};
+    case Usage::kTransferDst:
+      return {vk::ImageLayout::eTransferDstOptimal,
+              vk::PipelineStageFlagBits::eTransfer, vk::AccessFlags(),
+              vk::AccessFlagBits::eTransferWrite};
+  }
+  FTL_CHECK(false);
+  return {};
+}
+
+vk::ImageMemoryBarrier NewImageBarrier(const ImagePtr& image) {
+  vk::ImageMemoryBarrier barrier;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image->get();
+  if (image->has_depth() || image->has_stencil()) {
+    if (image->has_depth()) {
+      barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eDepth;
+    }
+    if (image->has_stencil()) {
+      barrier.subresourceRange.aspectMask |= vk::ImageAspectFlagBits::eStencil;
+    }
+  } else {
+    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+  }
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+  return barrier;
+}
+
+}  // namespace
+
+RenderGraph::RenderGraph(ImageCache* image_cache, GpuAllocator* allocator)
+    : image_cache_(image_cache), allocator_(allocator) {}
+
+RenderGraph::~RenderGraph() {}
+
+RenderGraph::ImageId RenderGraph::CreateImage(const ImageInfo& info) {
+  ImageResource resource;
+  resource.kind = ImageKind::kTransient;
+  resource.info = info;
+  images_.push_back(std::move(resource));
+  return static_cast<ImageId>(images_.size() - 1);
+}
+
+RenderGraph::ImageId RenderGraph::ImportImage(
+    ImagePtr image,
+    vk::ImageLayout initial_layout,
+    vk::ImageLayout final_layout,
+    vk::PipelineStageFlags wait_stages) {
+  ImageResource resource;
+  resource.kind = ImageKind::kImported;
+  resource.image = std::move(image);
+  resource.final_layout = final_layout;
+  resource.state.layout = initial_layout;
+  // Treated like a read, so that the first barrier depends on these stages.
+  resource.state.read_stages = wait_stages;
+  images_.push_back(std::move(resource));
+  return static_cast<ImageId>(images_.size() - 1);
+}
+
+RenderGraph::ImageId RenderGraph::DeclareImage() {
+  ImageResource resource;
+  resource.kind = ImageKind::kDeclared;
+  images_.push_back(std::move(resource));
+  return static_cast<ImageId>(images_.size() - 1);
+}
+
+void RenderGraph::SetImage(ImageId id, ImagePtr image) {
+  FTL_DCHECK(id < images_.size());
+  FTL_DCHECK(images_[id].kind == ImageKind::kDeclared);
+  FTL_DCHECK(!images_[id].image);
+  images_[id].image = std::move(image);
+}
+
+const ImagePtr& RenderGraph::GetImage(ImageId id) const {
+  FTL_DCHECK(id < images_.size());
+  return images_[id].image;
+}
+
+RenderGraph::PassId RenderGraph::AddPass(std::string name,
+                                         PassCallback callback) {
+  FTL_DCHECK(!compiled_);
+  Pass pass;
+  pass.name = std::move(name);
+  pass.callback = std::move(callback);
+  passes_.push_back(std::move(pass));
+  return static_cast<PassId>(passes_.size() - 1);
+}
+
+RenderGraph::ImageAccess* RenderGraph::FindOrAddAccess(PassId pass,
+                                                       ImageId image,
+                                                       Usage usage) {
+  FTL_DCHECK(pass < passes_.size());
+  FTL_DCHECK(image < images_.size());
+  auto& accesses = passes_[pass].accesses;
+  for (auto& access : accesses) {
+    if (access.image == image) {
+      FTL_DCHECK(access.usage == usage);
+      return &access;
+    }
+  }
+  accesses.push_back(
+      {image, usage, false, false, vk::ImageLayout::eUndefined});
+  return &accesses.back();
+}
+
+void RenderGraph::Read(PassId pass, ImageId image, Usage usage) {
+  FindOrAddAccess(pass, image, usage)->reads = true;
+}
+
+void RenderGraph::Write(PassId pass,
+                        ImageId image,
+                        Usage usage,
+                        vk::ImageLayout layout_after) {
+  FTL_DCHECK(GetUsageInfo(usage).write_access);
+  ImageAccess* access = FindOrAddAccess(pass, image, usage);
+  access->writes = true;
+  access->layout_after = layout_after;
+}
+
+void RenderGraph::Compile() {
+  // Walk backward from the end of the frame, where only the imported images
+  // are live.  A pass is needed if it writes a live image.  The images that a
+  // needed pass writes are dead before it (unless it also reads them), and
+  // the ones that it reads are live.
+  std::vector<bool> live(images_.size(), false);
+  for (size_t i = 0; i < images_.size(); ++i) {
+    live[i] = images_[i].kind == ImageKind::kImported;
+  }
+  for (size_t i = passes_.size(); i-- > 0;) {
+    Pass& pass = passes_[i];
+    pass.culled = std::none_of(
+        pass.accesses.begin(), pass.accesses.end(),
+        [&live](const ImageAccess& access) {
+          return access.writes && live[access.image];
+        });
+    if (pass.culled) {
+      continue;
+    }
+    for (auto& access : pass.accesses) {
+      if (access.writes) {
+        live[access.image] = false;
+      }
+    }
+    for (auto& access : pass.accesses) {
+      if (access.reads) {
+        live[access.image] = true;
+      }
+    }
+  }
+
+  for (auto& image : images_) {
+    image.first_pass = UINT32_MAX;
+    image.last_pass = 0;
+  }
+  for (uint32_t i = 0; i < passes_.size(); ++i) {
+    if (passes_[i].culled) {
+      continue;
+    }
+    for (auto& access : passes_[i].accesses) {
+      ImageResource& image = images_[access.image];
+      image.first_pass = std::min(image.first_pass, i);
+      image.last_pass = std::max(image.last_pass, i);
+    }
+  }
+  compiled_ = true;
+}
+
+bool RenderGraph::is_culled(PassId pass) const {
+  FTL_DCHECK(compiled_);
+  FTL_DCHECK(pass < passes_.size());
+  return passes_[pass].culled;
+}
+
+std::vector<uint32_t> RenderGraph::AssignMemoryBlocks(
+    const std::vector<AliasingCandidate>& candidates,
+    uint32_t* block_count) {
+  struct Block {
+    uint32_t last_pass;
+    vk::DeviceSize size;
+    uint32_t memory_type_bits;
+    vk::MemoryPropertyFlags memory_flags;
+  };
+  std::vector<Block> blocks;
+  std::vector<uint32_t> result(candidates.size());
+
+  // Place images in the order that their lifetimes begin, so that each block
+  // only needs to remember when its latest image's lifetime ends.
+  std::vector<size_t> order(candidates.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&candidates](size_t a,
+                                                             size_t b) {
+    return candidates[a].first_pass < candidates[b].first_pass;
+  });
+
+  for (size_t index : order) {
+    const AliasingCandidate& candidate = candidates[index];
+    const vk::DeviceSize size = candidate.requirements.size;
+    uint32_t best_block = UINT32_MAX;
+    vk::DeviceSize best_growth = 0;
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+      const Block& block = blocks[i];
+      if (block.last_pass >= candidate.first_pass ||
+          block.memory_flags != candidate.memory_flags ||
+          !(block.memory_type_bits &
+            candidate.requirements.memoryTypeBits)) {
+        continue;
+      }
+      vk::DeviceSize growth = size > block.size ? size - block.size : 0;
+      if (best_block == UINT32_MAX || growth < best_growth ||
+          (growth == best_growth && block.size < blocks[best_block].size)) {
+        best_block = i;
+        best_growth = growth;
+      }
+    }
+    if (best_block == UINT32_MAX) {
+      best_block = static_cast<uint32_t>(blocks.size());
+      blocks.push_back({candidate.last_pass, size,
+                        candidate.requirements.memoryTypeBits,
+                        candidate.memory_flags});
+    } else {
+      Block& block = blocks[best_block];
+      block.last_pass = candidate.last_pass;
+      block.size = std::max(block.size, size);
+      block.memory_type_bits &= candidate.requirements.memoryTypeBits;
+    }
+    result[index] = best_block;
+  }
+  *block_count = static_cast<uint32_t>(blocks.size());
+  return result;
+}
+
+void RenderGraph::CreateTransientImages() {
+  std::vector<AliasingCandidate> candidates;
+  std::vector<ImageId> candidate_ids;
+  std::vector<vk::Image> vk_images;
+  for (ImageId id = 0; id < images_.size(); ++id) {
+    ImageResource& resource = images_[id];
+    if (resource.kind != ImageKind::kTransient ||
+        resource.first_pass == UINT32_MAX) {
+      continue;
+    }
+    vk::Image image = image_cache_->NewUnboundImage(resource.info);
+    candidates.push_back(
+        {resource.first_pass, resource.last_pass,
+         image_cache_->device().getImageMemoryRequirements(image),
+         resource.info.memory_flags});
+    candidate_ids.push_back(id);
+    vk_images.push_back(image);
+  }
+
+  uint32_t block_count = 0;
+  std::vector<uint32_t> blocks = AssignMemoryBlocks(candidates, &block_count);
+
+  // Each block must satisfy the requirements of all of its images.
+  std::vector<vk::MemoryRequirements> block_requirements(block_count);
+  std::vector<vk::MemoryPropertyFlags> block_flags(block_count);
+  for (auto& reqs : block_requirements) {
+    reqs.size = 0;
+    reqs.alignment = 1;
+    reqs.memoryTypeBits = ~0U;
+  }
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    const vk::MemoryRequirements& image_reqs = candidates[i].requirements;
+    vk::MemoryRequirements& reqs = block_requirements[blocks[i]];
+    reqs.size = std::max(reqs.size, image_reqs.size);
+    reqs.alignment = std::max(reqs.alignment, image_reqs.alignment);
+    reqs.memoryTypeBits &= image_reqs.memoryTypeBits;
+    block_flags[blocks[i]] = candidates[i].memory_flags;
+  }
+  std::vector<GpuMemPtr> block_memory;
+  for (uint32_t i = 0; i < block_count; ++i) {
+    block_memory.push_back(allocator_->Allocate(
+        block_requirements[i], block_flags[i], GpuMemCategory::kImage));
+    transient_memory_bytes_ += block_requirements[i].size;
+  }
+
+  // Candidates are in ImageId order, which is not necessarily the order of
+  // their lifetimes; find the image that precedes each one in its block.
+  std::vector<size_t> order(candidates.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&candidates](size_t a, size_t b) {
+    return candidates[a].first_pass < candidates[b].first_pass;
+  });
+  std::vector<ImageId> last_occupant(block_count, UINT32_MAX);
+  for (size_t index : order) {
+    ImageResource& resource = images_[candidate_ids[index]];
+    resource.previous_occupant = last_occupant[blocks[index]];
+    last_occupant[blocks[index]] = candidate_ids[index];
+    resource.image = image_cache_->NewAliasedImage(
+        resource.info, vk_images[index], block_memory[blocks[index]]);
+  }
+}
+
+void RenderGraph::AddBarrierForAccess(
+    const ImageAccess& access,
+    std::vector<vk::ImageMemoryBarrier>* barriers,
+    std::vector<ImageId>* barrier_images,
+    vk::PipelineStageFlags* src_stages,
+    vk::PipelineStageFlags* dst_stages) {
+  ImageResource& resource = images_[access.image];
+  ImageState& state = resource.state;
+  const UsageInfo info = GetUsageInfo(access.usage);
+
+  bool needs_barrier = false;
+  vk::PipelineStageFlags src;
+  vk::AccessFlags src_access;
+  if (state.layout != info.layout) {
+    // Layout transitions read and write the image, so they must follow all
+    // previous accesses.
+    needs_barrier = true;
+    src |= state.write_stages | state.read_stages;
+    src_access |= state.write_access;
+  }
+  if (access.reads && state.write_stages &&
+      (info.stages & ~state.visible_stages)) {
+    // Read-after-write, where the write isn't yet visible to these stages.
+    needs_barrier = true;
+    src |= state.write_stages;
+    src_access |= state.write_access;
+  }
+  if (access.writes && (state.write_stages || state.read_stages)) {
+    // Write-after-write or write-after-read.
+    needs_barrier = true;
+    src |= state.write_stages | state.read_stages;
+    src_access |= state.write_access;
+  }
+
+  if (needs_barrier && resource.image) {
+    vk::ImageMemoryBarrier barrier = NewImageBarrier(resource.image);
+    // Contents that will be entirely overwritten needn't be preserved.
+    barrier.oldLayout =
+        access.reads ? state.layout : vk::ImageLayout::eUndefined;
+    barrier.newLayout = info.layout;
+    barrier.srcAccessMask = src_access;
+    if (access.reads) {
+      barrier.dstAccessMask |= info.read_access;
+    }
+    if (access.writes) {
+      barrier.dstAccessMask |= info.write_access;
+    }
+    barriers->push_back(barrier);
+    barrier_images->push_back(access.image);
+    *src_stages |= src;
+    *dst_stages |= info.stages;
+  }
+
+  state.layout = info.layout;
+  if (access.writes) {
+    state.write_stages = info.stages;
+    state.write_access = info.write_access;
+    state.visible_stages = vk::PipelineStageFlags();
+    state.read_stages = vk::PipelineStageFlags();
+  } else {
+    if (needs_barrier) {
+      state.visible_stages |= info.stages;
+    }
+    state.read_stages |= info.stages;
+  }
+}
+
+void RenderGraph::RecordBarriers(
+    CommandBuffer* command_buffer,
+    const std::vector<vk::ImageMemoryBarrier>& barriers,
+    const std::vector<ImageId>& images,
+    vk::PipelineStageFlags src_stages,
+    vk::PipelineStageFlags dst_stages) {
+  if (barriers.empty()) {
+    return;
+  }
+  if (!src_stages) {
+    src_stages = vk::PipelineStageFlagBits::eTopOfPipe;
+  }
+  command_buffer->get().pipelineBarrier(
+      src_stages, dst_stages, vk::DependencyFlags(), 0, nullptr, 0, nullptr,
+      static_cast<uint32_t>(barriers.size()), barriers.data());
+  for (ImageId id : images) {
+    images_[id].image->KeepAlive(command_buffer);
+  }
+  barrier_count_ += static_cast<uint32_t>(barriers.size());
+}
+
+void RenderGraph::Execute(
+    const std::function<CommandBuffer*()>& current_command_buffer) {
+  Compile();
+  CreateTransientImages();
+
+  std::vector<vk::ImageMemoryBarrier> barriers;
+  std::vector<ImageId> barrier_images;
+  for (uint32_t i = 0; i < passes_.size(); ++i) {
+    Pass& pass = passes_[i];
+    if (pass.culled) {
+      continue;
+    }
+    barriers.clear();
+    barrier_images.clear();
+    vk::PipelineStageFlags src_stages;
+    vk::PipelineStageFlags dst_stages;
+    for (auto& access : pass.accesses) {
+      ImageResource& resource = images_[access.image];
+      if (resource.first_pass == i &&
+          resource.previous_occupant != UINT32_MAX) {
+        // The image's memory was used by another image, whose accesses must
+        // finish before this one's begin.
+        const ImageState& previous = images_[resource.previous_occupant].state;
+        resource.state.write_stages =
+            previous.write_stages | previous.read_stages;
+        resource.state.write_access = previous.write_access;
+      }
+      AddBarrierForAccess(access, &barriers, &barrier_images, &src_stages,
+                          &dst_stages);
+    }
+    CommandBuffer* command_buffer = current_command_buffer();
+    RecordBarriers(command_buffer, barriers, barrier_images, src_stages,
+                   dst_stages);
+
+    pass.callback(command_buffer);
+
+    for (auto& access : pass.accesses) {
+      if (access.writes && access.layout_after != vk::ImageLayout::eUndefined) {
+        images_[access.image].state.layout = access.layout_after;
+      }
+    }
+  }
+
+  // Leave imported images in the layout that the client expects.
+  barriers.clear();
+  barrier_images.clear();
+  vk::PipelineStageFlags src_stages;
+  for (ImageId id = 0; id < images_.size(); ++id) {
+    ImageResource& resource = images_[id];
+    if (resource.kind != ImageKind::kImported ||
+        resource.state.layout == resource.final_layout) {
+      continue;
+    }
+    vk::ImageMemoryBarrier barrier = NewImageBarrier(resource.image);
+    barrier.oldLayout = resource.state.layout;
+    barrier.newLayout = resource.final_layout;
+    barrier.srcAccessMask = resource.state.write_access;
+    barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+    barriers.push_back(barrier);
+    barrier_images.push_back(id);
+    src_stages |= resource.state.write_stages | resource.state.read_stages;
+    resource.state = ImageState();
+    resource.state.layout = resource.final_layout;
+  }
+  RecordBarriers(current_command_buffer(), barriers, barrier_images,
+                 src_stages, vk::PipelineStageFlagBits::eBottomOfPipe);
+}
+
+}  // namespace impl
+}  // namespace escher
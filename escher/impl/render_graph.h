@@ -0,0 +1,219 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/forward_declarations.h"
+#include "escher/renderer/image.h"
+#include "ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+class CommandBuffer;
+class GpuAllocator;
+class ImageCache;
+
+// Sequences the passes that render a frame.  Instead of recording barriers and
+// layout transitions by hand, each pass declares which images it reads and
+// writes, and how.  The graph then:
+//   - culls passes whose output is never used (e.g. passes that compute the
+//     input of a disabled effect),
+//   - records the barriers and layout transitions between passes, and omits
+//     those that are redundant (e.g. between two passes that sample the same
+//     image),
+//   - creates the transient images that passes render into, aliasing the
+//     memory of images whose lifetimes do not overlap.
+//
+// A RenderGraph is built and executed once per frame.  Not thread-safe.
+class RenderGraph {
+ public:
+  typedef uint32_t ImageId;
+  typedef uint32_t PassId;
+
+  // How a pass accesses an image.  Determines the layout that the image must
+  // be in, and the pipeline stages and memory accesses that barriers must
+  // synchronize with.
+  enum class Usage {
+    kColorAttachment,
+    kDepthAttachment,
+    // Sampled, in eShaderReadOnlyOptimal.
+    kFragmentShaderRead,
+    kComputeShaderRead,
+    // Storage image (or sampled in eGeneral), by fragment or compute shaders.
+    kShaderStorage,
+    kTransferSrc,
+    kTransferDst,
+  };
+
+  // Invoked by Execute(), after the barriers that the pass requires have been
+  // recorded into |command_buffer|.
+  typedef std::function<void(CommandBuffer* command_buffer)> PassCallback;
+
+  // Transient images are created by |image_cache|, and bound to memory from
+  // |allocator| (typically the FrameGpuAllocator).
+  RenderGraph(ImageCache* image_cache, GpuAllocator* allocator);
+  ~RenderGraph();
+
+  // Declare an image that only lives during this frame.  It is only created if
+  // a pass that uses it is not culled.  Its contents are undefined until the
+  // first pass that writes it.
+  ImageId CreateImage(const ImageInfo& info);
+
+  // Declare an existing image, whose contents are currently in
+  // |initial_layout|.  The image is an output of the graph: the last passes
+  // that write it are never culled.  Execute() leaves it in |final_layout|.
+  // If a pass waits for a semaphore before using the image (e.g. a swapchain
+  // image), |wait_stages| must contain the stages at which it waits, so that
+  // the image's first barrier (and layout transition) follows the wait.
+  ImageId ImportImage(
+      ImagePtr image,
+      vk::ImageLayout initial_layout,
+      vk::ImageLayout final_layout,
+      vk::PipelineStageFlags wait_stages = vk::PipelineStageFlags());
+
+  // Declare an image that is created by the first pass that writes it (e.g.
+  // by a helper that obtains its own image); that pass must call SetImage().
+  ImageId DeclareImage();
+  void SetImage(ImageId id, ImagePtr image);
+
+  // Return the image.  Transient images only exist during Execute().
+  const ImagePtr& GetImage(ImageId id) const;
+
+  // Add a pass.  Passes are executed in the order that they are added.
+  PassId AddPass(std::string name, PassCallback callback);
+
+  // Declare that |pass| reads |image|.
+  void Read(PassId pass, ImageId image, Usage usage);
+
+  // Declare that |pass| writes |image|.  Unless the pass also reads it, the
+  // previous contents are discarded.  |layout_after| is the layout that the
+  // pass leaves the image in (e.g. the final layout of a render pass), if it
+  // differs from the layout required by |usage|.  A pass may only access an
+  // image with a single Usage.
+  void Write(PassId pass,
+             ImageId image,
+             Usage usage,
+             vk::ImageLayout layout_after = vk::ImageLayout::eUndefined);
+
+  // Cull unneeded passes, and compute the lifetimes of transient images.
+  // Called by Execute(); exposed for testing.
+  void Compile();
+  bool is_culled(PassId pass) const;
+
+  // Create the transient images.  Then, for each pass that is not culled,
+  // record its barriers into the CommandBuffer returned by
+  // |current_command_buffer| and invoke its callback; since a pass may submit
+  // a partial frame, this is called again for each pass.  Finally, transition
+  // imported images to their final layouts.
+  void Execute(const std::function<CommandBuffer*()>& current_command_buffer);
+
+  // Number of image barriers recorded by Execute().
+  uint32_t barrier_count() const { return barrier_count_; }
+  // Size of the memory bound to transient images, after aliasing.
+  vk::DeviceSize transient_memory_bytes() const {
+    return transient_memory_bytes_;
+  }
+
+  // A transient image that needs memory, as seen by AssignMemoryBlocks().
+  struct AliasingCandidate {
+    // First and last passes that use the image.
+    uint32_t first_pass;
+    uint32_t last_pass;
+    vk::MemoryRequirements requirements;
+    vk::MemoryPropertyFlags memory_flags;
+  };
+
+  // Assign each candidate to a block of memory, such that the images that
+  // share a block have disjoint lifetimes, compatible memory types, and the
+  // same memory flags.  Images are placed in the compatible block that grows
+  // the least, or in a new block.  Return the index of each candidate's
+  // block, and set |block_count|.  Exposed for testing.
+  static std::vector<uint32_t> AssignMemoryBlocks(
+      const std::vector<AliasingCandidate>& candidates,
+      uint32_t* block_count);
+
+ private:
+  enum class ImageKind { kTransient, kImported, kDeclared };
+
+  // The synchronization state of an image, between passes.
+  struct ImageState {
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+    // Stages and accesses of the last write.
+    vk::PipelineStageFlags write_stages;
+    vk::AccessFlags write_access;
+    // Stages that the last write has been made visible to.
+    vk::PipelineStageFlags visible_stages;
+    // Stages that have read the image since the last write.
+    vk::PipelineStageFlags read_stages;
+  };
+
+  struct ImageResource {
+    ImageKind kind;
+    ImageInfo info;
+    ImagePtr image;
+    vk::ImageLayout final_layout = vk::ImageLayout::eUndefined;
+    ImageState state;
+    // Passes that use the image, if any are not culled.
+    uint32_t first_pass = UINT32_MAX;
+    uint32_t last_pass = 0;
+    // Transient image whose memory this image reuses, if any.
+    ImageId previous_occupant = UINT32_MAX;
+  };
+
+  struct ImageAccess {
+    ImageId image;
+    Usage usage;
+    bool reads;
+    bool writes;
+    vk::ImageLayout layout_after;
+  };
+
+  struct Pass {
+    std::string name;
+    PassCallback callback;
+    std::vector<ImageAccess> accesses;
+    bool culled = true;
+  };
+
+  ImageAccess* FindOrAddAccess(PassId pass, ImageId image, Usage usage);
+
+  // Create the transient images, and bind them to aliased memory.
+  void CreateTransientImages();
+
+  // If |access| requires a barrier, append it to |barriers| (and its image to
+  // |barrier_images|), and accumulate its stages.  Update the image's state to
+  // reflect the access.
+  void AddBarrierForAccess(const ImageAccess& access,
+                           std::vector<vk::ImageMemoryBarrier>* barriers,
+                           std::vector<ImageId>* barrier_images,
+                           vk::PipelineStageFlags* src_stages,
+                           vk::PipelineStageFlags* dst_stages);
+
+  // Record |barriers|, and keep their images alive.
+  void RecordBarriers(CommandBuffer* command_buffer,
+                      const std::vector<vk::ImageMemoryBarrier>& barriers,
+                      const std::vector<ImageId>& images,
+                      vk::PipelineStageFlags src_stages,
+                      vk::PipelineStageFlags dst_stages);
+
+  ImageCache* const image_cache_;
+  GpuAllocator* const allocator_;
+  std::vector<ImageResource> images_;
+  std::vector<Pass> passes_;
+  bool compiled_ = false;
+
+  uint32_t barrier_count_ = 0;
+  vk::DeviceSize transient_memory_bytes_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(RenderGraph);
+};
+
+}  // namespace impl
+}  // namespace escher
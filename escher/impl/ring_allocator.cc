@@ -0,0 +1,114 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/ring_allocator.h"
+
+#include <algorithm>
+
+#include "ftl/logging.h"
+
+namespace escher {
+namespace impl {
+
+constexpr uint64_t RingAllocator::kUnassignedSequenceNumber;
+
+RingAllocator::RingAllocator(vk::DeviceSize size, vk::DeviceSize alignment)
+    : size_(size), alignment_(alignment) {
+  FTL_DCHECK(alignment_ && (alignment_ & (alignment_ - 1)) == 0);
+  FTL_DCHECK(size_ % alignment_ == 0);
+}
+
+bool RingAllocator::CanAllocate(vk::DeviceSize size) const {
+  vk::DeviceSize offset;
+  return FindSpace(AlignUp(size), &offset);
+}
+
+vk::DeviceSize RingAllocator::Allocate(vk::DeviceSize size,
+                                       uint64_t sequence_number) {
+  size = AlignUp(size);
+  vk::DeviceSize offset;
+  FTL_CHECK(FindSpace(size, &offset));
+  head_ = offset + size;
+  ranges_.push_back({offset, head_, sequence_number, false});
+  return offset;
+}
+
+void RingAllocator::Reassign(vk::DeviceSize offset,
+                             uint64_t sequence_number) {
+  auto it = std::find_if(ranges_.begin(), ranges_.end(),
+                         [offset](const Range& range) {
+                           return range.begin == offset && !range.released;
+                         });
+  FTL_DCHECK(it != ranges_.end());
+  it->sequence_number = sequence_number;
+}
+
+void RingAllocator::Release(uint64_t sequence_number) {
+  FTL_DCHECK(sequence_number != kUnassignedSequenceNumber);
+  // Since ranges may be reassigned, those with the same sequence number are
+  // not necessarily adjacent.
+  bool found = false;
+  for (auto& range : ranges_) {
+    if (range.sequence_number == sequence_number) {
+      FTL_DCHECK(!range.released);
+      range.released = true;
+      found = true;
+    }
+  }
+  FTL_DCHECK(found);
+  while (!ranges_.empty() && ranges_.front().released) {
+    ranges_.pop_front();
+  }
+  if (ranges_.empty()) {
+    // Start over at the beginning, to minimize wrapping.
+    head_ = 0;
+  }
+}
+
+vk::DeviceSize RingAllocator::bytes_in_use() const {
+  if (ranges_.empty()) {
+    return 0;
+  }
+  vk::DeviceSize tail = ranges_.front().begin;
+  return head_ > tail ? head_ - tail : size_ - tail + head_;
+}
+
+uint64_t RingAllocator::oldest_sequence_number() const {
+  FTL_DCHECK(!ranges_.empty());
+  return ranges_.front().sequence_number;
+}
+
+bool RingAllocator::FindSpace(vk::DeviceSize size,
+                              vk::DeviceSize* offset) const {
+  if (size > size_) {
+    return false;
+  }
+  if (ranges_.empty()) {
+    *offset = 0;
+    return true;
+  }
+  vk::DeviceSize tail = ranges_.front().begin;
+  if (head_ > tail) {
+    // The used bytes are [tail, head): try the end of the ring first, then
+    // wrap around to the beginning.
+    if (head_ + size <= size_) {
+      *offset = head_;
+      return true;
+    } else if (size <= tail) {
+      *offset = 0;
+      return true;
+    }
+    return false;
+  }
+  // The used bytes wrap around the end of the ring, leaving [head, tail) free.
+  // If the head has caught up with the tail, the ring is full.
+  if (head_ < tail && head_ + size <= tail) {
+    *offset = head_;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace impl
+}  // namespace escher
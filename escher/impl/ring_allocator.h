@@ -0,0 +1,85 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <deque>
+#include <vulkan/vulkan.hpp>
+
+#include "ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Sub-allocates ranges of a fixed-size ring, such as a staging buffer.  Ranges
+// are carved from the head, and each is tagged with the sequence number of the
+// CommandBuffer that uses it; if that CommandBuffer is not known yet, the range
+// is tagged with kUnassignedSequenceNumber until Reassign() is called.  Space
+// is reclaimed from the tail: a released range is only reused once all ranges
+// allocated before it are also released.
+// Only offsets are managed; the ring doesn't know what memory it describes.
+//
+// Not thread-safe.
+class RingAllocator {
+ public:
+  static constexpr uint64_t kUnassignedSequenceNumber = UINT64_MAX;
+
+  // All offsets and sizes are rounded up to a multiple of |alignment|, which
+  // must be a power of two.
+  RingAllocator(vk::DeviceSize size, vk::DeviceSize alignment);
+
+  // Return true if Allocate() would succeed.
+  bool CanAllocate(vk::DeviceSize size) const;
+
+  // Allocate a contiguous range of |size| bytes and return its offset.  It is
+  // illegal to call this unless CanAllocate() returns true.  Several ranges may
+  // share a sequence number (e.g. if the same CommandBuffer uses all of them).
+  vk::DeviceSize Allocate(vk::DeviceSize size, uint64_t sequence_number);
+
+  // Change the sequence number of the unreleased range that begins at
+  // |offset|, e.g. once the CommandBuffer that uses it is known.
+  void Reassign(vk::DeviceSize offset, uint64_t sequence_number);
+
+  // Release all ranges whose sequence number is |sequence_number|.  It must not
+  // be kUnassignedSequenceNumber.
+  void Release(uint64_t sequence_number);
+
+  vk::DeviceSize size() const { return size_; }
+  bool empty() const { return ranges_.empty(); }
+
+  // Bytes between the tail and the head, including released ranges that can't
+  // be reclaimed yet and padding that was skipped when wrapping around.
+  vk::DeviceSize bytes_in_use() const;
+
+  // Sequence number of the range at the tail, which may be
+  // kUnassignedSequenceNumber.  Must not be empty().
+  uint64_t oldest_sequence_number() const;
+
+ private:
+  struct Range {
+    vk::DeviceSize begin;
+    vk::DeviceSize end;
+    uint64_t sequence_number;
+    bool released;
+  };
+
+  // Return false if there is no room for |size| bytes, otherwise set |offset|.
+  bool FindSpace(vk::DeviceSize size, vk::DeviceSize* offset) const;
+
+  vk::DeviceSize AlignUp(vk::DeviceSize size) const {
+    return (size + alignment_ - 1) & ~(alignment_ - 1);
+  }
+
+  const vk::DeviceSize size_;
+  const vk::DeviceSize alignment_;
+  // Offset at which the next range will be allocated, unless it must wrap.
+  vk::DeviceSize head_ = 0;
+  // Allocated ranges, from tail to head.
+  std::deque<Range> ranges_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(RingAllocator);
+};
+
+}  // namespace impl
+}  // namespace escher
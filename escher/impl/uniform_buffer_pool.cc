@@ -38,22 +38,44 @@ uint8_t* UniformBufferPool::UniformBufferInfo::GetMappedPointer() {
 
 UniformBufferPool::UniformBufferPool(vk::Device device,
                                      GpuAllocator* allocator,
-                                     vk::MemoryPropertyFlags additional_flags)
+                                     vk::MemoryPropertyFlags additional_flags,
+                                     vk::BufferUsageFlags usage,
+                                     std::mutex* allocator_mutex)
     : device_(device),
       allocator_(allocator),
+      allocator_mutex_(allocator_mutex),
       flags_(additional_flags | vk::MemoryPropertyFlagBits::eHostVisible),
-      buffer_size_(kBufferSize) {}
+      usage_(usage),
+      buffer_size_(kBufferSize),
+      allocation_count_(0) {}
 
 UniformBufferPool::~UniformBufferPool() {
   FTL_CHECK(allocation_count_ == 0);
+  Trim();
+}
+
+void UniformBufferPool::Trim() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Buffers share their backing memory, so it can only be freed once all of
+  // them are unused.
+  if (allocation_count_ > 0) {
+    return;
+  }
   for (auto& info : free_buffers_) {
     auto uniform_buffer_info = static_cast<UniformBufferInfo*>(info.get());
     device_.destroyBuffer(uniform_buffer_info->buffer);
     uniform_buffer_info->buffer = nullptr;
   }
+  free_buffers_.clear();
+  std::unique_lock<std::mutex> allocator_lock;
+  if (allocator_mutex_) {
+    allocator_lock = std::unique_lock<std::mutex>(*allocator_mutex_);
+  }
+  backing_memory_.clear();
 }
 
 BufferPtr UniformBufferPool::Allocate() {
+  std::lock_guard<std::mutex> lock(mutex_);
   if (free_buffers_.empty()) {
     InternalAllocate();
   }
@@ -64,6 +86,7 @@ BufferPtr UniformBufferPool::Allocate() {
 }
 
 void UniformBufferPool::RecycleBuffer(std::unique_ptr<BufferInfo> info) {
+  std::lock_guard<std::mutex> lock(mutex_);
   --allocation_count_;
   free_buffers_.push_back(std::move(info));
 }
@@ -74,7 +97,7 @@ void UniformBufferPool::InternalAllocate() {
   vk::Buffer new_buffers[kBufferBatchSize];
   vk::BufferCreateInfo info;
   info.size = buffer_size_;
-  info.usage = vk::BufferUsageFlagBits::eUniformBuffer;
+  info.usage = usage_;
   info.sharingMode = vk::SharingMode::eExclusive;
   for (uint32_t i = 0; i < kBufferBatchSize; ++i) {
     new_buffers[i] = ESCHER_CHECKED_VK_RESULT(device_.createBuffer(info));
@@ -97,13 +120,20 @@ void UniformBufferPool::InternalAllocate() {
 
   // Allocate enough memory for all of the buffers.
   reqs.size *= kBufferBatchSize;
-  auto mem = allocator_->Allocate(reqs, flags_);
+  GpuMemPtr mem;
+  {
+    std::unique_lock<std::mutex> allocator_lock;
+    if (allocator_mutex_) {
+      allocator_lock = std::unique_lock<std::mutex>(*allocator_mutex_);
+    }
+    mem = allocator_->Allocate(reqs, flags_, GpuMemCategory::kUniform);
+  }
   backing_memory_.push_back(mem);
 
-  // Map the memory; we will associate a mapped pointer with each buffer.
-  void* void_ptr = ESCHER_CHECKED_VK_RESULT(
-      device_.mapMemory(mem->base(), mem->offset(), mem->size()));
-  uint8_t* ptr = reinterpret_cast<uint8_t*>(void_ptr);
+  // The memory is persistently mapped by the allocator; we will associate a
+  // mapped pointer with each buffer.
+  uint8_t* ptr = mem->mapped_ptr();
+  FTL_DCHECK(ptr);
 
   // Finish up: bind each buffer to memory.
   vk::DeviceSize offset = mem->offset();
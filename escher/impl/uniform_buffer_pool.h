@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <mutex>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 
@@ -17,17 +18,34 @@ namespace impl {
 // to the pool upon destruction.  If necessary, it will grow by creating new
 // buffers (and allocating backing memory for them).  |additional_flags| allows
 // the user to customize the memory that is allocated by the pool; by default,
-// only eHostVisible is used.  Not thread-safe.
+// only eHostVisible is used.  |usage| allows the same kind of pool to vend
+// e.g. storage buffers.  Allocate() is thread-safe, so that display lists
+// can be built by multiple threads (see ModelDisplayListBuilder::AddObjects()).
+// GpuAllocators are not thread-safe, so if |allocator| is shared with other
+// pools that may grow concurrently, they must all pass the same
+// |allocator_mutex|, which is held whenever the allocator is used.
 class UniformBufferPool : public BufferOwner {
  public:
   UniformBufferPool(
       vk::Device device,
       GpuAllocator* allocator,
-      vk::MemoryPropertyFlags additional_flags = vk::MemoryPropertyFlags());
+      vk::MemoryPropertyFlags additional_flags = vk::MemoryPropertyFlags(),
+      vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eUniformBuffer,
+      std::mutex* allocator_mutex = nullptr);
   ~UniformBufferPool();
 
   BufferPtr Allocate();
 
+  // If none of the pool's buffers are in use, destroy them and free their
+  // backing memory.
+  void Trim();
+
+  // Total size of the buffers that are available for allocation.
+  vk::DeviceSize GetFreeBufferBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return free_buffers_.size() * buffer_size_;
+  }
+
  private:
   // Implement BufferOwner::RecycleBuffer().
   void RecycleBuffer(std::unique_ptr<BufferInfo> info) override;
@@ -40,13 +58,21 @@ class UniformBufferPool : public BufferOwner {
   // Used to allocate backing memory for the pool's buffers.
   GpuAllocator* const allocator_;
 
+  // If non-null, guards |allocator_|.  Always acquired after |mutex_|.
+  std::mutex* const allocator_mutex_;
+
   // Specify the properties of the memory used to back the pool's buffers (e.g.
   // host-visible and coherent).
   const vk::MemoryPropertyFlags flags_;
 
+  const vk::BufferUsageFlags usage_;
+
   // The size of each allocated buffer.
   const vk::DeviceSize buffer_size_;
 
+  // Guards the members below.
+  mutable std::mutex mutex_;
+
   // Item in free_buffers_.
   class UniformBufferInfo : public BufferInfo {
    public:
@@ -9,11 +9,11 @@
 
 namespace escher {
 
-ImageCore::ImageCore(ImageOwner* image_owner,
+ImageCore::ImageCore(ResourceCoreManager* manager,
                      ImageInfo info,
                      vk::Image image,
                      impl::GpuMemPtr mem)
-    : ResourceCore(image_owner),
+    : ResourceCore(manager),
       info_(info),
       image_(image),
       mem_(std::move(mem)) {
@@ -20,11 +20,14 @@ struct ImageInfo {
   vk::ImageUsageFlags usage;
   vk::MemoryPropertyFlags memory_flags =
       vk::MemoryPropertyFlagBits::eDeviceLocal;
+  // Last, so that existing brace-initializers of ImageInfo are unaffected.
+  uint32_t mip_levels = 1;
 
   bool operator==(const ImageInfo& other) const {
     return format == other.format && width == other.width &&
            height == other.height && sample_count == other.sample_count &&
-           usage == other.usage && memory_flags == other.memory_flags;
+           usage == other.usage && memory_flags == other.memory_flags &&
+           mip_levels == other.mip_levels;
   }
 };
 #pragma pack(pop)
@@ -36,7 +39,10 @@ class ImageOwner;
 
 class ImageCore : public ResourceCore {
  public:
-  ImageCore(ImageOwner* image_owner,
+  // |manager| is usually the ImageOwner that creates the Image, but an
+  // ImageOwner may instead delegate destruction of the core to another manager
+  // (e.g. ImageCache::NewTransientImage()).
+  ImageCore(ResourceCoreManager* manager,
             ImageInfo info,
             vk::Image,
             impl::GpuMemPtr mem);
@@ -47,8 +53,10 @@ class ImageCore : public ResourceCore {
   vk::Format format() const { return info_.format; }
   uint32_t width() const { return info_.width; }
   uint32_t height() const { return info_.height; }
+  uint32_t mip_levels() const { return info_.mip_levels; }
   bool has_depth() const { return has_depth_; }
   bool has_stencil() const { return has_stencil_; }
+  const impl::GpuMemPtr& mem() const { return mem_; }
 
  private:
   const ImageInfo info_;
@@ -68,6 +76,7 @@ class Image : public Resource2 {
   vk::Format format() const { return core()->format(); }
   uint32_t width() const { return core()->width(); }
   uint32_t height() const { return core()->height(); }
+  uint32_t mip_levels() const { return core()->mip_levels(); }
 
   bool has_depth() const { return core()->has_depth(); }
   bool has_stencil() const { return core()->has_stencil(); }
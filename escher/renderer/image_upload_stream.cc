@@ -0,0 +1,104 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/renderer/image_upload_stream.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "escher/impl/gpu_uploader.h"
+#include "escher/renderer/image.h"
+
+namespace escher {
+
+ImageUploadStream::ImageUploadStream(impl::GpuUploader* uploader,
+                                     ImagePtr image,
+                                     size_t bytes_per_pixel,
+                                     vk::DeviceSize max_staging_bytes,
+                                     ProgressCallback callback)
+    : uploader_(uploader),
+      image_(std::move(image)),
+      height_(image_->height()),
+      row_bytes_(image_->width() * bytes_per_pixel),
+      max_staging_bytes_(max_staging_bytes),
+      max_band_rows_(static_cast<uint32_t>(
+          std::max<vk::DeviceSize>(1, max_staging_bytes / 2 / row_bytes_))),
+      callback_(std::move(callback)) {
+  FTL_DCHECK(uploader_);
+  FTL_DCHECK(row_bytes_ > 0);
+}
+
+ImageUploadStream::~ImageUploadStream() {}
+
+uint32_t ImageUploadStream::WriteRows(const uint8_t* pixels,
+                                      uint32_t row_count) {
+  row_count = std::min(row_count, height_ - rows_written_);
+  uint32_t rows_accepted = 0;
+  while (rows_accepted < row_count) {
+    uint32_t band_rows = std::min(max_band_rows_, row_count - rows_accepted);
+    vk::DeviceSize band_bytes = band_rows * row_bytes_;
+    // A single row that exceeds the budget is allowed if nothing else is in
+    // flight, so that the stream always makes progress.
+    if (staging_bytes_in_flight_ > 0 &&
+        staging_bytes_in_flight_ + band_bytes > max_staging_bytes_) {
+      break;
+    }
+    auto writer = uploader_->TryGetWriter(band_bytes);
+    if (!writer.is_valid()) {
+      break;
+    }
+    memcpy(writer.ptr(), pixels + rows_accepted * row_bytes_, band_bytes);
+
+    vk::BufferImageCopy region;
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = vk::Offset3D(0, rows_written_, 0);
+    region.imageExtent = vk::Extent3D(image_->width(), band_rows, 1);
+
+    // The first band discards the image's undefined contents; later bands
+    // must preserve the rows that were already copied.  Bands are submitted
+    // in order on the same queue, and the layout transitions order them.
+    auto initial_layout = rows_written_ == 0
+                              ? vk::ImageLayout::eUndefined
+                              : vk::ImageLayout::eShaderReadOnlyOptimal;
+    rows_written_ += band_rows;
+    rows_accepted += band_rows;
+
+    // If writes are batched, the image is waited on along with all other
+    // uploads (see GpuUploader::Flush()).  Otherwise, the last band signals a
+    // semaphore, which also covers the earlier bands since they were
+    // submitted before it.
+    SemaphorePtr semaphore;
+    if (rows_written_ == height_ && !uploader_->batches_writes()) {
+      semaphore = Semaphore::New(image_->core()->vulkan_context().device);
+    }
+    writer.WriteImage(image_, region, std::move(semaphore), initial_layout);
+
+    staging_bytes_in_flight_ += band_bytes;
+    ImageUploadStreamPtr self(this);
+    writer.AddFinishedCallback([self, band_rows, band_bytes]() {
+      self->OnBandFinished(band_rows, band_bytes);
+    });
+    writer.Submit();
+  }
+  return rows_accepted;
+}
+
+void ImageUploadStream::OnBandFinished(uint32_t row_count,
+                                       vk::DeviceSize staging_bytes) {
+  FTL_DCHECK(staging_bytes_in_flight_ >= staging_bytes);
+  staging_bytes_in_flight_ -= staging_bytes;
+  rows_resident_ += row_count;
+  FTL_DCHECK(rows_resident_ <= height_);
+  if (callback_) {
+    callback_(rows_resident_, height_);
+  }
+}
+
+}  // namespace escher
@@ -0,0 +1,88 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <functional>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/forward_declarations.h"
+#include "ftl/macros.h"
+#include "ftl/memory/ref_counted.h"
+
+namespace escher {
+namespace impl {
+class GpuUploader;
+}  // namespace impl
+
+// Uploads the pixels of a large Image incrementally, for example as they are
+// produced by a decoder.  Rows are uploaded top to bottom, in bands whose size
+// is bounded by a staging budget; a band's staging memory is reused once its
+// copy has finished on the GPU.  The staging memory used by a stream therefore
+// stays flat, regardless of the size of the image.
+//
+// Obtain one via Escher::NewImageUploadStream().  The stream must not outlive
+// Escher.
+class ImageUploadStream : public ftl::RefCountedThreadSafe<ImageUploadStream> {
+ public:
+  // Invoked when the number of rows that are resident on the GPU changes.
+  typedef std::function<void(uint32_t rows_resident, uint32_t height)>
+      ProgressCallback;
+
+  // Copy up to |row_count| rows of tightly-packed pixels, starting at the
+  // first row that has not been written yet.  Return the number of rows that
+  // were accepted; this is less than |row_count| if the staging budget (or the
+  // uploader's ring buffer) is exhausted, in which case the caller should
+  // write the remaining rows later, e.g. during the next frame.
+  uint32_t WriteRows(const uint8_t* pixels, uint32_t row_count);
+
+  // The Image that is being uploaded.  Its contents are undefined until
+  // is_resident() returns true.
+  const ImagePtr& image() const { return image_; }
+
+  uint32_t height() const { return height_; }
+  size_t row_bytes() const { return row_bytes_; }
+  uint32_t rows_written() const { return rows_written_; }
+  uint32_t rows_resident() const { return rows_resident_; }
+
+  // True once all rows have been copied into the Image on the GPU.
+  bool is_resident() const { return rows_resident_ == height_; }
+
+  // Staging bytes whose copies have not yet finished on the GPU.
+  vk::DeviceSize staging_bytes_in_flight() const {
+    return staging_bytes_in_flight_;
+  }
+
+ private:
+  // Called by impl::ImageCache::NewImageUploadStream().
+  friend class impl::ImageCache;
+  ImageUploadStream(impl::GpuUploader* uploader,
+                    ImagePtr image,
+                    size_t bytes_per_pixel,
+                    vk::DeviceSize max_staging_bytes,
+                    ProgressCallback callback);
+  FRIEND_REF_COUNTED_THREAD_SAFE(ImageUploadStream);
+  ~ImageUploadStream();
+
+  // Called when the copy of a band finishes on the GPU.
+  void OnBandFinished(uint32_t row_count, vk::DeviceSize staging_bytes);
+
+  impl::GpuUploader* const uploader_;
+  const ImagePtr image_;
+  const uint32_t height_;
+  const size_t row_bytes_;
+  const vk::DeviceSize max_staging_bytes_;
+  // Bands are at most half of the budget, so that the next band can be staged
+  // while the previous one is being copied.
+  const uint32_t max_band_rows_;
+  const ProgressCallback callback_;
+
+  uint32_t rows_written_ = 0;
+  uint32_t rows_resident_ = 0;
+  vk::DeviceSize staging_bytes_in_flight_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(ImageUploadStream);
+};
+
+}  // namespace escher
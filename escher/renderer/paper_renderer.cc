@@ -9,11 +9,13 @@
 #include "escher/impl/command_buffer_pool.h"
 #include "escher/impl/escher_impl.h"
 #include "escher/impl/image_cache.h"
+#include "escher/impl/memory_budget.h"
 #include "escher/impl/mesh_manager.h"
 #include "escher/impl/model_data.h"
 #include "escher/impl/model_display_list.h"
 #include "escher/impl/model_pipeline_cache.h"
 #include "escher/impl/model_renderer.h"
+#include "escher/impl/render_graph.h"
 #include "escher/impl/ssdo_accelerator.h"
 #include "escher/impl/ssdo_sampler.h"
 #include "escher/impl/vulkan_utils.h"
@@ -38,8 +40,6 @@ constexpr uint32_t kSsdoAccelDownsampleFactor =
 
 constexpr bool kSkipFiltering = false;
 
-constexpr uint32_t kLightingPassSampleCount = 1;
-
 }  // namespace
 
 PaperRenderer::PaperRenderer(impl::EscherImpl* escher)
@@ -67,9 +67,12 @@ PaperRenderer::PaperRenderer(impl::EscherImpl* escher)
           escher->resource_life_preserver())),
       clear_values_({vk::ClearColorValue(
                          std::array<float, 4>{{0.012, 0.047, 0.427, 1.f}}),
-                     vk::ClearDepthStencilValue(kMaxDepth, 0)}) {}
+                     vk::ClearDepthStencilValue(kMaxDepth, 0)}) {
+  escher->memory_budget()->AddClient(model_data_.get());
+}
 
 PaperRenderer::~PaperRenderer() {
+  escher_->memory_budget()->RemoveClient(model_data_.get());
   escher_->command_buffer_pool()->Cleanup();
   if (escher_->transfer_command_buffer_pool()) {
     escher_->transfer_command_buffer_pool()->Cleanup();
@@ -79,7 +82,8 @@ PaperRenderer::~PaperRenderer() {
 void PaperRenderer::DrawDepthPrePass(const ImagePtr& depth_image,
                                      const ImagePtr& dummy_color_image,
                                      const Stage& stage,
-                                     const Model& model) {
+                                     const Model& model,
+                                     impl::ModelDisplayListPtr* display_list) {
   auto command_buffer = current_frame();
 
   FramebufferPtr framebuffer = ftl::MakeRefCounted<Framebuffer>(
@@ -91,40 +95,25 @@ void PaperRenderer::DrawDepthPrePass(const ImagePtr& depth_image,
       static_cast<float>(depth_image->width()) / stage.physical_size().width();
   float scale_y = static_cast<float>(depth_image->height()) /
                   stage.physical_size().height();
-  impl::ModelDisplayListPtr display_list = model_renderer_->CreateDisplayList(
-      stage, model, vec2(scale_x, scale_y), sort_by_pipeline_, true, true, 1,
-      TexturePtr(), command_buffer);
+  *display_list = model_renderer_->CreateDisplayList(
+      stage, model, vec2(scale_x, scale_y), sort_by_pipeline_, true, false,
+      use_descriptor_set_per_object_, 1, TexturePtr(), *display_list,
+      command_buffer);
 
   framebuffer->KeepAlive(command_buffer);
-  command_buffer->AddUsedResource(display_list);
+  command_buffer->AddUsedResource(*display_list);
+  per_object_bytes_written_ += (*display_list)->per_object_bytes_written();
   command_buffer->BeginRenderPass(model_renderer_->depth_prepass(), framebuffer,
                                   clear_values_);
-  model_renderer_->Draw(stage, display_list, command_buffer);
+  model_renderer_->Draw(stage, *display_list, command_buffer);
   command_buffer->EndRenderPass();
 }
 
-void PaperRenderer::DrawSsdoPasses(const ImagePtr& depth_in,
-                                   const ImagePtr& color_out,
-                                   const ImagePtr& color_aux,
-                                   const TexturePtr& accelerator_texture,
-                                   const Stage& stage) {
-  FTL_DCHECK(color_out->width() == color_aux->width() &&
-             color_out->height() == color_aux->height());
-  uint32_t width = color_out->width();
-  uint32_t height = color_out->height();
-
+void PaperRenderer::DrawSsdoSamplingPass(const ImagePtr& depth_in,
+                                         const ImagePtr& color_out,
+                                         const TexturePtr& accelerator_texture,
+                                         const Stage& stage) {
   auto command_buffer = current_frame();
-
-  auto fb_out = ftl::MakeRefCounted<Framebuffer>(
-      escher_, width, height, std::vector<ImagePtr>{color_out},
-      ssdo_->render_pass());
-
-  auto fb_aux = ftl::MakeRefCounted<Framebuffer>(
-      escher_, width, height, std::vector<ImagePtr>{color_aux},
-      ssdo_->render_pass());
-
-  fb_out->KeepAlive(command_buffer);
-  fb_aux->KeepAlive(command_buffer);
   accelerator_texture->KeepAlive(command_buffer);
 
 #if SSDO_SAMPLING_USES_KERNEL
@@ -133,113 +122,82 @@ void PaperRenderer::DrawSsdoPasses(const ImagePtr& depth_in,
       vk::ImageAspectFlagBits::eDepth);
 
   TexturePtr output_texture = ftl::MakeRefCounted<Texture>(
-      escher_->resource_life_preserver() color_out, vk::Filter::eNearest,
+      escher_->resource_life_preserver(), color_out, vk::Filter::eNearest,
       vk::ImageAspectFlagBits::eColor);
 
-  command_buffer->AddUsedResource(depth_texture);
-  command_buffer->AddUsedResource(output_texture);
-  command_buffer->AddUsedResource(fb_out);
-  command_buffer->AddUsedResource(fb_aux);
-
-  // Prepare to sample from the depth buffer.
-  command_buffer->TransitionImageLayout(
-      depth_in, vk::ImageLayout::eDepthStencilAttachmentOptimal,
-      vk::ImageLayout::eGeneral);
-  command_buffer->TransitionImageLayout(color_out, vk::ImageLayout::eUndefined,
-                                        vk::ImageLayout::eGeneral);
-
-  AddTimestamp("finished layout transition before SSDO sampling");
+  depth_texture->KeepAlive(command_buffer);
+  output_texture->KeepAlive(command_buffer);
 
   impl::SsdoSampler::SamplerConfig sampler_config(stage);
   ssdo_->SampleUsingKernel(command_buffer, depth_texture, output_texture,
                            &sampler_config);
-  AddTimestamp("finished SSDO sampling");
-
 #else
+  auto fb_out = ftl::MakeRefCounted<Framebuffer>(
+      escher_, color_out->width(), color_out->height(),
+      std::vector<ImagePtr>{color_out}, ssdo_->render_pass());
+  fb_out->KeepAlive(command_buffer);
+
   TexturePtr depth_texture = ftl::MakeRefCounted<Texture>(
       escher_->resource_life_preserver(), depth_in, vk::Filter::eNearest,
       vk::ImageAspectFlagBits::eDepth);
   depth_texture->KeepAlive(command_buffer);
 
-  // Prepare to sample from the depth buffer.
-  command_buffer->TransitionImageLayout(
-      depth_in, vk::ImageLayout::eDepthStencilAttachmentOptimal,
-      vk::ImageLayout::eShaderReadOnlyOptimal);
-
-  AddTimestamp("finished layout transition before SSDO sampling");
-
   impl::SsdoSampler::SamplerConfig sampler_config(stage);
   ssdo_->Sample(command_buffer, fb_out, depth_texture, accelerator_texture,
                 &sampler_config);
-
-  AddTimestamp("finished SSDO sampling");
-
-  // Now that we have finished sampling the depth buffer, transition it for
-  // reuse as a depth buffer in the lighting pass.
-  command_buffer->TransitionImageLayout(
-      depth_in, vk::ImageLayout::eShaderReadOnlyOptimal,
-      vk::ImageLayout::eDepthStencilAttachmentOptimal);
-
-  AddTimestamp("finished layout transition before SSDO filtering");
 #endif
 
-  // Do two filter passes, one horizontal and one vertical.
-  if (!kSkipFiltering) {
-    {
-      auto color_out_tex = ftl::MakeRefCounted<Texture>(
-          escher_->resource_life_preserver(), color_out, vk::Filter::eNearest);
-      color_out_tex->KeepAlive(command_buffer);
-
-      impl::SsdoSampler::FilterConfig filter_config;
-      filter_config.stride = vec2(1.f / stage.viewing_volume().width(), 0.f);
-      filter_config.scene_depth = stage.viewing_volume().depth_range();
-      ssdo_->Filter(command_buffer, fb_aux, color_out_tex, accelerator_texture,
-                    &filter_config);
-
-#if SSDO_SAMPLING_USES_KERNEL
-      command_buffer->TransitionImageLayout(
-          color_out, vk::ImageLayout::eGeneral,
-          vk::ImageLayout::eColorAttachmentOptimal);
-#else
-      command_buffer->TransitionImageLayout(
-          color_out, vk::ImageLayout::eShaderReadOnlyOptimal,
-          vk::ImageLayout::eColorAttachmentOptimal);
-#endif
+  AddTimestamp("finished SSDO sampling");
+}
 
-      AddTimestamp("finished SSDO filter pass 1");
-    }
-    {
-      auto color_aux_tex = ftl::MakeRefCounted<Texture>(
-          escher_->resource_life_preserver(), color_aux, vk::Filter::eNearest);
-      color_aux_tex->KeepAlive(command_buffer);
+void PaperRenderer::DrawSsdoFilterPass(const ImagePtr& color_in,
+                                       const ImagePtr& color_out,
+                                       const TexturePtr& accelerator_texture,
+                                       const vec2& stride,
+                                       const Stage& stage) {
+  FTL_DCHECK(color_in->width() == color_out->width() &&
+             color_in->height() == color_out->height());
+  auto command_buffer = current_frame();
 
-      impl::SsdoSampler::FilterConfig filter_config;
-      filter_config.stride = vec2(0.f, 1.f / stage.viewing_volume().height());
-      filter_config.scene_depth = stage.viewing_volume().depth_range();
-      ssdo_->Filter(command_buffer, fb_out, color_aux_tex, accelerator_texture,
-                    &filter_config);
+  auto fb_out = ftl::MakeRefCounted<Framebuffer>(
+      escher_, color_out->width(), color_out->height(),
+      std::vector<ImagePtr>{color_out}, ssdo_->render_pass());
+  fb_out->KeepAlive(command_buffer);
 
-      command_buffer->TransitionImageLayout(
-          color_aux, vk::ImageLayout::eShaderReadOnlyOptimal,
-          vk::ImageLayout::eColorAttachmentOptimal);
+  auto color_in_tex = ftl::MakeRefCounted<Texture>(
+      escher_->resource_life_preserver(), color_in, vk::Filter::eNearest);
+  color_in_tex->KeepAlive(command_buffer);
+  accelerator_texture->KeepAlive(command_buffer);
 
-      AddTimestamp("finished SSDO filter pass 2");
-    }
-  }
+  impl::SsdoSampler::FilterConfig filter_config;
+  filter_config.stride = stride;
+  filter_config.scene_depth = stage.viewing_volume().depth_range();
+  ssdo_->Filter(command_buffer, fb_out, color_in_tex, accelerator_texture,
+                &filter_config);
 }
 
 void PaperRenderer::UpdateModelRenderer(vk::Format pre_pass_color_format,
                                         vk::Format lighting_pass_color_format) {
   // TODO: eventually, we should be able to handle it if the client changes the
   // format of the buffers that we are to render into.  For now, just lazily
-  // create the ModelRenderer, and assume that it doesn't change.
-  if (!model_renderer_) {
+  // create the ModelRenderer, and assume that it doesn't change.  The
+  // ModelRenderer's render passes depend on the sample count, so it is
+  // recreated (along with its pipelines) if the sample count changes.
+  if (!model_renderer_ ||
+      model_renderer_->lighting_pass_sample_count() != sample_count_) {
+    previous_ssdo_accel_depth_display_list_ = nullptr;
+    previous_depth_display_list_ = nullptr;
+    previous_lighting_display_list_ = nullptr;
+    model_renderer_.reset();
     model_renderer_ = std::make_unique<impl::ModelRenderer>(
         escher_, model_data_.get(), pre_pass_color_format,
-        lighting_pass_color_format, kLightingPassSampleCount,
+        lighting_pass_color_format, sample_count_,
         ESCHER_CHECKED_VK_RESULT(
             impl::GetSupportedDepthStencilFormat(context_.physical_device)));
   }
+  model_renderer_->set_display_list_worker_count(display_list_worker_count_);
+  model_renderer_->set_use_instancing(use_instancing_);
+  model_renderer_->set_use_push_constants(use_push_constants_);
 }
 
 void PaperRenderer::DrawLightingPass(uint32_t sample_count,
@@ -251,9 +209,12 @@ void PaperRenderer::DrawLightingPass(uint32_t sample_count,
   framebuffer->KeepAlive(command_buffer);
 
   impl::ModelDisplayListPtr display_list = model_renderer_->CreateDisplayList(
-      stage, model, vec2(1.f, 1.f), sort_by_pipeline_, false, true,
-      sample_count, illumination_texture, command_buffer);
+      stage, model, vec2(1.f, 1.f), sort_by_pipeline_, false, false,
+      use_descriptor_set_per_object_, sample_count, illumination_texture,
+      previous_lighting_display_list_, command_buffer);
   command_buffer->AddUsedResource(display_list);
+  previous_lighting_display_list_ = display_list;
+  per_object_bytes_written_ += display_list->per_object_bytes_written();
 
   // Update the clear color from the stage
   vec3 clear_color = stage.clear_color();
@@ -267,59 +228,108 @@ void PaperRenderer::DrawLightingPass(uint32_t sample_count,
   command_buffer->EndRenderPass();
 }
 
+void PaperRenderer::DrawDepthAndLightingPass(uint32_t sample_count,
+                                             const FramebufferPtr& framebuffer,
+                                             const Stage& stage,
+                                             const Model& model) {
+  auto command_buffer = current_frame();
+  framebuffer->KeepAlive(command_buffer);
+
+  impl::ModelDisplayListPtr depth_display_list =
+      model_renderer_->CreateDisplayList(
+          stage, model, vec2(1.f, 1.f), sort_by_pipeline_, true, true,
+          use_descriptor_set_per_object_, sample_count, TexturePtr(),
+          previous_depth_display_list_, command_buffer);
+  impl::ModelDisplayListPtr lighting_display_list =
+      model_renderer_->CreateDisplayList(
+          stage, model, vec2(1.f, 1.f), sort_by_pipeline_, false, true,
+          use_descriptor_set_per_object_, sample_count, TexturePtr(),
+          previous_lighting_display_list_, command_buffer);
+  command_buffer->AddUsedResource(depth_display_list);
+  command_buffer->AddUsedResource(lighting_display_list);
+  previous_depth_display_list_ = depth_display_list;
+  previous_lighting_display_list_ = lighting_display_list;
+  per_object_bytes_written_ += depth_display_list->per_object_bytes_written();
+  per_object_bytes_written_ +=
+      lighting_display_list->per_object_bytes_written();
+
+  // Update the clear color from the stage
+  vec3 clear_color = stage.clear_color();
+  clear_values_[0] = vk::ClearColorValue(
+      std::array<float, 4>{{clear_color.x, clear_color.y, clear_color.z, 1.f}});
+  command_buffer->BeginRenderPass(model_renderer_->depth_and_lighting_pass(),
+                                  framebuffer, clear_values_);
+
+  model_renderer_->Draw(stage, depth_display_list, command_buffer);
+  command_buffer->NextSubpass();
+
+  // The depth is kept, but the clip regions are drawn again, so start from a
+  // clear stencil buffer, as the separate lighting pass does.
+  vk::ClearAttachment clear_stencil;
+  clear_stencil.aspectMask = vk::ImageAspectFlagBits::eStencil;
+  clear_stencil.clearValue = clear_values_[kFramebufferDepthAttachmentIndex];
+  vk::ClearRect clear_rect;
+  clear_rect.rect.extent =
+      vk::Extent2D{framebuffer->width(), framebuffer->height()};
+  clear_rect.baseArrayLayer = 0;
+  clear_rect.layerCount = 1;
+  command_buffer->get().clearAttachments(1, &clear_stencil, 1, &clear_rect);
+
+  model_renderer_->Draw(stage, lighting_display_list, command_buffer);
+
+  command_buffer->EndRenderPass();
+}
+
 void PaperRenderer::DrawDebugOverlays(const ImagePtr& output,
-                                      const ImagePtr& depth,
                                       const ImagePtr& illumination,
                                       const TexturePtr& ssdo_acceleration) {
-  if (show_debug_info_) {
-    int32_t dst_width = output->width();
-    int32_t dst_height = output->height();
-    int32_t src_width = 0;
-    int32_t src_height = 0;
-
-    vk::ImageBlit blit;
-    blit.srcSubresource.mipLevel = 0;
-    blit.srcSubresource.baseArrayLayer = 0;
-    blit.srcSubresource.layerCount = 1;
-    blit.srcOffsets[0] = vk::Offset3D{0, 0, 0};
-    blit.dstSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-    blit.dstSubresource.mipLevel = 0;
-    blit.dstSubresource.baseArrayLayer = 0;
-    blit.dstSubresource.layerCount = 1;
-
-    if (illumination) {
-      src_width = illumination->width();
-      src_height = illumination->height();
-      blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-      blit.srcOffsets[1] = vk::Offset3D{src_width, src_height, 1};
-      blit.dstOffsets[0] = vk::Offset3D{dst_width * 3 / 4, 0, 0};
-      blit.dstOffsets[1] = vk::Offset3D{dst_width, dst_height / 4, 1};
-      current_frame()->get().blitImage(
-          illumination->get(), vk::ImageLayout::eShaderReadOnlyOptimal,
-          output->get(), vk::ImageLayout::eColorAttachmentOptimal, 1, &blit,
-          vk::Filter::eLinear);
-    }
-
-    src_width = depth->width() / kSsdoAccelDownsampleFactor;
-    src_height = depth->height() / kSsdoAccelDownsampleFactor;
-    TexturePtr unpacked_ssdo_acceleration =
-        ssdo_accelerator_->UnpackLookupTable(current_frame(), ssdo_acceleration,
-                                             src_width, src_height, this);
-    FTL_DCHECK(unpacked_ssdo_acceleration->width() ==
-               static_cast<uint32_t>(src_width));
-    FTL_DCHECK(unpacked_ssdo_acceleration->height() ==
-               static_cast<uint32_t>(src_height));
+  int32_t dst_width = output->width();
+  int32_t dst_height = output->height();
+  int32_t src_width = 0;
+  int32_t src_height = 0;
+
+  vk::ImageBlit blit;
+  blit.srcSubresource.mipLevel = 0;
+  blit.srcSubresource.baseArrayLayer = 0;
+  blit.srcSubresource.layerCount = 1;
+  blit.srcOffsets[0] = vk::Offset3D{0, 0, 0};
+  blit.dstSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+  blit.dstSubresource.mipLevel = 0;
+  blit.dstSubresource.baseArrayLayer = 0;
+  blit.dstSubresource.layerCount = 1;
+
+  if (illumination) {
+    src_width = illumination->width();
+    src_height = illumination->height();
     blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
     blit.srcOffsets[1] = vk::Offset3D{src_width, src_height, 1};
-    blit.dstOffsets[0] = vk::Offset3D{dst_width * 3 / 4, dst_height * 1 / 4, 0};
-    blit.dstOffsets[1] = vk::Offset3D{dst_width, dst_height * 1 / 2, 1};
-    current_frame()->get().blitImage(unpacked_ssdo_acceleration->image()->get(),
-                                     vk::ImageLayout::eGeneral, output->get(),
-                                     vk::ImageLayout::eColorAttachmentOptimal,
-                                     1, &blit, vk::Filter::eNearest);
-
-    AddTimestamp("finished blitting debug overlay");
+    blit.dstOffsets[0] = vk::Offset3D{dst_width * 3 / 4, 0, 0};
+    blit.dstOffsets[1] = vk::Offset3D{dst_width, dst_height / 4, 1};
+    current_frame()->get().blitImage(
+        illumination->get(), vk::ImageLayout::eTransferSrcOptimal,
+        output->get(), vk::ImageLayout::eTransferDstOptimal, 1, &blit,
+        vk::Filter::eLinear);
   }
+
+  src_width = dst_width / kSsdoAccelDownsampleFactor;
+  src_height = dst_height / kSsdoAccelDownsampleFactor;
+  TexturePtr unpacked_ssdo_acceleration =
+      ssdo_accelerator_->UnpackLookupTable(current_frame(), ssdo_acceleration,
+                                           src_width, src_height, this);
+  FTL_DCHECK(unpacked_ssdo_acceleration->width() ==
+             static_cast<uint32_t>(src_width));
+  FTL_DCHECK(unpacked_ssdo_acceleration->height() ==
+             static_cast<uint32_t>(src_height));
+  blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+  blit.srcOffsets[1] = vk::Offset3D{src_width, src_height, 1};
+  blit.dstOffsets[0] = vk::Offset3D{dst_width * 3 / 4, dst_height * 1 / 4, 0};
+  blit.dstOffsets[1] = vk::Offset3D{dst_width, dst_height * 1 / 2, 1};
+  current_frame()->get().blitImage(unpacked_ssdo_acceleration->image()->get(),
+                                   vk::ImageLayout::eGeneral, output->get(),
+                                   vk::ImageLayout::eTransferDstOptimal, 1,
+                                   &blit, vk::Filter::eNearest);
+
+  AddTimestamp("finished blitting debug overlay");
 }
 
 void PaperRenderer::DrawFrame(const Stage& stage,
@@ -327,167 +337,271 @@ void PaperRenderer::DrawFrame(const Stage& stage,
                               const ImagePtr& color_image_out,
                               const SemaphorePtr& frame_done,
                               FrameRetiredCallback frame_retired_callback) {
+  typedef impl::RenderGraph::Usage Usage;
+
   UpdateModelRenderer(color_image_out->format(), color_image_out->format());
+  per_object_bytes_written_ = 0;
 
   uint32_t width = color_image_out->width();
   uint32_t height = color_image_out->height();
 
   BeginFrame();
 
-  // Downsized depth-only prepass for SSDO acceleration.
   FTL_CHECK(width % kSsdoAccelDownsampleFactor == 0);
   FTL_CHECK(height % kSsdoAccelDownsampleFactor == 0);
   uint32_t ssdo_accel_width = width / kSsdoAccelDownsampleFactor;
   uint32_t ssdo_accel_height = height / kSsdoAccelDownsampleFactor;
-  ImagePtr ssdo_accel_depth_image = image_cache_->NewDepthImage(
-      depth_format_, ssdo_accel_width, ssdo_accel_height,
-      vk::ImageUsageFlagBits::eSampled);
-  TexturePtr ssdo_accel_depth_texture = ftl::MakeRefCounted<Texture>(
-      escher_->resource_life_preserver(), ssdo_accel_depth_image,
-      vk::Filter::eNearest, vk::ImageAspectFlagBits::eDepth,
-      // TODO: use a more descriptive enum than true.
-      true);
-  {
+
+  // Each pass declares the images that it reads and writes; the graph records
+  // the barriers and layout transitions between passes, culls passes whose
+  // output is unused (e.g. the SSDO passes if lighting is disabled), and
+  // aliases the memory of intermediate images whose lifetimes don't overlap.
+  impl::RenderGraph graph(image_cache_, escher_->frame_gpu_allocator());
+
+  // ModelRenderer's lighting render-pass leaves the color-attachment format
+  // as eColorAttachmentOptimal, since it's not clear how it will be used
+  // next.
+  // We could push this flexibility farther by letting our client specify the
+  // desired output format, but for now we'll assume that the image is being
+  // presented immediately.
+  // The first pass that renders into |color_image_out| waits for its
+  // semaphore.
+  auto output = graph.ImportImage(
+      color_image_out, vk::ImageLayout::eUndefined,
+      vk::ImageLayout::ePresentSrcKHR,
+      vk::PipelineStageFlagBits::eColorAttachmentOutput |
+          vk::PipelineStageFlagBits::eTransfer);
+  auto ssdo_accel_depth = graph.CreateImage(
+      {depth_format_, ssdo_accel_width, ssdo_accel_height, 1,
+       vk::ImageUsageFlagBits::eDepthStencilAttachment |
+           vk::ImageUsageFlagBits::eSampled});
+  // Created by SsdoAccelerator::GenerateLookupTable().
+  auto ssdo_accel_table = graph.DeclareImage();
+  auto depth = graph.CreateImage(
+      {depth_format_, width, height, 1,
+       vk::ImageUsageFlagBits::eDepthStencilAttachment |
+           vk::ImageUsageFlagBits::eSampled |
+           vk::ImageUsageFlagBits::eTransferSrc});
+  // |illum2| only lives during the filter passes, so it can share memory with
+  // e.g. |ssdo_accel_depth|.
+  auto illum1 = graph.CreateImage(
+      {impl::SsdoSampler::kColorFormat, width, height, 1,
+       vk::ImageUsageFlagBits::eSampled |
+           vk::ImageUsageFlagBits::eColorAttachment |
+           vk::ImageUsageFlagBits::eStorage |
+           vk::ImageUsageFlagBits::eTransferSrc});
+  auto illum2 = graph.CreateImage(
+      {impl::SsdoSampler::kColorFormat, width, height, 1,
+       vk::ImageUsageFlagBits::eSampled |
+           vk::ImageUsageFlagBits::eColorAttachment |
+           vk::ImageUsageFlagBits::eStorage |
+           vk::ImageUsageFlagBits::eTransferSrc});
+
+  TexturePtr ssdo_accelerator_texture;
+
+  // Downsized depth-only prepass for SSDO acceleration.
+  auto pass = graph.AddPass("SSDO acceleration depth pre-pass", [&](
+      impl::CommandBuffer* command_buffer) {
     // TODO: maybe share this with SsdoAccelerator::GenerateLookupTable().
     // However, this would require refactoring to match the color format
     // expected by ModelRenderer.
-    ImagePtr ssdo_accel_dummy_color_image = image_cache_->NewImage(
-        {color_image_out->format(), ssdo_accel_width, ssdo_accel_height, 1,
-         vk::ImageUsageFlagBits::eColorAttachment});
-
-    DrawDepthPrePass(ssdo_accel_depth_image, ssdo_accel_dummy_color_image,
-                     stage, model);
+    ImagePtr ssdo_accel_dummy_color_image =
+        image_cache_->NewTransientAttachmentImage(
+            {color_image_out->format(), ssdo_accel_width, ssdo_accel_height, 1,
+             vk::ImageUsageFlagBits::eColorAttachment});
+
+    DrawDepthPrePass(graph.GetImage(ssdo_accel_depth),
+                     ssdo_accel_dummy_color_image, stage, model,
+                     &previous_ssdo_accel_depth_display_list_);
     SubmitPartialFrame();
 
     AddTimestamp("finished SSDO acceleration depth pre-pass");
-  }
+  });
+  graph.Write(pass, ssdo_accel_depth, Usage::kDepthAttachment);
 
   // Compute SSDO acceleration structure.
-  TexturePtr ssdo_accelerator_texture = ssdo_accelerator_->GenerateLookupTable(
-      current_frame(), ssdo_accel_depth_texture,
-      vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc,
-      this);
-  SubmitPartialFrame();
+  pass = graph.AddPass("SSDO acceleration lookup table", [&](
+      impl::CommandBuffer* command_buffer) {
+    TexturePtr ssdo_accel_depth_texture = ftl::MakeRefCounted<Texture>(
+        escher_->resource_life_preserver(), graph.GetImage(ssdo_accel_depth),
+        vk::Filter::eNearest, vk::ImageAspectFlagBits::eDepth,
+        // TODO: use a more descriptive enum than true.
+        true);
+    ssdo_accelerator_texture = ssdo_accelerator_->GenerateLookupTable(
+        command_buffer, ssdo_accel_depth_texture,
+        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc,
+        this);
+    graph.SetImage(ssdo_accel_table, ssdo_accelerator_texture->image());
+    SubmitPartialFrame();
+  });
+  graph.Read(pass, ssdo_accel_depth, Usage::kComputeShaderRead);
+  graph.Write(pass, ssdo_accel_table, Usage::kShaderStorage);
 
   // Depth-only pre-pass.
-  ImagePtr depth_image = image_cache_->NewDepthImage(
-      depth_format_, width, height,
-      vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc);
-  {
-    current_frame()->TakeWaitSemaphore(
+  pass = graph.AddPass("depth pre-pass", [&](
+      impl::CommandBuffer* command_buffer) {
+    command_buffer->TakeWaitSemaphore(
         color_image_out, vk::PipelineStageFlagBits::eColorAttachmentOutput);
 
-    DrawDepthPrePass(depth_image, color_image_out, stage, model);
+    DrawDepthPrePass(graph.GetImage(depth), color_image_out, stage, model,
+                     &previous_depth_display_list_);
     SubmitPartialFrame();
 
     AddTimestamp("finished depth pre-pass");
-  }
-
-  // Compute the illumination and store the result in a texture.
-  TexturePtr illumination_texture;
-  if (enable_lighting_) {
-    ImagePtr illum1 = image_cache_->NewImage(
-        {impl::SsdoSampler::kColorFormat, width, height, 1,
-         vk::ImageUsageFlagBits::eSampled |
-             vk::ImageUsageFlagBits::eColorAttachment |
-             vk::ImageUsageFlagBits::eStorage |
-             vk::ImageUsageFlagBits::eTransferSrc});
-
-    ImagePtr illum2 = image_cache_->NewImage(
-        {impl::SsdoSampler::kColorFormat, width, height, 1,
-         vk::ImageUsageFlagBits::eSampled |
-             vk::ImageUsageFlagBits::eColorAttachment |
-             vk::ImageUsageFlagBits::eStorage |
-             vk::ImageUsageFlagBits::eTransferSrc});
-
-    DrawSsdoPasses(depth_image, illum1, illum2, ssdo_accelerator_texture,
-                   stage);
-    SubmitPartialFrame();
+  });
+  graph.Write(pass, depth, Usage::kDepthAttachment);
+  graph.Write(pass, output, Usage::kColorAttachment);
 
-    illumination_texture = ftl::MakeRefCounted<Texture>(
-        escher_->resource_life_preserver(), illum1, vk::Filter::eNearest);
+  // Compute the illumination and store the result in |illum1|.  These passes
+  // are culled unless the illumination is used below.
+#if SSDO_SAMPLING_USES_KERNEL
+  const Usage kSsdoSamplingDepthUsage = Usage::kShaderStorage;
+  const Usage kSsdoSamplingOutputUsage = Usage::kShaderStorage;
+  const vk::ImageLayout kSsdoSamplingOutputLayout = vk::ImageLayout::eGeneral;
+#else
+  const Usage kSsdoSamplingDepthUsage = Usage::kFragmentShaderRead;
+  const Usage kSsdoSamplingOutputUsage = Usage::kColorAttachment;
+  // The final layout of SsdoSampler's render pass.
+  const vk::ImageLayout kSsdoSamplingOutputLayout =
+      vk::ImageLayout::eShaderReadOnlyOptimal;
+#endif
+  pass = graph.AddPass("SSDO sampling", [&](
+      impl::CommandBuffer* command_buffer) {
+    DrawSsdoSamplingPass(graph.GetImage(depth), graph.GetImage(illum1),
+                         ssdo_accelerator_texture, stage);
+    if (kSkipFiltering) {
+      SubmitPartialFrame();
+    }
+  });
+  graph.Read(pass, depth, kSsdoSamplingDepthUsage);
+  graph.Read(pass, ssdo_accel_table, Usage::kFragmentShaderRead);
+  graph.Write(pass, illum1, kSsdoSamplingOutputUsage,
+              kSsdoSamplingOutputLayout);
 
-    // Done after previous SubmitPartialFrame(), because this is needed by the
-    // final lighting pass.
-    illumination_texture->KeepAlive(current_frame());
+  // Do two filter passes, one horizontal and one vertical.
+  if (!kSkipFiltering) {
+    pass = graph.AddPass("SSDO filter pass 1", [&](
+        impl::CommandBuffer* command_buffer) {
+      DrawSsdoFilterPass(graph.GetImage(illum1), graph.GetImage(illum2),
+                         ssdo_accelerator_texture,
+                         vec2(1.f / stage.viewing_volume().width(), 0.f),
+                         stage);
+      AddTimestamp("finished SSDO filter pass 1");
+    });
+    graph.Read(pass, illum1, Usage::kFragmentShaderRead);
+    graph.Read(pass, ssdo_accel_table, Usage::kFragmentShaderRead);
+    graph.Write(pass, illum2, Usage::kColorAttachment,
+                vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    pass = graph.AddPass("SSDO filter pass 2", [&](
+        impl::CommandBuffer* command_buffer) {
+      DrawSsdoFilterPass(graph.GetImage(illum2), graph.GetImage(illum1),
+                         ssdo_accelerator_texture,
+                         vec2(0.f, 1.f / stage.viewing_volume().height()),
+                         stage);
+      AddTimestamp("finished SSDO filter pass 2");
+      SubmitPartialFrame();
+    });
+    graph.Read(pass, illum2, Usage::kFragmentShaderRead);
+    graph.Read(pass, ssdo_accel_table, Usage::kFragmentShaderRead);
+    graph.Write(pass, illum1, Usage::kColorAttachment,
+                vk::ImageLayout::eShaderReadOnlyOptimal);
   }
 
-  // Use multisampling for final lighting pass, or not.
-  if (kLightingPassSampleCount == 1) {
+  auto make_illumination_texture = [&]() {
+    if (!enable_lighting_) {
+      return TexturePtr();
+    }
+    auto texture = ftl::MakeRefCounted<Texture>(
+        escher_->resource_life_preserver(), graph.GetImage(illum1),
+        vk::Filter::eNearest);
+    texture->KeepAlive(current_frame());
+    return texture;
+  };
+
+  // Without SSDO, nothing needs the depth buffer between the depth pre-pass
+  // and the lighting pass, so they can be subpasses of a single render pass.
+  const bool use_depth_and_lighting_pass =
+      use_depth_and_lighting_pass_ && !enable_lighting_;
+  const bool multisampled = sample_count_ > 1;
+  // Otherwise, the lighting pass clears and reuses the depth pre-pass' buffer.
+  const bool use_transient_depth =
+      multisampled || use_depth_and_lighting_pass;
+
+  const char* lighting_pass_name = use_depth_and_lighting_pass
+                                       ? "depth pre-pass and lighting pass"
+                                       : "lighting pass";
+  pass = graph.AddPass(lighting_pass_name, [&](
+      impl::CommandBuffer* command_buffer) {
+    // Only needed if the depth pre-pass was culled.
+    command_buffer->TakeWaitSemaphore(
+        color_image_out, vk::PipelineStageFlagBits::eColorAttachmentOutput);
+
+    // Multisampled attachments never leave the render pass: the color is
+    // resolved into |color_image_out| at the end of the pass.  Like a depth
+    // buffer that is discarded after the pass, a tile-based GPU doesn't
+    // actually need memory for them.
+    std::vector<ImagePtr> attachments;
+    if (multisampled) {
+      attachments.push_back(image_cache_->NewTransientAttachmentImage(
+          {color_image_out->format(), width, height, sample_count_,
+           vk::ImageUsageFlagBits::eColorAttachment}));
+    } else {
+      attachments.push_back(color_image_out);
+    }
+    if (use_transient_depth) {
+      attachments.push_back(image_cache_->NewTransientAttachmentImage(
+          {depth_format_, width, height, sample_count_,
+           vk::ImageUsageFlagBits::eDepthStencilAttachment}));
+    } else {
+      attachments.push_back(graph.GetImage(depth));
+    }
+    if (multisampled) {
+      attachments.push_back(color_image_out);
+    }
+
     FramebufferPtr lighting_fb = ftl::MakeRefCounted<Framebuffer>(
-        escher_, width, height,
-        std::vector<ImagePtr>{color_image_out, depth_image},
-        model_renderer_->lighting_pass());
-
-    lighting_fb->KeepAlive(current_frame());
-
-    DrawLightingPass(kLightingPassSampleCount, lighting_fb,
-                     illumination_texture, stage, model);
-
-    AddTimestamp("finished lighting pass");
-  } else {
-    ImageInfo info;
-    info.width = width;
-    info.height = height;
-    info.sample_count = kLightingPassSampleCount;
-    info.format = color_image_out->format();
-    info.usage = vk::ImageUsageFlagBits::eColorAttachment |
-                 vk::ImageUsageFlagBits::eTransferSrc;
-    ImagePtr color_image_multisampled = image_cache_->NewImage(info);
-
-    // TODO: use lazily-allocated image: since we don't care about saving the
-    // depth buffer, a tile-based GPU doesn't actually need this memory.
-    info.format = depth_format_;
-    info.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
-    ImagePtr depth_image_multisampled = image_cache_->NewImage(info);
-
-    FramebufferPtr multisample_fb = ftl::MakeRefCounted<Framebuffer>(
-        escher_, width, height,
-        std::vector<ImagePtr>{color_image_multisampled,
-                              depth_image_multisampled},
-        model_renderer_->lighting_pass());
-
-    multisample_fb->KeepAlive(current_frame());
-
-    DrawLightingPass(kLightingPassSampleCount, multisample_fb,
-                     illumination_texture, stage, model);
-
-    AddTimestamp("finished lighting pass");
-
-    // TODO: do this during lighting sub-pass by adding a resolve attachment.
-    vk::ImageResolve resolve;
-    vk::ImageSubresourceLayers layers;
-    layers.aspectMask = vk::ImageAspectFlagBits::eColor;
-    layers.mipLevel = 0;
-    layers.baseArrayLayer = 0;
-    layers.layerCount = 1;
-    resolve.srcSubresource = layers;
-    resolve.srcOffset = vk::Offset3D{0, 0, 0};
-    resolve.dstSubresource = layers;
-    resolve.dstOffset = vk::Offset3D{0, 0, 0};
-    resolve.extent = vk::Extent3D{width, height, 0};
-    current_frame()->get().resolveImage(
-        color_image_multisampled->get(),
-        vk::ImageLayout::eColorAttachmentOptimal, color_image_out->get(),
-        vk::ImageLayout::eColorAttachmentOptimal, resolve);
-
-    AddTimestamp("finished multisample resolve");
+        escher_, width, height, std::move(attachments),
+        use_depth_and_lighting_pass
+            ? model_renderer_->depth_and_lighting_pass()
+            : model_renderer_->lighting_pass());
+
+    if (use_depth_and_lighting_pass) {
+      DrawDepthAndLightingPass(sample_count_, lighting_fb, stage, model);
+      AddTimestamp("finished depth pre-pass and lighting pass");
+    } else {
+      DrawLightingPass(sample_count_, lighting_fb, make_illumination_texture(),
+                       stage, model);
+      AddTimestamp("finished lighting pass");
+    }
+  });
+  graph.Write(pass, output, Usage::kColorAttachment);
+  if (!use_transient_depth) {
+    // The lighting pass clears the depth buffer.
+    graph.Write(pass, depth, Usage::kDepthAttachment);
+  }
+  if (enable_lighting_) {
+    graph.Read(pass, illum1, Usage::kFragmentShaderRead);
   }
 
-  DrawDebugOverlays(
-      color_image_out, depth_image,
-      illumination_texture ? illumination_texture->image() : ImagePtr(),
-      ssdo_accelerator_texture);
+  if (show_debug_info_) {
+    pass = graph.AddPass("debug overlays", [&](
+        impl::CommandBuffer* command_buffer) {
+      DrawDebugOverlays(
+          color_image_out,
+          enable_lighting_ ? graph.GetImage(illum1) : ImagePtr(),
+          ssdo_accelerator_texture);
+    });
+    graph.Read(pass, output, Usage::kTransferDst);
+    graph.Write(pass, output, Usage::kTransferDst);
+    if (enable_lighting_) {
+      graph.Read(pass, illum1, Usage::kTransferSrc);
+    }
+    // Unpacked by a compute kernel.
+    graph.Read(pass, ssdo_accel_table, Usage::kShaderStorage);
+  }
 
-  // ModelRenderer's lighting render-pass leaves the color-attachment format
-  // as eColorAttachmentOptimal, since it's not clear how it will be used
-  // next.
-  // We could push this flexibility farther by letting our client specify the
-  // desired output format, but for now we'll assume that the image is being
-  // presented immediately.
-  current_frame()->TransitionImageLayout(
-      color_image_out, vk::ImageLayout::eColorAttachmentOptimal,
-      vk::ImageLayout::ePresentSrcKHR);
+  graph.Execute([this]() { return current_frame(); });
 
   AddTimestamp("finished transition to presentation layout");
 
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "escher/forward_declarations.h"
+#include "escher/geometry/types.h"
 #include "escher/renderer/renderer.h"
 
 namespace escher {
@@ -23,10 +24,50 @@ class PaperRenderer : public Renderer {
   // Set whether SSDO lighting model is used.
   void set_enable_lighting(bool b) { enable_lighting_ = b; }
 
-  // Set whether objects should be sorted by their pipeline, or rendered in the
-  // order that they are provided by the caller.
+  // Set whether, when SSDO lighting is disabled, the depth pre-pass and the
+  // lighting pass are subpasses of a single render pass.  The lighting
+  // subpass then only shades visible fragments, and the depth buffer never
+  // leaves the GPU's tile memory.
+  void set_use_depth_and_lighting_pass(bool b) {
+    use_depth_and_lighting_pass_ = b;
+  }
+
+  // Set the number of samples per pixel of the lighting pass; 1 disables
+  // multisampling.  The multisampled color is resolved within the render pass,
+  // and the multisampled attachments are transient.  The device must support
+  // this sample count for both color and depth attachments.
+  void set_sample_count(uint32_t count) { sample_count_ = count; }
+
+  // Set whether objects should be sorted by their pipeline (and front-to-back
+  // within each pipeline), or rendered in the order that they are provided by
+  // the caller.
   void set_sort_by_pipeline(bool b) { sort_by_pipeline_ = b; }
 
+  // Set the maximum number of threads that build each display list.  Only
+  // large models are split among multiple threads.
+  void set_display_list_worker_count(uint32_t count) {
+    display_list_worker_count_ = count;
+  }
+
+  // Set whether consecutive objects that share a mesh and texture should be
+  // drawn with a single instanced draw call.
+  void set_use_instancing(bool b) { use_instancing_ = b; }
+
+  // Set whether each object should have its own descriptor set, instead of
+  // sharing one with the other objects that have the same texture, and
+  // selecting its data with a dynamic uniform offset.
+  void set_use_descriptor_set_per_object(bool b) {
+    use_descriptor_set_per_object_ = b;
+  }
+
+  // Set whether the data of untextured objects without shape modifiers should
+  // be passed as push constants, instead of in uniform buffers.
+  void set_use_push_constants(bool b) { use_push_constants_ = b; }
+
+  // Number of bytes of per-object data (uniforms, instance data and push
+  // constants) that were written by the last frame.
+  size_t per_object_bytes_written() const { return per_object_bytes_written_; }
+
   // Cycle through the available SSDO acceleration modes.  This is a temporary
   // API: eventually there will only be one mode (the best one!), but this is
   // useful during development.
@@ -41,38 +82,51 @@ class PaperRenderer : public Renderer {
   static constexpr uint32_t kFramebufferDepthAttachmentIndex = 1;
 
   // Render pass that generates a depth buffer, but no color fragments.  The
-  // resulting depth buffer is used by DrawSsdoPasses() in order to compute
-  // per-pixel occlusion, and by DrawLightingPass().
+  // resulting depth buffer is used by DrawSsdoSamplingPass() in order to
+  // compute per-pixel occlusion.  |display_list| holds the display list that
+  // was used by the same pass during the previous frame (if any), and is
+  // replaced by the one used by this frame.
   void DrawDepthPrePass(const ImagePtr& depth_image,
                         const ImagePtr& dummy_color_image,
                         const Stage& stage,
-                        const Model& model);
-
-  // Multiple render passes.  The first samples the depth buffer to generate
-  // per-pixel occlusion information, and subsequent passes filter this noisy
-  // data.
-  void DrawSsdoPasses(const ImagePtr& depth_in,
-                      const ImagePtr& color_out,
-                      const ImagePtr& color_aux,
-                      const TexturePtr& accelerator_texture,
-                      const Stage& stage);
-
-  // Render pass that renders the fully-lit/shadowed scene.  Uses the depth
-  // buffer from DrawDepthPrePass(), and the illumination texture from
-  // DrawSsdoPasses().
-  // TODO: on GPUs that use tiled rendering, it may be faster simply clear the
-  // depth buffer instead of reusing the values from DrawDepthPrePass().  This
-  // might save bandwidth at the cost of more per-fragment computation (but
-  // the latter might be mitigated by sorting front-to-back, etc.).  Revisit
-  // after doing performance profiling.
+                        const Model& model,
+                        impl::ModelDisplayListPtr* display_list);
+
+  // Render pass that samples the depth buffer to generate noisy per-pixel
+  // occlusion information.
+  void DrawSsdoSamplingPass(const ImagePtr& depth_in,
+                            const ImagePtr& color_out,
+                            const TexturePtr& accelerator_texture,
+                            const Stage& stage);
+
+  // Render pass that filters the output of DrawSsdoSamplingPass() in one
+  // direction; this is done twice, horizontally and then vertically.
+  void DrawSsdoFilterPass(const ImagePtr& color_in,
+                          const ImagePtr& color_out,
+                          const TexturePtr& accelerator_texture,
+                          const vec2& stride,
+                          const Stage& stage);
+
+  // Render pass that renders the fully-lit/shadowed scene.  Uses the
+  // illumination texture from the SSDO passes.
   void DrawLightingPass(uint32_t sample_count,
                         const FramebufferPtr& framebuffer,
                         const TexturePtr& illumination_texture,
                         const Stage& stage,
                         const Model& model);
 
+  // Render pass that performs a depth pre-pass and then renders the unlit
+  // scene, as two subpasses.  Used instead of DrawLightingPass() when there is
+  // no SSDO illumination.
+  void DrawDepthAndLightingPass(uint32_t sample_count,
+                                const FramebufferPtr& framebuffer,
+                                const Stage& stage,
+                                const Model& model);
+
+  // Blit the illumination (if any) and the SSDO acceleration table into the
+  // corner of |output|, which must be in eTransferDstOptimal layout.
+  // |illumination| must be in eTransferSrcOptimal layout.
   void DrawDebugOverlays(const ImagePtr& output,
-                         const ImagePtr& depth,
                          const ImagePtr& illumination,
                          const TexturePtr& ssdo_acceleration);
 
@@ -91,6 +145,20 @@ class PaperRenderer : public Renderer {
   bool show_debug_info_ = false;
   bool enable_lighting_ = true;
   bool sort_by_pipeline_ = true;
+  bool use_depth_and_lighting_pass_ = false;
+  uint32_t sample_count_ = 1;
+  uint32_t display_list_worker_count_ = 1;
+  bool use_instancing_ = true;
+  bool use_descriptor_set_per_object_ = false;
+  bool use_push_constants_ = true;
+  size_t per_object_bytes_written_ = 0;
+
+  // The display lists used by the previous frame.  Each is passed to
+  // ModelRenderer::CreateDisplayList() by the next frame, so that the
+  // descriptor sets of objects that haven't changed can be reused.
+  impl::ModelDisplayListPtr previous_ssdo_accel_depth_display_list_;
+  impl::ModelDisplayListPtr previous_depth_display_list_;
+  impl::ModelDisplayListPtr previous_lighting_display_list_;
 
   FRIEND_REF_COUNTED_THREAD_SAFE(PaperRenderer);
   FTL_DISALLOW_COPY_AND_ASSIGN(PaperRenderer);
@@ -6,6 +6,8 @@
 
 #include "escher/impl/command_buffer_pool.h"
 #include "escher/impl/escher_impl.h"
+#include "escher/impl/frame_gpu_allocator.h"
+#include "escher/impl/gpu_uploader.h"
 #include "escher/impl/image_cache.h"
 #include "escher/impl/vulkan_utils.h"
 #include "escher/profiling/timestamp_profiler.h"
@@ -28,11 +30,34 @@ Renderer::~Renderer() {
   escher_->DecrementRendererCount();
 }
 
+void Renderer::set_max_frames_in_flight(uint32_t count) {
+  FTL_DCHECK(count > 0);
+  max_frames_in_flight_ = count;
+}
+
+void Renderer::WaitForAvailableFrame() {
+  frame_wait_stopwatch_.Start();
+  while (frames_in_flight_.size() >= max_frames_in_flight_) {
+    pool_->WaitUntilFinished(frames_in_flight_.front());
+    frames_in_flight_.pop();
+  }
+  frame_wait_stopwatch_.Stop();
+}
+
 void Renderer::BeginFrame() {
   FTL_DCHECK(!current_frame_);
+  WaitForAvailableFrame();
   ++frame_number_;
   current_frame_ = pool_->GetCommandBuffer();
 
+  // Submit all uploads that were made since the previous frame in a single
+  // batch, which must finish before this frame uses the uploaded resources.
+  current_frame_->AddWaitSemaphore(escher_->gpu_uploader()->Flush(),
+                                   vk::PipelineStageFlagBits::eAllCommands);
+  // Images that were uploaded with a mip chain have only their first level
+  // defined; blit the others before the frame samples them.
+  escher_->image_cache()->GenerateMipmaps(current_frame_);
+
   FTL_DCHECK(!profiler_);
   if (enable_profiling_ && escher_->supports_timer_queries()) {
     profiler_ = ftl::MakeRefCounted<TimestampProfiler>(
@@ -44,20 +69,37 @@ void Renderer::BeginFrame() {
 
 void Renderer::SubmitPartialFrame() {
   FTL_DCHECK(current_frame_);
-  current_frame_->Submit(context_.queue, nullptr);
+  if (!submit_partial_frames_) {
+    return;
+  }
+  SubmitCurrentFrame(nullptr);
+  submit_stopwatch_.Start();
   current_frame_ = pool_->GetCommandBuffer();
+  submit_stopwatch_.Stop();
+}
+
+void Renderer::SubmitCurrentFrame(FrameRetiredCallback callback) {
+  // Resources may also be uploaded while the frame is recorded (e.g. the
+  // meshes of a new ModelRenderer); submit them before the frame that uses
+  // them.
+  current_frame_->AddWaitSemaphore(escher_->gpu_uploader()->Flush(),
+                                   vk::PipelineStageFlagBits::eAllCommands);
+  submit_stopwatch_.Start();
+  current_frame_->Submit(context_.queue, std::move(callback));
+  submit_stopwatch_.Stop();
+  ++submit_count_;
 }
 
 void Renderer::EndFrame(const SemaphorePtr& frame_done,
                         FrameRetiredCallback frame_retired_callback) {
   FTL_DCHECK(current_frame_);
+  uint64_t sequence_number = current_frame_->sequence_number();
   current_frame_->AddSignalSemaphore(frame_done);
   if (profiler_) {
     // Avoid implicit reference to this in closure.
     TimestampProfilerPtr profiler = std::move(profiler_);
     auto frame_number = frame_number_;
-    current_frame_->Submit(context_.queue, [frame_retired_callback, profiler,
-                                            frame_number]() {
+    SubmitCurrentFrame([frame_retired_callback, profiler, frame_number]() {
       if (frame_retired_callback) {
         frame_retired_callback();
       }
@@ -79,9 +121,13 @@ void Renderer::EndFrame(const SemaphorePtr& frame_done,
       FTL_LOG(INFO) << "------------------------------------------------------";
     });
   } else {
-    current_frame_->Submit(context_.queue, std::move(frame_retired_callback));
+    SubmitCurrentFrame(std::move(frame_retired_callback));
   }
   current_frame_ = nullptr;
+  frames_in_flight_.push(sequence_number);
+
+  // Transient memory used by this frame can be reused once it is finished.
+  escher_->frame_gpu_allocator()->EndFrame(sequence_number);
 
   escher_->Cleanup();
 }
@@ -100,6 +146,9 @@ void Renderer::RunOffscreenBenchmark(const VulkanContext& context,
                                      vk::Format framebuffer_format,
                                      size_t frame_count) {
   constexpr uint64_t kSecondsToNanoseconds = 1000000000;
+  // If the CPU spends more than this fraction of each frame waiting for the
+  // GPU, the benchmark is reported as GPU-bound.
+  constexpr double kGpuBoundWaitFraction = 0.1;
 
   // Create the images that we will render into, and the semaphores that will
   // prevent us from rendering into the same image concurrently.  At the same
@@ -133,55 +182,119 @@ void Renderer::RunOffscreenBenchmark(const VulkanContext& context,
               command_buffer->Wait(kSwapchainSize * kSecondsToNanoseconds));
   }
 
-  // Render the benchmark frames.
-  Stopwatch stopwatch;
-  stopwatch.Start();
+  // Render the benchmark frames.  Return the elapsed time in seconds, and
+  // accumulate the CPU time spent in DrawFrame() into |draw_stopwatch|.
+  auto run_benchmark = [&](bool profile_last_frame,
+                           Stopwatch* draw_stopwatch) {
+    Stopwatch stopwatch;
+    stopwatch.Start();
 
-  impl::CommandBuffer* throttle = nullptr;
-  for (size_t current_frame = 0; current_frame < frame_count; ++current_frame) {
-    size_t image_index = current_frame % kSwapchainSize;
+    for (size_t current_frame = 0; current_frame < frame_count;
+         ++current_frame) {
+      size_t image_index = current_frame % kSwapchainSize;
 
-    auto command_buffer = pool_->GetCommandBuffer();
-    command_buffer->AddWaitSemaphore(semaphores[image_index],
-                                     vk::PipelineStageFlagBits::eBottomOfPipe);
-    command_buffer->Submit(context_.queue, nullptr);
+      // Don't render into an image until the previous frame that was rendered
+      // into it has finished.  BeginFrame() prevents the CPU from getting more
+      // than max_frames_in_flight() frames ahead of the GPU.
+      auto command_buffer = pool_->GetCommandBuffer();
+      command_buffer->AddWaitSemaphore(
+          semaphores[image_index], vk::PipelineStageFlagBits::eBottomOfPipe);
+      command_buffer->Submit(context_.queue, nullptr);
 
-    // Don't get too many frames ahead of the GPU.  Every time we cycle through
-    // all images, wait for the previous frame that was rendered to that image
-    // to finish.
-    if (image_index == 0) {
-      if (throttle) {
-        FTL_CHECK(vk::Result::eSuccess ==
-                  throttle->Wait(kSwapchainSize * kSecondsToNanoseconds));
+      if (profile_last_frame && current_frame == frame_count - 1) {
+        set_enable_profiling(true);
       }
-      throttle = command_buffer;
-    }
 
-    if (current_frame == frame_count - 1) {
-      set_enable_profiling(true);
+      draw_stopwatch->Start();
+      DrawFrame(stage, model, images[image_index], semaphores[image_index],
+                nullptr);
+      draw_stopwatch->Stop();
+
+      set_enable_profiling(false);
     }
 
-    DrawFrame(stage, model, images[image_index], semaphores[image_index],
-              nullptr);
+    // Wait for the last frame to finish.  Signal its semaphore again, so that
+    // it can be waited upon by the next run.
+    auto command_buffer = pool_->GetCommandBuffer();
+    auto& last_semaphore = semaphores[(frame_count - 1) % kSwapchainSize];
+    command_buffer->AddWaitSemaphore(last_semaphore,
+                                     vk::PipelineStageFlagBits::eBottomOfPipe);
+    command_buffer->AddSignalSemaphore(last_semaphore);
+    command_buffer->Submit(context.queue, nullptr);
+    FTL_CHECK(vk::Result::eSuccess ==
+              command_buffer->Wait(kSwapchainSize * kSecondsToNanoseconds));
+    stopwatch.Stop();
+    return stopwatch.GetElapsedSeconds();
+  };
 
-    set_enable_profiling(false);
-  }
+  // Run the benchmark in the current submission mode, and then in the other
+  // one, in order to measure the overhead of submitting partial frames.
+  const bool submit_partial_frames = submit_partial_frames_;
+  double seconds[2];
+  double submits_per_frame[2];
+  double submit_microseconds_per_frame[2];
+  // CPU time per frame spent recording and submitting, and blocked in
+  // WaitForAvailableFrame().
+  double cpu_microseconds_per_frame[2];
+  double wait_microseconds_per_frame[2];
+  for (int run = 0; run < 2; ++run) {
+    submit_partial_frames_ = run == 0 ? submit_partial_frames
+                                      : !submit_partial_frames;
+    submit_count_ = 0;
+    submit_stopwatch_.Reset();
+    frame_wait_stopwatch_.Reset();
+    Stopwatch draw_stopwatch(false);
 
-  // Wait for the last frame to finish.
-  auto command_buffer = pool_->GetCommandBuffer();
-  command_buffer->AddWaitSemaphore(
-      semaphores[(frame_count - 1) % kSwapchainSize],
-      vk::PipelineStageFlagBits::eBottomOfPipe);
-  command_buffer->Submit(context.queue, nullptr);
-  FTL_CHECK(vk::Result::eSuccess ==
-            command_buffer->Wait(kSwapchainSize * kSecondsToNanoseconds));
-  stopwatch.Stop();
+    seconds[run] = run_benchmark(run == 0, &draw_stopwatch);
+
+    submits_per_frame[run] = static_cast<double>(submit_count_) / frame_count;
+    submit_microseconds_per_frame[run] =
+        static_cast<double>(submit_stopwatch_.GetElapsedMicroseconds()) /
+        frame_count;
+    uint64_t wait_microseconds = frame_wait_stopwatch_.GetElapsedMicroseconds();
+    wait_microseconds_per_frame[run] =
+        static_cast<double>(wait_microseconds) / frame_count;
+    cpu_microseconds_per_frame[run] =
+        static_cast<double>(draw_stopwatch.GetElapsedMicroseconds() -
+                            wait_microseconds) /
+        frame_count;
+  }
+  submit_partial_frames_ = submit_partial_frames;
 
   FTL_LOG(INFO) << "------------------------------------------------------";
-  FTL_LOG(INFO) << "Offscreen benchmark";
-  FTL_LOG(INFO) << "Rendered " << frame_count << " frames in "
-                << stopwatch.GetElapsedSeconds() << " seconds";
-  FTL_LOG(INFO) << (frame_count / stopwatch.GetElapsedSeconds()) << " FPS";
+  FTL_LOG(INFO) << "Offscreen benchmark, with up to " << max_frames_in_flight_
+                << " frames in flight";
+  for (int run = 0; run < 2; ++run) {
+    bool partial = run == 0 ? submit_partial_frames : !submit_partial_frames;
+    FTL_LOG(INFO) << (partial ? "Partial-frame submission:"
+                              : "Single submission per frame:");
+    FTL_LOG(INFO) << "  Rendered " << frame_count << " frames in "
+                  << seconds[run] << " seconds";
+    FTL_LOG(INFO) << "  " << (frame_count / seconds[run]) << " FPS";
+    FTL_LOG(INFO) << "  " << submits_per_frame[run] << " submits per frame, "
+                  << submit_microseconds_per_frame[run]
+                  << " microseconds per frame submitting";
+    // If the CPU has to wait for the GPU to finish a frame before it can begin
+    // the next one, then the GPU is the bottleneck, and the frame time is the
+    // GPU's.  Otherwise, the GPU is idle while it waits for the CPU.
+    double frame_microseconds = 1000000.0 * seconds[run] / frame_count;
+    bool gpu_bound = wait_microseconds_per_frame[run] >
+                     kGpuBoundWaitFraction * frame_microseconds;
+    FTL_LOG(INFO) << "  " << cpu_microseconds_per_frame[run]
+                  << " microseconds of CPU time per frame, "
+                  << wait_microseconds_per_frame[run]
+                  << " microseconds per frame waiting for the GPU";
+    FTL_LOG(INFO) << "  " << (gpu_bound ? "GPU-bound" : "CPU-bound")
+                  << " frame time: " << frame_microseconds << " microseconds";
+  }
+  // Index of the run that submitted partial frames.
+  int partial = submit_partial_frames ? 0 : 1;
+  FTL_LOG(INFO) << "Single submission saved "
+                << (submits_per_frame[partial] - submits_per_frame[1 - partial])
+                << " submits and "
+                << (submit_microseconds_per_frame[partial] -
+                    submit_microseconds_per_frame[1 - partial])
+                << " microseconds of CPU time per frame";
   FTL_LOG(INFO) << "------------------------------------------------------";
 }
 
@@ -9,6 +9,7 @@
 #include "escher/forward_declarations.h"
 #include "escher/renderer/semaphore_wait.h"
 #include "escher/renderer/timestamper.h"
+#include "escher/util/stopwatch.h"
 #include "escher/vk/vulkan_context.h"
 #include "ftl/macros.h"
 #include "ftl/memory/ref_counted.h"
@@ -36,12 +37,37 @@ class Renderer : public ftl::RefCountedThreadSafe<Renderer>,
 
   void set_enable_profiling(bool enabled) { enable_profiling_ = enabled; }
 
+  // If true, each frame is split into several submissions, wherever the
+  // renderer calls SubmitPartialFrame().  This costs a vkQueueSubmit() and a
+  // CommandBuffer per submission, but keeps each submission short, which helps
+  // when debugging GPU hangs that trigger a watchdog.  Otherwise (the default),
+  // each frame is recorded into a single CommandBuffer, and its passes are
+  // ordered by pipeline barriers.
+  void set_submit_partial_frames(bool b) { submit_partial_frames_ = b; }
+  bool submit_partial_frames() const { return submit_partial_frames_; }
+
+  // The number of frames that may be pending on the GPU while the CPU records
+  // the next one.  Once this many frames are pending, BeginFrame() blocks
+  // until the oldest one has finished.  Must be at least 1; with 1, the CPU
+  // and GPU never overlap.
+  static constexpr uint32_t kDefaultMaxFramesInFlight = 2;
+  void set_max_frames_in_flight(uint32_t count);
+  uint32_t max_frames_in_flight() const { return max_frames_in_flight_; }
+
+  // Block until another frame may be begun (see set_max_frames_in_flight()).
+  // Called by BeginFrame(); clients that reuse per-frame resources of their
+  // own, such as VulkanSwapchainHelper's semaphores, call it before DrawFrame()
+  // so that these resources are no longer in use.
+  void WaitForAvailableFrame();
+
  protected:
   explicit Renderer(impl::EscherImpl* escher);
   virtual ~Renderer();
 
   // Obtain a CommandBuffer, to record commands for the current frame.
   void BeginFrame();
+  // Submit the commands recorded so far, and obtain a new CommandBuffer for
+  // the rest of the frame; does nothing unless submit_partial_frames() is true.
   void SubmitPartialFrame();
   void EndFrame(const SemaphorePtr& frame_done,
                 FrameRetiredCallback frame_retired_callback);
@@ -56,11 +82,29 @@ class Renderer : public ftl::RefCountedThreadSafe<Renderer>,
   const VulkanContext context_;
 
  private:
+  // Submit |current_frame_|, and measure the CPU time that this takes.
+  void SubmitCurrentFrame(FrameRetiredCallback callback);
+
   impl::CommandBufferPool* pool_;
   impl::CommandBuffer* current_frame_ = nullptr;
 
   uint64_t frame_number_ = 0;
 
+  uint32_t max_frames_in_flight_ = kDefaultMaxFramesInFlight;
+  // Sequence numbers of the last CommandBuffers of the frames that may still
+  // be pending on the GPU, oldest first.
+  std::queue<uint64_t> frames_in_flight_;
+  // CPU time spent in WaitForAvailableFrame().  Reported by
+  // RunOffscreenBenchmark().
+  Stopwatch frame_wait_stopwatch_{false};
+
+  bool submit_partial_frames_ = false;
+  // Number of submissions made by SubmitCurrentFrame(), and the CPU time spent
+  // in them (including obtaining the next CommandBuffer, for partial frames).
+  // Reported by RunOffscreenBenchmark().
+  uint64_t submit_count_ = 0;
+  Stopwatch submit_stopwatch_{false};
+
   bool enable_profiling_ = false;
   // Created in BeginFrame() when profiling is enabled.
   TimestampProfilerPtr profiler_;
@@ -22,7 +22,7 @@ TextureCore::TextureCore(ResourceLifePreserver* life_preserver,
   vk::ImageViewCreateInfo view_info;
   view_info.viewType = vk::ImageViewType::e2D;
   view_info.subresourceRange.baseMipLevel = 0;
-  view_info.subresourceRange.levelCount = 1;
+  view_info.subresourceRange.levelCount = image->mip_levels();
   view_info.subresourceRange.baseArrayLayer = 0;
   view_info.subresourceRange.layerCount = 1;
   view_info.subresourceRange.aspectMask = aspect_mask;
@@ -45,7 +45,7 @@ TextureCore::TextureCore(ResourceLifePreserver* life_preserver,
   sampler_info.mipmapMode = vk::SamplerMipmapMode::eLinear;
   sampler_info.mipLodBias = 0.0f;
   sampler_info.minLod = 0.0f;
-  sampler_info.maxLod = 0.0f;
+  sampler_info.maxLod = static_cast<float>(image->mip_levels() - 1);
   sampler_ = ESCHER_CHECKED_VK_RESULT(device.createSampler(sampler_info));
 }
 
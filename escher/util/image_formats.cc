@@ -0,0 +1,117 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/util/image_formats.h"
+
+#include <algorithm>
+
+#include "ftl/logging.h"
+
+namespace escher {
+
+namespace {
+
+ImageFormatInfo MakeFormatInfo(uint32_t block_width,
+                               uint32_t block_height,
+                               uint32_t block_bytes) {
+  ImageFormatInfo info;
+  info.block_width = block_width;
+  info.block_height = block_height;
+  info.block_bytes = block_bytes;
+  return info;
+}
+
+}  // namespace
+
+ImageFormatInfo GetImageFormatInfo(vk::Format format) {
+  switch (format) {
+    // Uncompressed.
+    case vk::Format::eR8Unorm:
+      return MakeFormatInfo(1, 1, 1);
+    case vk::Format::eR8G8B8A8Unorm:
+    case vk::Format::eR8G8B8A8Srgb:
+    case vk::Format::eB8G8R8A8Unorm:
+      return MakeFormatInfo(1, 1, 4);
+
+    // BC (aka S3TC/DXT and friends).
+    case vk::Format::eBc1RgbUnormBlock:
+    case vk::Format::eBc1RgbSrgbBlock:
+    case vk::Format::eBc1RgbaUnormBlock:
+    case vk::Format::eBc1RgbaSrgbBlock:
+    case vk::Format::eBc4UnormBlock:
+    case vk::Format::eBc4SnormBlock:
+      return MakeFormatInfo(4, 4, 8);
+    case vk::Format::eBc2UnormBlock:
+    case vk::Format::eBc2SrgbBlock:
+    case vk::Format::eBc3UnormBlock:
+    case vk::Format::eBc3SrgbBlock:
+    case vk::Format::eBc5UnormBlock:
+    case vk::Format::eBc5SnormBlock:
+    case vk::Format::eBc6HUfloatBlock:
+    case vk::Format::eBc6HSfloatBlock:
+    case vk::Format::eBc7UnormBlock:
+    case vk::Format::eBc7SrgbBlock:
+      return MakeFormatInfo(4, 4, 16);
+
+    // ETC2 and EAC.
+    case vk::Format::eEtc2R8G8B8UnormBlock:
+    case vk::Format::eEtc2R8G8B8SrgbBlock:
+    case vk::Format::eEtc2R8G8B8A1UnormBlock:
+    case vk::Format::eEtc2R8G8B8A1SrgbBlock:
+    case vk::Format::eEacR11UnormBlock:
+    case vk::Format::eEacR11SnormBlock:
+      return MakeFormatInfo(4, 4, 8);
+    case vk::Format::eEtc2R8G8B8A8UnormBlock:
+    case vk::Format::eEtc2R8G8B8A8SrgbBlock:
+    case vk::Format::eEacR11G11UnormBlock:
+    case vk::Format::eEacR11G11SnormBlock:
+      return MakeFormatInfo(4, 4, 16);
+
+    // ASTC: every block is 16 bytes, regardless of its footprint.
+    case vk::Format::eAstc4x4UnormBlock:
+    case vk::Format::eAstc4x4SrgbBlock:
+      return MakeFormatInfo(4, 4, 16);
+    case vk::Format::eAstc5x5UnormBlock:
+    case vk::Format::eAstc5x5SrgbBlock:
+      return MakeFormatInfo(5, 5, 16);
+    case vk::Format::eAstc6x6UnormBlock:
+    case vk::Format::eAstc6x6SrgbBlock:
+      return MakeFormatInfo(6, 6, 16);
+    case vk::Format::eAstc8x8UnormBlock:
+    case vk::Format::eAstc8x8SrgbBlock:
+      return MakeFormatInfo(8, 8, 16);
+    case vk::Format::eAstc10x10UnormBlock:
+    case vk::Format::eAstc10x10SrgbBlock:
+      return MakeFormatInfo(10, 10, 16);
+    case vk::Format::eAstc12x12UnormBlock:
+    case vk::Format::eAstc12x12SrgbBlock:
+      return MakeFormatInfo(12, 12, 16);
+
+    default:
+      return ImageFormatInfo();
+  }
+}
+
+vk::DeviceSize GetImageLevelSize(vk::Format format,
+                                 uint32_t width,
+                                 uint32_t height) {
+  ImageFormatInfo info = GetImageFormatInfo(format);
+  FTL_DCHECK(info.is_valid()) << "unsupported format "
+                              << vk::to_string(format);
+  vk::DeviceSize blocks_wide =
+      (width + info.block_width - 1) / info.block_width;
+  vk::DeviceSize blocks_high =
+      (height + info.block_height - 1) / info.block_height;
+  return blocks_wide * blocks_high * info.block_bytes;
+}
+
+uint32_t GetMaxMipLevels(uint32_t width, uint32_t height) {
+  uint32_t levels = 1;
+  for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+    ++levels;
+  }
+  return levels;
+}
+
+}  // namespace escher
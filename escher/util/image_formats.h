@@ -0,0 +1,37 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+namespace escher {
+
+// Describes how texels of a format are laid out in memory.  Uncompressed
+// formats have 1x1 blocks; block-compressed formats (BC, ETC2/EAC, ASTC)
+// encode a block of texels in a fixed number of bytes.
+struct ImageFormatInfo {
+  uint32_t block_width = 0;
+  uint32_t block_height = 0;
+  uint32_t block_bytes = 0;
+
+  bool is_compressed() const { return block_width > 1 || block_height > 1; }
+  bool is_valid() const { return block_bytes != 0; }
+};
+
+// Return the layout of |format|.  The result is invalid (i.e. all zeroes) if
+// Escher doesn't know how to upload images of this format.
+ImageFormatInfo GetImageFormatInfo(vk::Format format);
+
+// Return the number of bytes in a tightly-packed |width| x |height| image (or
+// mip level) of the specified format.  Partial blocks are rounded up to whole
+// blocks.  |format| must be valid.
+vk::DeviceSize GetImageLevelSize(vk::Format format,
+                                 uint32_t width,
+                                 uint32_t height);
+
+// Return the number of levels in a full mip chain, down to 1x1.
+uint32_t GetMaxMipLevels(uint32_t width, uint32_t height);
+
+}  // namespace escher
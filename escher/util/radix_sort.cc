@@ -0,0 +1,78 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/util/radix_sort.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace escher {
+
+namespace {
+
+constexpr uint32_t kDigitBits = 8;
+constexpr uint32_t kDigitCount = 64 / kDigitBits;
+constexpr uint32_t kBucketCount = 1 << kDigitBits;
+
+inline uint32_t Digit(uint64_t key, uint32_t digit_index) {
+  return static_cast<uint32_t>(key >> (digit_index * kDigitBits)) &
+         (kBucketCount - 1);
+}
+
+}  // namespace
+
+void RadixSort(uint64_t* keys,
+               uint32_t* values,
+               size_t count,
+               uint64_t* scratch_keys,
+               uint32_t* scratch_values) {
+  if (count < 2) {
+    return;
+  }
+
+  // Count the occurrences of every digit in a single pass over the keys.
+  size_t histograms[kDigitCount][kBucketCount];
+  memset(histograms, 0, sizeof(histograms));
+  for (size_t i = 0; i < count; ++i) {
+    for (uint32_t d = 0; d < kDigitCount; ++d) {
+      ++histograms[d][Digit(keys[i], d)];
+    }
+  }
+
+  uint64_t* src_keys = keys;
+  uint32_t* src_values = values;
+  uint64_t* dst_keys = scratch_keys;
+  uint32_t* dst_values = scratch_values;
+  for (uint32_t d = 0; d < kDigitCount; ++d) {
+    size_t* histogram = histograms[d];
+    // If every key has the same digit, this pass wouldn't change anything.
+    if (histogram[Digit(src_keys[0], d)] == count) {
+      continue;
+    }
+
+    // Convert the counts into the index of each bucket's first element.
+    size_t offset = 0;
+    for (uint32_t b = 0; b < kBucketCount; ++b) {
+      size_t bucket_count = histogram[b];
+      histogram[b] = offset;
+      offset += bucket_count;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      size_t index = histogram[Digit(src_keys[i], d)]++;
+      dst_keys[index] = src_keys[i];
+      dst_values[index] = src_values[i];
+    }
+    std::swap(src_keys, dst_keys);
+    std::swap(src_values, dst_values);
+  }
+
+  // After an odd number of passes, the result is in the scratch arrays.
+  if (src_keys != keys) {
+    memcpy(keys, src_keys, count * sizeof(uint64_t));
+    memcpy(values, src_values, count * sizeof(uint32_t));
+  }
+}
+
+}  // namespace escher
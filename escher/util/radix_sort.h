@@ -0,0 +1,24 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace escher {
+
+// Sort |count| 64-bit |keys| in ascending order, and permute |values| in the
+// same way.  The sort is stable, and performs no allocation: the caller
+// provides |scratch_keys| and |scratch_values|, each with room for |count|
+// elements, whose contents are undefined afterward.  This is an LSD radix
+// sort, with 8-bit digits; passes over digits that are the same in every key
+// are skipped, so unused high bits cost nothing.
+void RadixSort(uint64_t* keys,
+               uint32_t* values,
+               size_t count,
+               uint64_t* scratch_keys,
+               uint32_t* scratch_values);
+
+}  // namespace escher
@@ -19,16 +19,14 @@ class UnownedBufferInfo : public BufferInfo {
                     impl::GpuAllocator* allocator,
                     vk::DeviceSize size,
                     vk::BufferUsageFlags usage_flags,
-                    vk::MemoryPropertyFlags memory_property_flags)
-      : device_(device), size_(size), mapped_ptr_(nullptr) {
-    // Determine whether we will need to map the memory of the new buffer.
-    bool needs_mapped_ptr = false;
+                    vk::MemoryPropertyFlags memory_property_flags,
+                    impl::GpuMemCategory category)
+      : device_(device), size_(size) {
     if (memory_property_flags & vk::MemoryPropertyFlagBits::eHostVisible) {
       // We don't currently provide an interface for flushing mapped data, so
       // ensure that the allocated memory is cache-coherent.  This is more
       // convenient anyway.
       memory_property_flags |= vk::MemoryPropertyFlagBits::eHostCoherent;
-      needs_mapped_ptr = true;
     }
 
     // Create buffer.
@@ -39,38 +37,23 @@ class UnownedBufferInfo : public BufferInfo {
     buffer_ = ESCHER_CHECKED_VK_RESULT(device.createBuffer(buffer_create_info));
 
     // Allocate memory and bind it to the buffer.
-    mem_ = allocator->Allocate(device.getBufferMemoryRequirements(buffer_),
-                               memory_property_flags);
+    mem_ = allocator->AllocateForBuffer(buffer_, memory_property_flags,
+                                        category);
     device.bindBufferMemory(buffer_, mem_->base(), mem_->offset());
-
-    if (needs_mapped_ptr) {
-      auto ptr = ESCHER_CHECKED_VK_RESULT(
-          device.mapMemory(mem_->base(), mem_->offset(), mem_->size()));
-      mapped_ptr_ = reinterpret_cast<uint8_t*>(ptr);
-    }
   }
 
-  ~UnownedBufferInfo() {
-    if (mapped_ptr_) {
-      // We currently assume that there is one Vulkan allocation per GpuMem.
-      // If this is false, then this will potentially unmap the memory of other
-      // buffers and images.
-      FTL_CHECK(mem_->offset() == 0);
-      device_.unmapMemory(mem_->base());
-    }
-    device_.destroyBuffer(buffer_);
-  }
+  ~UnownedBufferInfo() { device_.destroyBuffer(buffer_); }
 
   vk::Buffer GetBuffer() override { return buffer_; }
   vk::DeviceSize GetSize() override { return size_; }
-  uint8_t* GetMappedPointer() override { return mapped_ptr_; }
+  // Host-visible memory is persistently mapped by the GpuAllocator.
+  uint8_t* GetMappedPointer() override { return mem_->mapped_ptr(); }
 
  private:
   vk::Device device_;
   vk::DeviceSize size_;
   vk::Buffer buffer_;
   impl::GpuMemPtr mem_;
-  uint8_t* mapped_ptr_;
 };
 
 }  // namespace
@@ -83,13 +66,15 @@ Buffer::Buffer(vk::Device device,
                impl::GpuAllocator* allocator,
                vk::DeviceSize size,
                vk::BufferUsageFlags usage_flags,
-               vk::MemoryPropertyFlags memory_property_flags)
+               vk::MemoryPropertyFlags memory_property_flags,
+               impl::GpuMemCategory category)
     : Resource(nullptr),
       info_(std::make_unique<UnownedBufferInfo>(device,
                                                 allocator,
                                                 size,
                                                 usage_flags,
-                                                memory_property_flags)),
+                                                memory_property_flags,
+                                                category)),
       buffer_(info_->GetBuffer()),
       size_(info_->GetSize()),
       ptr_(info_->GetMappedPointer()),
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "escher/forward_declarations.h"
+#include "escher/impl/gpu_mem.h"
 #include <escher/impl/resource.h>
 
 namespace escher {
@@ -40,12 +41,13 @@ class BufferOwner {
 class Buffer : public impl::Resource {
  public:
   // Construct an ownerless Buffer.  When the Buffer is destroyed, all resources
-  // are immediately freed/destroyed.
+  // are immediately freed/destroyed.  |category| is used only for accounting.
   Buffer(vk::Device device,
          impl::GpuAllocator* allocator,
          vk::DeviceSize size,
          vk::BufferUsageFlags usage_flags,
-         vk::MemoryPropertyFlags memory_property_flags);
+         vk::MemoryPropertyFlags memory_property_flags,
+         impl::GpuMemCategory category = impl::GpuMemCategory::kOther);
   ~Buffer() override;
 
   // Return the underlying Vulkan buffer object.
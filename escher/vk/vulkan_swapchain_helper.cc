@@ -15,17 +15,28 @@ VulkanSwapchainHelper::VulkanSwapchainHelper(VulkanSwapchain swapchain,
     : swapchain_(swapchain),
       renderer_(renderer),
       device_(renderer->vulkan_context().device),
-      queue_(renderer->vulkan_context().queue) {
-  image_available_semaphore_ = Semaphore::New(device_);
-  render_finished_semaphore_ = Semaphore::New(device_);
-}
+      queue_(renderer->vulkan_context().queue) {}
 
 VulkanSwapchainHelper::~VulkanSwapchainHelper() {}
 
 void VulkanSwapchainHelper::DrawFrame(Stage& stage, Model& model) {
+  // Each frame that may be in flight has its own semaphores.  Once the
+  // Renderer allows another frame to begin, the frame that previously used
+  // this pair of semaphores has finished, and so have its waits on them.
+  renderer_->WaitForAvailableFrame();
+  size_t frame_index = frame_number_++ % renderer_->max_frames_in_flight();
+  if (frame_index >= frame_semaphores_.size()) {
+    frame_semaphores_.resize(frame_index + 1);
+  }
+  auto& semaphores = frame_semaphores_[frame_index];
+  if (!semaphores.image_available) {
+    semaphores.image_available = Semaphore::New(device_);
+    semaphores.render_finished = Semaphore::New(device_);
+  }
+
   auto result =
       device_.acquireNextImageKHR(swapchain_.swapchain, UINT64_MAX,
-                                  image_available_semaphore_->value(), nullptr);
+                                  semaphores.image_available->value(), nullptr);
 
   if (result.result == vk::Result::eSuboptimalKHR) {
     FTL_DLOG(WARNING) << "suboptimal swapchain configuration";
@@ -39,14 +50,14 @@ void VulkanSwapchainHelper::DrawFrame(Stage& stage, Model& model) {
   // Render the scene.  The Renderer will wait for acquireNextImageKHR() to
   // signal the semaphore.
   auto& image = swapchain_.images[swapchain_index];
-  image->SetWaitSemaphore(image_available_semaphore_);
-  renderer_->DrawFrame(stage, model, image, render_finished_semaphore_,
+  image->SetWaitSemaphore(semaphores.image_available);
+  renderer_->DrawFrame(stage, model, image, semaphores.render_finished,
                        nullptr);
 
   // When the image is completely rendered, present it.
   vk::PresentInfoKHR info;
   info.waitSemaphoreCount = 1;
-  auto sema = render_finished_semaphore_->value();
+  auto sema = semaphores.render_finished->value();
   info.pWaitSemaphores = &sema;
   info.swapchainCount = 1;
   info.pSwapchains = &swapchain_.swapchain;
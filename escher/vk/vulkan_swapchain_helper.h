@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "escher/forward_declarations.h"
 #include "escher/vk/vulkan_swapchain.h"
 
@@ -23,8 +25,14 @@ class VulkanSwapchainHelper {
   RendererPtr renderer_;
   vk::Device device_;
   vk::Queue queue_;
-  SemaphorePtr image_available_semaphore_;
-  SemaphorePtr render_finished_semaphore_;
+  // A pair of semaphores for each frame that may be in flight (see
+  // Renderer::set_max_frames_in_flight()); created as necessary.
+  struct FrameSemaphores {
+    SemaphorePtr image_available;
+    SemaphorePtr render_finished;
+  };
+  std::vector<FrameSemaphores> frame_semaphores_;
+  uint64_t frame_number_ = 0;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(VulkanSwapchainHelper);
 };
@@ -217,10 +217,25 @@ void DemoHarness::CreateDeviceAndQueue() {
           vk::DeviceCreateInfo device_info;
           device_info.queueCreateInfoCount = 1;
           device_info.pQueueCreateInfos = queue_info;
-          // TODO: need other device extensions?
-          const char* swapchain_extension_name = "VK_KHR_swapchain";
-          device_info.enabledExtensionCount = 1;
-          device_info.ppEnabledExtensionNames = &swapchain_extension_name;
+          // Enable the swapchain extension, along with optional extensions
+          // that Escher takes advantage of when they are available.
+          std::vector<const char*> extension_names{
+              VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+          const char* kOptionalExtensionNames[] = {
+              "VK_KHR_get_memory_requirements2",
+              "VK_KHR_dedicated_allocation"};
+          for (const char* name : kOptionalExtensionNames) {
+            for (auto& extension : device_props) {
+              if (!strncmp(extension.extensionName, name,
+                           VK_MAX_EXTENSION_NAME_SIZE)) {
+                extension_names.push_back(name);
+                break;
+              }
+            }
+          }
+          device_info.enabledExtensionCount =
+              static_cast<uint32_t>(extension_names.size());
+          device_info.ppEnabledExtensionNames = extension_names.data();
 
           // Try to find a transfer-only queue... if it exists, it will be the
           // fastest way to upload data to the GPU.
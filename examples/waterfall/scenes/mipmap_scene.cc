@@ -0,0 +1,108 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "examples/waterfall/scenes/mipmap_scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "escher/geometry/types.h"
+#include "escher/material/material.h"
+#include "escher/renderer/image.h"
+#include "escher/scene/model.h"
+#include "escher/scene/stage.h"
+#include "escher/util/image_formats.h"
+#include "escher/util/stopwatch.h"
+#include "ftl/logging.h"
+
+using escher::vec2;
+using escher::vec3;
+using escher::Object;
+
+namespace {
+
+// Each texel is a single check, so that minification without mipmaps samples
+// texels that are far apart.
+constexpr uint32_t kTextureSize = 1024;
+constexpr float kTileSize = 48.f;
+constexpr float kTileSpacing = 56.f;
+
+}  // namespace
+
+MipmapScene::MipmapScene(Demo* demo, TextureMode mode)
+    : Scene(demo), mode_(mode) {}
+
+MipmapScene::~MipmapScene() {}
+
+void MipmapScene::Init(escher::Stage* stage) {
+  escher::ImagePtr image;
+  if (mode_ == TextureMode::kCompressed) {
+    image = NewCompressedCheckerboardImage(kTextureSize);
+    if (!image) {
+      FTL_LOG(WARNING) << "BC1 is not supported; using mipmapped RGBA instead.";
+    }
+  }
+  if (!image) {
+    image = escher()->NewCheckerboardImage(
+        kTextureSize, kTextureSize, mode_ != TextureMode::kSingleLevel);
+  }
+
+  material_ = ftl::MakeRefCounted<escher::Material>(
+      escher()->NewTexture(std::move(image), vk::Filter::eLinear));
+  material_->set_color(vec3(0.9f, 0.9f, 0.9f));
+}
+
+escher::ImagePtr MipmapScene::NewCompressedCheckerboardImage(uint32_t size) {
+  constexpr vk::Format kFormat = vk::Format::eBc1RgbUnormBlock;
+  if (!escher()->SupportsCompressedFormat(kFormat)) {
+    return escher::ImagePtr();
+  }
+
+  // BC1 blocks are two RGB565 endpoints followed by a 2-bit index per texel.
+  // The first level alternates between the endpoints (white and black), to
+  // match NewCheckerboardImage().  All smaller levels are the average: gray.
+  const uint8_t kCheckerboardBlock[8] = {0xff, 0xff, 0x00, 0x00,
+                                         0x44, 0x11, 0x44, 0x11};
+  const uint8_t kGrayBlock[8] = {0x10, 0x84, 0x10, 0x84, 0, 0, 0, 0};
+
+  uint32_t mip_levels = escher::GetMaxMipLevels(size, size);
+  std::vector<uint8_t> data;
+  for (uint32_t level = 0; level < mip_levels; ++level) {
+    uint32_t level_size = std::max(size >> level, 1U);
+    vk::DeviceSize level_bytes =
+        escher::GetImageLevelSize(kFormat, level_size, level_size);
+    const uint8_t* block = level == 0 ? kCheckerboardBlock : kGrayBlock;
+    for (vk::DeviceSize i = 0; i < level_bytes; i += sizeof(kGrayBlock)) {
+      data.insert(data.end(), block, block + sizeof(kGrayBlock));
+    }
+  }
+  return escher()->NewCompressedImage(kFormat, size, size, mip_levels,
+                                      data.data(), data.size());
+}
+
+escher::Model* MipmapScene::Update(const escher::Stopwatch& stopwatch,
+                                   uint64_t frame_count,
+                                   escher::Stage* stage) {
+  stage->set_clear_color(vec3(0.f, 0.f, 0.f));
+  float current_time_sec = stopwatch.GetElapsedSeconds();
+  float screen_width = stage->viewing_volume().width();
+  float screen_height = stage->viewing_volume().height();
+
+  // Slowly scroll the grid so that the sampled texels keep changing.
+  float scroll = fmod(current_time_sec * 10.f, kTileSpacing);
+
+  std::vector<Object> objects;
+  for (float y = -kTileSpacing; y < screen_height; y += kTileSpacing) {
+    for (float x = -kTileSpacing; x < screen_width; x += kTileSpacing) {
+      objects.push_back(Object::NewRect(vec2(x + scroll, y + scroll),
+                                        vec2(kTileSize, kTileSize), 4.f,
+                                        material_));
+    }
+  }
+  model_ = std::unique_ptr<escher::Model>(new escher::Model(objects));
+  model_->set_time(current_time_sec);
+
+  return model_.get();
+}
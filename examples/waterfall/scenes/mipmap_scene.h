@@ -0,0 +1,48 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "escher/escher.h"
+
+#include "examples/waterfall/scenes/scene.h"
+
+// Benchmark scene that covers the screen with small tiles, each of which
+// samples a large, high-frequency texture.  Compare the frame times (e.g. with
+// the offscreen benchmark) of the different texture modes to see the memory
+// bandwidth that is saved by mipmapping and block compression.
+class MipmapScene : public Scene {
+ public:
+  enum class TextureMode {
+    // A single RGBA level; every minified sample touches distant texels.
+    kSingleLevel,
+    // RGBA with a mip chain that is generated on the GPU.
+    kMipmapped,
+    // BC1 with a precompressed mip chain, or kMipmapped if BC1 isn't
+    // supported by the device.
+    kCompressed,
+  };
+
+  MipmapScene(Demo* demo, TextureMode mode);
+  ~MipmapScene();
+
+  void Init(escher::Stage* stage) override;
+
+  escher::Model* Update(const escher::Stopwatch& stopwatch,
+                        uint64_t frame_count,
+                        escher::Stage* stage) override;
+
+ private:
+  // Return a BC1-compressed checkerboard with a full mip chain, or null if the
+  // device doesn't support BC1.
+  escher::ImagePtr NewCompressedCheckerboardImage(uint32_t size);
+
+  const TextureMode mode_;
+
+  std::unique_ptr<escher::Model> model_;
+
+  escher::MaterialPtr material_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(MipmapScene);
+};
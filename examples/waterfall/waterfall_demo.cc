@@ -5,6 +5,7 @@
 #include "escher/examples/waterfall/waterfall_demo.h"
 
 #include "escher/examples/waterfall/scenes/demo_scene.h"
+#include "escher/examples/waterfall/scenes/mipmap_scene.h"
 #include "escher/examples/waterfall/scenes/ring_tricks1.h"
 #include "escher/examples/waterfall/scenes/ring_tricks2.h"
 #include "escher/examples/waterfall/scenes/ring_tricks3.h"
@@ -59,6 +60,57 @@ void WaterfallDemo::ProcessCommandLineArgs(int argc, char** argv) {
       show_debug_info_ = false;
     } else if (!strcmp("--toggle-lighting", argv[i])) {
       auto_toggle_lighting_ = true;
+    } else if (!strcmp("--submit-partial-frames", argv[i])) {
+      submit_partial_frames_ = true;
+    } else if (!strcmp("--no-instancing", argv[i])) {
+      use_instancing_ = false;
+    } else if (!strcmp("--descriptor-set-per-object", argv[i])) {
+      use_descriptor_set_per_object_ = true;
+    } else if (!strcmp("--no-push-constants", argv[i])) {
+      use_push_constants_ = false;
+    } else if (!strcmp("--depth-and-lighting-pass", argv[i])) {
+      use_depth_and_lighting_pass_ = true;
+    } else if (!strcmp("--frames-in-flight", argv[i])) {
+      if (i == argc - 1) {
+        FTL_LOG(ERROR)
+            << "--frames-in-flight must be followed by a positive number";
+      } else {
+        char* end;
+        int count = strtol(argv[i + 1], &end, 10);
+        if (argv[i + 1] == end || count < 1) {
+          FTL_LOG(ERROR)
+              << "--frames-in-flight must be followed by a positive number";
+        } else {
+          max_frames_in_flight_ = count;
+        }
+      }
+    } else if (!strcmp("--sample-count", argv[i])) {
+      if (i == argc - 1) {
+        FTL_LOG(ERROR) << "--sample-count must be followed by 1, 2, 4 or 8";
+      } else {
+        char* end;
+        int count = strtol(argv[i + 1], &end, 10);
+        if (argv[i + 1] == end ||
+            (count != 1 && count != 2 && count != 4 && count != 8)) {
+          FTL_LOG(ERROR) << "--sample-count must be followed by 1, 2, 4 or 8";
+        } else {
+          sample_count_ = count;
+        }
+      }
+    } else if (!strcmp("--display-list-threads", argv[i])) {
+      if (i == argc - 1) {
+        FTL_LOG(ERROR)
+            << "--display-list-threads must be followed by a positive number";
+      } else {
+        char* end;
+        int count = strtol(argv[i + 1], &end, 10);
+        if (argv[i + 1] == end || count < 1) {
+          FTL_LOG(ERROR) << "--display-list-threads must be followed by a "
+                            "positive number";
+        } else {
+          display_list_worker_count_ = count;
+        }
+      }
     }
   }
 }
@@ -108,6 +160,14 @@ void WaterfallDemo::InitializeDemoScenes() {
         this, color_scheme[0], color_scheme[1], color_scheme[1],
         color_scheme[1], color_scheme[2], color_scheme[3]));
   }
+
+  // Texture bandwidth benchmarks; select with --scene.
+  scenes_.emplace_back(
+      new MipmapScene(this, MipmapScene::TextureMode::kSingleLevel));
+  scenes_.emplace_back(
+      new MipmapScene(this, MipmapScene::TextureMode::kMipmapped));
+  scenes_.emplace_back(
+      new MipmapScene(this, MipmapScene::TextureMode::kCompressed));
   for (auto& scene : scenes_) {
     scene->Init(&stage_);
   }
@@ -188,6 +248,14 @@ void WaterfallDemo::DrawFrame() {
   renderer_->set_enable_lighting(enable_lighting_);
   renderer_->set_sort_by_pipeline(sort_by_pipeline_);
   renderer_->set_enable_profiling(profile_one_frame_);
+  renderer_->set_submit_partial_frames(submit_partial_frames_);
+  renderer_->set_use_depth_and_lighting_pass(use_depth_and_lighting_pass_);
+  renderer_->set_max_frames_in_flight(max_frames_in_flight_);
+  renderer_->set_sample_count(sample_count_);
+  renderer_->set_display_list_worker_count(display_list_worker_count_);
+  renderer_->set_use_instancing(use_instancing_);
+  renderer_->set_use_descriptor_set_per_object(use_descriptor_set_per_object_);
+  renderer_->set_use_push_constants(use_push_constants_);
   profile_one_frame_ = false;
   if (cycle_ssdo_acceleration_) {
     renderer_->CycleSsdoAccelerationMode();
@@ -237,5 +305,23 @@ void WaterfallDemo::DrawFrame() {
     FTL_LOG(INFO) << "---- Average frame rate: " << fps;
     FTL_LOG(INFO) << "---- Total GPU memory: "
                   << (escher()->GetNumGpuBytesAllocated() / 1024) << "kB";
+    auto memory_stats = escher()->GetGpuMemoryStats();
+    FTL_LOG(INFO) << "---- GPU memory in use: "
+                  << (memory_stats.gpu_mem.used_bytes / 1024) << "kB, cached: "
+                  << (memory_stats.cached_bytes / 1024) << "kB";
+    for (size_t i = 0; i < memory_stats.heap_budgets.size(); ++i) {
+      FTL_LOG(INFO) << "---- Heap " << i << ": "
+                    << (memory_stats.heap_usages[i] / 1024) << "kB of "
+                    << (memory_stats.heap_budgets[i] / 1024) << "kB budget";
+    }
+    auto image_cache_stats = escher()->GetImageCacheStats();
+    FTL_LOG(INFO) << "---- Image cache: " << image_cache_stats.hit_count
+                  << " hits, " << image_cache_stats.miss_count << " misses ("
+                  << image_cache_stats.reuse_would_stall_count
+                  << " to avoid stalls), "
+                  << image_cache_stats.eviction_count << " evictions ("
+                  << (image_cache_stats.evicted_bytes / 1024) << "kB)";
+    FTL_LOG(INFO) << "---- Per-object data written by last frame: "
+                  << renderer_->per_object_bytes_written() << " bytes";
   }
 }
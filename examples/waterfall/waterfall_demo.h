@@ -56,6 +56,26 @@ class WaterfallDemo : public Demo {
   bool profile_one_frame_ = false;
   // Run an offscreen benchmark.
   bool run_offscreen_benchmark_ = false;
+  // Submit each frame in several parts, to help debug GPU hangs.
+  bool submit_partial_frames_ = false;
+  // When lighting is off, render the depth pre-pass and the lighting pass as
+  // subpasses of a single render pass.
+  bool use_depth_and_lighting_pass_ = false;
+  // Draw consecutive objects that share a mesh with a single draw call.
+  bool use_instancing_ = true;
+  // Give each object its own descriptor set, instead of using dynamic uniform
+  // offsets.
+  bool use_descriptor_set_per_object_ = false;
+  // Pass the data of untextured objects as push constants.
+  bool use_push_constants_ = true;
+  // Number of frames that the CPU may record while the GPU renders previous
+  // ones.
+  uint32_t max_frames_in_flight_ =
+      escher::Renderer::kDefaultMaxFramesInFlight;
+  // Number of samples per pixel in the lighting pass.
+  uint32_t sample_count_ = 1;
+  // Maximum number of threads that build each display list.
+  uint32_t display_list_worker_count_ = 1;
 
   std::vector<std::unique_ptr<Scene>> scenes_;
   escher::PaperRendererPtr renderer_;
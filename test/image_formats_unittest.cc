@@ -0,0 +1,52 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/util/image_formats.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+using namespace escher;
+
+TEST(ImageFormats, LevelSize) {
+  // Uncompressed formats.
+  EXPECT_EQ(64U * 32U * 4U,
+            GetImageLevelSize(vk::Format::eR8G8B8A8Unorm, 64, 32));
+  EXPECT_EQ(3U * 5U, GetImageLevelSize(vk::Format::eR8Unorm, 3, 5));
+
+  // 4x4 blocks; partial blocks are rounded up.
+  EXPECT_EQ(16U * 8U * 8U,
+            GetImageLevelSize(vk::Format::eBc1RgbaUnormBlock, 64, 32));
+  EXPECT_EQ(8U, GetImageLevelSize(vk::Format::eBc1RgbaUnormBlock, 1, 1));
+  EXPECT_EQ(2U * 2U * 16U,
+            GetImageLevelSize(vk::Format::eBc7UnormBlock, 5, 8));
+  EXPECT_EQ(16U * 8U * 16U,
+            GetImageLevelSize(vk::Format::eEtc2R8G8B8A8UnormBlock, 64, 32));
+
+  // ASTC blocks are always 16 bytes, but their footprint varies.
+  EXPECT_EQ(16U * 8U * 16U,
+            GetImageLevelSize(vk::Format::eAstc4x4UnormBlock, 64, 32));
+  EXPECT_EQ(8U * 4U * 16U,
+            GetImageLevelSize(vk::Format::eAstc8x8UnormBlock, 64, 32));
+  EXPECT_EQ(7U * 4U * 16U,
+            GetImageLevelSize(vk::Format::eAstc10x10UnormBlock, 64, 32));
+}
+
+TEST(ImageFormats, FormatInfo) {
+  EXPECT_FALSE(GetImageFormatInfo(vk::Format::eR8G8B8A8Unorm).is_compressed());
+  EXPECT_TRUE(GetImageFormatInfo(vk::Format::eBc3UnormBlock).is_compressed());
+  EXPECT_TRUE(GetImageFormatInfo(vk::Format::eAstc6x6SrgbBlock).is_valid());
+  EXPECT_FALSE(GetImageFormatInfo(vk::Format::eD32Sfloat).is_valid());
+}
+
+TEST(ImageFormats, MaxMipLevels) {
+  EXPECT_EQ(1U, GetMaxMipLevels(1, 1));
+  EXPECT_EQ(2U, GetMaxMipLevels(2, 1));
+  EXPECT_EQ(9U, GetMaxMipLevels(256, 256));
+  EXPECT_EQ(9U, GetMaxMipLevels(256, 3));
+  EXPECT_EQ(9U, GetMaxMipLevels(300, 200));
+  EXPECT_EQ(10U, GetMaxMipLevels(512, 200));
+}
+
+}  // namespace
@@ -0,0 +1,624 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <set>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/impl/buddy_gpu_allocator.h"
+#include "escher/impl/frame_gpu_allocator.h"
+#include "escher/impl/gpu_allocation_trace.h"
+#include "escher/impl/gpu_mem.h"
+#include "escher/impl/naive_gpu_allocator.h"
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+constexpr uint32_t kDeviceLocalMemoryType = 0;
+constexpr uint32_t kHostVisibleMemoryType = 1;
+constexpr uint32_t kLazilyAllocatedMemoryType = 2;
+constexpr uint32_t kMemoryTypeCount = 3;
+constexpr uint32_t kAnyMemoryType = 0xffffffff;
+constexpr vk::DeviceSize kBufferImageGranularity = 1024;
+
+// FakeBackend pretends that the driver prefers dedicated allocations for
+// images and buffers that are at least this large.
+constexpr vk::DeviceSize kFakeDedicatedThreshold = 4 * 1024 * 1024;
+
+// Fake image and buffer handles encode the size of the resource.
+template <typename HandleT>
+HandleT MakeFakeHandle(uint64_t size) {
+  HandleT handle;
+  static_assert(sizeof(handle) == sizeof(size), "unexpected handle size");
+  std::memcpy(&handle, &size, sizeof(handle));
+  return handle;
+}
+
+template <typename HandleT>
+uint64_t GetFakeHandleSize(HandleT handle) {
+  uint64_t size;
+  std::memcpy(&size, &handle, sizeof(size));
+  return size;
+}
+
+// Records the allocations made through a FakeBackend.  Outlives the backend,
+// so that tests can verify that everything was freed.
+struct FakeBackendStats {
+  std::map<VkDeviceMemory, vk::DeviceSize> live_allocations;
+  uint32_t total_allocation_count = 0;
+  uint32_t dedicated_allocation_count = 0;
+  std::set<VkDeviceMemory> mapped_allocations;
+};
+
+// Hands out fake vk::DeviceMemory handles instead of talking to a GPU.
+class FakeBackend : public GpuAllocator::Backend {
+ public:
+  // If |supports_dedicated| is false, the backend behaves like a device
+  // without VK_KHR_dedicated_allocation.
+  explicit FakeBackend(FakeBackendStats* stats, bool supports_dedicated = true)
+      : stats_(stats), supports_dedicated_(supports_dedicated) {}
+
+  vk::DeviceMemory AllocateMemory(vk::DeviceSize size,
+                                  uint32_t memory_type_index,
+                                  const DedicatedResource& dedicated) override {
+    if (dedicated.image || dedicated.buffer) {
+      EXPECT_TRUE(supports_dedicated_);
+      ++stats_->dedicated_allocation_count;
+    }
+    uint64_t id = ++stats_->total_allocation_count;
+    VkDeviceMemory mem;
+    static_assert(sizeof(mem) == sizeof(id), "unexpected handle size");
+    std::memcpy(&mem, &id, sizeof(mem));
+    stats_->live_allocations[mem] = size;
+    return vk::DeviceMemory(mem);
+  }
+
+  void FreeMemory(vk::DeviceMemory mem) override {
+    auto erased =
+        stats_->live_allocations.erase(static_cast<VkDeviceMemory>(mem));
+    EXPECT_EQ(1U, erased);
+    stats_->mapped_allocations.erase(static_cast<VkDeviceMemory>(mem));
+  }
+
+  vk::MemoryRequirements GetImageMemoryRequirements(
+      vk::Image image,
+      bool* wants_dedicated) override {
+    return GetFakeRequirements(
+        GetFakeHandleSize(static_cast<VkImage>(image)), wants_dedicated);
+  }
+
+  vk::MemoryRequirements GetBufferMemoryRequirements(
+      vk::Buffer buffer,
+      bool* wants_dedicated) override {
+    return GetFakeRequirements(
+        GetFakeHandleSize(static_cast<VkBuffer>(buffer)), wants_dedicated);
+  }
+
+  uint8_t* MapMemory(vk::DeviceMemory mem, vk::DeviceSize size) override {
+    auto it = stats_->live_allocations.find(static_cast<VkDeviceMemory>(mem));
+    EXPECT_NE(it, stats_->live_allocations.end());
+    EXPECT_EQ(size, it->second);
+    EXPECT_EQ(0U, stats_->mapped_allocations.count(it->first));
+    stats_->mapped_allocations.insert(it->first);
+    // The pointer is never dereferenced, so any distinct value will do.
+    return reinterpret_cast<uint8_t*>(it->first);
+  }
+
+  vk::MemoryPropertyFlags GetMemoryPropertyFlags(
+      uint32_t memory_type_index) override {
+    const vk::MemoryPropertyFlags kMemoryTypes[] = {
+        vk::MemoryPropertyFlagBits::eDeviceLocal,
+        vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent,
+        vk::MemoryPropertyFlagBits::eDeviceLocal |
+            vk::MemoryPropertyFlagBits::eLazilyAllocated};
+    EXPECT_LT(memory_type_index, kMemoryTypeCount);
+    return kMemoryTypes[memory_type_index];
+  }
+
+  uint32_t GetMemoryTypeIndex(uint32_t type_bits,
+                              vk::MemoryPropertyFlags flags) override {
+    for (uint32_t i = 0; i < kMemoryTypeCount; ++i) {
+      if ((type_bits & (1 << i)) &&
+          (GetMemoryPropertyFlags(i) & flags) == flags) {
+        return i;
+      }
+    }
+    ADD_FAILURE() << "no suitable memory type";
+    return 0;
+  }
+
+  vk::DeviceSize GetBufferImageGranularity() override {
+    return kBufferImageGranularity;
+  }
+
+  bool SupportsDedicatedAllocation() override { return supports_dedicated_; }
+
+ private:
+  vk::MemoryRequirements GetFakeRequirements(vk::DeviceSize size,
+                                             bool* wants_dedicated) {
+    *wants_dedicated = supports_dedicated_ && size >= kFakeDedicatedThreshold;
+    vk::MemoryRequirements reqs;
+    reqs.size = size;
+    reqs.alignment = 256;
+    reqs.memoryTypeBits = kAnyMemoryType;
+    return reqs;
+  }
+
+  FakeBackendStats* stats_;
+  bool supports_dedicated_;
+};
+
+vk::MemoryRequirements MakeRequirements(vk::DeviceSize size,
+                                        vk::DeviceSize alignment) {
+  vk::MemoryRequirements reqs;
+  reqs.size = size;
+  reqs.alignment = alignment;
+  reqs.memoryTypeBits = kAnyMemoryType;
+  return reqs;
+}
+
+// Tests that every GpuAllocator must pass.
+template <typename AllocatorT>
+class GpuAllocatorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    allocator_ = std::make_unique<AllocatorT>(
+        VulkanContext(), std::make_unique<FakeBackend>(&stats_));
+  }
+
+  void TearDown() override {
+    allocator_.reset();
+    EXPECT_TRUE(stats_.live_allocations.empty());
+  }
+
+  // Verify that none of the GpuMems overlap within the same vk::DeviceMemory,
+  // and that each lies within its underlying allocation.
+  void ExpectNoOverlap(const std::vector<GpuMemPtr>& mems) {
+    for (size_t i = 0; i < mems.size(); ++i) {
+      auto& a = mems[i];
+      auto it = stats_.live_allocations.find(
+          static_cast<VkDeviceMemory>(a->base()));
+      ASSERT_NE(it, stats_.live_allocations.end());
+      EXPECT_LE(a->offset() + a->size(), it->second);
+      for (size_t j = i + 1; j < mems.size(); ++j) {
+        auto& b = mems[j];
+        if (a->base() != b->base())
+          continue;
+        EXPECT_TRUE(a->offset() + a->size() <= b->offset() ||
+                    b->offset() + b->size() <= a->offset());
+      }
+    }
+  }
+
+  FakeBackendStats stats_;
+  std::unique_ptr<GpuAllocator> allocator_;
+};
+
+typedef ::testing::Types<NaiveGpuAllocator,
+                         BuddyGpuAllocator,
+                         FrameGpuAllocator>
+    AllocatorTypes;
+TYPED_TEST_CASE(GpuAllocatorTest, AllocatorTypes);
+
+TYPED_TEST(GpuAllocatorTest, RespectsSizeAndAlignment) {
+  std::vector<GpuMemPtr> mems;
+  for (vk::DeviceSize alignment : {1, 16, 256, 4096, 65536}) {
+    for (vk::DeviceSize size : {1, 100, 1000, 65536, 100000}) {
+      auto mem = this->allocator_->Allocate(
+          MakeRequirements(size, alignment),
+          vk::MemoryPropertyFlagBits::eDeviceLocal);
+      EXPECT_EQ(size, mem->size());
+      EXPECT_EQ(0U, mem->offset() % alignment);
+      mems.push_back(std::move(mem));
+    }
+  }
+  this->ExpectNoOverlap(mems);
+}
+
+TYPED_TEST(GpuAllocatorTest, RespectsMemoryProperties) {
+  auto device_mem =
+      this->allocator_->Allocate(MakeRequirements(1000, 16),
+                                 vk::MemoryPropertyFlagBits::eDeviceLocal);
+  auto host_mem =
+      this->allocator_->Allocate(MakeRequirements(1000, 16),
+                                 vk::MemoryPropertyFlagBits::eHostVisible);
+  EXPECT_EQ(kDeviceLocalMemoryType, device_mem->memory_type_index());
+  EXPECT_EQ(kHostVisibleMemoryType, host_mem->memory_type_index());
+  EXPECT_NE(device_mem->base(), host_mem->base());
+
+  // Host-visible memory is mapped; device-local memory is not.
+  EXPECT_EQ(nullptr, device_mem->mapped_ptr());
+  EXPECT_NE(nullptr, host_mem->mapped_ptr());
+  EXPECT_EQ(1U, this->stats_.mapped_allocations.count(
+                    static_cast<VkDeviceMemory>(host_mem->base())));
+
+  // Only the host-visible type is allowed by the requirements.
+  auto reqs = MakeRequirements(1000, 16);
+  reqs.memoryTypeBits = 1 << kHostVisibleMemoryType;
+  auto restricted_mem = this->allocator_->Allocate(reqs,
+                                                   vk::MemoryPropertyFlags());
+  EXPECT_EQ(kHostVisibleMemoryType, restricted_mem->memory_type_index());
+}
+
+TYPED_TEST(GpuAllocatorTest, HugeAllocation) {
+  constexpr vk::DeviceSize kHugeSize = 3 * BuddyGpuAllocator::kDefaultSlabSize;
+  auto mem = this->allocator_->Allocate(
+      MakeRequirements(kHugeSize, 256),
+      vk::MemoryPropertyFlagBits::eDeviceLocal);
+  EXPECT_EQ(kHugeSize, mem->size());
+  EXPECT_EQ(kHugeSize, this->allocator_->GetNumBytesAllocated());
+}
+
+TYPED_TEST(GpuAllocatorTest, FreeAndReallocate) {
+  std::vector<GpuMemPtr> mems;
+  for (int iteration = 0; iteration < 10; ++iteration) {
+    for (int i = 0; i < 50; ++i) {
+      mems.push_back(this->allocator_->Allocate(
+          MakeRequirements(1000 * (i + 1), 256),
+          vk::MemoryPropertyFlagBits::eDeviceLocal));
+    }
+    this->ExpectNoOverlap(mems);
+    // Free every other allocation, leaving holes for the next iteration.
+    for (size_t i = 0; i < mems.size(); i += 2) {
+      mems[i] = nullptr;
+    }
+    mems.erase(std::remove_if(mems.begin(), mems.end(),
+                              [](const GpuMemPtr& mem) { return !mem; }),
+               mems.end());
+  }
+  mems.clear();
+}
+
+TYPED_TEST(GpuAllocatorTest, TracksStats) {
+  auto image_mem = this->allocator_->Allocate(
+      MakeRequirements(1000, 16), vk::MemoryPropertyFlagBits::eDeviceLocal,
+      GpuMemCategory::kImage);
+  auto staging_mem = this->allocator_->Allocate(
+      MakeRequirements(300, 16), vk::MemoryPropertyFlagBits::eHostVisible,
+      GpuMemCategory::kStaging);
+  EXPECT_EQ(GpuMemCategory::kImage, image_mem->category());
+
+  const GpuMemStats& stats = this->allocator_->stats();
+  EXPECT_EQ(1300U, stats.used_bytes);
+  EXPECT_EQ(1000U, stats.used_bytes_by_memory_type[kDeviceLocalMemoryType]);
+  EXPECT_EQ(300U, stats.used_bytes_by_memory_type[kHostVisibleMemoryType]);
+  EXPECT_EQ(1000U, stats.used_bytes_by_category[static_cast<size_t>(
+                       GpuMemCategory::kImage)]);
+  EXPECT_EQ(300U, stats.used_bytes_by_category[static_cast<size_t>(
+                      GpuMemCategory::kStaging)]);
+  EXPECT_EQ(this->allocator_->GetNumBytesAllocated(),
+            stats.allocated_bytes_by_memory_type[kDeviceLocalMemoryType] +
+                stats.allocated_bytes_by_memory_type[kHostVisibleMemoryType]);
+
+  image_mem = nullptr;
+  EXPECT_EQ(300U, stats.used_bytes);
+  EXPECT_EQ(0U, stats.used_bytes_by_category[static_cast<size_t>(
+                    GpuMemCategory::kImage)]);
+}
+
+TEST(GpuAllocator, DedicatedAllocationForLargeResources) {
+  FakeBackendStats stats;
+  {
+    BuddyGpuAllocator allocator(VulkanContext(),
+                                std::make_unique<FakeBackend>(&stats));
+    auto small_image = allocator.AllocateForImage(
+        MakeFakeHandle<VkImage>(1024 * 1024),
+        vk::MemoryPropertyFlagBits::eDeviceLocal, GpuMemCategory::kImage);
+    auto small_buffer = allocator.AllocateForBuffer(
+        MakeFakeHandle<VkBuffer>(1024),
+        vk::MemoryPropertyFlagBits::eDeviceLocal, GpuMemCategory::kMesh);
+    EXPECT_EQ(0U, stats.dedicated_allocation_count);
+    EXPECT_FALSE(small_image->is_dedicated());
+    EXPECT_EQ(small_image->base(), small_buffer->base());
+
+    auto big_image = allocator.AllocateForImage(
+        MakeFakeHandle<VkImage>(kFakeDedicatedThreshold),
+        vk::MemoryPropertyFlagBits::eDeviceLocal, GpuMemCategory::kImage);
+    EXPECT_EQ(1U, stats.dedicated_allocation_count);
+    EXPECT_TRUE(big_image->is_dedicated());
+    EXPECT_EQ(kFakeDedicatedThreshold,
+              stats.live_allocations[static_cast<VkDeviceMemory>(
+                  big_image->base())]);
+    EXPECT_EQ(kFakeDedicatedThreshold + small_image->size(),
+              allocator.stats().used_bytes_by_category[static_cast<size_t>(
+                  GpuMemCategory::kImage)]);
+
+    // The dedicated allocation is freed along with the GpuMem.
+    auto live_count = stats.live_allocations.size();
+    big_image = nullptr;
+    EXPECT_EQ(live_count - 1, stats.live_allocations.size());
+  }
+  EXPECT_TRUE(stats.live_allocations.empty());
+}
+
+TEST(GpuAllocator, DedicatedAllocationForLazilyAllocatedImages) {
+  FakeBackendStats stats;
+  {
+    BuddyGpuAllocator allocator(VulkanContext(),
+                                std::make_unique<FakeBackend>(&stats));
+    auto image = allocator.AllocateForImage(
+        MakeFakeHandle<VkImage>(1024),
+        vk::MemoryPropertyFlagBits::eDeviceLocal |
+            vk::MemoryPropertyFlagBits::eLazilyAllocated,
+        GpuMemCategory::kImage);
+    EXPECT_EQ(1U, stats.dedicated_allocation_count);
+    EXPECT_TRUE(image->is_dedicated());
+    EXPECT_EQ(kLazilyAllocatedMemoryType, image->memory_type_index());
+  }
+  EXPECT_TRUE(stats.live_allocations.empty());
+}
+
+TEST(GpuAllocator, LazilyAllocatedImagesWithoutDedicatedAllocationExtension) {
+  FakeBackendStats stats;
+  {
+    BuddyGpuAllocator allocator(
+        VulkanContext(),
+        std::make_unique<FakeBackend>(&stats, false /* supports_dedicated */));
+    auto image1 = allocator.AllocateForImage(
+        MakeFakeHandle<VkImage>(1024),
+        vk::MemoryPropertyFlagBits::eDeviceLocal |
+            vk::MemoryPropertyFlagBits::eLazilyAllocated,
+        GpuMemCategory::kImage);
+    auto image2 = allocator.AllocateForImage(
+        MakeFakeHandle<VkImage>(1024),
+        vk::MemoryPropertyFlagBits::eDeviceLocal |
+            vk::MemoryPropertyFlagBits::eLazilyAllocated,
+        GpuMemCategory::kImage);
+    // Each image still gets a vk::DeviceMemory of its own, but the backend is
+    // not asked for a dedicated allocation.
+    EXPECT_EQ(0U, stats.dedicated_allocation_count);
+    EXPECT_EQ(2U, stats.live_allocations.size());
+    EXPECT_TRUE(image1->is_dedicated());
+    EXPECT_NE(image1->base(), image2->base());
+    EXPECT_EQ(kLazilyAllocatedMemoryType, image1->memory_type_index());
+  }
+  EXPECT_TRUE(stats.live_allocations.empty());
+}
+
+TEST(FrameGpuAllocator, DoesNotMakeDedicatedAllocations) {
+  FakeBackendStats stats;
+  FrameGpuAllocator allocator(VulkanContext(),
+                              std::make_unique<FakeBackend>(&stats));
+  auto mem = allocator.AllocateForImage(
+      MakeFakeHandle<VkImage>(kFakeDedicatedThreshold),
+      vk::MemoryPropertyFlagBits::eDeviceLocal, GpuMemCategory::kImage);
+  EXPECT_EQ(0U, stats.dedicated_allocation_count);
+  EXPECT_FALSE(mem->is_dedicated());
+}
+
+// Tests that are specific to sub-allocating allocators.
+TEST(BuddyGpuAllocator, SharesSlabs) {
+  FakeBackendStats stats;
+  {
+    BuddyGpuAllocator allocator(VulkanContext(),
+                                std::make_unique<FakeBackend>(&stats));
+    std::vector<GpuMemPtr> mems;
+    for (int i = 0; i < 100; ++i) {
+      mems.push_back(allocator.Allocate(
+          MakeRequirements(4096, 256),
+          vk::MemoryPropertyFlagBits::eDeviceLocal));
+    }
+    EXPECT_EQ(1U, stats.live_allocations.size());
+
+    // The last slab of each memory type is retained when it becomes empty, so
+    // that a subsequent allocation doesn't need to allocate Vulkan memory.
+    mems.clear();
+    EXPECT_EQ(1U, stats.live_allocations.size());
+    auto mem = allocator.Allocate(MakeRequirements(4096, 256),
+                                  vk::MemoryPropertyFlagBits::eDeviceLocal);
+    EXPECT_EQ(1U, stats.total_allocation_count);
+  }
+  EXPECT_TRUE(stats.live_allocations.empty());
+}
+
+TEST(BuddyGpuAllocator, SharesMappedSlabs) {
+  FakeBackendStats stats;
+  BuddyGpuAllocator allocator(VulkanContext(),
+                              std::make_unique<FakeBackend>(&stats));
+  auto mem1 = allocator.Allocate(MakeRequirements(4096, 256),
+                                 vk::MemoryPropertyFlagBits::eHostVisible);
+  auto mem2 = allocator.Allocate(MakeRequirements(4096, 256),
+                                 vk::MemoryPropertyFlagBits::eHostVisible);
+  EXPECT_EQ(mem1->base(), mem2->base());
+  EXPECT_EQ(1U, stats.mapped_allocations.size());
+
+  // Each GpuMem's pointer is offset into the slab's single mapping.
+  EXPECT_EQ(mem2->mapped_ptr() - mem1->mapped_ptr(),
+            static_cast<ptrdiff_t>(mem2->offset() - mem1->offset()));
+}
+
+TEST(BuddyGpuAllocator, RespectsBufferImageGranularity) {
+  FakeBackendStats stats;
+  BuddyGpuAllocator allocator(VulkanContext(),
+                              std::make_unique<FakeBackend>(&stats));
+  std::vector<GpuMemPtr> mems;
+  for (int i = 0; i < 10; ++i) {
+    mems.push_back(
+        allocator.Allocate(MakeRequirements(100, 4),
+                           vk::MemoryPropertyFlagBits::eDeviceLocal));
+  }
+  for (auto& mem : mems) {
+    EXPECT_EQ(0U, mem->offset() % kBufferImageGranularity);
+  }
+}
+
+TEST(BuddyGpuAllocator, FreesExtraSlabs) {
+  FakeBackendStats stats;
+  constexpr vk::DeviceSize kSlabSize = 1024 * 1024;
+  BuddyGpuAllocator allocator(
+      VulkanContext(), std::make_unique<FakeBackend>(&stats), kSlabSize);
+
+  std::vector<GpuMemPtr> mems;
+  for (int i = 0; i < 8; ++i) {
+    mems.push_back(
+        allocator.Allocate(MakeRequirements(kSlabSize / 2, 256),
+                           vk::MemoryPropertyFlagBits::eDeviceLocal));
+  }
+  EXPECT_EQ(4U, stats.live_allocations.size());
+  EXPECT_EQ(4 * kSlabSize, allocator.GetNumBytesAllocated());
+
+  mems.clear();
+  EXPECT_EQ(1U, stats.live_allocations.size());
+  EXPECT_EQ(kSlabSize, allocator.GetNumBytesAllocated());
+}
+
+TEST(FrameGpuAllocator, ReusesBlocksOfFinishedFrames) {
+  FakeBackendStats stats;
+  constexpr vk::DeviceSize kBlockSize = 1024 * 1024;
+  FrameGpuAllocator allocator(
+      VulkanContext(), std::make_unique<FakeBackend>(&stats), kBlockSize);
+
+  // Allocations are packed into a single block, one after another.
+  std::vector<GpuMemPtr> mems;
+  for (int i = 0; i < 10; ++i) {
+    mems.push_back(
+        allocator.Allocate(MakeRequirements(10000, 256),
+                           vk::MemoryPropertyFlagBits::eDeviceLocal));
+  }
+  EXPECT_EQ(1U, stats.total_allocation_count);
+  for (size_t i = 1; i < mems.size(); ++i) {
+    EXPECT_EQ(mems[0]->base(), mems[i]->base());
+    EXPECT_LT(mems[i - 1]->offset(), mems[i]->offset());
+  }
+  mems.clear();
+  allocator.EndFrame(1);
+
+  // The frame's block cannot be reused until its command buffer finishes.
+  auto mem = allocator.Allocate(MakeRequirements(10000, 256),
+                                vk::MemoryPropertyFlagBits::eDeviceLocal);
+  EXPECT_EQ(2U, stats.total_allocation_count);
+  EXPECT_EQ(0U, allocator.GetFreeBlockCount());
+  allocator.CommandBufferFinished(1);
+  EXPECT_EQ(1U, allocator.GetFreeBlockCount());
+  mem = nullptr;
+  allocator.EndFrame(2);
+  allocator.CommandBufferFinished(2);
+  EXPECT_EQ(2U, allocator.GetFreeBlockCount());
+
+  // Subsequent frames reuse the existing blocks, starting at the beginning.
+  mem = allocator.Allocate(MakeRequirements(10000, 256),
+                           vk::MemoryPropertyFlagBits::eDeviceLocal);
+  EXPECT_EQ(0U, mem->offset());
+  EXPECT_EQ(2U, stats.total_allocation_count);
+  EXPECT_EQ(2 * kBlockSize, allocator.GetNumBytesAllocated());
+}
+
+TEST(FrameGpuAllocator, WaitsForOutstandingMem) {
+  FakeBackendStats stats;
+  FrameGpuAllocator allocator(VulkanContext(),
+                              std::make_unique<FakeBackend>(&stats));
+  auto mem = allocator.Allocate(MakeRequirements(10000, 256),
+                                vk::MemoryPropertyFlagBits::eDeviceLocal);
+  allocator.EndFrame(1);
+  allocator.CommandBufferFinished(1);
+
+  // The frame is finished, but its memory is still in use.
+  EXPECT_EQ(0U, allocator.GetFreeBlockCount());
+  mem = nullptr;
+  EXPECT_EQ(1U, allocator.GetFreeBlockCount());
+}
+
+TEST(FrameGpuAllocator, FreesOversizedBlocks) {
+  FakeBackendStats stats;
+  constexpr vk::DeviceSize kBlockSize = 1024 * 1024;
+  FrameGpuAllocator allocator(
+      VulkanContext(), std::make_unique<FakeBackend>(&stats), kBlockSize);
+  auto small_mem =
+      allocator.Allocate(MakeRequirements(1000, 256),
+                         vk::MemoryPropertyFlagBits::eDeviceLocal);
+  auto big_mem =
+      allocator.Allocate(MakeRequirements(3 * kBlockSize, 256),
+                         vk::MemoryPropertyFlagBits::eDeviceLocal);
+  EXPECT_EQ(4 * kBlockSize, allocator.GetNumBytesAllocated());
+
+  small_mem = nullptr;
+  big_mem = nullptr;
+  allocator.EndFrame(1);
+  allocator.CommandBufferFinished(1);
+  EXPECT_EQ(1U, allocator.GetFreeBlockCount());
+  EXPECT_EQ(kBlockSize, allocator.GetNumBytesAllocated());
+}
+
+TEST(FrameGpuAllocator, TrimFreesFreeBlocks) {
+  FakeBackendStats stats;
+  constexpr vk::DeviceSize kBlockSize = 1024 * 1024;
+  FrameGpuAllocator allocator(
+      VulkanContext(), std::make_unique<FakeBackend>(&stats), kBlockSize);
+  auto mem = allocator.Allocate(MakeRequirements(1000, 256),
+                                vk::MemoryPropertyFlagBits::eDeviceLocal);
+  allocator.EndFrame(1);
+  allocator.CommandBufferFinished(1);
+  mem = nullptr;
+
+  MemoryBudget::Stats budget_stats;
+  allocator.AddToStats(&budget_stats);
+  EXPECT_EQ(kBlockSize, budget_stats.cached_bytes);
+
+  allocator.Trim(1);
+  EXPECT_EQ(0U, allocator.GetFreeBlockCount());
+  EXPECT_EQ(0U, allocator.GetNumBytesAllocated());
+  EXPECT_TRUE(stats.live_allocations.empty());
+}
+
+TEST(GpuAllocationTraceRecorder, RecordsAllocationsAndFrees) {
+  FakeBackendStats stats;
+  GpuAllocationTraceRecorder recorder;
+  BuddyGpuAllocator buddy(VulkanContext(),
+                          std::make_unique<FakeBackend>(&stats));
+  FrameGpuAllocator frame(VulkanContext(),
+                          std::make_unique<FakeBackend>(&stats));
+  buddy.set_trace_recorder(&recorder);
+  frame.set_trace_recorder(&recorder);
+
+  auto mem1 = buddy.Allocate(MakeRequirements(1000, 256),
+                             vk::MemoryPropertyFlagBits::eHostVisible,
+                             GpuMemCategory::kStaging);
+  auto mem2 = frame.Allocate(MakeRequirements(2000, 512),
+                             vk::MemoryPropertyFlagBits::eDeviceLocal);
+  frame.EndFrame(7);
+  mem1 = nullptr;
+
+  auto& records = recorder.records();
+  ASSERT_EQ(4U, records.size());
+  EXPECT_EQ(GpuAllocationTraceRecord::kAllocate, records[0].type);
+  EXPECT_EQ(0U, records[0].allocator);
+  EXPECT_EQ(static_cast<uint8_t>(GpuMemCategory::kStaging),
+            records[0].category);
+  EXPECT_EQ(kHostVisibleMemoryType, records[0].memory_type_index);
+  EXPECT_EQ(1000U, records[0].size);
+  EXPECT_EQ(256U, records[0].alignment);
+  EXPECT_EQ(kAnyMemoryType, records[0].memory_type_bits);
+  EXPECT_EQ(static_cast<VkMemoryPropertyFlags>(
+                vk::MemoryPropertyFlagBits::eHostVisible),
+            records[0].memory_property_flags);
+
+  EXPECT_EQ(GpuAllocationTraceRecord::kAllocate, records[1].type);
+  EXPECT_EQ(1U, records[1].allocator);
+  EXPECT_EQ(2000U, records[1].size);
+
+  EXPECT_EQ(GpuAllocationTraceRecord::kEndFrame, records[2].type);
+  EXPECT_EQ(1U, records[2].allocator);
+  EXPECT_EQ(7U, records[2].id);
+
+  EXPECT_EQ(GpuAllocationTraceRecord::kFree, records[3].type);
+  EXPECT_EQ(0U, records[3].allocator);
+  EXPECT_EQ(records[0].id, records[3].id);
+  EXPECT_LE(records[0].timestamp_ns, records[3].timestamp_ns);
+
+  // Detached allocators are no longer recorded.
+  buddy.set_trace_recorder(nullptr);
+  frame.set_trace_recorder(nullptr);
+  mem2 = nullptr;
+  EXPECT_EQ(4U, recorder.records().size());
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,123 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/render_graph.h"
+
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+typedef RenderGraph::Usage Usage;
+
+RenderGraph::AliasingCandidate NewCandidate(uint32_t first_pass,
+                                            uint32_t last_pass,
+                                            vk::DeviceSize size,
+                                            uint32_t memory_type_bits = 1) {
+  vk::MemoryRequirements reqs;
+  reqs.size = size;
+  reqs.alignment = 256;
+  reqs.memoryTypeBits = memory_type_bits;
+  return {first_pass, last_pass, reqs,
+          vk::MemoryPropertyFlagBits::eDeviceLocal};
+}
+
+TEST(RenderGraph, CullsPassesWhoseOutputIsUnused) {
+  RenderGraph graph(nullptr, nullptr);
+  auto output = graph.ImportImage(ImagePtr(), vk::ImageLayout::eUndefined,
+                                  vk::ImageLayout::ePresentSrcKHR);
+  auto depth = graph.CreateImage(ImageInfo());
+  auto illumination = graph.CreateImage(ImageInfo());
+
+  auto depth_pass = graph.AddPass("depth", nullptr);
+  graph.Write(depth_pass, depth, Usage::kDepthAttachment);
+  auto illumination_pass = graph.AddPass("illumination", nullptr);
+  graph.Read(illumination_pass, depth, Usage::kFragmentShaderRead);
+  graph.Write(illumination_pass, illumination, Usage::kColorAttachment);
+  // Clears the depth buffer, and doesn't read the illumination.
+  auto lighting_pass = graph.AddPass("lighting", nullptr);
+  graph.Write(lighting_pass, output, Usage::kColorAttachment);
+  graph.Write(lighting_pass, depth, Usage::kDepthAttachment);
+  // Reads and writes the output.
+  auto overlay_pass = graph.AddPass("overlay", nullptr);
+  graph.Read(overlay_pass, output, Usage::kTransferDst);
+  graph.Write(overlay_pass, output, Usage::kTransferDst);
+
+  graph.Compile();
+  EXPECT_TRUE(graph.is_culled(depth_pass));
+  EXPECT_TRUE(graph.is_culled(illumination_pass));
+  EXPECT_FALSE(graph.is_culled(lighting_pass));
+  EXPECT_FALSE(graph.is_culled(overlay_pass));
+}
+
+TEST(RenderGraph, KeepsPassesWhoseOutputIsRead) {
+  RenderGraph graph(nullptr, nullptr);
+  auto output = graph.ImportImage(ImagePtr(), vk::ImageLayout::eUndefined,
+                                  vk::ImageLayout::ePresentSrcKHR);
+  auto depth = graph.CreateImage(ImageInfo());
+  auto illumination = graph.CreateImage(ImageInfo());
+
+  auto depth_pass = graph.AddPass("depth", nullptr);
+  graph.Write(depth_pass, depth, Usage::kDepthAttachment);
+  auto illumination_pass = graph.AddPass("illumination", nullptr);
+  graph.Read(illumination_pass, depth, Usage::kFragmentShaderRead);
+  graph.Write(illumination_pass, illumination, Usage::kColorAttachment);
+  auto lighting_pass = graph.AddPass("lighting", nullptr);
+  graph.Read(lighting_pass, illumination, Usage::kFragmentShaderRead);
+  graph.Write(lighting_pass, output, Usage::kColorAttachment);
+  // Overwrites the output before anything reads it.
+  auto unused_pass = graph.AddPass("unused", nullptr);
+  graph.Write(unused_pass, illumination, Usage::kColorAttachment);
+
+  graph.Compile();
+  EXPECT_FALSE(graph.is_culled(depth_pass));
+  EXPECT_FALSE(graph.is_culled(illumination_pass));
+  EXPECT_FALSE(graph.is_culled(lighting_pass));
+  EXPECT_TRUE(graph.is_culled(unused_pass));
+}
+
+TEST(RenderGraph, AliasesImagesWithDisjointLifetimes) {
+  uint32_t block_count = 0;
+  auto blocks = RenderGraph::AssignMemoryBlocks(
+      {NewCandidate(0, 1, 1000), NewCandidate(2, 5, 4000),
+       NewCandidate(3, 6, 4000), NewCandidate(4, 5, 4000),
+       NewCandidate(6, 7, 500)},
+      &block_count);
+  ASSERT_EQ(5U, blocks.size());
+  EXPECT_EQ(3U, block_count);
+  // The second image reuses the memory of the first, which is then busy until
+  // pass 5; the third and fourth overlap with it and each other.
+  EXPECT_EQ(blocks[0], blocks[1]);
+  EXPECT_NE(blocks[1], blocks[2]);
+  EXPECT_NE(blocks[1], blocks[3]);
+  EXPECT_NE(blocks[2], blocks[3]);
+  // The last image fits in the block that became free after pass 5.
+  EXPECT_EQ(blocks[1], blocks[4]);
+}
+
+TEST(RenderGraph, PrefersBlockThatGrowsLeast) {
+  uint32_t block_count = 0;
+  auto blocks = RenderGraph::AssignMemoryBlocks(
+      {NewCandidate(0, 0, 1000), NewCandidate(0, 0, 4000),
+       NewCandidate(1, 1, 3000)},
+      &block_count);
+  EXPECT_EQ(2U, block_count);
+  EXPECT_EQ(blocks[1], blocks[2]);
+}
+
+TEST(RenderGraph, DoesNotAliasIncompatibleMemoryTypes) {
+  uint32_t block_count = 0;
+  auto blocks = RenderGraph::AssignMemoryBlocks(
+      {NewCandidate(0, 0, 1000, 0x1), NewCandidate(1, 1, 1000, 0x2),
+       NewCandidate(2, 2, 1000, 0x3)},
+      &block_count);
+  EXPECT_EQ(2U, block_count);
+  EXPECT_NE(blocks[0], blocks[1]);
+  EXPECT_EQ(blocks[0], blocks[2]);
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,110 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/ring_allocator.h"
+
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+TEST(RingAllocator, AllocatesFromHeadAndAligns) {
+  RingAllocator ring(1024, 16);
+  EXPECT_TRUE(ring.empty());
+  EXPECT_EQ(0U, ring.Allocate(100, 1));
+  EXPECT_EQ(112U, ring.Allocate(16, 2));
+  EXPECT_EQ(128U, ring.bytes_in_use());
+  EXPECT_EQ(1U, ring.oldest_sequence_number());
+  EXPECT_FALSE(ring.CanAllocate(1025));
+}
+
+TEST(RingAllocator, ReclaimsFromTailInOrder) {
+  RingAllocator ring(1024, 16);
+  ring.Allocate(512, 1);
+  ring.Allocate(256, 2);
+  ring.Allocate(256, 3);
+  EXPECT_FALSE(ring.CanAllocate(16));
+
+  // Releasing a range that is not at the tail doesn't free any space.
+  ring.Release(2);
+  EXPECT_EQ(1024U, ring.bytes_in_use());
+  EXPECT_FALSE(ring.CanAllocate(16));
+
+  // Releasing the tail also reclaims the ranges released before it.
+  ring.Release(1);
+  EXPECT_EQ(256U, ring.bytes_in_use());
+  EXPECT_EQ(3U, ring.oldest_sequence_number());
+  EXPECT_TRUE(ring.CanAllocate(768));
+  EXPECT_FALSE(ring.CanAllocate(769));
+}
+
+TEST(RingAllocator, ReleasesRangesThatShareSequenceNumber) {
+  RingAllocator ring(1024, 16);
+  ring.Allocate(256, 1);
+  ring.Allocate(256, 2);
+  ring.Allocate(256, 2);
+  ring.Allocate(256, 3);
+  ring.Release(1);
+  ring.Release(2);
+  EXPECT_EQ(256U, ring.bytes_in_use());
+  EXPECT_EQ(3U, ring.oldest_sequence_number());
+}
+
+TEST(RingAllocator, WrapsAround) {
+  RingAllocator ring(1024, 16);
+  ring.Allocate(400, 1);
+  ring.Allocate(400, 2);
+  ring.Release(1);
+
+  // Not enough room at the end of the ring, so the range wraps to the start.
+  EXPECT_EQ(0U, ring.Allocate(300, 3));
+  EXPECT_EQ(1024U - 400U + 304U, ring.bytes_in_use());
+  // Only [304, 400) is free.
+  EXPECT_TRUE(ring.CanAllocate(96));
+  EXPECT_FALSE(ring.CanAllocate(112));
+
+  ring.Release(2);
+  EXPECT_EQ(304U, ring.bytes_in_use());
+  EXPECT_EQ(304U, ring.Allocate(720, 4));
+  EXPECT_FALSE(ring.CanAllocate(16));
+
+  // Once empty, allocation starts over at the beginning.
+  ring.Release(3);
+  ring.Release(4);
+  EXPECT_TRUE(ring.empty());
+  EXPECT_EQ(0U, ring.Allocate(1024, 5));
+}
+
+// Models a GpuUploader Writer that stays open across several frames, while
+// Writers that were obtained after it are flushed.
+TEST(RingAllocator, KeepsUnassignedRangesAcrossReleases) {
+  constexpr uint64_t kUnassigned = RingAllocator::kUnassignedSequenceNumber;
+  RingAllocator ring(1024, 16);
+  vk::DeviceSize held = ring.Allocate(256, kUnassigned);
+  vk::DeviceSize flushed = ring.Allocate(256, kUnassigned);
+  EXPECT_EQ(kUnassigned, ring.oldest_sequence_number());
+
+  // The second Writer is flushed in CommandBuffer #5, which finishes.
+  ring.Reassign(flushed, 5);
+  ring.Release(5);
+  EXPECT_EQ(512U, ring.bytes_in_use());
+  EXPECT_EQ(kUnassigned, ring.oldest_sequence_number());
+
+  // Another frame's Writer is flushed and finishes; the held range is still in
+  // use, so its space is not reclaimed either.
+  ring.Reassign(ring.Allocate(256, kUnassigned), 7);
+  ring.Release(7);
+  EXPECT_EQ(768U, ring.bytes_in_use());
+
+  // Finally, the held Writer is flushed in CommandBuffer #9.
+  ring.Reassign(held, 9);
+  EXPECT_EQ(9U, ring.oldest_sequence_number());
+  ring.Release(9);
+  EXPECT_TRUE(ring.empty());
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,80 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/util/radix_sort.h"
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+using namespace escher;
+
+// Sort |keys| with RadixSort(), using each key's original index as its value,
+// and compare with std::stable_sort().
+void ExpectSortedLikeStableSort(const std::vector<uint64_t>& keys) {
+  std::vector<std::pair<uint64_t, uint32_t>> expected;
+  std::vector<uint64_t> sorted_keys = keys;
+  std::vector<uint32_t> values;
+  for (uint32_t i = 0; i < keys.size(); ++i) {
+    expected.push_back({keys[i], i});
+    values.push_back(i);
+  }
+  std::stable_sort(expected.begin(), expected.end(),
+                   [](const std::pair<uint64_t, uint32_t>& a,
+                      const std::pair<uint64_t, uint32_t>& b) {
+                     return a.first < b.first;
+                   });
+
+  std::vector<uint64_t> scratch_keys(keys.size());
+  std::vector<uint32_t> scratch_values(keys.size());
+  RadixSort(sorted_keys.data(), values.data(), keys.size(),
+            scratch_keys.data(), scratch_values.data());
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(expected[i].first, sorted_keys[i]);
+    EXPECT_EQ(expected[i].second, values[i]);
+  }
+}
+
+TEST(RadixSort, EmptyAndSingleElement) {
+  RadixSort(nullptr, nullptr, 0, nullptr, nullptr);
+  uint64_t key = 42;
+  uint32_t value = 7;
+  RadixSort(&key, &value, 1, nullptr, nullptr);
+  EXPECT_EQ(42U, key);
+  EXPECT_EQ(7U, value);
+}
+
+TEST(RadixSort, RandomKeys) {
+  std::mt19937_64 random(1234);
+  std::vector<uint64_t> keys(1000);
+  for (auto& key : keys) {
+    key = random();
+  }
+  ExpectSortedLikeStableSort(keys);
+}
+
+TEST(RadixSort, IsStable) {
+  // Few distinct keys, so that most of them are equal.
+  std::mt19937_64 random(5678);
+  std::vector<uint64_t> keys(500);
+  for (auto& key : keys) {
+    key = (random() % 4) << 60;
+  }
+  ExpectSortedLikeStableSort(keys);
+}
+
+TEST(RadixSort, SkipsIdenticalDigits) {
+  // Only one digit differs between keys, so the result of the single pass
+  // must be copied back from the scratch arrays.
+  ExpectSortedLikeStableSort({0x1200, 0x0500, 0xff00, 0x0000, 0x0500});
+  // No digit differs.
+  ExpectSortedLikeStableSort({0xabcd, 0xabcd, 0xabcd});
+}
+
+}  // namespace
@@ -0,0 +1,384 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Replays a GPU allocation trace (see escher/impl/gpu_allocation_trace.h)
+// against GpuAllocator implementations, using a fake memory backend instead of
+// a Vulkan device, and reports the footprint and speed of each.
+//
+// Usage:
+//   gpu_allocator_replay [--allocator=naive|buddy|frame] [--source=N]
+//                        [--frames-in-flight=N] TRACE_FILE
+//
+// By default, every allocator replays every event in the trace.  --source
+// restricts the replay to the events of a single recorded allocator (e.g. the
+// FrameGpuAllocator's transient memory).  --frames-in-flight is the number of
+// frames that the fake GPU lags behind; it only affects FrameGpuAllocator,
+// which can only replay traces whose EndFrame sequence numbers increase.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "escher/impl/buddy_gpu_allocator.h"
+#include "escher/impl/frame_gpu_allocator.h"
+#include "escher/impl/gpu_allocation_trace.h"
+#include "escher/impl/gpu_allocator.h"
+#include "escher/impl/naive_gpu_allocator.h"
+#include "ftl/logging.h"
+
+using escher::VulkanContext;
+using escher::impl::BuddyGpuAllocator;
+using escher::impl::FrameGpuAllocator;
+using escher::impl::GpuAllocationTraceRecord;
+using escher::impl::GpuAllocationTraceRecorder;
+using escher::impl::GpuAllocator;
+using escher::impl::GpuMemCategory;
+using escher::impl::GpuMemPtr;
+using escher::impl::NaiveGpuAllocator;
+
+namespace {
+
+typedef std::chrono::steady_clock ClockT;
+
+// Hands out fake vk::DeviceMemory handles, and keeps track of how many are
+// alive.  Memory types are those that appear in the trace; a type is
+// host-visible if any allocation of that type requested host-visible memory.
+class ReplayBackend : public GpuAllocator::Backend {
+ public:
+  explicit ReplayBackend(
+      const std::vector<GpuAllocationTraceRecord>& records) {
+    for (auto& record : records) {
+      if (record.type == GpuAllocationTraceRecord::kAllocate) {
+        memory_type_flags_[record.memory_type_index] |=
+            vk::MemoryPropertyFlags(record.memory_property_flags);
+      }
+    }
+  }
+
+  vk::DeviceMemory AllocateMemory(vk::DeviceSize size,
+                                  uint32_t memory_type_index,
+                                  const DedicatedResource& dedicated) override {
+    uint64_t id = ++total_slab_count_;
+    VkDeviceMemory mem;
+    static_assert(sizeof(mem) == sizeof(id), "unexpected handle size");
+    std::memcpy(&mem, &id, sizeof(mem));
+    live_slabs_[mem] = size;
+    peak_slab_count_ = std::max(peak_slab_count_, live_slabs_.size());
+    return vk::DeviceMemory(mem);
+  }
+
+  void FreeMemory(vk::DeviceMemory mem) override {
+    live_slabs_.erase(static_cast<VkDeviceMemory>(mem));
+  }
+
+  uint8_t* MapMemory(vk::DeviceMemory mem, vk::DeviceSize size) override {
+    // Never dereferenced.
+    return reinterpret_cast<uint8_t*>(static_cast<VkDeviceMemory>(mem));
+  }
+
+  vk::MemoryPropertyFlags GetMemoryPropertyFlags(
+      uint32_t memory_type_index) override {
+    return memory_type_flags_[memory_type_index];
+  }
+
+  // The replay restricts |type_bits| to the recorded memory type.
+  uint32_t GetMemoryTypeIndex(uint32_t type_bits,
+                              vk::MemoryPropertyFlags flags) override {
+    for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; ++i) {
+      if (type_bits & (1u << i)) {
+        return i;
+      }
+    }
+    std::cerr << "no memory type in " << type_bits << std::endl;
+    abort();
+  }
+
+  vk::DeviceSize GetBufferImageGranularity() override {
+    // A typical value for discrete GPUs.
+    return 1024;
+  }
+
+  bool SupportsDedicatedAllocation() override { return true; }
+
+  // Only used to replay dedicated allocations; see SetDedicatedRequirements().
+  vk::MemoryRequirements GetImageMemoryRequirements(
+      vk::Image image,
+      bool* wants_dedicated) override {
+    *wants_dedicated = true;
+    return dedicated_reqs_;
+  }
+  vk::MemoryRequirements GetBufferMemoryRequirements(
+      vk::Buffer buffer,
+      bool* wants_dedicated) override {
+    *wants_dedicated = true;
+    return dedicated_reqs_;
+  }
+  void SetDedicatedRequirements(const vk::MemoryRequirements& reqs) {
+    dedicated_reqs_ = reqs;
+  }
+
+  size_t live_slab_count() const { return live_slabs_.size(); }
+  size_t peak_slab_count() const { return peak_slab_count_; }
+  uint64_t total_slab_count() const { return total_slab_count_; }
+
+ private:
+  vk::MemoryPropertyFlags memory_type_flags_[VK_MAX_MEMORY_TYPES];
+  std::map<VkDeviceMemory, vk::DeviceSize> live_slabs_;
+  size_t peak_slab_count_ = 0;
+  uint64_t total_slab_count_ = 0;
+  vk::MemoryRequirements dedicated_reqs_;
+};
+
+struct ReplayResults {
+  uint64_t allocate_count = 0;
+  uint64_t free_count = 0;
+  uint64_t allocate_ns = 0;
+  uint64_t free_ns = 0;
+  vk::DeviceSize peak_allocated_bytes = 0;
+  vk::DeviceSize peak_used_bytes = 0;
+  // 1 - used / allocated, when the allocated bytes peaked.
+  double fragmentation_at_peak = 0.0;
+  // 1 - used / allocated, averaged over all operations.
+  double mean_fragmentation = 0.0;
+  size_t peak_slab_count = 0;
+  uint64_t total_slab_count = 0;
+};
+
+uint64_t ElapsedNanoseconds(ClockT::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(ClockT::now() -
+                                                              start)
+      .count();
+}
+
+std::unique_ptr<GpuAllocator> NewAllocator(
+    const std::string& name,
+    std::unique_ptr<GpuAllocator::Backend> backend) {
+  if (name == "naive") {
+    return std::make_unique<NaiveGpuAllocator>(VulkanContext(),
+                                               std::move(backend));
+  } else if (name == "buddy") {
+    return std::make_unique<BuddyGpuAllocator>(VulkanContext(),
+                                               std::move(backend));
+  } else if (name == "frame") {
+    return std::make_unique<FrameGpuAllocator>(VulkanContext(),
+                                               std::move(backend));
+  }
+  FTL_CHECK(false) << "unknown allocator: " << name;
+  return nullptr;
+}
+
+ReplayResults Replay(const std::string& allocator_name,
+                     const std::vector<GpuAllocationTraceRecord>& records,
+                     int64_t source,
+                     size_t frames_in_flight) {
+  auto backend_ptr = std::make_unique<ReplayBackend>(records);
+  ReplayBackend* backend = backend_ptr.get();
+  auto allocator = NewAllocator(allocator_name, std::move(backend_ptr));
+  auto frame_allocator = allocator_name == "frame"
+                             ? static_cast<FrameGpuAllocator*>(allocator.get())
+                             : nullptr;
+
+  ReplayResults results;
+  std::unordered_map<uint64_t, GpuMemPtr> live_mems;
+  std::deque<uint64_t> pending_frames;
+  double fragmentation_sum = 0.0;
+  uint64_t fragmentation_samples = 0;
+
+  for (auto& record : records) {
+    if (source >= 0 && record.allocator != source) {
+      continue;
+    }
+    switch (record.type) {
+      case GpuAllocationTraceRecord::kAllocate: {
+        vk::MemoryRequirements reqs;
+        reqs.size = record.size;
+        reqs.alignment = record.alignment;
+        reqs.memoryTypeBits = 1u << record.memory_type_index;
+        auto flags = vk::MemoryPropertyFlags(record.memory_property_flags);
+        auto category = static_cast<GpuMemCategory>(record.category);
+        GpuMemPtr mem;
+        auto start = ClockT::now();
+        if (record.is_dedicated) {
+          backend->SetDedicatedRequirements(reqs);
+          mem = allocator->AllocateForBuffer(vk::Buffer(), flags, category);
+        } else {
+          mem = allocator->Allocate(reqs, flags, category);
+        }
+        results.allocate_ns += ElapsedNanoseconds(start);
+        ++results.allocate_count;
+        live_mems[record.id] = std::move(mem);
+        break;
+      }
+      case GpuAllocationTraceRecord::kFree: {
+        auto it = live_mems.find(record.id);
+        if (it == live_mems.end()) {
+          // Allocated before the trace started.
+          continue;
+        }
+        GpuMemPtr mem = std::move(it->second);
+        live_mems.erase(it);
+        auto start = ClockT::now();
+        mem = nullptr;
+        results.free_ns += ElapsedNanoseconds(start);
+        ++results.free_count;
+        break;
+      }
+      case GpuAllocationTraceRecord::kEndFrame:
+        if (frame_allocator) {
+          frame_allocator->EndFrame(record.id);
+          pending_frames.push_back(record.id);
+          while (pending_frames.size() > frames_in_flight) {
+            frame_allocator->CommandBufferFinished(pending_frames.front());
+            pending_frames.pop_front();
+          }
+        }
+        continue;
+    }
+
+    vk::DeviceSize allocated = allocator->GetNumBytesAllocated();
+    vk::DeviceSize used = allocator->stats().used_bytes;
+    double fragmentation =
+        allocated ? 1.0 - static_cast<double>(used) / allocated : 0.0;
+    if (allocated > results.peak_allocated_bytes) {
+      results.peak_allocated_bytes = allocated;
+      results.fragmentation_at_peak = fragmentation;
+    }
+    results.peak_used_bytes = std::max(results.peak_used_bytes, used);
+    fragmentation_sum += fragmentation;
+    ++fragmentation_samples;
+  }
+
+  live_mems.clear();
+  if (frame_allocator) {
+    while (!pending_frames.empty()) {
+      frame_allocator->CommandBufferFinished(pending_frames.front());
+      pending_frames.pop_front();
+    }
+  }
+  if (fragmentation_samples) {
+    results.mean_fragmentation = fragmentation_sum / fragmentation_samples;
+  }
+  results.peak_slab_count = backend->peak_slab_count();
+  results.total_slab_count = backend->total_slab_count();
+  return results;
+}
+
+// FrameGpuAllocator requires the sequence numbers passed to EndFrame() to be
+// non-zero and strictly increasing, which isn't the case if several renderers
+// ended frames on the recorded allocator.  Return false, and print the first
+// offending event, if the replayed events don't satisfy this.
+bool ValidateEndFrames(const std::vector<GpuAllocationTraceRecord>& records,
+                       int64_t source) {
+  uint64_t last_sequence_number = 0;
+  for (size_t i = 0; i < records.size(); ++i) {
+    auto& record = records[i];
+    if (record.type != GpuAllocationTraceRecord::kEndFrame ||
+        (source >= 0 && record.allocator != source)) {
+      continue;
+    }
+    if (record.id <= last_sequence_number) {
+      std::cerr << "event " << i << ": EndFrame sequence number " << record.id
+                << " does not follow " << last_sequence_number << std::endl;
+      return false;
+    }
+    last_sequence_number = record.id;
+  }
+  return true;
+}
+
+void PrintResults(const std::string& allocator_name,
+                  const ReplayResults& results) {
+  auto per_op = [](uint64_t ns, uint64_t count) {
+    return count ? static_cast<double>(ns) / count : 0.0;
+  };
+  std::cout << allocator_name << ":" << std::endl
+            << "  allocations:            " << results.allocate_count
+            << std::endl
+            << "  frees:                  " << results.free_count << std::endl
+            << "  ns per allocation:      "
+            << per_op(results.allocate_ns, results.allocate_count)
+            << std::endl
+            << "  ns per free:            "
+            << per_op(results.free_ns, results.free_count) << std::endl
+            << "  peak footprint (bytes): " << results.peak_allocated_bytes
+            << std::endl
+            << "  peak used (bytes):      " << results.peak_used_bytes
+            << std::endl
+            << "  fragmentation at peak:  " << results.fragmentation_at_peak
+            << std::endl
+            << "  mean fragmentation:     " << results.mean_fragmentation
+            << std::endl
+            << "  peak slab count:        " << results.peak_slab_count
+            << std::endl
+            << "  total slabs allocated:  " << results.total_slab_count
+            << std::endl;
+}
+
+void PrintUsage() {
+  std::cerr << "usage: gpu_allocator_replay [--allocator=naive|buddy|frame] "
+               "[--source=N] [--frames-in-flight=N] TRACE_FILE"
+            << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::string> allocator_names{"naive", "buddy", "frame"};
+  int64_t source = -1;
+  size_t frames_in_flight = 2;
+  std::string trace_path;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp("--allocator=", argv[i], 12)) {
+      allocator_names = {argv[i] + 12};
+      if (allocator_names[0] != "naive" && allocator_names[0] != "buddy" &&
+          allocator_names[0] != "frame") {
+        PrintUsage();
+        return 1;
+      }
+    } else if (!strncmp("--source=", argv[i], 9)) {
+      source = atoll(argv[i] + 9);
+    } else if (!strncmp("--frames-in-flight=", argv[i], 19)) {
+      frames_in_flight = static_cast<size_t>(atoll(argv[i] + 19));
+    } else if (argv[i][0] != '-' && trace_path.empty()) {
+      trace_path = argv[i];
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (trace_path.empty()) {
+    PrintUsage();
+    return 1;
+  }
+
+  std::vector<GpuAllocationTraceRecord> records;
+  if (!GpuAllocationTraceRecorder::ReadFromFile(trace_path, &records)) {
+    return 1;
+  }
+  std::cout << "Replaying " << records.size() << " events from " << trace_path
+            << std::endl;
+  int result = 0;
+  for (auto& name : allocator_names) {
+    if (name == "frame" && !ValidateEndFrames(records, source)) {
+      std::cerr << "frame: cannot replay a trace whose EndFrame sequence "
+                   "numbers don't increase"
+                << std::endl;
+      result = 1;
+      continue;
+    }
+    PrintResults(name, Replay(name, records, source, frames_in_flight));
+  }
+  return result;
+}